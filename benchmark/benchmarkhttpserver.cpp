@@ -0,0 +1,515 @@
+#include "benchmarkhttpserver.h"
+#include <QMutexLocker>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUrlQuery>
+
+using namespace QtNetworkRequest;
+
+#define MAX_REQUEST_HEADER_BYTES (64 * 1024)
+// Payload is written while less than this is waiting in the socket buffer
+#define SEND_HIGH_WATER_BYTES (512 * 1024)
+
+namespace
+{
+    // Not compressible, the payload of every response is a window into it
+    const QByteArray &payloadPattern()
+    {
+        static const QByteArray s_pattern = []() {
+            QByteArray pattern(64 * 1024, Qt::Uninitialized);
+            quint32 seed = 0x9E3779B9;
+            for (int i = 0; i < pattern.size(); ++i)
+            {
+                seed = seed * 1664525 + 1013904223;
+                pattern[i] = static_cast<char>(seed >> 24);
+            }
+            return pattern;
+        }();
+        return s_pattern;
+    }
+
+    QByteArray reasonPhrase(int nStatusCode)
+    {
+        switch (nStatusCode)
+        {
+        case 200: return "OK";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 307: return "Temporary Redirect";
+        case 308: return "Permanent Redirect";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 416: return "Range Not Satisfiable";
+        case 503: return "Service Unavailable";
+        default: return "Unknown";
+        }
+    }
+}
+
+BenchmarkHttpServer::BenchmarkHttpServer(QObject *parent)
+    : QTcpServer(parent), m_pOwnerThread(nullptr), m_uiPort(0)
+{
+    m_thread.setObjectName("BenchmarkHttpServer");
+}
+
+BenchmarkHttpServer::~BenchmarkHttpServer()
+{
+    stop();
+}
+
+bool BenchmarkHttpServer::start()
+{
+    if (m_thread.isRunning())
+    {
+        return m_uiPort != 0;
+    }
+
+    // Moved to the server thread, so the benchmarked requests do not share an event loop with it
+    m_pOwnerThread = thread();
+    moveToThread(&m_thread);
+    m_thread.start();
+
+    bool bListening = false;
+    QMetaObject::invokeMethod(this, [this, &bListening]() {
+        bListening = listen(QHostAddress::LocalHost);
+        m_uiPort = bListening ? serverPort() : 0;
+    }, Qt::BlockingQueuedConnection);
+
+    if (!bListening)
+    {
+        stop();
+    }
+    return bListening;
+}
+
+void BenchmarkHttpServer::stop()
+{
+    if (!m_thread.isRunning())
+    {
+        return;
+    }
+
+    QThread *pOwnerThread = m_pOwnerThread;
+    QMetaObject::invokeMethod(this, [this, pOwnerThread]() {
+        close();
+        qDeleteAll(findChildren<BenchmarkHttpConnection *>(QString(), Qt::FindDirectChildrenOnly));
+        moveToThread(pOwnerThread);
+    }, Qt::BlockingQueuedConnection);
+
+    m_thread.quit();
+    m_thread.wait();
+    m_uiPort = 0;
+}
+
+QUrl BenchmarkHttpServer::url(const QString &strPath) const
+{
+    return QUrl(QString("http://127.0.0.1:%1%2").arg(m_uiPort).arg(strPath));
+}
+
+QByteArray BenchmarkHttpServer::payload(qint64 nSize)
+{
+    const QByteArray &pattern = payloadPattern();
+    QByteArray data;
+    data.reserve(static_cast<int>(nSize));
+    while (data.size() < nSize)
+    {
+        data.append(pattern.constData(), static_cast<int>(qMin<qint64>(pattern.size(), nSize - data.size())));
+    }
+    return data;
+}
+
+int BenchmarkHttpServer::hitCount(const QUrl &url) const
+{
+    QMutexLocker locker(&m_hitMutex);
+    return m_hits.value(url.toEncoded(QUrl::RemoveScheme | QUrl::RemoveAuthority));
+}
+
+int BenchmarkHttpServer::recordHit(const QByteArray &target)
+{
+    QMutexLocker locker(&m_hitMutex);
+    return ++m_hits[target];
+}
+
+void BenchmarkHttpServer::incomingConnection(qintptr socketDescriptor)
+{
+    new BenchmarkHttpConnection(socketDescriptor, this);
+}
+
+//////////////////////////////////////////////////////////////////////////
+BenchmarkHttpConnection::BenchmarkHttpConnection(qintptr socketDescriptor, BenchmarkHttpServer *pServer)
+    : QObject(pServer)
+    , m_pServer(pServer)
+    , m_pSocket(new QTcpSocket(this))
+    , m_eState(State::Headers)
+    , m_nBodyRemaining(0)
+    , m_nBodyReceived(0)
+    , m_bClose(false)
+    , m_nSendOffset(0)
+    , m_nSendEnd(0)
+    , m_bSendChunked(false)
+{
+    connect(m_pSocket, &QTcpSocket::readyRead, this, &BenchmarkHttpConnection::onReadyRead);
+    connect(m_pSocket, &QTcpSocket::bytesWritten, this, &BenchmarkHttpConnection::onBytesWritten);
+    connect(m_pSocket, &QTcpSocket::disconnected, this, &QObject::deleteLater);
+
+    if (!m_pSocket->setSocketDescriptor(socketDescriptor))
+    {
+        deleteLater();
+        return;
+    }
+    m_pSocket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+}
+
+void BenchmarkHttpConnection::onReadyRead()
+{
+    m_buffer += m_pSocket->readAll();
+    if (!parse())
+    {
+        m_pSocket->abort();
+        deleteLater();
+    }
+}
+
+void BenchmarkHttpConnection::onBytesWritten()
+{
+    if (m_eState == State::Responding && m_nSendOffset < m_nSendEnd)
+    {
+        sendPayload();
+    }
+}
+
+bool BenchmarkHttpConnection::parse()
+{
+    while (true)
+    {
+        switch (m_eState)
+        {
+        case State::Headers:
+        {
+            const int nEnd = m_buffer.indexOf("\r\n\r\n");
+            if (nEnd < 0)
+            {
+                return m_buffer.size() <= MAX_REQUEST_HEADER_BYTES;
+            }
+            const QByteArray head = m_buffer.left(nEnd);
+            m_buffer.remove(0, nEnd + 4);
+            if (!parseHeaders(head))
+            {
+                return false;
+            }
+            if (m_headers.value("transfer-encoding").toLower().contains("chunked"))
+            {
+                m_eState = State::ChunkSize;
+            }
+            else
+            {
+                m_nBodyRemaining = qMax<qint64>(0, m_headers.value("content-length").trimmed().toLongLong());
+                m_eState = State::Body;
+            }
+            break;
+        }
+        case State::Body:
+        {
+            const qint64 nBytes = qMin<qint64>(m_nBodyRemaining, m_buffer.size());
+            m_buffer.remove(0, static_cast<int>(nBytes));
+            m_nBodyRemaining -= nBytes;
+            m_nBodyReceived += nBytes;
+            if (m_nBodyRemaining > 0)
+            {
+                return true;
+            }
+            respond();
+            break;
+        }
+        case State::ChunkSize:
+        {
+            const int nEnd = m_buffer.indexOf("\r\n");
+            if (nEnd < 0)
+            {
+                return m_buffer.size() <= MAX_REQUEST_HEADER_BYTES;
+            }
+            bool bOk = false;
+            const qint64 nSize = m_buffer.left(nEnd).split(';').first().trimmed().toLongLong(&bOk, 16);
+            m_buffer.remove(0, nEnd + 2);
+            if (!bOk || nSize < 0)
+            {
+                return false;
+            }
+            // The data of a chunk is followed by CRLF
+            m_nBodyRemaining = nSize + 2;
+            m_eState = (nSize == 0) ? State::ChunkTrailer : State::ChunkData;
+            break;
+        }
+        case State::ChunkData:
+        {
+            const qint64 nBytes = qMin<qint64>(m_nBodyRemaining, m_buffer.size());
+            m_nBodyReceived += qMin(nBytes, qMax<qint64>(0, m_nBodyRemaining - 2));
+            m_buffer.remove(0, static_cast<int>(nBytes));
+            m_nBodyRemaining -= nBytes;
+            if (m_nBodyRemaining > 0)
+            {
+                return true;
+            }
+            m_eState = State::ChunkSize;
+            break;
+        }
+        case State::ChunkTrailer:
+        {
+            const int nEnd = m_buffer.indexOf("\r\n");
+            if (nEnd < 0)
+            {
+                return m_buffer.size() <= MAX_REQUEST_HEADER_BYTES;
+            }
+            m_buffer.remove(0, nEnd + 2);
+            if (nEnd == 0)
+            {
+                respond();
+            }
+            break;
+        }
+        case State::Responding:
+            // The next request waits for the current response
+            return true;
+        }
+    }
+}
+
+bool BenchmarkHttpConnection::parseHeaders(const QByteArray &head)
+{
+    const QList<QByteArray> lines = head.split('\n');
+    const QList<QByteArray> requestLine = lines.first().trimmed().split(' ');
+    if (requestLine.size() != 3)
+    {
+        return false;
+    }
+    m_method = requestLine.at(0);
+    m_path = requestLine.at(1);
+
+    m_headers.clear();
+    for (int i = 1; i < lines.size(); ++i)
+    {
+        const int nColon = lines.at(i).indexOf(':');
+        if (nColon > 0)
+        {
+            m_headers.insert(lines.at(i).left(nColon).trimmed().toLower(), lines.at(i).mid(nColon + 1).trimmed());
+        }
+    }
+
+    const QByteArray connection = m_headers.value("connection").toLower();
+    m_bClose = (requestLine.at(2) == "HTTP/1.0") ? (connection != "keep-alive") : (connection == "close");
+    m_nBodyRemaining = 0;
+    m_nBodyReceived = 0;
+    return true;
+}
+
+void BenchmarkHttpConnection::respond()
+{
+    m_eState = State::Responding;
+
+    const int nHit = m_pServer->recordHit(m_path);
+    const QUrlQuery query(QUrl(QString::fromLatin1(m_path)));
+    int nDelayMs = query.queryItemValue("delay").toInt();
+    if (query.hasQueryItem("delayfrom") && !m_headers.value("range").trimmed().startsWith("bytes=" + query.queryItemValue("delayfrom").toLatin1() + '-'))
+    {
+        nDelayMs = 0;
+    }
+    if (nDelayMs > 0)
+    {
+        // The connection stays in State::Responding, a pipelined request waits
+        QTimer::singleShot(nDelayMs, this, [this, nHit]() { respondNow(nHit); });
+        return;
+    }
+    respondNow(nHit);
+}
+
+void BenchmarkHttpConnection::respondNow(int nHit)
+{
+    const QUrl url(QString::fromLatin1(m_path));
+    const QUrlQuery query(url);
+    const QString strPath = url.path();
+    if (nHit <= query.queryItemValue("fail").toInt())
+    {
+        const QString strRetryAfter = query.hasQueryItem("retryafter") ? query.queryItemValue("retryafter") : QString("1");
+        respondSimple(503, "Service Unavailable", "Retry-After: " + strRetryAfter.toLatin1() + "\r\n");
+        return;
+    }
+    if (strPath.startsWith("/bytes/") && (m_method == "GET" || m_method == "HEAD"))
+    {
+        bool bOk = false;
+        const qint64 nSize = strPath.mid(7).toLongLong(&bOk);
+        if (bOk && nSize >= 0)
+        {
+            QByteArray etag = query.queryItemValue("etag").toLatin1();
+            if (!etag.isEmpty() && query.hasQueryItem("changeafter") && nHit > query.queryItemValue("changeafter").toInt())
+            {
+                etag += "-changed";
+            }
+            respondBytes(nSize, query.queryItemValue("chunked") == "1", query.queryItemValue("norange") != "1", etag);
+            return;
+        }
+    }
+    else if (strPath == "/redirect" && (m_method == "GET" || m_method == "HEAD"))
+    {
+        const int nStatusCode = query.hasQueryItem("code") ? query.queryItemValue("code").toInt() : 302;
+        respondSimple(nStatusCode, QByteArray(), "Location: " + query.queryItemValue("to", QUrl::FullyDecoded).toUtf8() + "\r\n");
+        return;
+    }
+    else if (strPath == "/upload" && (m_method == "POST" || m_method == "PUT"))
+    {
+        respondSimple(200, QString("{\"received\":%1}").arg(m_nBodyReceived).toLatin1(), "Content-Type: application/json\r\n");
+        return;
+    }
+    respondSimple(404, "Not Found");
+}
+
+void BenchmarkHttpConnection::respondBytes(qint64 nSize, bool bChunked, bool bRanges, const QByteArray &etag)
+{
+    qint64 nStart = 0;
+    qint64 nEnd = nSize;
+    int nStatusCode = 200;
+    QByteArray headers = "Content-Type: application/octet-stream\r\n";
+    if (bRanges)
+    {
+        headers += "Accept-Ranges: bytes\r\n";
+    }
+    if (!etag.isEmpty())
+    {
+        // Revalidated before every use
+        const QByteArray quoted = '"' + etag + '"';
+        const QByteArray validator = "ETag: " + quoted + "\r\nCache-Control: no-cache\r\n";
+        if (m_headers.value("if-none-match") == quoted)
+        {
+            respondSimple(304, QByteArray(), validator);
+            return;
+        }
+        headers += validator;
+    }
+
+    // A single range: "bytes=first-last", "bytes=first-" or "bytes=-suffix".
+    // Only an If-Range matching the ETag keeps the range (no Last-Modified is sent, a date never matches)
+    const bool bIfRangeMatches = !m_headers.contains("if-range") || (!etag.isEmpty() && m_headers.value("if-range") == '"' + etag + '"');
+    const QByteArray range = (bRanges && bIfRangeMatches) ? m_headers.value("range").trimmed() : QByteArray();
+    if (!range.isEmpty())
+    {
+        const QByteArray spec = range.startsWith("bytes=") ? range.mid(6).trimmed() : QByteArray();
+        const int nDash = spec.indexOf('-');
+        bool bFirstOk = true;
+        bool bLastOk = true;
+        const QByteArray first = spec.left(nDash).trimmed();
+        const QByteArray last = spec.mid(nDash + 1).trimmed();
+        if (nDash < 0 || spec.contains(',') || (first.isEmpty() && last.isEmpty()))
+        {
+            bFirstOk = false;
+        }
+        else if (first.isEmpty())
+        {
+            nStart = qMax<qint64>(0, nSize - last.toLongLong(&bLastOk));
+        }
+        else
+        {
+            nStart = first.toLongLong(&bFirstOk);
+            if (!last.isEmpty())
+            {
+                nEnd = qMin(nSize, last.toLongLong(&bLastOk) + 1);
+            }
+        }
+        if (!bFirstOk || !bLastOk || nStart >= nSize || nStart >= nEnd)
+        {
+            respondSimple(416, QByteArray(), QString("Content-Range: bytes */%1\r\n").arg(nSize).toLatin1());
+            return;
+        }
+        nStatusCode = 206;
+        headers += QString("Content-Range: bytes %1-%2/%3\r\n").arg(nStart).arg(nEnd - 1).arg(nSize).toLatin1();
+    }
+
+    QByteArray head = "HTTP/1.1 " + QByteArray::number(nStatusCode) + ' ' + reasonPhrase(nStatusCode) + "\r\n" + headers;
+    head += bChunked ? QByteArray("Transfer-Encoding: chunked\r\n") : ("Content-Length: " + QByteArray::number(nEnd - nStart) + "\r\n");
+    if (m_bClose)
+    {
+        head += "Connection: close\r\n";
+    }
+    head += "\r\n";
+    m_pSocket->write(head);
+
+    if (m_method == "HEAD")
+    {
+        finishResponse();
+        return;
+    }
+    m_nSendOffset = nStart;
+    m_nSendEnd = nEnd;
+    m_bSendChunked = bChunked;
+    sendPayload();
+}
+
+void BenchmarkHttpConnection::respondSimple(int nStatusCode, const QByteArray &body, const QByteArray &extraHeaders)
+{
+    QByteArray response = "HTTP/1.1 " + QByteArray::number(nStatusCode) + ' ' + reasonPhrase(nStatusCode) + "\r\n" + extraHeaders;
+    if (nStatusCode != 304)
+    {
+        // A 304 has no body, a Content-Length would describe the stored one
+        response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    }
+    if (m_bClose)
+    {
+        response += "Connection: close\r\n";
+    }
+    response += "\r\n";
+    if (m_method != "HEAD")
+    {
+        response += body;
+    }
+    m_pSocket->write(response);
+    finishResponse();
+}
+
+void BenchmarkHttpConnection::sendPayload()
+{
+    const QByteArray &pattern = payloadPattern();
+    while (m_nSendOffset < m_nSendEnd && m_pSocket->bytesToWrite() < SEND_HIGH_WATER_BYTES)
+    {
+        const int nPos = static_cast<int>(m_nSendOffset % pattern.size());
+        const qint64 nBytes = qMin<qint64>(pattern.size() - nPos, m_nSendEnd - m_nSendOffset);
+        if (m_bSendChunked)
+        {
+            m_pSocket->write(QByteArray::number(nBytes, 16) + "\r\n");
+        }
+        m_pSocket->write(pattern.constData() + nPos, nBytes);
+        if (m_bSendChunked)
+        {
+            m_pSocket->write("\r\n");
+        }
+        m_nSendOffset += nBytes;
+    }
+
+    if (m_nSendOffset >= m_nSendEnd)
+    {
+        if (m_bSendChunked)
+        {
+            m_pSocket->write("0\r\n\r\n");
+        }
+        finishResponse();
+    }
+}
+
+void BenchmarkHttpConnection::finishResponse()
+{
+    m_nSendOffset = 0;
+    m_nSendEnd = 0;
+    m_bSendChunked = false;
+    if (m_bClose)
+    {
+        m_pSocket->disconnectFromHost();
+        return;
+    }
+
+    m_headers.clear();
+    m_eState = State::Headers;
+    if (!m_buffer.isEmpty())
+    {
+        // A request arrived meanwhile, parsed from the event loop rather than from within parse()
+        QMetaObject::invokeMethod(this, "onReadyRead", Qt::QueuedConnection);
+    }
+}
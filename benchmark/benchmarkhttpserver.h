@@ -0,0 +1,117 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QTcpServer>
+#include <QThread>
+#include <QUrl>
+
+class QTcpSocket;
+
+namespace QtNetworkRequest
+{
+    /**
+     * @brief Minimal HTTP/1.1 server on 127.0.0.1 for the network benchmark and the unit tests, served from a thread of its own.
+     *
+     * GET|HEAD /bytes/<n>[?chunked=1]  n generated bytes, Range (single range) and chunked transfer coding
+     * POST|PUT /upload                 Discards the body (Content-Length or chunked), answers {"received":<bytes>}
+     * GET|HEAD /redirect?to=<target>[&code=<status>]
+     *                                  Redirects to target (percent-encoded path and query) with status 302 or code
+     *
+     * Query options of /bytes (the unit tests add a tag=<name> of their own to tell their requests apart):
+     *   delay=<ms>[&delayfrom=<first>] Answer after a delay. With delayfrom only the range requests starting at byte <first>
+     *   norange=1                      Ignore Range and send no Accept-Ranges, like a server without range support
+     *   etag=<tag>[&changeafter=<k>]   ETag and Cache-Control: no-cache, a matching If-None-Match is answered with 304.
+     *                                  After the k-th request of the target the ETag is "<tag>-changed", as if the file had changed.
+     *                                  A range request with an If-Range that does not match is answered with the whole file
+     *   fail=<k>[&retryafter=<s>]      The first k requests of the target are answered with 503 and Retry-After (1 s by default)
+     *
+     * Connections are kept alive unless the client asks to close them.
+     */
+    class BenchmarkHttpServer : public QTcpServer
+    {
+        Q_OBJECT
+
+    public:
+        explicit BenchmarkHttpServer(QObject *parent = nullptr);
+        ~BenchmarkHttpServer();
+
+        bool start();
+        void stop();
+
+        QUrl url(const QString &strPath) const;
+        // Body of /bytes/<nSize>
+        static QByteArray payload(qint64 nSize);
+        // Requests received for the path and query of url
+        int hitCount(const QUrl &url) const;
+
+        // Called by the connections, returns the number of requests for the target including this one
+        int recordHit(const QByteArray &target);
+
+    protected:
+        void incomingConnection(qintptr socketDescriptor) override;
+
+    private:
+        QThread m_thread;
+        QThread *m_pOwnerThread;
+        quint16 m_uiPort;
+        mutable QMutex m_hitMutex;
+        QHash<QByteArray, int> m_hits;
+    };
+
+    // One client connection of BenchmarkHttpServer
+    class BenchmarkHttpConnection : public QObject
+    {
+        Q_OBJECT
+
+    public:
+        BenchmarkHttpConnection(qintptr socketDescriptor, BenchmarkHttpServer *pServer);
+
+    private Q_SLOTS:
+        void onReadyRead();
+        void onBytesWritten();
+
+    private:
+        enum class State
+        {
+            Headers,
+            Body,
+            ChunkSize,
+            ChunkData,
+            ChunkTrailer,
+            Responding
+        };
+
+        // Consume the buffered request bytes, false if the connection must be closed
+        bool parse();
+        bool parseHeaders(const QByteArray &head);
+        void respond();
+        // Response to the nHit-th request of the target, after the delay it asked for
+        void respondNow(int nHit);
+        void respondBytes(qint64 nSize, bool bChunked, bool bRanges, const QByteArray &etag);
+        void respondSimple(int nStatusCode, const QByteArray &body, const QByteArray &extraHeaders = QByteArray());
+        // Write payload while the socket buffer is low
+        void sendPayload();
+        void finishResponse();
+
+    private:
+        BenchmarkHttpServer *m_pServer;
+        QTcpSocket *m_pSocket;
+        QByteArray m_buffer;
+        State m_eState;
+
+        // Current request
+        QByteArray m_method;
+        QByteArray m_path;
+        QHash<QByteArray, QByteArray> m_headers; // Lower-case names
+        qint64 m_nBodyRemaining;
+        qint64 m_nBodyReceived;
+        bool m_bClose;
+
+        // Current response payload
+        qint64 m_nSendOffset;
+        qint64 m_nSendEnd;
+        bool m_bSendChunked;
+    };
+}
@@ -0,0 +1,637 @@
+// Measures the library's own overhead against a local HTTP/1.1 server (BenchmarkHttpServer), no external host involved.
+// Fixed scenarios, the results are written as JSON so runs can be compared across commits:
+//   small-get   --requests GETs of --small-size bytes, --concurrency requests kept in flight (one result per level)
+//   download    Multi-threaded download of --download-size MB, one result per --segments count
+//   batch       One batch of --batch tiny GETs
+//   submit      --requests tiny GETs posted from several threads at once while the main thread takes the results,
+//               one result per --submitters count: postRequest -> onResponse throughput of the manager under contention
+//   upload      POST of a --upload-size MB file
+//   http2       small-get and download once over separate HTTP/1.1 connections and once as HTTP/2 streams of one
+//               connection (behavior.http2), against --h2c-small and --h2c-large. BenchmarkHttpServer speaks HTTP/1.1
+//               only: the URLs point to a local server that speaks both HTTP/1.1 and cleartext HTTP/2 with prior
+//               knowledge on the same port (e.g. h2o, or nghttpx in front of a file server)
+// Latencies are measured from postRequest to requestFinished on the main thread.
+//
+// NetworkBenchmark [--scenarios small-get,download,batch,submit,upload] [--mode thread|eventloop] [--runs 3] [--output results.json]
+// NetworkBenchmark --scenarios http2 --h2c-small http://127.0.0.1:8080/1k.bin --h2c-large http://127.0.0.1:8080/256m.bin
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTimer>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "benchmarkhttpserver.h"
+#include "networkreply.h"
+#include "networkrequestmanager.h"
+
+using namespace QtNetworkRequest;
+
+namespace
+{
+    struct BenchmarkOptions
+    {
+        int requests;
+        qint64 smallSize;
+        QList<int> concurrency;
+        qint64 downloadSize;
+        QList<int> segments;
+        int batch;
+        QList<int> submitters;
+        qint64 uploadSize;
+        int runs;
+        int timeoutSec;
+        QString dir;
+        QString h2cSmallUrl;
+        QString h2cLargeUrl;
+    };
+
+    QList<int> toIntList(const QString &strValues)
+    {
+        QList<int> values;
+        for (const QString &strValue : strValues.split(','))
+        {
+            const int nValue = strValue.trimmed().toInt();
+            if (nValue > 0)
+            {
+                values << nValue;
+            }
+        }
+        return values;
+    }
+
+    // p50/p90/p99 by nearest rank, in milliseconds
+    QJsonObject latencyStats(std::vector<double> samples)
+    {
+        QJsonObject stats;
+        if (samples.empty())
+        {
+            return stats;
+        }
+        std::sort(samples.begin(), samples.end());
+        auto percentile = [&samples](double p) {
+            const size_t nRank = static_cast<size_t>(std::ceil(p * samples.size()));
+            return samples[std::min(samples.size(), std::max<size_t>(1, nRank)) - 1];
+        };
+        double total = 0;
+        for (double sample : samples)
+        {
+            total += sample;
+        }
+        stats["p50"] = percentile(0.50);
+        stats["p90"] = percentile(0.90);
+        stats["p99"] = percentile(0.99);
+        stats["min"] = samples.front();
+        stats["max"] = samples.back();
+        stats["mean"] = total / samples.size();
+        return stats;
+    }
+
+    // Runs the event loop until quit() or the timeout, false on timeout
+    bool exec(QEventLoop &loop, int nTimeoutSec)
+    {
+        bool bTimedOut = false;
+        QTimer::singleShot(nTimeoutSec * 1000, &loop, [&loop, &bTimedOut]() {
+            bTimedOut = true;
+            loop.quit();
+        });
+        loop.exec();
+        return !bTimedOut;
+    }
+
+    // nTotal GETs of strUrl, nConcurrency of them in flight at any time. nSize: expected body size, -1 = any
+    QJsonObject runSmallGet(const char *pszScenario, const QString &strUrl, qint64 nSize, bool bHttp2,
+                            const BenchmarkOptions &options, int nTotal, int nConcurrency)
+    {
+        NetworkRequestManager *pManager = NetworkRequestManager::globalInstance();
+
+        QEventLoop loop;
+        QElapsedTimer clock;
+        std::vector<double> latencies;
+        latencies.reserve(nTotal);
+        int nPosted = 0;
+        int nFinished = 0;
+        int nFailed = 0;
+        int nHttp2 = 0;
+
+        std::function<void()> postNext = [&]() {
+            while (nPosted < nTotal)
+            {
+                ++nPosted;
+                const qint64 nStartNs = clock.nsecsElapsed();
+                std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+                req->url = strUrl;
+                req->type = RequestType::Get;
+                req->behavior.http2 = bHttp2;
+                std::shared_ptr<NetworkReply> reply = pManager->postRequest(std::move(req));
+                if (reply)
+                {
+                    QObject::connect(reply.get(), &NetworkReply::requestFinished, &loop,
+                                     [&, nStartNs](QSharedPointer<ResponseResult> rsp) {
+                                         latencies.push_back((clock.nsecsElapsed() - nStartNs) / 1e6);
+                                         if (!rsp->success || (nSize >= 0 && rsp->body.size() != nSize))
+                                         {
+                                             ++nFailed;
+                                         }
+                                         if (rsp->performance.http2)
+                                         {
+                                             ++nHttp2;
+                                         }
+                                         if (++nFinished == nTotal)
+                                         {
+                                             loop.quit();
+                                         }
+                                         else
+                                         {
+                                             postNext();
+                                         }
+                                     });
+                    return;
+                }
+                ++nFailed;
+                if (++nFinished == nTotal)
+                {
+                    loop.quit();
+                    return;
+                }
+            }
+        };
+
+        clock.start();
+        for (int i = 0; i < nConcurrency && nPosted < nTotal; ++i)
+        {
+            postNext();
+        }
+        const bool bCompleted = (nFinished == nTotal) || exec(loop, options.timeoutSec);
+        const double seconds = clock.nsecsElapsed() / 1e9;
+
+        QJsonObject result;
+        result["scenario"] = pszScenario;
+        result["concurrency"] = nConcurrency;
+        result["requests"] = nTotal;
+        result["bytes"] = nSize;
+        result["http2"] = bHttp2;
+        // Replies that actually came as HTTP/2 streams
+        result["http2Replies"] = nHttp2;
+        result["failed"] = nFailed + (nTotal - nFinished);
+        result["timedOut"] = !bCompleted;
+        result["seconds"] = seconds;
+        result["requestsPerSecond"] = nFinished / seconds;
+        result["latencyMs"] = latencyStats(latencies);
+        return result;
+    }
+
+    // One request until its result, seconds (-1 on failure or timeout)
+    double runSingle(std::unique_ptr<RequestContext> req, const BenchmarkOptions &options,
+                     const std::function<bool(const ResponseResult &)> &verify)
+    {
+        QEventLoop loop;
+        QElapsedTimer clock;
+        bool bSuccess = false;
+        clock.start();
+        std::shared_ptr<NetworkReply> reply = NetworkRequestManager::globalInstance()->postRequest(std::move(req));
+        if (!reply)
+        {
+            return -1;
+        }
+        QObject::connect(reply.get(), &NetworkReply::requestFinished, &loop,
+                         [&](QSharedPointer<ResponseResult> rsp) {
+                             bSuccess = rsp->success && verify(*rsp);
+                             if (!bSuccess)
+                             {
+                                 std::fprintf(stderr, "  failed: %s\n", qPrintable(rsp->errorMessage));
+                             }
+                             loop.quit();
+                         });
+        if (!exec(loop, options.timeoutSec))
+        {
+            NetworkRequestManager::globalInstance()->stopRequest(reply->task()->id);
+            return -1;
+        }
+        return bSuccess ? clock.nsecsElapsed() / 1e9 : -1;
+    }
+
+    QJsonObject throughputResult(const char *pszScenario, qint64 nBytes, const std::vector<double> &seconds, int nFailed)
+    {
+        std::vector<double> latencies;
+        double best = 0;
+        double total = 0;
+        for (double value : seconds)
+        {
+            latencies.push_back(value * 1000);
+            best = latencies.size() == 1 ? value : qMin(best, value);
+            total += value;
+        }
+
+        QJsonObject result;
+        result["scenario"] = pszScenario;
+        result["bytes"] = nBytes;
+        result["runs"] = static_cast<int>(seconds.size()) + nFailed;
+        result["failed"] = nFailed;
+        if (!seconds.empty())
+        {
+            result["bestMBps"] = nBytes / (1024.0 * 1024.0) / best;
+            result["averageMBps"] = nBytes / (1024.0 * 1024.0) / (total / seconds.size());
+        }
+        result["latencyMs"] = latencyStats(latencies);
+        return result;
+    }
+
+    // Multi-threaded download of strUrl. nSize: expected file size, -1 = take that of the first run
+    QJsonObject runDownload(const char *pszScenario, const QString &strUrl, qint64 nSize, bool bHttp2,
+                            const BenchmarkOptions &options, int nSegments)
+    {
+        const QString strFileName = "network-benchmark-download.bin";
+        std::vector<double> seconds;
+        int nFailed = 0;
+        for (int run = 0; run < options.runs; ++run)
+        {
+            std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+            req->url = strUrl;
+            req->type = RequestType::MTDownload;
+            req->behavior.http2 = bHttp2;
+            req->downloadConfig = std::make_unique<DownloadConfig>();
+            req->downloadConfig->saveDir = options.dir;
+            req->downloadConfig->saveFileName = strFileName;
+            req->downloadConfig->overwriteFile = true;
+            req->downloadConfig->threadCount = static_cast<quint16>(nSegments);
+
+            const double value = runSingle(std::move(req), options, [&options, &strFileName, &nSize](const ResponseResult &) {
+                const qint64 nFileSize = QFileInfo(QDir(options.dir).filePath(strFileName)).size();
+                if (nSize < 0)
+                {
+                    nSize = nFileSize;
+                }
+                return nFileSize == nSize;
+            });
+            QFile::remove(QDir(options.dir).filePath(strFileName));
+            if (value < 0)
+                ++nFailed;
+            else
+                seconds.push_back(value);
+        }
+
+        QJsonObject result = throughputResult(pszScenario, qMax<qint64>(0, nSize), seconds, nFailed);
+        result["segments"] = nSegments;
+        result["http2"] = bHttp2;
+        return result;
+    }
+
+    QJsonObject runUpload(const BenchmarkHttpServer &server, const BenchmarkOptions &options)
+    {
+        // Uploads read their body from a file
+        const QString strFilePath = QDir(options.dir).filePath("network-benchmark-upload.bin");
+        {
+            QFile file(strFilePath);
+            QByteArray chunk(1024 * 1024, 'u');
+            if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            {
+                std::fprintf(stderr, "upload: cannot write %s\n", qPrintable(strFilePath));
+                return throughputResult("upload", options.uploadSize, {}, options.runs);
+            }
+            for (qint64 nWritten = 0; nWritten < options.uploadSize; nWritten += chunk.size())
+            {
+                file.write(chunk.constData(), qMin<qint64>(chunk.size(), options.uploadSize - nWritten));
+            }
+        }
+
+        std::vector<double> seconds;
+        int nFailed = 0;
+        for (int run = 0; run < options.runs; ++run)
+        {
+            std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+            req->url = server.url("/upload").toString();
+            req->type = RequestType::Upload;
+            req->uploadConfig = std::make_unique<UploadConfig>();
+            req->uploadConfig->filePath = strFilePath;
+
+            const QByteArray expected = QString("{\"received\":%1}").arg(options.uploadSize).toLatin1();
+            const double value = runSingle(std::move(req), options, [&expected](const ResponseResult &rsp) {
+                return rsp.body == expected;
+            });
+            if (value < 0)
+                ++nFailed;
+            else
+                seconds.push_back(value);
+        }
+        QFile::remove(strFilePath);
+        return throughputResult("upload", options.uploadSize, seconds, nFailed);
+    }
+
+    // All requests submitted at once as one batch
+    QJsonObject runBatch(const BenchmarkHttpServer &server, const BenchmarkOptions &options)
+    {
+        const QString strUrl = server.url("/bytes/16").toString();
+        BatchRequestPtrTasks tasks;
+        tasks.reserve(options.batch);
+        for (int i = 0; i < options.batch; ++i)
+        {
+            std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+            req->url = strUrl;
+            req->type = RequestType::Get;
+            tasks.push_back(std::move(req));
+        }
+
+        QEventLoop loop;
+        QElapsedTimer clock;
+        std::vector<double> latencies;
+        latencies.reserve(options.batch);
+        int nFinished = 0;
+        int nFailed = 0;
+
+        clock.start();
+        quint64 uiBatchId = 0;
+        std::shared_ptr<NetworkReply> reply = NetworkRequestManager::globalInstance()->postBatchRequest(std::move(tasks), uiBatchId);
+        const double submitMs = clock.nsecsElapsed() / 1e6;
+        bool bCompleted = false;
+        if (reply)
+        {
+            QObject::connect(reply.get(), &NetworkReply::requestFinished, &loop,
+                             [&](QSharedPointer<ResponseResult> rsp) {
+                                 latencies.push_back(clock.nsecsElapsed() / 1e6);
+                                 if (!rsp->success)
+                                 {
+                                     ++nFailed;
+                                 }
+                                 if (++nFinished == options.batch)
+                                 {
+                                     loop.quit();
+                                 }
+                             });
+            bCompleted = exec(loop, options.timeoutSec);
+            if (!bCompleted)
+            {
+                NetworkRequestManager::globalInstance()->stopBatchRequests(uiBatchId);
+            }
+        }
+        const double seconds = clock.nsecsElapsed() / 1e9;
+
+        QJsonObject result;
+        result["scenario"] = "batch";
+        result["requests"] = options.batch;
+        result["failed"] = nFailed + (options.batch - nFinished);
+        result["timedOut"] = !bCompleted;
+        result["submitMs"] = submitMs;
+        result["seconds"] = seconds;
+        result["requestsPerSecond"] = nFinished / seconds;
+        result["latencyMs"] = latencyStats(latencies);
+        return result;
+    }
+
+    // --requests tiny GETs posted by nSubmitters threads at once, the main thread takes the results
+    QJsonObject runSubmit(BenchmarkHttpServer &server, const BenchmarkOptions &options, int nSubmitters)
+    {
+        NetworkRequestManager *pManager = NetworkRequestManager::globalInstance();
+        const QUrl url = server.url(QString("/bytes/16?tag=submit-%1").arg(nSubmitters));
+        const int nTotal = options.requests;
+        const int nHitsBefore = server.hitCount(url);
+
+        QEventLoop loop;
+        std::atomic<int> nFinished{ 0 };
+        auto finishOne = [&]() {
+            if (nFinished.fetch_add(1) + 1 == nTotal)
+            {
+                QMetaObject::invokeMethod(&loop, "quit", Qt::QueuedConnection);
+            }
+        };
+
+        QElapsedTimer clock;
+        clock.start();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < nSubmitters; ++i)
+        {
+            const int nCount = nTotal / nSubmitters + (i < nTotal % nSubmitters ? 1 : 0);
+            threads.emplace_back([&, nCount]() {
+                for (int n = 0; n < nCount; ++n)
+                {
+                    std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+                    req->url = url.toString();
+                    req->type = RequestType::Get;
+                    std::shared_ptr<NetworkReply> reply = pManager->postRequest(std::move(req));
+                    if (!reply)
+                    {
+                        finishOne();
+                        continue;
+                    }
+                    // The result may be delivered before a connection to requestFinished is made from here. The
+                    // manager lets go of the reply once it delivered the result, it is destroyed after this thread did too
+                    QObject::connect(reply.get(), &QObject::destroyed, finishOne);
+                }
+            });
+        }
+        const bool bCompleted = (nFinished.load() == nTotal) || exec(loop, options.timeoutSec);
+        const double seconds = clock.nsecsElapsed() / 1e9;
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+
+        // Every result counts as failed that did not come from the server
+        const int nHits = server.hitCount(url) - nHitsBefore;
+        QJsonObject result;
+        result["scenario"] = "submit";
+        result["submitters"] = nSubmitters;
+        result["requests"] = nTotal;
+        result["failed"] = nTotal - qMin(nTotal, qMin(nHits, nFinished.load()));
+        result["timedOut"] = !bCompleted;
+        result["seconds"] = seconds;
+        result["requestsPerSecond"] = nFinished.load() / seconds;
+        return result;
+    }
+
+    void printResult(const QJsonObject &result)
+    {
+        const QJsonObject latency = result["latencyMs"].toObject();
+        QString strName = result["scenario"].toString();
+        if (result.contains("concurrency"))
+            strName += QString(" c=%1").arg(result["concurrency"].toInt());
+        if (result.contains("submitters"))
+            strName += QString(" threads=%1").arg(result["submitters"].toInt());
+        if (result.contains("segments"))
+            strName += QString(" segments=%1").arg(result["segments"].toInt());
+        if (result["http2"].toBool())
+            strName += " h2";
+
+        const QString strRate = result.contains("requestsPerSecond")
+                                    ? QString("%1 req/s").arg(result["requestsPerSecond"].toDouble(), 0, 'f', 1)
+                                    : QString("%1 MB/s").arg(result["averageMBps"].toDouble(), 0, 'f', 1);
+        std::fprintf(stderr, "%-22s %16s  p50 %8.2f ms  p90 %8.2f ms  p99 %8.2f ms  failed %d\n",
+                     qPrintable(strName), qPrintable(strRate), latency["p50"].toDouble(), latency["p90"].toDouble(),
+                     latency["p99"].toDouble(), result["failed"].toInt());
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    qRegisterMetaType<QSharedPointer<QtNetworkRequest::ResponseResult>>("QSharedPointer<QtNetworkRequest::ResponseResult>");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Network request benchmark against a local HTTP server");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("scenarios", "Scenarios to run (small-get, download, batch, submit, upload, http2).", "list", "small-get,download,batch,submit,upload"));
+    parser.addOption(QCommandLineOption("mode", "Execution mode (thread, eventloop).", "mode", "thread"));
+    parser.addOption(QCommandLineOption("threads", "Thread pool size (thread mode) or network threads (eventloop mode), 0 = default.", "count", "0"));
+    parser.addOption(QCommandLineOption("requests", "small-get, submit: requests per concurrency level or submitter count.", "count", "2000"));
+    parser.addOption(QCommandLineOption("small-size", "small-get: response size in bytes.", "bytes", "1024"));
+    parser.addOption(QCommandLineOption("concurrency", "small-get: requests in flight.", "list", "1,64,512"));
+    parser.addOption(QCommandLineOption("download-size", "download: file size in MB.", "MB", "256"));
+    parser.addOption(QCommandLineOption("segments", "download: channel counts.", "list", "1,2,4,8"));
+    parser.addOption(QCommandLineOption("batch", "batch: requests in the batch.", "count", "10000"));
+    parser.addOption(QCommandLineOption("submitters", "submit: threads posting the requests.", "list", "1,4,16"));
+    parser.addOption(QCommandLineOption("upload-size", "upload: body size in MB.", "MB", "64"));
+    parser.addOption(QCommandLineOption("h2c-small", "http2: URL of a small file on a local HTTP/1.1 + h2c server.", "url"));
+    parser.addOption(QCommandLineOption("h2c-large", "http2: URL of a large file on the same server.", "url"));
+    parser.addOption(QCommandLineOption("runs", "download/upload/http2: runs per configuration.", "count", "3"));
+    parser.addOption(QCommandLineOption("timeout", "Seconds a scenario may take.", "seconds", "600"));
+    parser.addOption(QCommandLineOption("dir", "Directory of the downloaded and uploaded files.", "path", QDir::tempPath()));
+    parser.addOption(QCommandLineOption("output", "JSON results file (default: standard output).", "path"));
+    parser.process(app);
+
+    BenchmarkOptions options;
+    options.requests = qMax(1, parser.value("requests").toInt());
+    options.smallSize = qMax<qint64>(0, parser.value("small-size").toLongLong());
+    options.concurrency = toIntList(parser.value("concurrency"));
+    options.downloadSize = qMax<qint64>(1, parser.value("download-size").toLongLong()) * 1024 * 1024;
+    options.segments = toIntList(parser.value("segments"));
+    options.batch = qMax(1, parser.value("batch").toInt());
+    options.submitters = toIntList(parser.value("submitters"));
+    options.uploadSize = qMax<qint64>(1, parser.value("upload-size").toLongLong()) * 1024 * 1024;
+    options.runs = qMax(1, parser.value("runs").toInt());
+    options.timeoutSec = qMax(1, parser.value("timeout").toInt());
+    options.dir = parser.value("dir");
+    options.h2cSmallUrl = parser.value("h2c-small");
+    options.h2cLargeUrl = parser.value("h2c-large");
+    const QStringList scenarios = parser.value("scenarios").split(',');
+    const bool bEventLoop = parser.value("mode") == "eventloop";
+    const int nThreads = parser.value("threads").toInt();
+
+    BenchmarkHttpServer server;
+    if (!server.start())
+    {
+        std::fprintf(stderr, "Cannot start the local HTTP server: %s\n", qPrintable(server.errorString()));
+        return 1;
+    }
+
+    NetworkRequestManager::initialize();
+    NetworkRequestManager *pManager = NetworkRequestManager::globalInstance();
+    pManager->setExecutionMode(bEventLoop ? ExecutionMode::EventLoop : ExecutionMode::ThreadPerRequest, nThreads);
+    if (!bEventLoop && nThreads > 0)
+    {
+        pManager->setMaxThreadCount(nThreads);
+    }
+
+    QJsonArray results;
+    auto record = [&results](const QJsonObject &result) {
+        printResult(result);
+        results.append(result);
+    };
+
+    const QString strSmallUrl = server.url(QString("/bytes/%1").arg(options.smallSize)).toString();
+    // Connections and threads warmed up, not recorded
+    runSmallGet("small-get", strSmallUrl, options.smallSize, false, options, 64, 8);
+
+    if (scenarios.contains("small-get"))
+    {
+        for (int nConcurrency : options.concurrency)
+        {
+            record(runSmallGet("small-get", strSmallUrl, options.smallSize, false, options, options.requests, nConcurrency));
+        }
+    }
+    if (scenarios.contains("download"))
+    {
+        const QString strUrl = server.url(QString("/bytes/%1").arg(options.downloadSize)).toString();
+        for (int nSegments : options.segments)
+        {
+            record(runDownload("download", strUrl, options.downloadSize, false, options, nSegments));
+        }
+    }
+    if (scenarios.contains("http2"))
+    {
+        if (options.h2cSmallUrl.isEmpty() && options.h2cLargeUrl.isEmpty())
+        {
+            std::fprintf(stderr, "http2: --h2c-small and/or --h2c-large required, skipped\n");
+        }
+        for (bool bHttp2 : { false, true })
+        {
+            if (!options.h2cSmallUrl.isEmpty())
+            {
+                runSmallGet("h2c-small-get", options.h2cSmallUrl, -1, bHttp2, options, 64, 8);
+                for (int nConcurrency : options.concurrency)
+                {
+                    record(runSmallGet("h2c-small-get", options.h2cSmallUrl, -1, bHttp2, options, options.requests, nConcurrency));
+                }
+            }
+            if (!options.h2cLargeUrl.isEmpty())
+            {
+                for (int nSegments : options.segments)
+                {
+                    record(runDownload("h2c-download", options.h2cLargeUrl, -1, bHttp2, options, nSegments));
+                }
+            }
+        }
+    }
+    if (scenarios.contains("batch"))
+    {
+        record(runBatch(server, options));
+    }
+    if (scenarios.contains("submit"))
+    {
+        for (int nSubmitters : options.submitters)
+        {
+            record(runSubmit(server, options, nSubmitters));
+        }
+    }
+    if (scenarios.contains("upload"))
+    {
+        record(runUpload(server, options));
+    }
+
+    NetworkRequestManager::unInitialize();
+    server.stop();
+
+    QJsonObject report;
+    report["benchmark"] = "NetworkBenchmark";
+    report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report["qtVersion"] = QString(qVersion());
+    report["mode"] = bEventLoop ? "eventloop" : "thread";
+    report["threads"] = nThreads;
+    report["results"] = results;
+    const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+
+    int nFailed = 0;
+    for (const QJsonValue &result : results)
+    {
+        nFailed += result.toObject()["failed"].toInt();
+    }
+
+    if (parser.isSet("output"))
+    {
+        QFile file(parser.value("output"));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size())
+        {
+            std::fprintf(stderr, "Cannot write %s\n", qPrintable(parser.value("output")));
+            return 1;
+        }
+    }
+    else
+    {
+        std::fwrite(json.constData(), 1, json.size(), stdout);
+    }
+    return nFailed == 0 ? 0 : 1;
+}
@@ -0,0 +1,157 @@
+// Contention of the reply registry data structure alone: --threads threads each register, look up and complete --ops ids
+// (insert, value, take with sequential ids, the registry calls of postRequest -> progress registration -> onResponse), against
+//   global    one QHash behind one recursive mutex, the way the replies were kept before the registry was sharded
+//   sharded   ShardedRegistry
+// The scheduling, indices and delivery around it are not part of it, NetworkBenchmark --scenarios submit measures
+// the manager end to end.
+//
+// RegistryBenchmark [--threads 1,2,4,8,16] [--ops 200000] [--runs 3]
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
+#include <QRecursiveMutex>
+#endif
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "networkrequestregistry.h"
+
+using namespace QtNetworkRequest;
+
+namespace
+{
+    typedef std::shared_ptr<int> Reply;
+
+    class GlobalRegistry
+    {
+    public:
+        void insert(quint64 uiId, const Reply &value)
+        {
+            QMutexLocker locker(&m_mutex);
+            m_values.insert(uiId, value);
+        }
+        Reply value(quint64 uiId) const
+        {
+            QMutexLocker locker(&m_mutex);
+            return m_values.value(uiId);
+        }
+        Reply take(quint64 uiId)
+        {
+            QMutexLocker locker(&m_mutex);
+            return m_values.take(uiId);
+        }
+
+    private:
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
+        mutable QRecursiveMutex m_mutex;
+#else
+        mutable QMutex m_mutex{ QMutex::Recursive };
+#endif
+        QHash<quint64, Reply> m_values;
+    };
+
+    // Million operations per second, -1 if a lookup missed
+    template <typename Registry>
+    double runOnce(int nThreads, int nOps)
+    {
+        Registry registry;
+        std::atomic<quint64> uiNextId(0);
+        std::atomic<bool> bFailed(false);
+        const Reply reply = std::make_shared<int>(0);
+
+        QElapsedTimer timer;
+        timer.start();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < nThreads; ++i)
+        {
+            threads.emplace_back([&]() {
+                // A few requests in flight per thread
+                quint64 inFlight[8] = {};
+                for (int op = 0; op < nOps; ++op)
+                {
+                    quint64 &uiId = inFlight[op % 8];
+                    if (uiId != 0 && !registry.take(uiId))
+                    {
+                        bFailed = true;
+                    }
+                    uiId = uiNextId.fetch_add(1, std::memory_order_relaxed) + 1;
+                    registry.insert(uiId, reply);
+                    if (!registry.value(uiId))
+                    {
+                        bFailed = true;
+                    }
+                }
+            });
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+        const double seconds = timer.nsecsElapsed() / 1e9;
+        // Three operations per iteration
+        return bFailed ? -1 : 3.0 * nThreads * nOps / seconds / 1e6;
+    }
+
+    template <typename Registry>
+    double best(int nThreads, int nOps, int nRuns)
+    {
+        double value = 0;
+        for (int run = 0; run < nRuns; ++run)
+        {
+            const double result = runOnce<Registry>(nThreads, nOps);
+            if (result < 0)
+            {
+                return -1;
+            }
+            value = qMax(value, result);
+        }
+        return value;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Request registry contention benchmark");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("threads", "Thread counts.", "list", "1,2,4,8,16"));
+    parser.addOption(QCommandLineOption("ops", "Requests per thread.", "count", "200000"));
+    parser.addOption(QCommandLineOption("runs", "Runs per configuration, the best is reported.", "count", "3"));
+    parser.process(app);
+
+    const int nOps = qMax(1, parser.value("ops").toInt());
+    const int nRuns = qMax(1, parser.value("runs").toInt());
+
+    std::printf("%d requests per thread, best of %d runs, million operations per second\n", nOps, nRuns);
+    std::printf("%-8s %10s %10s %8s\n", "threads", "global", "sharded", "speedup");
+
+    int nFailed = 0;
+    for (const QString &strThreads : parser.value("threads").split(','))
+    {
+        const int nThreads = strThreads.trimmed().toInt();
+        if (nThreads <= 0)
+        {
+            continue;
+        }
+        const double global = best<GlobalRegistry>(nThreads, nOps, nRuns);
+        const double sharded = best<ShardedRegistry<Reply>>(nThreads, nOps, nRuns);
+        if (global < 0 || sharded < 0)
+        {
+            std::printf("%-8d %10s\n", nThreads, "failed");
+            ++nFailed;
+            continue;
+        }
+        std::printf("%-8d %10.2f %10.2f %7.2fx\n", nThreads, global, sharded, sharded / global);
+    }
+    return nFailed == 0 ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+// Compares the download storage backends (DownloadConfig::storageBackend) on the same local transfer:
+// a file of --size MB written by --segments concurrent streams in --chunk KB pieces (the size of a network read),
+// the way NetworkMTDownloadRequest writes it. Every run includes the allocation, the final flush and the close.
+//
+// StorageBenchmark [--size 1024] [--segments 8] [--chunk 16] [--runs 3] [--dir <path>] [--backend pwrite]
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QVector>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "networkdownloadstorage.h"
+
+using namespace QtNetworkRequest;
+
+namespace
+{
+    struct BenchmarkOptions
+    {
+        qint64 size;
+        int segments;
+        qint64 chunk;
+        int runs;
+        QString dir;
+    };
+
+    // Seconds to download the file through the storage, -1 on failure
+    double runOnce(StorageBackend backend, const BenchmarkOptions &options, const QByteArray &payload)
+    {
+        const QString strFilePath = QDir(options.dir).filePath(QString("storage-benchmark-%1.bin").arg(DownloadStorage::backendName(backend)));
+        QFile::remove(strFilePath);
+
+        QElapsedTimer timer;
+        timer.start();
+
+        std::unique_ptr<DownloadStorage> storage = DownloadStorage::create(backend, true);
+        if (!storage->open(strFilePath, options.size, false))
+        {
+            std::fprintf(stderr, "%s: open failed - %s\n", DownloadStorage::backendName(backend), qPrintable(storage->lastError()));
+            return -1;
+        }
+        storage->startBackgroundFlush();
+
+        // Page aligned segments, like the range splitting of a multi-threaded download
+        std::vector<std::thread> writers;
+        std::atomic<bool> bFailed(false);
+        for (int i = 0; i < options.segments; ++i)
+        {
+            const qint64 start = options.size * i / options.segments / 4096 * 4096;
+            const qint64 end = (i + 1 == options.segments) ? options.size : options.size * (i + 1) / options.segments / 4096 * 4096;
+            writers.emplace_back([&storage, &payload, &bFailed, start, end]() {
+                for (qint64 offset = start; offset < end; offset += payload.size())
+                {
+                    const qint64 size = qMin<qint64>(payload.size(), end - offset);
+                    if (storage->write(offset, payload.constData(), size) != size)
+                    {
+                        bFailed = true;
+                        return;
+                    }
+                }
+                // A finished part starts the write-back of its range
+                storage->flushRange(start, end - start);
+            });
+        }
+        for (std::thread &writer : writers)
+        {
+            writer.join();
+        }
+
+        const bool bFlushed = storage->flush();
+        const QString strError = storage->lastError();
+        storage->close();
+        const double seconds = timer.nsecsElapsed() / 1e9;
+        QFile::remove(strFilePath);
+
+        if (bFailed || !bFlushed)
+        {
+            std::fprintf(stderr, "%s: write failed - %s\n", DownloadStorage::backendName(backend), qPrintable(strError));
+            return -1;
+        }
+        return seconds;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Download storage backend benchmark");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("size", "File size in MB.", "MB", "1024"));
+    parser.addOption(QCommandLineOption("segments", "Concurrent write streams.", "count", "8"));
+    parser.addOption(QCommandLineOption("chunk", "Size of a single write in KB.", "KB", "16"));
+    parser.addOption(QCommandLineOption("runs", "Runs per backend.", "count", "3"));
+    parser.addOption(QCommandLineOption("dir", "Directory of the benchmark file.", "path", QDir::tempPath()));
+    parser.addOption(QCommandLineOption("backend", "Only this backend (mmap, windowed-mmap, pwrite, direct-io, io_uring).", "name"));
+    parser.process(app);
+
+    BenchmarkOptions options;
+    options.size = qMax<qint64>(1, parser.value("size").toLongLong()) * 1024 * 1024;
+    options.segments = qMax(1, parser.value("segments").toInt());
+    options.chunk = qMax<qint64>(1, parser.value("chunk").toLongLong()) * 1024;
+    options.runs = qMax(1, parser.value("runs").toInt());
+    options.dir = parser.value("dir");
+
+    // Not compressible and not zero pages, like a downloaded file
+    QByteArray payload(static_cast<int>(options.chunk), Qt::Uninitialized);
+    quint32 seed = 0x9E3779B9;
+    for (int i = 0; i < payload.size(); ++i)
+    {
+        seed = seed * 1664525 + 1013904223;
+        payload[i] = static_cast<char>(seed >> 24);
+    }
+
+    const QVector<StorageBackend> backends = {
+        StorageBackend::MemoryMapped,
+        StorageBackend::WindowedMemoryMapped,
+        StorageBackend::PositionalWrite,
+        StorageBackend::DirectIO,
+        StorageBackend::IoUring,
+    };
+
+    std::printf("%lld MB, %d segments, %lld KB writes, %d runs, %s\n",
+                options.size / (1024 * 1024), options.segments, options.chunk / 1024, options.runs, qPrintable(options.dir));
+    std::printf("%-16s %10s %10s %10s\n", "backend", "best s", "avg s", "avg MB/s");
+
+    int nFailed = 0;
+    for (StorageBackend backend : backends)
+    {
+        if (parser.isSet("backend") && parser.value("backend") != DownloadStorage::backendName(backend))
+        {
+            continue;
+        }
+        if (DownloadStorage::create(backend, true)->backend() != backend)
+        {
+            std::printf("%-16s %10s\n", DownloadStorage::backendName(backend), "n/a");
+            continue;
+        }
+        double best = 0;
+        double total = 0;
+        bool bOk = true;
+        for (int run = 0; run < options.runs && bOk; ++run)
+        {
+            const double seconds = runOnce(backend, options, payload);
+            bOk = seconds >= 0;
+            best = (run == 0) ? seconds : qMin(best, seconds);
+            total += seconds;
+        }
+        if (!bOk)
+        {
+            std::printf("%-16s %10s\n", DownloadStorage::backendName(backend), "failed");
+            ++nFailed;
+            continue;
+        }
+        const double average = total / options.runs;
+        std::printf("%-16s %10.3f %10.3f %10.1f\n", DownloadStorage::backendName(backend), best, average,
+                    options.size / (1024.0 * 1024.0) / average);
+    }
+    return nFailed == 0 ? 0 : 1;
+}
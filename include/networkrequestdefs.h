@@ -39,13 +39,17 @@ SOFTWARE.
 #pragma once
 
 #include <memory>
+#include <functional>
 #include <QMap>
 #include <QByteArray>
 #include <QVariant>
 #include <QNetworkCookie>
+#include <QNetworkReply>
 #include <QDateTime>
 #include <QSharedPointer>
 
+class QIODevice;
+
 #pragma pack(push, _CRT_PACKING)
 
 namespace QtNetworkRequest
@@ -75,6 +79,88 @@ namespace QtNetworkRequest
         Unknown = -1,
     };
 
+    // How asynchronous requests are executed
+    enum class ExecutionMode : int32_t
+    {
+        // Each in-flight request occupies one thread-pool thread (blocked in its own event loop)
+        ThreadPerRequest = 0,
+        // A small fixed set of network threads, each event loop drives many concurrent requests
+        EventLoop = 1,
+    };
+
+    // Scheduling priority class of a request.
+    // Queued requests of a higher class always start before those of a lower class,
+    // requests of the same class are shared fairly between sessions (see NetworkRequestManager::setSessionWeight)
+    enum class Priority : int32_t
+    {
+        Interactive = 0,
+        Normal = 1,
+        Bulk = 2,
+        Background = 3,
+    };
+
+    // Where a download writes its bytes (DownloadConfig::storageBackend)
+    enum class StorageBackend : int32_t
+    {
+        // Memory mapped for multi-threaded downloads, positional writes for single stream downloads
+        Auto = 0,
+        // The whole file mapped into memory
+        MemoryMapped = 1,
+        // Fixed size windows of the file mapped on demand, for files larger than RAM or the address space
+        WindowedMemoryMapped = 2,
+        // pwrite() at the file offset through a write-combining buffer per stream
+        PositionalWrite = 3,
+        // Positional writes bypassing the page cache (O_DIRECT / F_NOCACHE / FILE_FLAG_NO_BUFFERING)
+        DirectIO = 4,
+        // Asynchronous positional writes through io_uring (Linux, library built with QT_MTNETWORK_IO_URING, PositionalWrite otherwise)
+        IoUring = 5,
+    };
+
+    // How a GET request uses the response cache (RequestContext::Behavior::cacheMode)
+    enum class CacheMode : int32_t
+    {
+        // The cache is neither read nor written
+        NetworkOnly = 0,
+        // A fresh cached response is used without network access, a stale one is revalidated (If-None-Match / If-Modified-Since).
+        // Cacheable responses are stored
+        PreferCache = 1,
+        // Only the cached response is used, fresh or stale. Fails without network access if there is none
+        CacheOnly = 2,
+    };
+
+    // Level of a bandwidth limit (NetworkRequestManager::setBandwidthLimit), a transfer is held to every level it belongs to
+    enum class BandwidthScope : int32_t
+    {
+        Global = 0,
+        Session = 1,
+        Batch = 2,
+        Request = 3,
+    };
+
+    // Where the body of a response came from (ResponseResult::cacheStatus)
+    enum class CacheStatus : int32_t
+    {
+        // Network, the cache was not used
+        None = 0,
+        // Not in the cache, or changed on the server: the network response was used
+        Miss = 1,
+        // Cached response, no network access
+        Hit = 2,
+        // Stale cached response confirmed by the server (304 Not Modified)
+        Revalidated = 3,
+    };
+
+    // How a download was carried out (ResponseResult::downloadStrategy)
+    enum class DownloadStrategy : int32_t
+    {
+        // Not a download
+        None = 0,
+        // One request for the whole file: single channel download, a server without range support, or a small file
+        SingleStream = 1,
+        // Ranges on several channels
+        MultiThread = 2,
+    };
+
     // 任务元数据
     struct TaskData
     {
@@ -85,10 +171,37 @@ namespace QtNetworkRequest
         QDateTime createTime;
         QDateTime startTime;
         QDateTime endTime;
+        // Retries made before this attempt (RequestContext::Behavior::retryOnFailed)
+        quint16 retryCount{ 0 };
+    };
+
+    // When and how often a failed request is tried again (RequestContext::Behavior::retryOnFailed).
+    // The request gives its execution slot back while it waits, the retry is queued like a new request.
+    // A multi-threaded download retries a failed part from the first byte it is missing, the bytes on disk are kept
+    struct RetryPolicy
+    {
+        // Attempts including the first one. For a download part: attempts in a row that made no progress
+        quint16 maxAttempts{ 3 };
+        // Wait before retry n (n = 1, 2, ...): min(maxDelayMs, baseDelayMs * 2^(n-1)), shortened at random by up to jitter (0..1) of it
+        int baseDelayMs{ 500 };
+        int maxDelayMs{ 30000 };
+        double jitter{ 0.5 };
+        // Responses worth another attempt
+        QList<int> retryStatusCodes{ 408, 429, 500, 502, 503, 504 };
+        // Transport errors worth another attempt (OperationCanceledError: behavior.transferTimeout expired)
+        QList<QNetworkReply::NetworkError> retryNetworkErrors{
+            QNetworkReply::ConnectionRefusedError, QNetworkReply::RemoteHostClosedError, QNetworkReply::TimeoutError,
+            QNetworkReply::OperationCanceledError, QNetworkReply::TemporaryNetworkFailureError,
+            QNetworkReply::NetworkSessionFailedError, QNetworkReply::ProxyConnectionClosedError,
+            QNetworkReply::ProxyTimeoutError, QNetworkReply::UnknownNetworkError };
+        // 429 and 503: wait at least as long as the Retry-After header asks. A longer wait than maxRetryAfterMs is not retried
+        bool honorRetryAfter{ true };
+        int maxRetryAfterMs{ 120000 };
     };
 
     struct DownloadConfig;
     struct UploadConfig;
+    struct StreamConfig;
 
     // 请求上下文 (Input)
     struct RequestContext
@@ -111,19 +224,76 @@ namespace QtNetworkRequest
         struct Behavior
         {
             bool showProgress{ false };
-            bool retryOnFailed{ false };//TODO
+            Priority priority{ Priority::Normal };
+            // Try a failed request again according to retry
+            bool retryOnFailed{ false };
+            RetryPolicy retry;
+            // GET: response cache use (NetworkRequestManager::setCacheMemoryLimits / setCacheDirectory)
+            CacheMode cacheMode{ CacheMode::NetworkOnly };
+            // GET/HEAD posted with NetworkRequestManager::postRequest (not streamed): share the result of an identical request
+            // (method, URL, headers, cookies, cacheMode) that is already in flight instead of sending another one
+            bool coalesce{ false };
+            // Bandwidth limits of this request in bytes per second, 0 = unlimited (BandwidthScope::Request).
+            // Downloads and the file body of uploads are throttled
+            qint64 maxDownloadBytesPerSec{ 0 };
+            qint64 maxUploadBytesPerSec{ 0 };
+            // Negotiate HTTP/2 (ALPN for https, prior knowledge h2c for http: the server must speak HTTP/2 without an upgrade).
+            // Requests to the same origin run on one network thread and share its connection as parallel streams,
+            // the segments of a multi-threaded download included
+            bool http2{ false };
             quint16 maxRedirectionCount{ 3 };
             int transferTimeout{ 30000 }; // 30 seconds
         } behavior;
 
         std::unique_ptr<DownloadConfig> downloadConfig;
         std::unique_ptr<UploadConfig> uploadConfig;
+        // GET/POST/PUT/DELETE: hand the response body to a sink while it arrives (nullptr = collect it in ResponseResult::body)
+        std::unique_ptr<StreamConfig> streamConfig;
 
         // 用户自定义上下文
         QVariant userContext;
     };
     typedef std::vector<std::unique_ptr<RequestContext>> BatchRequestPtrTasks;
 
+    // Multi-threaded download: statistics of one download channel (ResponseResult::Performance::segments)
+    struct SegmentPerformance
+    {
+        int index{ 0 };
+        // Bytes downloaded by the channel over all of its ranges
+        qint64 bytes{ 0 };
+        // Time the channel was transferring
+        qint64 durationMs{ 0 };
+        double bytesPerSecond{ 0 };
+    };
+
+    // Outcome of a batch (NetworkRequestManager::batchRequestSummary / batchSummary)
+    struct BatchSummary
+    {
+        quint64 batchId{ 0 };
+        quint64 total{ 0 };
+        quint64 succeeded{ 0 };
+        quint64 failed{ 0 };
+        // Stopped before they finished (stopBatchRequests, stopRequest(s), abortBatchOnFailed)
+        quint64 cancelled{ 0 };
+        // Sum of ResponseResult::Performance::payloadBytesReceived / payloadBytesSent of the finished requests
+        qint64 payloadBytesReceived{ 0 };
+        qint64 payloadBytesSent{ 0 };
+        // Submitted until the last request finished or the batch was stopped
+        qint64 wallTimeMs{ 0 };
+    };
+
+    // Requests to stop with NetworkRequestManager::stopRequests, an empty criterion matches every request
+    struct RequestFilter
+    {
+        quint64 sessionId{ 0 };
+        // Case-insensitive
+        QString host;
+        // Matched against RequestContext::url as posted
+        QString urlPrefix;
+        QList<RequestType> types;
+        QList<Priority> priorities;
+    };
+
     // 响应结果 (Output)
     struct ResponseResult
     {
@@ -132,6 +302,8 @@ namespace QtNetworkRequest
         QString errorMessage;
         QByteArray body;
         QMap<QByteArray, QByteArray> headers;
+        CacheStatus cacheStatus{ CacheStatus::None };
+        DownloadStrategy downloadStrategy{ DownloadStrategy::None };
 
         TaskData task;
 
@@ -139,11 +311,38 @@ namespace QtNetworkRequest
         QVariant userContext;
 
         // 性能统计
+        // Times are measured with a monotonic clock in milliseconds, -1 = the phase did not happen or could not be measured
         struct Performance
         {
+            // Execution on the worker thread (started -> result emitted), redirects included
             quint64 durationMs{ 0 };
-            qint64 bytesReceived{ 0 };//TODO
-            qint64 bytesSent{ 0 };//TODO
+            // Requests scheduled ahead of this one when it was queued
+            quint64 queuePosition{ 0 };
+            // Time spent waiting for an execution slot (submitted -> started)
+            quint64 queueWaitMs{ 0 };
+            // Network phases of the last reply (the final one after redirects).
+            // Connection setup until the TLS handshake completed: DNS lookup + TCP connect + TLS. Only measured for HTTPS
+            // on a new connection, -1 for plain HTTP (QNetworkAccessManager of Qt 5 reports no connection event) and for
+            // a reused connection (see connectionReused)
+            qint64 connectMs{ -1 };
+            // Request issued until the response headers arrived, includes connectMs
+            qint64 timeToFirstByteMs{ -1 };
+            // Response headers until the last byte
+            qint64 transferMs{ -1 };
+            // Result emitted on the worker thread until it was handled on the main thread
+            qint64 deliveryMs{ -1 };
+            // Body bytes of all replies including redirects as QNetworkReply hands them out: after content decoding,
+            // without headers, chunked framing and TLS. Not the bytes on the wire
+            qint64 payloadBytesReceived{ 0 };
+            qint64 payloadBytesSent{ 0 };
+            quint16 redirectCount{ 0 };
+            // The last reply went over an already open connection (keep-alive): 1 = reused, 0 = new connection,
+            // -1 = unknown (plain HTTP, or no response headers arrived)
+            int connectionReused{ -1 };
+            // The last reply was an HTTP/2 stream
+            bool http2{ false };
+            // Multi-threaded download: one entry per download channel
+            QList<SegmentPerformance> segments;
         } performance;
     };
 
@@ -153,7 +352,38 @@ namespace QtNetworkRequest
         QString saveFileName;
         QString saveDir;
         bool overwriteFile{ false };
-        quint16 threadCount{ 0 }; // 0 = auto detect CPU cores
+        // Channels (connections) of a multi-threaded download, 0 = auto detect CPU cores. Spread over several network
+        // managers so that all of them run at once (one manager opens 6 connections per host) and the socket/TLS work uses
+        // several threads; with behavior.http2 they are streams of one connection instead
+        quint16 threadCount{ 0 };
+        // Keep the partial file ("<file>.download") and a journal of the downloaded ranges when the download is
+        // stopped or fails, a later request for the same url and destination only fetches the missing bytes
+        bool resumable{ false };
+        // Multi-threaded download: a channel that finishes early takes over the tail of the slowest channel.
+        // Ranges smaller than this are not split any further
+        qint64 minSegmentSize{ 1024 * 1024 };
+        // Multi-threaded download: range boundaries are aligned to this many bytes (0 = system page size)
+        qint64 segmentAlignment{ 0 };
+        // Multi-threaded download: smaller files are downloaded as a single stream (0 = always split)
+        qint64 minMultiThreadSize{ 4 * 1024 * 1024 };
+        // How the file is written to disk, see StorageBackend
+        StorageBackend storageBackend{ StorageBackend::Auto };
+    };
+
+    // 流式响应配置
+    // The body of a successful response is delivered chunk by chunk, ResponseResult::body stays empty and the result
+    // only carries the headers and the statistics. A failed request may have delivered part of the body already.
+    struct StreamConfig
+    {
+        // Called on the request's worker thread for every received chunk, data is only valid during the call.
+        // Return false to abort the request
+        std::function<bool(const char *data, qint64 size)> onData;
+        // Used if onData is not set: the chunks are written to this open device on the request's worker thread.
+        // Not owned, it must outlive the request and not be used by other threads meanwhile.
+        // A device with pending output (e.g. a socket) holds the reading back until it caught up
+        QIODevice *device{ nullptr };
+        // Bytes read ahead of the sink (QNetworkReply::setReadBufferSize), the connection is not read while they are pending
+        qint64 readBufferSize{ 256 * 1024 };
     };
 
     // 上传配置
@@ -172,5 +402,6 @@ namespace QtNetworkRequest
     };
 }
 Q_DECLARE_METATYPE(QSharedPointer<QtNetworkRequest::ResponseResult>);
+Q_DECLARE_METATYPE(QtNetworkRequest::BatchSummary);
 
 #pragma pack(pop)
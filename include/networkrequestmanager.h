@@ -45,7 +45,6 @@ SOFTWARE.
 #include "networkrequestglobal.h"
 #include <memory>
 
-class QEvent;
 class NetworkRequestManagerPrivate;
 
 namespace QtNetworkRequest
@@ -71,7 +70,8 @@ namespace QtNetworkRequest
 		// Asynchronously execute single request task (returns nullptr if url is invalid)
 		std::shared_ptr<NetworkReply> postRequest(std::unique_ptr<RequestContext> context);
 
-		// Asynchronously execute batch request tasks (requests in same batch will be bound to same NetworkReply)
+		// Asynchronously execute batch request tasks (requests in same batch will be bound to same NetworkReply).
+		// The tasks are queued as they are, each one gets its runnable once an execution slot is free for it
 		std::shared_ptr<NetworkReply> postBatchRequest(BatchRequestPtrTasks&& tasks, quint64 &uiBatchId);
 
 		// Synchronously execute single request task (returns false if url is invalid or no idle thread to handle)
@@ -82,27 +82,70 @@ namespace QtNetworkRequest
 		void stopAllRequest();
 		// Stop batch request tasks with specified batchid (async requests only)
 		void stopBatchRequests(quint64 uiBatchId);
-		// Stop specific request task (async requests only)
+		// Stop specific request task (async requests only), a batch member stops alone
 		void stopRequest(quint64 uiTaskId);
-		// Stop all requests of specific session (async requests only)
+		// Stop all requests of specific session (async requests only), each one gets a cancelled result
 		void stopSessionRequest(quint64 uiSessionId);
+		// Stop the unfinished requests matching the filter (async requests only), each one gets a cancelled result.
+		// Returns the number of requests stopped
+		int stopRequests(const RequestFilter &filter);
 
 	public:
 		// Set maximum thread count for thread pool (1-100, default is system CPU core count)
+		// Only applies to ExecutionMode::ThreadPerRequest
 		bool setMaxThreadCount(int iMax);
 		int maxThreadCount();
 
+		// Set how async requests are executed (default is ExecutionMode::ThreadPerRequest). Only affects requests posted afterwards.
+		// nThreadCount: number of network threads of ExecutionMode::EventLoop (0 = system CPU core count),
+		// takes effect when the network threads are first created.
+		// Requests with behavior.http2 run on the network threads in either mode, pinned to a thread per origin
+		void setExecutionMode(ExecutionMode mode, int nThreadCount = 0);
+		ExecutionMode executionMode();
+
+		// Maximum number of requests executing at the same time in ExecutionMode::EventLoop
+		// (0 = 256 per network thread). Requests beyond that wait in the priority queue
+		bool setMaxConcurrentRequests(int iMax);
+		int maxConcurrentRequests();
+
+		// Relative share of execution slots of a session among queued requests of the same priority (default 1, 0 = reset)
+		// e.g. a session with weight 3 gets three times the slots of a session with weight 1 when both have requests waiting
+		void setSessionWeight(quint64 uiSessionId, quint32 uiWeight);
+
+		// Progress signals of requests with behavior.showProgress: the transfer counters of all requests are sampled
+		// every nIntervalMs (default 100), a request is reported when it moved by at least nMinBytes since its last report
+		// or reached its total. Batch progress is reported at most once per interval
+		void setProgressInterval(int nIntervalMs, qint64 nMinBytes = 0);
+
+		// Response cache of GET requests with behavior.cacheMode other than CacheMode::NetworkOnly, shared by all threads.
+		// Memory tier: nMaxBytes in total (default 8 MB), bodies up to nMaxEntryBytes (default 64 KB)
+		void setCacheMemoryLimits(qint64 nMaxBytes, qint64 nMaxEntryBytes);
+		// Disk tier for the larger bodies (disabled by default, empty strDirectory disables it). Returns false if the directory is not usable
+		bool setCacheDirectory(const QString &strDirectory, qint64 nMaxBytes = 256 * 1024 * 1024);
+		// Drop the cached responses and the remembered permanent redirects
+		void clearCache();
+
+		// Bandwidth limits in bytes per second (0 = unlimited) of downloads and file uploads, changeable at any time.
+		// A transfer is held to the global limit and to those of its session, batch and request (uiId ignored for Global).
+		// The limits of a request or batch are dropped when it finishes
+		void setBandwidthLimit(BandwidthScope scope, quint64 uiId, qint64 nDownloadBytesPerSec, qint64 nUploadBytesPerSec);
+		// Rate shared by Priority::Background transfers while other transfers are moving data (default 8 KB/s, 0 = pause them)
+		void setBackgroundBandwidth(qint64 nBytesPerSec);
+
 		quint64 nextSessionId();
 
+		// Counters of a batch in progress (batchId is 0 if the batch is unknown or already finished)
+		BatchSummary batchSummary(quint64 uiBatchId);
+
 	Q_SIGNALS:
 		void errorMessage(const QString &error);
 		void batchRequestFinished(quint64 uiBatchId, bool bAllSuccess);
+		// Final counters of a batch, once all of its requests finished or it was stopped
+		void batchRequestSummary(const QtNetworkRequest::BatchSummary &summary);
 
 	public Q_SLOTS:
 		void onResponse(QSharedPointer<QtNetworkRequest::ResponseResult> rsp);
-
-	public:
-		bool event(QEvent *pEvent) Q_DECL_OVERRIDE;
+		void onRetry(quint64 uiRequestId, qint64 nDelayMs);
 
 	private:
 		explicit NetworkRequestManager(QObject *parent = 0);
@@ -115,10 +158,6 @@ namespace QtNetworkRequest
 
 		bool startAsRunnable(std::unique_ptr<RequestContext> request);
 
-		// bDownload(false: upload)
-		void updateProgress(quint64 uiRequestId, quint64 uiBatchId,
-							qint64 iBytes, qint64 iTotalBytes, bool bDownload);
-
 	private:
 		QScopedPointer<NetworkRequestManagerPrivate> d_ptr;
 
@@ -549,6 +549,8 @@ std::unique_ptr<QtNetworkRequest::RequestContext> QtNetworkRequest::NetworkDownl
     req->downloadConfig->saveDir = m_downloadDir;
     req->downloadConfig->overwriteFile = true;
     req->downloadConfig->threadCount = m_maxThreads;
+    // Pausing stops the request, resuming posts it again and continues where it stopped
+    req->downloadConfig->resumable = true;
     req->behavior.showProgress = true;
     req->behavior.retryOnFailed = true;
     return req;
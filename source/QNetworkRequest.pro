@@ -30,7 +30,18 @@ HEADERS += $$PWD/../include/networkrequestglobal.h \
            networkuploadrequest.h \
            networkcommonrequest.h \
            networkrequestrunnable.h \
-           networkrequestutility.h
+           networkrequestutility.h \
+           networkaccessmanagerpool.h \
+           networkeventlooppool.h \
+           networkrequestscheduler.h \
+           networkprogresstracker.h \
+           networkdownloadjournal.h \
+           networkdownloadstorage.h \
+           networkresponsecache.h \
+           networkprobecache.h \
+           networkredirectcache.h \
+           networkrequestregistry.h \
+           networkbandwidthlimiter.h
 
 SOURCES += networkrequest.cpp \
            networkcommonrequest.cpp \
@@ -41,8 +52,24 @@ SOURCES += networkrequest.cpp \
            networkreply.cpp \
            networkrequestmanager.cpp \
            networkrequestutility.cpp \
+           networkaccessmanagerpool.cpp \
+           networkeventlooppool.cpp \
+           networkrequestscheduler.cpp \
+           networkprogresstracker.cpp \
+           networkdownloadjournal.cpp \
+           networkdownloadstorage.cpp \
+           networkresponsecache.cpp \
+           networkprobecache.cpp \
+           networkredirectcache.cpp \
+           networkbandwidthlimiter.cpp \
            memorymappedfile.cpp
 
+# Optional io_uring storage backend: qmake CONFIG+=io_uring (Linux, requires liburing)
+linux:io_uring {
+    DEFINES += QT_MTNETWORK_IO_URING
+    LIBS += -luring
+}
+
 # Qt version compatibility
 greaterThan(QT_MAJOR_VERSION, 4) {
     TARGET_ARCH=$${QT_ARCH}
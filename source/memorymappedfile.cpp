@@ -1,6 +1,11 @@
 #include "memorymappedfile.h"
+#include "networkdownloadstorage.h"
 #include <QDebug>
 #include <QDir>
+#include <chrono>
+
+// Granularity of the dirty range tracking, a multiple of every page size in use
+#define DIRTY_CHUNK_SIZE (1024 * 1024)
 
 namespace QtNetworkRequest {
 
@@ -14,6 +19,8 @@ MemoryMappedFile::MemoryMappedFile(QObject *parent)
 #endif
     , m_mappedData(nullptr)
     , m_fileSize(0)
+    , m_dirtyWords(0)
+    , m_bStopFlusher(false)
 {
 }
 
@@ -22,7 +29,7 @@ MemoryMappedFile::~MemoryMappedFile()
     close();
 }
 
-bool MemoryMappedFile::open(const QString &filePath, qint64 size)
+bool MemoryMappedFile::open(const QString &filePath, qint64 size, bool keepContent)
 {
     QMutexLocker locker(&m_mutex);
 
@@ -54,7 +61,7 @@ bool MemoryMappedFile::open(const QString &filePath, qint64 size)
         GENERIC_READ | GENERIC_WRITE,
         FILE_SHARE_READ | FILE_SHARE_WRITE,
         nullptr,
-        CREATE_ALWAYS,
+        keepContent ? OPEN_ALWAYS : CREATE_ALWAYS,
         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
         nullptr
     );
@@ -110,7 +117,7 @@ bool MemoryMappedFile::open(const QString &filePath, qint64 size)
     // Linux/macOS implementation
     m_fileDescriptor = ::open(
         filePath.toUtf8().constData(),
-        O_RDWR | O_CREAT | O_TRUNC,
+        O_RDWR | O_CREAT | (keepContent ? 0 : O_TRUNC),
         0666
     );
 
@@ -146,12 +153,22 @@ bool MemoryMappedFile::open(const QString &filePath, qint64 size)
 
 #endif
 
+    m_dirtyWords = ((size + DIRTY_CHUNK_SIZE - 1) / DIRTY_CHUNK_SIZE + 63) / 64;
+    m_dirtyChunks.reset(new std::atomic<quint64>[m_dirtyWords]);
+    m_writingChunks.reset(new quint64[m_dirtyWords]());
+    for (qint64 i = 0; i < m_dirtyWords; ++i) {
+        m_dirtyChunks[i].store(0, std::memory_order_relaxed);
+    }
+
     qDebug() << "[MemoryMappedFile] Successfully mapped file:" << filePath << "size:" << size;
     return true;
 }
 
 void MemoryMappedFile::close()
 {
+    // Outside the lock, the flusher takes it
+    stopBackgroundFlush();
+
     QMutexLocker locker(&m_mutex);
 
     if (!isOpen()) {
@@ -187,15 +204,20 @@ void MemoryMappedFile::close()
 
     m_filePath.clear();
     m_fileSize = 0;
-    m_lastError.clear();
+    m_dirtyChunks.reset();
+    m_writingChunks.reset();
+    m_dirtyWords = 0;
+    {
+        QMutexLocker errorLocker(&m_errorMutex);
+        m_lastError.clear();
+    }
 
     qDebug() << "[MemoryMappedFile] File closed";
 }
 
 qint64 MemoryMappedFile::write(qint64 offset, const char *data, qint64 size)
 {
-    QMutexLocker locker(&m_mutex);
-
+    // No lock: every segment writes its own range, only the dirty bits are shared (atomic)
     if (!isOpen() || m_mappedData == nullptr) {
         setLastError(QString("File operation error: File is not open or has been closed"));
         return -1;
@@ -217,6 +239,7 @@ qint64 MemoryMappedFile::write(qint64 offset, const char *data, qint64 size)
 
     // Write directly to memory mapped area
     memcpy(m_mappedData + offset, data, size);
+    markDirty(offset, size);
 
     return size;
 }
@@ -259,12 +282,150 @@ bool MemoryMappedFile::flush()
         return false;
     }
 
+    // Everything is flushed, forget the dirty chunks
+    for (qint64 i = 0; i < m_dirtyWords; ++i) {
+        m_dirtyChunks[i].store(0, std::memory_order_relaxed);
+        m_writingChunks[i] = 0;
+    }
+    return syncRange(0, m_fileSize, true);
+}
+
+bool MemoryMappedFile::flushRange(qint64 offset, qint64 size, bool wait)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!isOpen() || m_mappedData == nullptr) {
+        setLastError(QString("File operation error: File is not open or has been closed"));
+        return false;
+    }
+    if (offset < 0 || size <= 0 || offset >= m_fileSize) {
+        return true;
+    }
+    return syncRange(offset, qMin(size, m_fileSize - offset), wait);
+}
+
+bool MemoryMappedFile::flushDirty(bool wait)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!isOpen() || m_mappedData == nullptr) {
+        return false;
+    }
+
+    // Coalesce consecutive dirty chunks into one write-back
+    bool bRet = true;
+    auto flushRun = [this, wait, &bRet](qint64 first, qint64 last) {
+        if (!syncRange(first * DIRTY_CHUNK_SIZE, (last - first) * DIRTY_CHUNK_SIZE, wait)) {
+            // Still not on disk, the next flush tries again
+            markDirty(first * DIRTY_CHUNK_SIZE, (last - first) * DIRTY_CHUNK_SIZE);
+            bRet = false;
+        }
+    };
+    qint64 runStart = -1;
+    qint64 runEnd = -1;
+    for (qint64 word = 0; word < m_dirtyWords; ++word) {
+        // A write racing with the exchange sets its bit again and is flushed next time
+        quint64 bits = m_dirtyChunks[word].exchange(0, std::memory_order_acq_rel);
+        if (wait) {
+            // Chunks whose write-back was only started are not on disk yet either
+            bits |= m_writingChunks[word];
+            m_writingChunks[word] = 0;
+        } else {
+            m_writingChunks[word] |= bits;
+        }
+        for (int bit = 0; bits != 0 && bit < 64; ++bit) {
+            if (!(bits & (quint64(1) << bit))) {
+                continue;
+            }
+            const qint64 chunk = word * 64 + bit;
+            if (runEnd == chunk) {
+                runEnd = chunk + 1;
+                continue;
+            }
+            if (runStart >= 0) {
+                flushRun(runStart, runEnd);
+            }
+            runStart = chunk;
+            runEnd = chunk + 1;
+        }
+    }
+    if (runStart >= 0) {
+        flushRun(runStart, runEnd);
+    }
+    return bRet;
+}
+
+void MemoryMappedFile::startBackgroundFlush(int intervalMs)
+{
+    if (m_flusher.joinable() || intervalMs <= 0) {
+        return;
+    }
+
+    m_bStopFlusher = false;
+    m_flusher = std::thread([this, intervalMs]() {
+        std::unique_lock<std::mutex> lock(m_flusherMutex);
+        while (!m_flusherCondition.wait_for(lock, std::chrono::milliseconds(intervalMs), [this]() { return m_bStopFlusher; })) {
+            lock.unlock();
+            flushDirty(false);
+            lock.lock();
+        }
+    });
+}
+
+void MemoryMappedFile::stopBackgroundFlush()
+{
+    if (!m_flusher.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_flusherMutex);
+        m_bStopFlusher = true;
+    }
+    m_flusherCondition.notify_all();
+    m_flusher.join();
+}
+
+void MemoryMappedFile::markDirty(qint64 offset, qint64 size)
+{
+    if (!m_dirtyChunks || size <= 0) {
+        return;
+    }
+    const qint64 first = offset / DIRTY_CHUNK_SIZE;
+    const qint64 last = (offset + size - 1) / DIRTY_CHUNK_SIZE;
+    for (qint64 chunk = first; chunk <= last; ++chunk) {
+        std::atomic<quint64> &word = m_dirtyChunks[chunk / 64];
+        const quint64 mask = quint64(1) << (chunk % 64);
+        // Most writes land in a chunk that is already dirty, skip the read-modify-write then
+        if (!(word.load(std::memory_order_relaxed) & mask)) {
+            word.fetch_or(mask, std::memory_order_release);
+        }
+    }
+}
+
+bool MemoryMappedFile::syncRange(qint64 offset, qint64 size, bool wait)
+{
+    if (offset >= m_fileSize || size <= 0) {
+        return true;
+    }
+    size = qMin(size, m_fileSize - offset);
+
 #ifdef _WIN32
-    // Windows syncs automatically, but we can force flush
-    return FlushViewOfFile(m_mappedData, m_fileSize) != FALSE;
+    // FlushViewOfFile starts the write-back, FlushFileBuffers waits for the disk
+    if (!FlushViewOfFile(m_mappedData + offset, static_cast<SIZE_T>(size))) {
+        return false;
+    }
+    return !wait || FlushFileBuffers(m_fileHandle) != FALSE;
 #else
-    // Linux/macOS sync to disk
-    return msync(m_mappedData, m_fileSize, MS_SYNC) == 0;
+    // msync needs a page aligned address
+    const qint64 alignedOffset = offset - offset % pageSize();
+    const qint64 alignedSize = size + (offset - alignedOffset);
+#ifdef __linux__
+    if (!wait) {
+        // msync(MS_ASYNC) is a no-op on Linux, start the write-back of the range explicitly
+        return sync_file_range(m_fileDescriptor, alignedOffset, alignedSize, SYNC_FILE_RANGE_WRITE) == 0;
+    }
+#endif
+    return msync(m_mappedData + alignedOffset, alignedSize, wait ? MS_SYNC : MS_ASYNC) == 0;
 #endif
 }
 
@@ -280,6 +441,7 @@ qint64 MemoryMappedFile::size() const
 
 QString MemoryMappedFile::lastError() const
 {
+    QMutexLocker locker(&m_errorMutex);
     return m_lastError;
 }
 
@@ -290,33 +452,12 @@ void* MemoryMappedFile::getMappedData() const
 
 qint64 MemoryMappedFile::writeUnsafe(qint64 offset, const char *data, qint64 size)
 {
-    // No locking for performance - caller must ensure thread safety
-    
-    if (!isOpen() || m_mappedData == nullptr) {
-        return -1;
-    }
-
-    if (offset < 0 || offset >= m_fileSize) {
-        return -1;
-    }
-
-    if (size <= 0) {
-        return 0;
-    }
-
-    // Check if exceeding file range
-    if (offset + size > m_fileSize) {
-        size = m_fileSize - offset;
-    }
-
-    // Write directly to memory mapped area (no lock)
-    memcpy(m_mappedData + offset, data, size);
-
-    return size;
+    return write(offset, data, size);
 }
 
 void MemoryMappedFile::setLastError(const QString &error) const
 {
+    QMutexLocker locker(&m_errorMutex);
     m_lastError = error;
     qWarning() << "[MemoryMappedFile] Error:" << error;
 }
@@ -354,34 +495,31 @@ QString MemoryMappedFile::systemErrorString() const
 #endif
 }
 
-bool MemoryMappedFile::preallocateFile(qint64 size)
+qint64 MemoryMappedFile::pageSize()
 {
 #ifdef _WIN32
-    LARGE_INTEGER li;
-    li.QuadPart = size;
-    if (!SetFilePointerEx(m_fileHandle, li, nullptr, FILE_BEGIN)) {
-        setLastError(systemErrorString());
-        return false;
-    }
-
-    if (!SetEndOfFile(m_fileHandle)) {
-        setLastError(systemErrorString());
-        return false;
-    }
-
-    // Reset file pointer to beginning
-    li.QuadPart = 0;
-    SetFilePointerEx(m_fileHandle, li, nullptr, FILE_BEGIN);
-
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return static_cast<qint64>(info.dwPageSize);
 #else
-    // Linux/macOS: Use ftruncate to pre-allocate space
-    if (ftruncate(m_fileDescriptor, size) == -1) {
-        setLastError(systemErrorString());
-        return false;
-    }
+    long size = sysconf(_SC_PAGESIZE);
+    return size > 0 ? static_cast<qint64>(size) : 4096;
 #endif
+}
 
-    return true;
+bool MemoryMappedFile::preallocateFile(qint64 size)
+{
+    // Allocate the blocks instead of a sparse file: a full disk fails here rather than with a fault writing to the mapping
+    QString error;
+#ifdef _WIN32
+    const bool bRet = allocateFileSpace(m_fileHandle, size, error);
+#else
+    const bool bRet = allocateFileSpace(m_fileDescriptor, size, error);
+#endif
+    if (!bRet) {
+        setLastError(error);
+    }
+    return bRet;
 }
 
 } // namespace QtNetworkRequest
\ No newline at end of file
@@ -4,6 +4,11 @@
 #include <QString>
 #include <QFile>
 #include <QMutex>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -22,7 +27,7 @@ namespace QtNetworkRequest
      * @brief Cross-platform memory mapped file wrapper class
      *
      * Features:
-     * 1. Thread-safe read/write operations
+     * 1. Lock-free writes to disjoint ranges (one writer per range), dirty ranges tracked per chunk
      * 2. Support for large files (>4GB)
      * 3. Automatic file pre-allocation
      * 4. Cross-platform compatibility
@@ -40,9 +45,10 @@ namespace QtNetworkRequest
          * @brief Open or create memory mapped file
          * @param filePath File path
          * @param size File size (bytes)
+         * @param keepContent Keep the existing content of the file (resume a download) instead of truncating it
          * @return Success status
          */
-        bool open(const QString &filePath, qint64 size);
+        bool open(const QString &filePath, qint64 size, bool keepContent = false);
 
         /**
          * @brief Close memory mapped file
@@ -50,7 +56,8 @@ namespace QtNetworkRequest
         void close();
 
         /**
-         * @brief Write data to specified position
+         * @brief Write data to specified position. Lock-free: concurrent writers must write disjoint ranges,
+         *        and the file must not be closed while writing
          * @param offset File offset
          * @param data Data pointer
          * @param size Data size
@@ -68,11 +75,34 @@ namespace QtNetworkRequest
         qint64 read(qint64 offset, char *data, qint64 size) const;
 
         /**
-         * @brief Flush memory mapping to disk
+         * @brief Flush the whole memory mapping to disk and wait for it
          * @return Success status
          */
         bool flush();
 
+        /**
+         * @brief Flush a range of the mapping
+         * @param offset File offset
+         * @param size Range size
+         * @param wait Wait until the data is on disk, otherwise only start the write-back
+         * @return Success status
+         */
+        bool flushRange(qint64 offset, qint64 size, bool wait = false);
+
+        /**
+         * @brief Flush only the chunks written since the last flush
+         * @param wait Wait until the data is on disk, otherwise only start the write-back
+         * @return Success status
+         */
+        bool flushDirty(bool wait = false);
+
+        /**
+         * @brief Start the write-back of dirty chunks from a background thread every interval,
+         *        so the page cache never piles up a whole file of dirty pages. Stopped by close()
+         * @param intervalMs Flush interval (milliseconds)
+         */
+        void startBackgroundFlush(int intervalMs = 500);
+
         /**
          * @brief Check if file is opened
          * @return Whether file is opened
@@ -97,13 +127,26 @@ namespace QtNetworkRequest
          */
         void *getMappedData() const;
 
+        /**
+         * @brief Record data written in place through getMappedData(), so the dirty range flushes cover it
+         * @param offset File offset
+         * @param size Data size
+         */
+        void markWritten(qint64 offset, qint64 size) { markDirty(offset, size); }
+
+        /**
+         * @brief Get system memory page size
+         * @return Page size (bytes), used to keep concurrent writers on separate pages
+         */
+        static qint64 pageSize();
+
         /**
          * @brief Write data without locking (for internal use by buffers)
          * @param offset File offset
          * @param data Data pointer
          * @param size Data size
          * @return Actual bytes written
-         * @warning This method is not thread-safe and should only be used by coordinated buffers
+         * @note Same as write(), which no longer takes a lock
          */
         qint64 writeUnsafe(qint64 offset, const char *data, qint64 size);
 
@@ -122,8 +165,26 @@ namespace QtNetworkRequest
         QString m_filePath;
         qint64 m_fileSize;
         mutable QString m_lastError;
+        mutable QMutex m_errorMutex;
+        // Serializes open/close/flush, never taken by write()
         mutable QMutex m_mutex;
 
+        // One bit per DIRTY_CHUNK_SIZE bytes, set by write() and cleared by the flushes
+        std::unique_ptr<std::atomic<quint64>[]> m_dirtyChunks;
+        // Chunks whose write-back a flushDirty(false) started, a waiting flush still waits for them (m_mutex)
+        std::unique_ptr<quint64[]> m_writingChunks;
+        qint64 m_dirtyWords;
+
+        std::thread m_flusher;
+        std::mutex m_flusherMutex;
+        std::condition_variable m_flusherCondition;
+        bool m_bStopFlusher;
+
+        void markDirty(qint64 offset, qint64 size);
+        // Write back [offset, offset + size) of the mapping (m_mutex held)
+        bool syncRange(qint64 offset, qint64 size, bool wait);
+        void stopBackgroundFlush();
+
         /**
          * @brief Set error message
          * @param error Error message
@@ -0,0 +1,56 @@
+#include "networkaccessmanagerpool.h"
+#include <atomic>
+#include <vector>
+#include <QThreadStorage>
+#include <QNetworkAccessManager>
+
+using namespace QtNetworkRequest;
+
+namespace
+{
+    std::atomic<int> s_nManagerCount{ 0 };
+
+    // Owned by QThreadStorage, deleted when the owning thread exits
+    class ThreadLocalNetworkManager
+    {
+    public:
+        ~ThreadLocalNetworkManager()
+        {
+            for (QNetworkAccessManager *pManager : m_managers)
+            {
+                delete pManager;
+                --s_nManagerCount;
+            }
+            m_managers.clear();
+        }
+
+        QNetworkAccessManager *manager(int nIndex)
+        {
+            while (static_cast<int>(m_managers.size()) <= nIndex)
+            {
+                m_managers.push_back(new QNetworkAccessManager);
+                ++s_nManagerCount;
+            }
+            return m_managers[nIndex];
+        }
+
+    private:
+        std::vector<QNetworkAccessManager *> m_managers;
+    };
+
+    QThreadStorage<ThreadLocalNetworkManager *> s_threadManagers;
+}
+
+QNetworkAccessManager *NetworkAccessManagerPool::threadLocalManager(int nIndex)
+{
+    if (!s_threadManagers.hasLocalData())
+    {
+        s_threadManagers.setLocalData(new ThreadLocalNetworkManager);
+    }
+    return s_threadManagers.localData()->manager(qMax(0, nIndex));
+}
+
+int NetworkAccessManagerPool::managerCount()
+{
+    return s_nManagerCount.load(std::memory_order_relaxed);
+}
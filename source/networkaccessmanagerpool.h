@@ -0,0 +1,30 @@
+#pragma once
+
+#include <QtGlobal>
+
+class QNetworkAccessManager;
+
+namespace QtNetworkRequest
+{
+    // Long-lived QNetworkAccessManager per worker thread.
+    // Every request executed on the same worker thread shares one manager, so that
+    // keep-alive connections, the host lookup cache and TLS sessions are reused
+    // instead of being rebuilt for each request.
+    // The segments of a multi-threaded download are spread over further managers of the thread,
+    // kept as well so that the next download reuses their connections.
+    // The managers are owned by the thread and destroyed when the thread exits.
+    class NetworkAccessManagerPool
+    {
+    public:
+        // Get the manager nIndex of the calling thread (created on first use), 0 is the one shared by every request
+        static QNetworkAccessManager *threadLocalManager(int nIndex = 0);
+
+        // Number of managers currently alive
+        static int managerCount();
+
+    private:
+        NetworkAccessManagerPool() {}
+        NetworkAccessManagerPool(const NetworkAccessManagerPool &) = delete;
+        NetworkAccessManagerPool &operator=(const NetworkAccessManagerPool &) = delete;
+    };
+}
@@ -0,0 +1,338 @@
+#include "networkbandwidthlimiter.h"
+#include <QMutexLocker>
+#include <cmath>
+
+using namespace QtNetworkRequest;
+
+// Foreground traffic counts as active for this long after its last quota
+#define BACKGROUND_YIELD_MS 500
+#define DEFAULT_BACKGROUND_RATE (8 * 1024)
+// Read buffer of the replies of throttled transfers
+#define THROTTLED_READ_BUFFER_SIZE (64 * 1024)
+
+BandwidthPath BandwidthPath::of(const RequestContext &context)
+{
+    BandwidthPath path;
+    path.requestId = context.task.id;
+    path.sessionId = context.task.sessionId;
+    path.batchId = context.task.batchId;
+    path.background = context.behavior.priority == Priority::Background;
+    return path;
+}
+
+void NetworkBandwidthLimiter::Bucket::refill(qint64 nNowNs)
+{
+    if (nLastNs < 0)
+    {
+        dTokens = capacity();
+    }
+    else if (nNowNs > nLastNs)
+    {
+        dTokens = qMin(capacity(), dTokens + static_cast<double>(nRate) * (nNowNs - nLastNs) / 1e9);
+    }
+    nLastNs = nNowNs;
+}
+
+NetworkBandwidthLimiter *NetworkBandwidthLimiter::globalInstance()
+{
+    static NetworkBandwidthLimiter s_instance;
+    return &s_instance;
+}
+
+NetworkBandwidthLimiter::NetworkBandwidthLimiter()
+    : m_nLimits(0), m_nBackgroundRate(DEFAULT_BACKGROUND_RATE)
+{
+    m_clock.start();
+    m_nForegroundNs[Download] = -1;
+    m_nForegroundNs[Upload] = -1;
+    m_background[Download].nRate = DEFAULT_BACKGROUND_RATE;
+    m_background[Upload].nRate = DEFAULT_BACKGROUND_RATE;
+}
+
+void NetworkBandwidthLimiter::setLimit(BandwidthScope scope, quint64 uiId, Direction direction, qint64 nBytesPerSec)
+{
+    if (scope == BandwidthScope::Global)
+    {
+        uiId = 0;
+    }
+    QMutexLocker locker(&m_mutex);
+    QHash<quint64, Bucket> &buckets = m_mapBuckets[static_cast<int>(scope)][direction];
+    auto iter = buckets.find(uiId);
+    if (nBytesPerSec <= 0)
+    {
+        if (iter != buckets.end())
+        {
+            buckets.erase(iter);
+            --m_nLimits;
+        }
+        return;
+    }
+    if (iter == buckets.end())
+    {
+        iter = buckets.insert(uiId, Bucket());
+        ++m_nLimits;
+    }
+    // Tokens on hand are kept, capped by the new burst allowance
+    iter.value().refill(m_clock.nsecsElapsed());
+    iter.value().nRate = nBytesPerSec;
+    iter.value().dTokens = qMin(iter.value().dTokens, iter.value().capacity());
+}
+
+qint64 NetworkBandwidthLimiter::limit(BandwidthScope scope, quint64 uiId, Direction direction) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_mapBuckets[static_cast<int>(scope)][direction].value(scope == BandwidthScope::Global ? 0 : uiId).nRate;
+}
+
+void NetworkBandwidthLimiter::setBackgroundRate(qint64 nBytesPerSec)
+{
+    QMutexLocker locker(&m_mutex);
+    m_nBackgroundRate = qMax<qint64>(0, nBytesPerSec);
+    for (Bucket &bucket : m_background)
+    {
+        bucket.nRate = m_nBackgroundRate;
+        bucket.dTokens = qMin(bucket.dTokens, bucket.capacity());
+    }
+}
+
+qint64 NetworkBandwidthLimiter::backgroundRate() const
+{
+    return m_nBackgroundRate;
+}
+
+void NetworkBandwidthLimiter::remove(BandwidthScope scope, quint64 uiId)
+{
+    if (m_nLimits.load(std::memory_order_relaxed) == 0)
+    {
+        return;
+    }
+    QMutexLocker locker(&m_mutex);
+    for (QHash<quint64, Bucket> &buckets : m_mapBuckets[static_cast<int>(scope)])
+    {
+        if (buckets.remove(uiId) > 0)
+        {
+            --m_nLimits;
+        }
+    }
+}
+
+bool NetworkBandwidthLimiter::isForegroundActive(Direction direction, qint64 nNowNs) const
+{
+    const qint64 nLastNs = m_nForegroundNs[direction].load(std::memory_order_relaxed);
+    return nLastNs >= 0 && nNowNs - nLastNs < BACKGROUND_YIELD_MS * 1000000LL;
+}
+
+bool NetworkBandwidthLimiter::collect(const BandwidthPath &path, Direction direction, qint64 nNowNs, QVarLengthArray<Bucket *, 5> &buckets)
+{
+    const quint64 ids[4] = { 0, path.sessionId, path.batchId, path.requestId };
+    for (int nScope = 0; nScope < 4; ++nScope)
+    {
+        if (nScope > 0 && ids[nScope] == 0)
+        {
+            continue;
+        }
+        auto iter = m_mapBuckets[nScope][direction].find(ids[nScope]);
+        if (iter != m_mapBuckets[nScope][direction].end())
+        {
+            iter.value().refill(nNowNs);
+            buckets.append(&iter.value());
+        }
+    }
+    if (path.background && isForegroundActive(direction, nNowNs))
+    {
+        Bucket &background = m_background[direction];
+        if (background.nRate <= 0)
+        {
+            return false;
+        }
+        background.refill(nNowNs);
+        buckets.append(&background);
+    }
+    return true;
+}
+
+qint64 NetworkBandwidthLimiter::acquire(const BandwidthPath &path, Direction direction, qint64 nWanted)
+{
+    if (nWanted <= 0)
+    {
+        return 0;
+    }
+    const qint64 nNowNs = m_clock.nsecsElapsed();
+    if (!path.background)
+    {
+        m_nForegroundNs[direction].store(nNowNs, std::memory_order_relaxed);
+        if (m_nLimits.load(std::memory_order_relaxed) == 0)
+        {
+            return nWanted;
+        }
+    }
+    else if (m_nLimits.load(std::memory_order_relaxed) == 0 && !isForegroundActive(direction, nNowNs))
+    {
+        return nWanted;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    QVarLengthArray<Bucket *, 5> buckets;
+    if (!collect(path, direction, nNowNs, buckets))
+    {
+        return 0;
+    }
+    qint64 nAllowed = nWanted;
+    for (const Bucket *bucket : buckets)
+    {
+        nAllowed = qMin(nAllowed, static_cast<qint64>(std::floor(qMax<double>(0, bucket->dTokens))));
+    }
+    if (nAllowed > 0)
+    {
+        for (Bucket *bucket : buckets)
+        {
+            bucket->dTokens -= nAllowed;
+        }
+    }
+    return nAllowed;
+}
+
+qint64 NetworkBandwidthLimiter::acquire(const BandwidthPath &path, Direction direction, qint64 nWanted, QTimer &resumeTimer)
+{
+    const qint64 nAllowed = acquire(path, direction, nWanted);
+    if (nAllowed < nWanted && !resumeTimer.isActive())
+    {
+        resumeTimer.start(static_cast<int>(waitMs(path, direction)));
+    }
+    return nAllowed;
+}
+
+void NetworkBandwidthLimiter::consume(const BandwidthPath &path, Direction direction, qint64 nBytes)
+{
+    if (nBytes == 0 || (m_nLimits.load(std::memory_order_relaxed) == 0 && !path.background))
+    {
+        return;
+    }
+    const qint64 nNowNs = m_clock.nsecsElapsed();
+    QMutexLocker locker(&m_mutex);
+    QVarLengthArray<Bucket *, 5> buckets;
+    collect(path, direction, nNowNs, buckets);
+    for (Bucket *bucket : buckets)
+    {
+        bucket->dTokens -= nBytes;
+    }
+}
+
+void NetworkBandwidthLimiter::noteForeground(Direction direction)
+{
+    m_nForegroundNs[direction].store(m_clock.nsecsElapsed(), std::memory_order_relaxed);
+}
+
+qint64 NetworkBandwidthLimiter::waitMs(const BandwidthPath &path, Direction direction)
+{
+    const qint64 nNowNs = m_clock.nsecsElapsed();
+    QMutexLocker locker(&m_mutex);
+    QVarLengthArray<Bucket *, 5> buckets;
+    if (!collect(path, direction, nNowNs, buckets))
+    {
+        // Paused until the foreground traffic stops
+        const qint64 nIdleAtNs = m_nForegroundNs[direction].load(std::memory_order_relaxed) + BACKGROUND_YIELD_MS * 1000000LL;
+        return qBound<qint64>(1, (nIdleAtNs - nNowNs) / 1000000 + 1, BACKGROUND_YIELD_MS);
+    }
+    qint64 nWaitMs = 1;
+    for (const Bucket *bucket : buckets)
+    {
+        // Wait for half the burst allowance rather than a few bytes
+        const double dMissing = bucket->capacity() / 2 - bucket->dTokens;
+        if (dMissing > 0 && bucket->nRate > 0)
+        {
+            nWaitMs = qMax(nWaitMs, static_cast<qint64>(std::ceil(dMissing * 1000 / bucket->nRate)));
+        }
+    }
+    // Limits may be raised meanwhile
+    return qMin<qint64>(nWaitMs, 1000);
+}
+
+qint64 NetworkBandwidthLimiter::readBufferSize(const BandwidthPath &path) const
+{
+    if (path.background)
+    {
+        return THROTTLED_READ_BUFFER_SIZE;
+    }
+    if (m_nLimits.load(std::memory_order_relaxed) == 0)
+    {
+        return 0;
+    }
+    // Limits elsewhere (another session, batch or request) do not bound this reply
+    const quint64 ids[4] = { 0, path.sessionId, path.batchId, path.requestId };
+    QMutexLocker locker(&m_mutex);
+    for (int nScope = 0; nScope < 4; ++nScope)
+    {
+        if (nScope > 0 && ids[nScope] == 0)
+        {
+            continue;
+        }
+        for (const QHash<quint64, Bucket> &buckets : m_mapBuckets[nScope])
+        {
+            if (buckets.value(ids[nScope]).nRate > 0)
+            {
+                return THROTTLED_READ_BUFFER_SIZE;
+            }
+        }
+    }
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+NetworkThrottledDevice::NetworkThrottledDevice(QIODevice *pSource, const BandwidthPath &path, QObject *parent)
+    : QIODevice(parent), m_pSource(pSource), m_path(path)
+{
+    m_resumeTimer.setSingleShot(true);
+    connect(&m_resumeTimer, &QTimer::timeout, this, &QIODevice::readyRead);
+    // Unbuffered: every read asks for its own quota, QIODevice does not read ahead
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+qint64 NetworkThrottledDevice::size() const
+{
+    return m_pSource->size();
+}
+
+bool NetworkThrottledDevice::seek(qint64 nPos)
+{
+    return m_pSource->seek(nPos) && QIODevice::seek(nPos);
+}
+
+bool NetworkThrottledDevice::atEnd() const
+{
+    return pos() >= size();
+}
+
+qint64 NetworkThrottledDevice::bytesAvailable() const
+{
+    return qMax<qint64>(0, size() - pos());
+}
+
+qint64 NetworkThrottledDevice::readData(char *data, qint64 nMaxSize)
+{
+    const qint64 nWanted = qMin(nMaxSize, bytesAvailable());
+    if (nWanted <= 0)
+    {
+        return 0;
+    }
+    NetworkBandwidthLimiter *pLimiter = NetworkBandwidthLimiter::globalInstance();
+    const qint64 nAllowed = pLimiter->acquire(m_path, NetworkBandwidthLimiter::Upload, nWanted, m_resumeTimer);
+    if (nAllowed <= 0)
+    {
+        return 0;
+    }
+    const qint64 nRead = m_pSource->read(data, nAllowed);
+    if (nRead < nAllowed)
+    {
+        // Give back what the source did not deliver
+        pLimiter->consume(m_path, NetworkBandwidthLimiter::Upload, qMax<qint64>(0, nRead) - nAllowed);
+    }
+    return nRead;
+}
+
+qint64 NetworkThrottledDevice::writeData(const char *data, qint64 nSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(nSize);
+    return -1;
+}
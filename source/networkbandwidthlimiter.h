@@ -0,0 +1,128 @@
+#pragma once
+
+#include <QHash>
+#include <QIODevice>
+#include <QMutex>
+#include <QTimer>
+#include <QVarLengthArray>
+#include <QElapsedTimer>
+#include <atomic>
+#include "networkrequestdefs.h"
+
+namespace QtNetworkRequest
+{
+    // Buckets a transfer draws from, from its request up to the global one
+    struct BandwidthPath
+    {
+        quint64 requestId{ 0 };
+        quint64 sessionId{ 0 };
+        quint64 batchId{ 0 };
+        // Priority::Background: held back while foreground transfers move data
+        bool background{ false };
+
+        static BandwidthPath of(const RequestContext &context);
+    };
+
+    /**
+     * @brief Token buckets for the download and upload bytes of all transfers: global, per session, per batch and
+     * per request.
+     *
+     * A transfer asks for a quota before it reads from its reply (or before its upload device hands out bytes) and
+     * gets at most what every bucket on its path holds. The rest stays in the reply, whose read buffer is bounded
+     * (readBufferSize()), so the socket is not read either and the sender is slowed down by TCP flow control;
+     * no thread sleeps. Limits can change at any time and apply from the next quota on.
+     *
+     * Background transfers share backgroundRate() while a foreground transfer moved data within the last
+     * BACKGROUND_YIELD_MS, and run unrestrained (apart from their limits) otherwise.
+     */
+    class NetworkBandwidthLimiter
+    {
+    public:
+        enum Direction
+        {
+            Download = 0,
+            Upload = 1,
+        };
+
+        static NetworkBandwidthLimiter *globalInstance();
+
+        // Bytes per second, 0 = unlimited. uiId is ignored for BandwidthScope::Global
+        void setLimit(BandwidthScope scope, quint64 uiId, Direction direction, qint64 nBytesPerSec);
+        qint64 limit(BandwidthScope scope, quint64 uiId, Direction direction) const;
+        // Rate shared by the background transfers while foreground traffic flows, 0 = pause them
+        void setBackgroundRate(qint64 nBytesPerSec);
+        qint64 backgroundRate() const;
+        // Drop the limits of a finished request or batch
+        void remove(BandwidthScope scope, quint64 uiId);
+
+        // Bytes the transfer may move now, at most nWanted. 0 = try again after waitMs()
+        qint64 acquire(const BandwidthPath &path, Direction direction, qint64 nWanted);
+        // acquire(), resumeTimer (single shot) is started for the rest if the quota falls short of nWanted
+        qint64 acquire(const BandwidthPath &path, Direction direction, qint64 nWanted, QTimer &resumeTimer);
+        // Bytes moved without a quota (the tail of a finished reply), the next quotas pay for them. Negative gives bytes back
+        void consume(const BandwidthPath &path, Direction direction, qint64 nBytes);
+        // A foreground transfer moved data without a quota (no limit applies to it), background ones yield to it
+        void noteForeground(Direction direction);
+        // Milliseconds until acquire() hands out a worthwhile quota again
+        qint64 waitMs(const BandwidthPath &path, Direction direction);
+        // Read buffer size for a reply of the transfer, 0 (unbounded) if no bucket on its path has a limit
+        qint64 readBufferSize(const BandwidthPath &path) const;
+
+    private:
+        NetworkBandwidthLimiter();
+        Q_DISABLE_COPY(NetworkBandwidthLimiter)
+
+        struct Bucket
+        {
+            qint64 nRate{ 0 };
+            double dTokens{ 0 };
+            qint64 nLastNs{ -1 };
+
+            // Burst allowance, an eighth of a second of traffic
+            double capacity() const { return qMax<double>(static_cast<double>(nRate) / 8, 4096); }
+            void refill(qint64 nNowNs);
+        };
+
+        // Buckets on the path of the transfer (m_mutex must be held), false if it must pause altogether
+        bool collect(const BandwidthPath &path, Direction direction, qint64 nNowNs, QVarLengthArray<Bucket *, 5> &buckets);
+        bool isForegroundActive(Direction direction, qint64 nNowNs) const;
+
+    private:
+        mutable QMutex m_mutex;
+        QElapsedTimer m_clock;
+        // [scope][direction] id <---> Bucket, the global bucket has id 0
+        QHash<quint64, Bucket> m_mapBuckets[4][2];
+        Bucket m_background[2];
+        // Buckets with a rate, nothing is throttled while there are none
+        std::atomic<int> m_nLimits;
+        std::atomic<qint64> m_nBackgroundRate;
+        // Last time a foreground transfer moved data or asked for a quota, per direction
+        std::atomic<qint64> m_nForegroundNs[2];
+    };
+
+    // Upload body read through the limiter, handed to QNetworkAccessManager in place of the source device
+    class NetworkThrottledDevice : public QIODevice
+    {
+        Q_OBJECT
+
+    public:
+        // The source must be open and stay alive as long as this device
+        NetworkThrottledDevice(QIODevice *pSource, const BandwidthPath &path, QObject *parent = nullptr);
+
+        bool isSequential() const override { return false; }
+        qint64 size() const override;
+        bool seek(qint64 nPos) override;
+        bool atEnd() const override;
+        qint64 bytesAvailable() const override;
+
+    protected:
+        // 0 when the quota is used up, readyRead() follows once there is a new one
+        qint64 readData(char *data, qint64 nMaxSize) override;
+        qint64 writeData(const char *data, qint64 nSize) override;
+
+    private:
+        QIODevice *m_pSource;
+        BandwidthPath m_path;
+        QTimer m_resumeTimer;
+    };
+}
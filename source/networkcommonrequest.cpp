@@ -1,20 +1,23 @@
 #include "networkcommonrequest.h"
 #include <QDebug>
 #include <QNetworkAccessManager>
-#include <QNetworkCookieJar>
 #include <QFile>
 #include <QFileInfo>
 #include <QMimeDatabase>
 
 #include "networkrequestutility.h"
+#include "networkaccessmanagerpool.h"
+#include "networkredirectcache.h"
 #include <QtGlobal> // Add header file for Qt version checking
 #include "QThread"
 #include "QHttpMultiPart"
 
 using namespace QtNetworkRequest;
 
+#define STREAM_CHUNK_SIZE (64 * 1024)
+
 NetworkCommonRequest::NetworkCommonRequest(QObject *parent /* = nullptr */)
-    : NetworkRequest(parent)
+    : NetworkRequest(parent), m_bStreamStarted(false), m_eCacheStatus(CacheStatus::None)
 {
 }
 
@@ -47,23 +50,35 @@ void NetworkCommonRequest::start()
         }
     }
 
-    if (nullptr == m_pNetworkManager)
+    m_spCached.reset();
+    m_eCacheStatus = CacheStatus::None;
+    if (usesCache())
     {
-        m_pNetworkManager = new QNetworkAccessManager(this);
-// Set timeout
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
-        m_pNetworkManager->setTransferTimeout(m_upContext->behavior.transferTimeout);
-#endif
-    }
-    for (QNetworkCookie &cookie : m_upContext->cookies)
-    {
-        if (m_pNetworkManager->cookieJar())
+        m_spCached = NetworkResponseCache::globalInstance()->lookup(url, NetworkRequestUtility::sentHeaders(*m_upContext));
+        if (m_spCached && (m_spCached->isFresh() || m_upContext->behavior.cacheMode == CacheMode::CacheOnly))
         {
-            m_pNetworkManager->cookieJar()->insertCookie(cookie);
+            replyFromCache(CacheStatus::Hit);
+            return;
         }
+        if (m_upContext->behavior.cacheMode == CacheMode::CacheOnly)
+        {
+            m_strError = QString("Cache error: No cached response for %1").arg(url.toString());
+            emit response(ToFailedResult());
+            return;
+        }
+        m_eCacheStatus = CacheStatus::Miss;
     }
 
+    // Reuse the worker thread's network manager (keep-alive connections and TLS sessions)
+    m_pNetworkManager = NetworkAccessManagerPool::threadLocalManager();
+
     QNetworkRequest request(url);
+    NetworkRequestUtility::applyCookies(request, m_upContext->cookies);
+    NetworkRequestUtility::applyHttp2(request, m_upContext->behavior.http2);
+// Set timeout
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
+    request.setTransferTimeout(m_upContext->behavior.transferTimeout);
+#endif
 
     // Set default User-Agent if not provided
     if (!m_upContext->headers.contains("User-Agent") && !m_upContext->headers.contains("user-agent"))
@@ -76,6 +91,18 @@ void NetworkCommonRequest::start()
     {
         request.setRawHeader(iter.key(), iter.value());
     }
+    if (m_spCached)
+    {
+        // Revalidate the stale response, a 304 confirms it
+        if (!m_spCached->etag.isEmpty())
+        {
+            request.setRawHeader("If-None-Match", m_spCached->etag);
+        }
+        if (!m_spCached->lastModified.isEmpty())
+        {
+            request.setRawHeader("If-Modified-Since", m_spCached->lastModified);
+        }
+    }
 
 #ifndef QT_NO_SSL
     if (url.scheme().toLower() == "https")
@@ -192,18 +219,31 @@ void NetworkCommonRequest::start()
         m_pNetworkReply = m_pNetworkManager->head(request);
     }
 
+    watchReply(m_pNetworkReply);
+    if (isStreamed())
+    {
+        // Bound what Qt buffers ahead of the sink, the socket is not read while the buffer is full
+        m_pNetworkReply->setReadBufferSize(qMax<qint64>(0, m_upContext->streamConfig->readBufferSize));
+        connect(m_pNetworkReply, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+        QIODevice *pDevice = m_upContext->streamConfig->device;
+        if (!m_upContext->streamConfig->onData && pDevice)
+        {
+            connect(pDevice, SIGNAL(bytesWritten(qint64)), this, SLOT(onReadyRead()), Qt::UniqueConnection);
+        }
+    }
+
     connect(m_pNetworkReply, SIGNAL(finished()), this, SLOT(onFinished()));
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
     connect(m_pNetworkReply, SIGNAL(errorOccurred(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
 #else
     connect(m_pNetworkReply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
 #endif
-    connect(m_pNetworkManager, SIGNAL(authenticationRequired(QNetworkReply *, QAuthenticator *)),
-            SLOT(onAuthenticationRequired(QNetworkReply *, QAuthenticator *)));
+    connectAuthentication();
 }
 
 void NetworkCommonRequest::onFinished()
 {
+    disconnectAuthentication();
     if (!m_pNetworkReply)
     {
         m_strError = QString("Network error: Invalid reply");
@@ -217,6 +257,22 @@ void NetworkCommonRequest::onFinished()
     Q_ASSERT(url.isValid());
 
     bool bHttpProxy = isHttpProxy(url.scheme()) || isHttpsProxy(url.scheme());
+    if (statusCode == 304 && m_spCached && !m_bAbortManual)
+    {
+        // The stale cached response is still valid
+        QMap<QByteArray, QByteArray> notModifiedHeaders;
+        foreach(const QByteArray & header, m_pNetworkReply->rawHeaderList())
+        {
+            notModifiedHeaders[header] = m_pNetworkReply->rawHeader(header);
+        }
+        m_spCached = NetworkResponseCache::globalInstance()->refresh(m_spCached, NetworkRequestUtility::sentHeaders(*m_upContext),
+                                                                     notModifiedHeaders);
+
+        m_pNetworkReply->deleteLater();
+        m_pNetworkReply = nullptr;
+        replyFromCache(CacheStatus::Revalidated);
+        return;
+    }
     if (bHttpProxy)
     {
         bSuccess = bSuccess && (statusCode >= 200 && statusCode < 300);
@@ -224,7 +280,7 @@ void NetworkCommonRequest::onFinished()
     if (!bSuccess)
     {
         // Handle redirection
-        if (statusCode == 301 || statusCode == 302)
+        if (statusCode == 301 || statusCode == 302 || statusCode == 307 || statusCode == 308)
         {
             const QVariant &redirectionTarget = m_pNetworkReply->attribute(QNetworkRequest::RedirectionTargetAttribute);
             const QUrl &redirectUrl = url.resolved(redirectionTarget.toUrl());
@@ -232,6 +288,7 @@ void NetworkCommonRequest::onFinished()
             {
                 qDebug() << "[NetworkCommonRequest] Redirecting from:" << url.toString()
                          << "to:" << redirectUrl.toString();
+                NetworkRedirectCache::globalInstance()->store(url, redirectUrl, statusCode);
                 m_url = redirectUrl;
 
                 // Clean up current resources
@@ -249,6 +306,25 @@ void NetworkCommonRequest::onFinished()
         }
     }
 
+    if (isStreamed())
+    {
+        QIODevice *pDevice = m_upContext->streamConfig->device;
+        if (pDevice)
+        {
+            disconnect(pDevice, SIGNAL(bytesWritten(qint64)), this, SLOT(onReadyRead()));
+        }
+        // Aborted by the sink (the abort replaced the error message), or the rest of the body could not be delivered
+        if (!m_strStreamError.isEmpty())
+        {
+            m_strError = m_strStreamError;
+            bSuccess = false;
+        }
+        else if (bSuccess && !m_bAbortManual && m_pNetworkReply->isOpen() && !deliverStreamData(true))
+        {
+            bSuccess = false;
+        }
+    }
+
     // Get response header information
     QMap<QByteArray, QByteArray> responseHeaders;
     QByteArray body;
@@ -256,7 +332,10 @@ void NetworkCommonRequest::onFinished()
     {
         if (bSuccess)
         {
-            body = m_pNetworkReply->readAll();
+            if (!isStreamed())
+            {
+                body = m_pNetworkReply->readAll();
+            }
             foreach(const QByteArray & header, m_pNetworkReply->rawHeaderList())
             {
                 responseHeaders[header] = m_pNetworkReply->rawHeader(header);
@@ -269,7 +348,115 @@ void NetworkCommonRequest::onFinished()
     m_pNetworkReply = nullptr;
 
     if (bSuccess)
-        emit response(ToSuccessResult(body, responseHeaders));
+    {
+        QSharedPointer<ResponseResult> spResult = ToSuccessResult(body, responseHeaders);
+        if (m_eCacheStatus != CacheStatus::None)
+        {
+            if (statusCode == 200)
+            {
+                NetworkResponseCache::globalInstance()->store(url, NetworkRequestUtility::sentHeaders(*m_upContext), responseHeaders, body);
+            }
+            spResult->cacheStatus = m_eCacheStatus;
+        }
+        else if (m_upContext->type == RequestType::Post || m_upContext->type == RequestType::Put
+                 || m_upContext->type == RequestType::Delete)
+        {
+            // The cached GET of the resource is outdated
+            NetworkResponseCache::globalInstance()->remove(url);
+        }
+        emit response(spResult);
+    }
     else
+    {
         emit response(ToFailedResult());
+    }
+}
+
+bool NetworkCommonRequest::usesCache() const
+{
+    return m_upContext->type == RequestType::Get && !isStreamed()
+           && m_upContext->behavior.cacheMode != CacheMode::NetworkOnly;
+}
+
+void NetworkCommonRequest::replyFromCache(CacheStatus eStatus)
+{
+    QSharedPointer<ResponseResult> spResult = ToSuccessResult(m_spCached->body, m_spCached->headers);
+    spResult->cacheStatus = eStatus;
+    m_spCached.reset();
+    emit response(spResult);
+}
+
+void NetworkCommonRequest::onReadyRead()
+{
+    if (!m_pNetworkReply || !m_strStreamError.isEmpty() || m_pNetworkReply->error() != QNetworkReply::NoError || !m_pNetworkReply->isOpen())
+    {
+        return;
+    }
+    if (!deliverStreamData(false))
+    {
+        // Ends in onFinished() with a failed result
+        m_strStreamError = m_strError;
+        m_pNetworkReply->abort();
+    }
+}
+
+bool NetworkCommonRequest::isStreamableResponse() const
+{
+    // Only the body of the final successful response, not of a redirection or an error page
+    if (isHttpProxy(m_url.scheme()) || isHttpsProxy(m_url.scheme()))
+    {
+        const int statusCode = m_pNetworkReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        return (statusCode >= 200 && statusCode < 300);
+    }
+    return true;
+}
+
+bool NetworkCommonRequest::deliverStreamData(bool bFinal)
+{
+    if (!isStreamableResponse())
+    {
+        return true;
+    }
+
+    const StreamConfig &config = *m_upContext->streamConfig;
+    if (m_streamBuffer.isEmpty())
+    {
+        m_streamBuffer.resize(STREAM_CHUNK_SIZE);
+    }
+
+    while (m_pNetworkReply->bytesAvailable() > 0)
+    {
+        if (!config.onData && config.device && !bFinal && config.device->bytesToWrite() >= qMax<qint64>(STREAM_CHUNK_SIZE, config.readBufferSize))
+        {
+            // The device has not caught up, resumed by its bytesWritten()
+            return true;
+        }
+
+        const qint64 nRead = m_pNetworkReply->read(m_streamBuffer.data(), m_streamBuffer.size());
+        if (nRead <= 0)
+        {
+            break;
+        }
+        m_bStreamStarted = true;
+
+        if (config.onData)
+        {
+            if (!config.onData(m_streamBuffer.constData(), nRead))
+            {
+                m_strError = QString("Stream error: Aborted by the data handler");
+                qDebug() << "[NetworkCommonRequest]" << m_strError;
+                return false;
+            }
+        }
+        else if (config.device)
+        {
+            if (config.device->write(m_streamBuffer.constData(), nRead) != nRead)
+            {
+                m_strError = QString("Stream error: Write to device failed - %1").arg(config.device->errorString());
+                qDebug() << "[NetworkCommonRequest]" << m_strError;
+                return false;
+            }
+        }
+    }
+    return true;
 }
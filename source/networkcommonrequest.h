@@ -2,6 +2,7 @@
 
 #include <QObject>
 #include "networkrequest.h"
+#include "networkresponsecache.h"
 
 namespace QtNetworkRequest
 {
@@ -17,5 +18,30 @@ namespace QtNetworkRequest
 	public Q_SLOTS:
 		void start() Q_DECL_OVERRIDE;
 		void onFinished() Q_DECL_OVERRIDE;
+
+	private Q_SLOTS:
+		void onReadyRead();
+
+	protected:
+		// A streamed body already handed to the sink cannot be taken back
+		bool canRetry() const Q_DECL_OVERRIDE { return NetworkRequest::canRetry() && !m_bStreamStarted; }
+
+	private:
+		// Streamed response (RequestContext::streamConfig)
+		bool isStreamed() const { return m_upContext && m_upContext->streamConfig; }
+		bool isStreamableResponse() const;
+		// Hand the available body bytes to the sink. bFinal: the reply finished, ignore the sink's backpressure
+		bool deliverStreamData(bool bFinal);
+
+		// GET answered through the response cache (behavior.cacheMode)
+		bool usesCache() const;
+		void replyFromCache(CacheStatus eStatus);
+
+	private:
+		QByteArray m_streamBuffer; // Reused read buffer of the streamed body
+		QString m_strStreamError; // Delivery failed, the request was aborted
+		bool m_bStreamStarted; // Bytes were handed to the sink
+		std::shared_ptr<const CachedResponse> m_spCached; // Stale cached response being revalidated
+		CacheStatus m_eCacheStatus;
 	};
 }
@@ -0,0 +1,220 @@
+#include "networkdownloadjournal.h"
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkReply>
+
+using namespace QtNetworkRequest;
+
+#define JOURNAL_VERSION 1
+
+NetworkDownloadJournal::NetworkDownloadJournal(const QString &strDstFilePath)
+    : m_strJournalPath(journalFilePath(strDstFilePath)), m_nTotalSize(0)
+{
+}
+
+QString NetworkDownloadJournal::tempFilePath(const QString &strDstFilePath)
+{
+    return strDstFilePath + ".download";
+}
+
+QString NetworkDownloadJournal::journalFilePath(const QString &strDstFilePath)
+{
+    return tempFilePath(strDstFilePath) + ".journal";
+}
+
+bool NetworkDownloadJournal::load()
+{
+    QFile file(m_strJournalPath);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+
+    QJsonParseError error;
+    const QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &error);
+    if (error.error != QJsonParseError::NoError || !doc.isObject())
+    {
+        qDebug() << "[QMultiThreadNetwork] Invalid download journal:" << m_strJournalPath << error.errorString();
+        return false;
+    }
+
+    const QJsonObject obj = doc.object();
+    if (obj.value("version").toInt() != JOURNAL_VERSION)
+    {
+        return false;
+    }
+    m_strUrl = obj.value("url").toString();
+    m_nTotalSize = static_cast<qint64>(obj.value("size").toDouble());
+    m_etag = obj.value("etag").toString().toUtf8();
+    m_lastModified = obj.value("lastModified").toString().toUtf8();
+
+    m_completed.clear();
+    for (const QJsonValue &value : obj.value("ranges").toArray())
+    {
+        const QJsonArray range = value.toArray();
+        if (range.size() == 2)
+        {
+            addCompleted(static_cast<qint64>(range.at(0).toDouble()), static_cast<qint64>(range.at(1).toDouble()));
+        }
+    }
+    return true;
+}
+
+bool NetworkDownloadJournal::save()
+{
+    QJsonArray ranges;
+    for (const Range &range : m_completed)
+    {
+        ranges.append(QJsonArray{ static_cast<double>(range.first), static_cast<double>(range.second) });
+    }
+
+    QJsonObject obj;
+    obj.insert("version", JOURNAL_VERSION);
+    obj.insert("url", m_strUrl);
+    obj.insert("size", static_cast<double>(m_nTotalSize));
+    obj.insert("etag", QString::fromUtf8(m_etag));
+    obj.insert("lastModified", QString::fromUtf8(m_lastModified));
+    obj.insert("ranges", ranges);
+
+    // Never leave a half written journal behind, a crash keeps the previous one
+    QSaveFile file(m_strJournalPath);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qDebug() << "[QMultiThreadNetwork] Failed to write download journal:" << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
+
+void NetworkDownloadJournal::remove()
+{
+    QFile::remove(m_strJournalPath);
+}
+
+void NetworkDownloadJournal::reset(const QString &strUrl, qint64 nTotalSize, const QByteArray &etag, const QByteArray &lastModified)
+{
+    m_strUrl = strUrl;
+    m_nTotalSize = nTotalSize;
+    m_etag = etag;
+    m_lastModified = lastModified;
+    m_completed.clear();
+}
+
+bool NetworkDownloadJournal::matches(const QString &strUrl, qint64 nTotalSize, const QByteArray &etag, const QByteArray &lastModified) const
+{
+    if (m_strUrl != strUrl || m_nTotalSize != nTotalSize || ifRange().isEmpty())
+    {
+        return false;
+    }
+    return m_etag == etag && m_lastModified == lastModified;
+}
+
+QByteArray NetworkDownloadJournal::ifRange() const
+{
+    // If-Range only accepts a strong ETag or a date
+    if (!m_etag.isEmpty() && !m_etag.startsWith("W/"))
+    {
+        return m_etag;
+    }
+    return m_lastModified;
+}
+
+void NetworkDownloadJournal::addCompleted(qint64 nFirst, qint64 nLast)
+{
+    if (nFirst < 0 || nLast < nFirst)
+    {
+        return;
+    }
+
+    // Merge with every overlapping or adjacent range
+    QList<Range> merged;
+    Range added(nFirst, nLast);
+    bool bInserted = false;
+    for (const Range &range : m_completed)
+    {
+        if (range.second + 1 < added.first)
+        {
+            merged.append(range);
+        }
+        else if (added.second + 1 < range.first)
+        {
+            if (!bInserted)
+            {
+                merged.append(added);
+                bInserted = true;
+            }
+            merged.append(range);
+        }
+        else
+        {
+            added.first = qMin(added.first, range.first);
+            added.second = qMax(added.second, range.second);
+        }
+    }
+    if (!bInserted)
+    {
+        merged.append(added);
+    }
+    m_completed = merged;
+}
+
+QList<NetworkDownloadJournal::Range> NetworkDownloadJournal::missingRanges() const
+{
+    QList<Range> missing;
+    qint64 nPos = 0;
+    for (const Range &range : m_completed)
+    {
+        if (range.first >= m_nTotalSize)
+        {
+            break;
+        }
+        if (range.first > nPos)
+        {
+            missing.append(Range(nPos, range.first - 1));
+        }
+        nPos = qMax(nPos, range.second + 1);
+    }
+    if (nPos < m_nTotalSize)
+    {
+        missing.append(Range(nPos, m_nTotalSize - 1));
+    }
+    return missing;
+}
+
+qint64 NetworkDownloadJournal::completedBytes() const
+{
+    qint64 nBytes = 0;
+    for (const Range &range : m_completed)
+    {
+        if (range.first >= m_nTotalSize)
+        {
+            break;
+        }
+        nBytes += qMin(range.second, m_nTotalSize - 1) - range.first + 1;
+    }
+    return nBytes;
+}
+
+qint64 NetworkDownloadJournal::completedPrefix() const
+{
+    if (m_completed.isEmpty() || m_completed.first().first != 0)
+    {
+        return 0;
+    }
+    return m_completed.first().second + 1;
+}
+
+QByteArray NetworkDownloadJournal::etagOf(const QNetworkReply *pReply)
+{
+    return pReply ? pReply->rawHeader("ETag") : QByteArray();
+}
+
+QByteArray NetworkDownloadJournal::lastModifiedOf(const QNetworkReply *pReply)
+{
+    return pReply ? pReply->rawHeader("Last-Modified") : QByteArray();
+}
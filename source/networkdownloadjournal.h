@@ -0,0 +1,66 @@
+#pragma once
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+
+class QNetworkReply;
+
+// How often a running resumable download flushes its data and journal
+#define JOURNAL_FLUSH_INTERVAL_MS 1000
+
+namespace QtNetworkRequest
+{
+    // Sidecar journal of a resumable download (DownloadConfig::resumable).
+    // Stored next to the partial file as JSON, it records the validators of the resource and the byte
+    // ranges already on disk, so a later request for the same url/destination only fetches the missing ranges.
+    class NetworkDownloadJournal
+    {
+    public:
+        typedef QPair<qint64, qint64> Range; // [first, last] byte offsets, inclusive
+
+        explicit NetworkDownloadJournal(const QString &strDstFilePath);
+
+        // Partial file and journal paths of a destination: "<dst>.download" and "<dst>.download.journal"
+        static QString tempFilePath(const QString &strDstFilePath);
+        static QString journalFilePath(const QString &strDstFilePath);
+
+        // Load the journal from disk. Returns false if it does not exist or is unreadable
+        bool load();
+        // Write the journal to disk (atomically replaces the previous one).
+        // Callers batch it (JOURNAL_FLUSH_INTERVAL_MS) and flush the data file first, the journal never claims bytes not on disk
+        bool save();
+        // Delete the journal file
+        void remove();
+
+        // Start over for a new version of the resource
+        void reset(const QString &strUrl, qint64 nTotalSize, const QByteArray &etag, const QByteArray &lastModified);
+        // Whether the loaded journal describes this version of the resource
+        bool matches(const QString &strUrl, qint64 nTotalSize, const QByteArray &etag, const QByteArray &lastModified) const;
+        // Value of the If-Range header, empty if the resource has no validator usable for resuming (weak ETag and no Last-Modified)
+        QByteArray ifRange() const;
+
+        void addCompleted(qint64 nFirst, qint64 nLast);
+        QList<Range> completedRanges() const { return m_completed; }
+        // Ranges of [0, totalSize) not completed yet
+        QList<Range> missingRanges() const;
+        qint64 completedBytes() const;
+        qint64 totalSize() const { return m_nTotalSize; }
+        QString url() const { return m_strUrl; }
+        // Bytes completed from offset 0 without a gap (resume point of a single stream download)
+        qint64 completedPrefix() const;
+
+        static QByteArray etagOf(const QNetworkReply *pReply);
+        static QByteArray lastModifiedOf(const QNetworkReply *pReply);
+
+    private:
+        QString m_strJournalPath;
+        QString m_strUrl;
+        qint64 m_nTotalSize;
+        QByteArray m_etag;
+        QByteArray m_lastModified;
+        // Sorted, non-overlapping, non-adjacent
+        QList<Range> m_completed;
+    };
+}
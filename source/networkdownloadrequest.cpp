@@ -3,40 +3,43 @@
 #include <QDebug>
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QUrlQuery>
 #include <QNetworkAccessManager>
-#include <QNetworkCookieJar>
 #include <QCoreApplication>
 #include "networkrequestmanager.h"
 #include "networkrequestutility.h"
-#include "networkrequestevent.h"
+#include "networkaccessmanagerpool.h"
+#include "networkprogresstracker.h"
+#include "networkbandwidthlimiter.h"
+#include "networkredirectcache.h"
 
 using namespace QtNetworkRequest;
 
 NetworkDownloadRequest::NetworkDownloadRequest(QObject *parent)
-    : NetworkRequest(parent), m_pFile(nullptr)
+    : NetworkRequest(parent)
 {
-	m_timer.setInterval(m_mIntervalMs);
-	connect(&m_timer, &QTimer::timeout, this, [this]()
-		{
-			m_bTimeout = true;
-		});
+	m_journalTimer.setInterval(JOURNAL_FLUSH_INTERVAL_MS);
+	connect(&m_journalTimer, &QTimer::timeout, this, &NetworkDownloadRequest::flushJournal);
+	m_throttleTimer.setSingleShot(true);
+	connect(&m_throttleTimer, &QTimer::timeout, this, &NetworkDownloadRequest::onReadyRead);
 }
 
 NetworkDownloadRequest::~NetworkDownloadRequest()
 {
-    m_timer.stop();
     // Improved destructor - ensure proper resource cleanup
-    if (m_pFile && m_pFile->isOpen())
+    if (m_storage && m_storage->isOpen())
     {
-        m_pFile->close();
+        m_storage->close();
     }
-    m_pFile.reset();
+    m_storage.reset();
 }
 
 void NetworkDownloadRequest::start()
 {
     NetworkRequest::start();
+    m_spResult->downloadStrategy = DownloadStrategy::SingleStream;
+    m_strWriteError.clear();
 
     const QUrl &url = m_url;
     if (!url.isValid())
@@ -47,11 +50,26 @@ void NetworkDownloadRequest::start()
         return;
     }
 
+    // Resuming relies on HTTP range requests
+    const bool bResumable = m_upContext->downloadConfig && m_upContext->downloadConfig->resumable &&
+                            (isHttpProxy(url.scheme()) || isHttpsProxy(url.scheme()));
+
     // Improved file creation - use smart pointers for exception safety
     try
     {
-        m_pFile = std::move(NetworkRequestUtility::createAndOpenFile(m_upContext.get(), m_strError));
-        if (!m_pFile || !m_pFile->isOpen())
+        if (bResumable)
+        {
+            openResumableFile();
+        }
+        else
+        {
+            const QString strFilePath = NetworkRequestUtility::getNewFilePath(m_upContext.get(), m_strError);
+            if (!strFilePath.isEmpty())
+            {
+                openStorage(strFilePath, false);
+            }
+        }
+        if (!m_storage || !m_storage->isOpen())
         {
             qDebug() << "[NetworkDownloadRequest] Failed to create/open file:" << m_strError;
             emit response(ToFailedResult());
@@ -66,29 +84,27 @@ void NetworkDownloadRequest::start()
         return;
     }
 
-    // Improved network manager creation
-    if (nullptr == m_pNetworkManager)
-    {
-        m_pNetworkManager = new QNetworkAccessManager(this);
+    // Reuse the worker thread's network manager (keep-alive connections and TLS sessions)
+    m_pNetworkManager = NetworkAccessManagerPool::threadLocalManager();
+
+    QNetworkRequest request(url);
+    // Set cookies
+    NetworkRequestUtility::applyCookies(request, m_upContext->cookies);
+    NetworkRequestUtility::applyHttp2(request, m_upContext->behavior.http2);
 // Set timeout
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
-        m_pNetworkManager->setTransferTimeout(m_upContext->behavior.transferTimeout);
+    request.setTransferTimeout(m_upContext->behavior.transferTimeout);
 #endif
-    }
-
-    // Set cookies
-    for (const QNetworkCookie &cookie : m_upContext->cookies)
-    {
-        if (m_pNetworkManager->cookieJar())
-        {
-            m_pNetworkManager->cookieJar()->insertCookie(cookie);
-        }
-    }
-
-    QNetworkRequest request(url);
-    request.setRawHeader("Accept-Encoding", "gzip,deflate");
+    // Range offsets of a resumable download refer to the file itself, not to a compressed representation
+    request.setRawHeader("Accept-Encoding", m_journal ? "identity" : "gzip,deflate");
     request.setRawHeader("Connection", "keep-alive");
     request.setRawHeader("User-Agent", "QtNetworkRequest/2.0");
+    if (m_nResumeOffset > 0)
+    {
+        // Only the missing tail, unless the file changed since the journal was written
+        request.setRawHeader("Range", QString("bytes=%1-").arg(m_nResumeOffset).toLatin1());
+        request.setRawHeader("If-Range", m_journal->ifRange());
+    }
 
     // Set custom headers
     auto iter = m_upContext->headers.cbegin();
@@ -121,7 +137,15 @@ void NetworkDownloadRequest::start()
         return;
     }
 
+    // A throttled reply stops reading the socket once its buffer is full
+    const qint64 nReadBufferSize = NetworkBandwidthLimiter::globalInstance()->readBufferSize(BandwidthPath::of(*m_upContext));
+    if (nReadBufferSize > 0)
+    {
+        m_pNetworkReply->setReadBufferSize(nReadBufferSize);
+    }
+
     // Connect signals
+    watchReply(m_pNetworkReply);
     connect(m_pNetworkReply, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
     connect(m_pNetworkReply, SIGNAL(finished()), this, SLOT(onFinished()));
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
@@ -130,7 +154,7 @@ void NetworkDownloadRequest::start()
     connect(m_pNetworkReply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
 #endif
 
-    if (m_upContext->behavior.showProgress)
+    if (m_spProgress)
     {
         connect(m_pNetworkReply, SIGNAL(downloadProgress(qint64, qint64)),
                 this, SLOT(onDownloadProgress(qint64, qint64)));
@@ -143,35 +167,77 @@ void NetworkDownloadRequest::start()
 }
 
 void NetworkDownloadRequest::onReadyRead()
+{
+    readReply(true);
+}
+
+void NetworkDownloadRequest::readReply(bool bThrottled)
 {
     if (!m_pNetworkReply || m_pNetworkReply->error() != QNetworkReply::NoError || !m_pNetworkReply->isOpen())
     {
         return;
     }
 
-    if (!m_pFile || !m_pFile->isOpen())
+    if (!m_storage || !m_storage->isOpen())
     {
         qDebug() << "[NetworkDownloadRequest] File not open for writing";
+        failWrite(QString("File operation failed: File is not open for writing"));
+        return;
+    }
+
+    if (m_journal && !checkResumeResponse())
+    {
         return;
     }
 
-    const QByteArray bytesReceived = m_pNetworkReply->readAll();
-    if (!bytesReceived.isEmpty())
+    // Read into the write buffer (or the file memory) of the storage directly, no QByteArray per chunk
+    qint64 nAvailable = m_pNetworkReply->bytesAvailable();
+    if (nAvailable > 0)
     {
-        qint64 bytesWritten = m_pFile->write(bytesReceived);
+        NetworkBandwidthLimiter *pLimiter = NetworkBandwidthLimiter::globalInstance();
+        if (bThrottled)
+        {
+            // The rest waits in the reply
+            nAvailable = pLimiter->acquire(BandwidthPath::of(*m_upContext), NetworkBandwidthLimiter::Download, nAvailable, m_throttleTimer);
+            if (nAvailable <= 0)
+            {
+                return;
+            }
+        }
+        else
+        {
+            pLimiter->consume(BandwidthPath::of(*m_upContext), NetworkBandwidthLimiter::Download, nAvailable);
+        }
+
+        qint64 bytesWritten = m_storage->writeFrom(m_pNetworkReply, m_nBytesWritten, nAvailable);
+        if (bytesWritten > 0)
+        {
+            m_nBytesWritten += bytesWritten;
+        }
         if (bytesWritten == -1)
         {
-            qDebug() << "[NetworkDownloadRequest] Write error:" << m_pFile->errorString();
-            m_strError = QString("File operation failed: Write operation failed - %1").arg(m_pFile->errorString());
+            qDebug() << "[NetworkDownloadRequest] Write error:" << m_storage->lastError();
+            failWrite(QString("File operation failed: Write operation failed - %1").arg(m_storage->lastError()));
         }
-        else if (bytesWritten != bytesReceived.size())
+        else if (bytesWritten != nAvailable)
         {
-            qDebug() << "[NetworkDownloadRequest] Partial write: expected" << bytesReceived.size()
+            qDebug() << "[NetworkDownloadRequest] Partial write: expected" << nAvailable
                      << "wrote" << bytesWritten;
         }
     }
 }
 
+void NetworkDownloadRequest::failWrite(const QString &strError)
+{
+    // Reading on would skip the bytes that were not written, the reply is aborted and the download fails
+    m_strWriteError = strError;
+    m_throttleTimer.stop();
+    if (m_pNetworkReply && m_pNetworkReply->isRunning())
+    {
+        m_pNetworkReply->abort();
+    }
+}
+
 void NetworkDownloadRequest::onFinished()
 {
     if (!m_pNetworkReply)
@@ -181,10 +247,21 @@ void NetworkDownloadRequest::onFinished()
         return;
     }
 
+    // The tail held back by the bandwidth limits
+    m_throttleTimer.stop();
+    readReply(false);
+
     bool bSuccess = (m_pNetworkReply->error() == QNetworkReply::NoError);
     int statusCode = m_pNetworkReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
     const QUrl &url = m_url;
     Q_ASSERT(url.isValid());
+    if (!m_strWriteError.isEmpty())
+    {
+        // The reply was aborted by a failed write, not a network error
+        m_strError = m_strWriteError;
+        bSuccess = false;
+        statusCode = 0;
+    }
 
     // Check HTTP status code
     bool bHttpProxy = isHttpProxy(url.scheme()) || isHttpsProxy(url.scheme());
@@ -195,7 +272,7 @@ void NetworkDownloadRequest::onFinished()
     if (!bSuccess)
     {
         // Handle redirection
-        if (statusCode == 301 || statusCode == 302)
+        if (statusCode == 301 || statusCode == 302 || statusCode == 307 || statusCode == 308)
         {
             const QVariant &redirectionTarget = m_pNetworkReply->attribute(QNetworkRequest::RedirectionTargetAttribute);
             const QUrl &redirectUrl = url.resolved(redirectionTarget.toUrl());
@@ -203,13 +280,17 @@ void NetworkDownloadRequest::onFinished()
             {
                 qDebug() << "[NetworkDownloadRequest] Redirecting from:" << url.toString()
                          << "to:" << redirectUrl.toString();
+                NetworkRedirectCache::globalInstance()->store(url, redirectUrl, statusCode);
                 m_url = redirectUrl.toString();
 
                 // Clean up current resources
                 m_pNetworkReply->deleteLater();
                 m_pNetworkReply = nullptr;
 
-                CloseFile(true);
+                // A resumable download keeps the bytes of its journal, start() reopens the file
+                m_journalTimer.stop();
+                CloseFile(!m_journal);
+                m_journal.reset();
 
                 // Restart request
                 start();
@@ -222,8 +303,38 @@ void NetworkDownloadRequest::onFinished()
         }
     }
 
+    // Write out the buffered tail of the file, a failed write fails the download
+    if (bSuccess && m_storage && !m_storage->flushDirty())
+    {
+        m_strError = QString("File operation failed: Write operation failed - %1").arg(m_storage->lastError());
+        bSuccess = false;
+    }
+
     // Clean up file
-    CloseFile(!bSuccess);
+    if (m_journal)
+    {
+        m_journalTimer.stop();
+        if (bSuccess)
+        {
+            CloseFile(false);
+            bSuccess = renameTempFileToFinal();
+            if (bSuccess)
+            {
+                m_journal->remove();
+            }
+        }
+        else
+        {
+            // Keep the partial file and its journal for a later request
+            flushJournal();
+            CloseFile(false);
+        }
+        m_journal.reset();
+    }
+    else
+    {
+        CloseFile(!bSuccess);
+    }
 
     // Get response header information
     QMap<QByteArray, QByteArray> responseHeaders;
@@ -259,22 +370,12 @@ void NetworkDownloadRequest::onFinished()
 
 void NetworkDownloadRequest::onDownloadProgress(qint64 iReceived, qint64 iTotal)
 {
-    if (m_bAbortManual || !m_bTimeout || iReceived <= 0 || iTotal <= 0)
+    if (m_bAbortManual || !m_spProgress || iReceived <= 0)
         return;
 
-    int progress = static_cast<int>(iReceived * 100 / iTotal);
-    if (m_nProgress < progress)
-    {
-        m_bTimeout = false;
-
-        m_nProgress = progress;
-        NetworkProgressEvent *event = new NetworkProgressEvent;
-        event->uiId = m_upContext->task.id;
-        event->uiBatchId = m_upContext->task.batchId;
-        event->iBtyes = iReceived;
-        event->iTotalBtyes = iTotal;
-        QCoreApplication::postEvent(NetworkRequestManager::globalInstance(), event);
-    }
+    // Sampled by the manager at its own rate, nothing is posted from here.
+    // A resumed download counts the bytes kept from the previous attempt
+    m_spProgress->set(m_nResumeOffset + iReceived, iTotal > 0 ? m_nResumeOffset + iTotal : 0);
 }
 
 #ifndef QT_NO_SSL
@@ -294,19 +395,190 @@ void NetworkDownloadRequest::onSslErrors(const QList<QSslError> &errors)
 }
 #endif
 
+bool NetworkDownloadRequest::openStorage(const QString &strFilePath, bool bKeepContent)
+{
+    // A single stream does not know the file size yet, the file grows with the writes
+    m_strFilePath = strFilePath;
+    m_storage = DownloadStorage::create(m_upContext->downloadConfig->storageBackend, false);
+    if (!m_storage->open(strFilePath, 0, bKeepContent))
+    {
+        m_strError = QString("File operation failed: Unable to open file '%1' for writing - %2").arg(strFilePath).arg(m_storage->lastError());
+        m_storage.reset();
+        return false;
+    }
+    return true;
+}
+
 void NetworkDownloadRequest::CloseFile(bool bRemove)
 {
-    if (m_pFile)
+    if (m_storage)
     {
-        if (m_pFile->isOpen())
+        if (m_storage->isOpen())
         {
-            m_pFile->close();
+            m_storage->close();
         }
+        m_storage.reset();
 
-        if (bRemove && m_pFile->exists())
+        if (bRemove && QFile::exists(m_strFilePath))
         {
-            m_pFile->remove();
+            QFile::remove(m_strFilePath);
         }
-        m_pFile.reset();
     }
 }
+
+void NetworkDownloadRequest::abort()
+{
+    if (!m_journal)
+    {
+        NetworkRequest::abort();
+        return;
+    }
+
+    // Pause: keep the partial file and its journal, a later request for the same url/destination resumes
+    m_journalTimer.stop();
+    m_throttleTimer.stop();
+    if (m_pNetworkReply)
+    {
+        m_pNetworkReply->disconnect(this);
+    }
+    NetworkRequest::abort();
+    flushJournal();
+    CloseFile(false);
+    m_journal.reset();
+}
+
+bool NetworkDownloadRequest::openResumableFile()
+{
+    m_strDstFilePath = NetworkRequestUtility::getFilePath(m_upContext.get(), m_strError);
+    if (m_strDstFilePath.isEmpty())
+    {
+        return false;
+    }
+
+    m_journal = std::make_unique<NetworkDownloadJournal>(m_strDstFilePath);
+    const QString strTempFilePath = NetworkDownloadJournal::tempFilePath(m_strDstFilePath);
+    m_nResumeOffset = 0;
+    m_bResponseChecked = false;
+    if (m_journal->load() && m_journal->url() == m_upContext->url && !m_journal->ifRange().isEmpty())
+    {
+        m_nResumeOffset = qMin(m_journal->completedPrefix(), QFileInfo(strTempFilePath).size());
+    }
+    if (m_nResumeOffset == 0)
+    {
+        m_journal->reset(m_upContext->url, 0, QByteArray(), QByteArray());
+    }
+
+    // Anything after the journaled bytes may not have reached the disk completely
+    if (!openStorage(strTempFilePath, true))
+    {
+        m_journal.reset();
+        return false;
+    }
+    if (!m_storage->resize(m_nResumeOffset))
+    {
+        m_strError = QString("File operation failed: Unable to resize file '%1' - %2").arg(strTempFilePath).arg(m_storage->lastError());
+        m_storage.reset();
+        m_journal.reset();
+        return false;
+    }
+    m_nBytesWritten = m_nResumeOffset;
+
+    if (m_nResumeOffset > 0)
+    {
+        qDebug() << "[NetworkDownloadRequest] Resume download from offset" << m_nResumeOffset;
+    }
+    return true;
+}
+
+bool NetworkDownloadRequest::checkResumeResponse()
+{
+    const int statusCode = m_pNetworkReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (statusCode < 200 || statusCode >= 300)
+    {
+        // Body of a redirection or an error page, not part of the file
+        m_pNetworkReply->readAll();
+        return false;
+    }
+    if (m_bResponseChecked)
+    {
+        return true;
+    }
+    m_bResponseChecked = true;
+
+    if (statusCode == 206 && m_nResumeOffset > 0)
+    {
+        // Content-Range: bytes <first>-<last>/<total>
+        const QByteArray contentRange = m_pNetworkReply->rawHeader("Content-Range");
+        const qint64 nFirst = contentRange.mid(contentRange.indexOf(' ') + 1).split('-').value(0).toLongLong();
+        if (nFirst != m_nResumeOffset)
+        {
+            m_strError = QString("Download error: Unexpected Content-Range '%1'").arg(QString::fromLatin1(contentRange));
+            m_pNetworkReply->abort();
+            return false;
+        }
+    }
+    else
+    {
+        // Full content: the server does not support ranges or the file changed, start over
+        if (m_nResumeOffset > 0)
+        {
+            qDebug() << "[NetworkDownloadRequest] Server did not resume, restart from offset 0";
+            m_storage->resize(0);
+            m_nResumeOffset = 0;
+            m_nBytesWritten = 0;
+        }
+        m_journal->reset(m_upContext->url,
+                         m_pNetworkReply->header(QNetworkRequest::ContentLengthHeader).toLongLong(),
+                         NetworkDownloadJournal::etagOf(m_pNetworkReply),
+                         NetworkDownloadJournal::lastModifiedOf(m_pNetworkReply));
+    }
+
+    // Identity encoding: the body is exactly the file, allocate its blocks up front
+    if (m_journal->totalSize() > m_nBytesWritten)
+    {
+        m_storage->resize(m_journal->totalSize());
+    }
+
+    // Batched: data and journal reach the disk once per interval, not per write
+    m_journal->save();
+    m_journalTimer.start();
+    return true;
+}
+
+void NetworkDownloadRequest::flushJournal()
+{
+    if (!m_journal || !m_storage || !m_storage->isOpen() || !m_bResponseChecked)
+    {
+        return;
+    }
+    // Data first: the journal must never claim bytes that are not on disk yet
+    if (!m_storage->flushDirty(true))
+    {
+        qDebug() << "[QMultiThreadNetwork] Journal not saved, flushing the data failed:" << m_storage->lastError();
+        return;
+    }
+    if (m_nBytesWritten > 0)
+    {
+        m_journal->addCompleted(0, m_nBytesWritten - 1);
+    }
+    m_journal->save();
+}
+
+bool NetworkDownloadRequest::renameTempFileToFinal()
+{
+    const QString strTempFilePath = NetworkDownloadJournal::tempFilePath(m_strDstFilePath);
+    if (QFile::exists(m_strDstFilePath))
+    {
+        if (!m_upContext->downloadConfig->overwriteFile || !QFile::remove(m_strDstFilePath))
+        {
+            m_strError = QString("File conflict: Target file already exists at '%1'").arg(m_strDstFilePath);
+            return false;
+        }
+    }
+    if (!QFile::rename(strTempFilePath, m_strDstFilePath))
+    {
+        m_strError = QString("File operation failed: Unable to rename '%1' to '%2'").arg(strTempFilePath).arg(m_strDstFilePath);
+        return false;
+    }
+    return true;
+}
@@ -5,13 +5,13 @@
 #include <QTimer>
 
 #include "networkrequest.h"
+#include "networkdownloadjournal.h"
+#include "networkdownloadstorage.h"
 
 #ifndef QT_NO_SSL
 #include <QSslError>
 #endif
 
-class QFile;
-
 namespace QtNetworkRequest
 {
 	// Download request
@@ -25,6 +25,7 @@ namespace QtNetworkRequest
 
 	public Q_SLOTS:
 		void start() Q_DECL_OVERRIDE;
+		void abort() Q_DECL_OVERRIDE;
 		void onFinished() Q_DECL_OVERRIDE;
 		void onReadyRead();
 		void onDownloadProgress(qint64 iReceived, qint64 iTotal);
@@ -35,12 +36,31 @@ namespace QtNetworkRequest
 #endif
 
 	private:
+		// Create the storage of DownloadConfig::storageBackend and open the file
+		bool openStorage(const QString &strFilePath, bool bKeepContent);
 		void CloseFile(bool bRemove);
+		// Write what the reply holds, within the bandwidth quota unless the reply finished
+		void readReply(bool bThrottled);
+		// Writing to the file failed: abort the reply, the download fails with strError
+		void failWrite(const QString &strError);
+
+		// Resumable download (DownloadConfig::resumable): open "<dst>.download", keeping the bytes its journal vouches for
+		bool openResumableFile();
+		// Check the status of the first response chunk, restart from offset 0 if the server did not resume
+		bool checkResumeResponse();
+		void flushJournal();
+		bool renameTempFileToFinal();
 
 	private:
-		std::unique_ptr<QFile> m_pFile;
-		QTimer m_timer;
-		int m_mIntervalMs{ 250 };
-		bool m_bTimeout = false;
+		std::unique_ptr<DownloadStorage> m_storage;
+		QString m_strFilePath;			// File being written
+		std::unique_ptr<NetworkDownloadJournal> m_journal;
+		QTimer m_journalTimer;
+		QTimer m_throttleTimer;			// Reads again once the bandwidth quota allows it
+		QString m_strDstFilePath;
+		qint64 m_nResumeOffset{ 0 };	// Bytes kept from the previous attempt
+		qint64 m_nBytesWritten{ 0 };	// Bytes in the file
+		bool m_bResponseChecked{ false };
+		QString m_strWriteError;		// Set by failWrite()
 	};
 }
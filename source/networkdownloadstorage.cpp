@@ -0,0 +1,1235 @@
+#include "networkdownloadstorage.h"
+#include "memorymappedfile.h"
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QIODevice>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <cstdlib>
+#include <limits>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#ifdef QT_MTNETWORK_IO_URING
+#include <liburing.h>
+#endif
+
+// Size of the write-combining buffer of a write stream, a multiple of every storage alignment
+#define WRITE_COMBINE_SIZE (1024 * 1024)
+// Free write-combining buffers kept for reuse
+#define MAX_FREE_BUFFERS 16
+// Windowed mapping: size of a window (a multiple of the page size and of the Windows allocation granularity),
+// and how many windows stay mapped when no writer uses them
+#define MAPPING_WINDOW_SIZE (64 * 1024 * 1024)
+#define MAX_MAPPED_WINDOWS 8
+#define IO_URING_QUEUE_DEPTH 32
+// Stack buffer of DownloadStorage::writeFrom() for backends without in-place writes
+#define READ_CHUNK_SIZE (16 * 1024)
+
+namespace QtNetworkRequest
+{
+
+namespace
+{
+#ifdef _WIN32
+const NativeFileHandle InvalidFileHandle = INVALID_HANDLE_VALUE;
+#else
+const NativeFileHandle InvalidFileHandle = -1;
+#endif
+
+QString systemErrorString()
+{
+#ifdef _WIN32
+    const DWORD errorCode = GetLastError();
+    LPWSTR messageBuffer = nullptr;
+    const DWORD size = FormatMessageW(
+        FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+        nullptr, errorCode, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPWSTR)&messageBuffer, 0, nullptr);
+    QString message = QString("System error: Unknown error occurred (code: %1)").arg(errorCode);
+    if (size > 0 && messageBuffer) {
+        message = QString::fromWCharArray(messageBuffer, size).trimmed();
+    }
+    if (messageBuffer) {
+        LocalFree(messageBuffer);
+    }
+    return message;
+#else
+    return QString::fromLocal8Bit(strerror(errno));
+#endif
+}
+
+void *alignedAlloc(qint64 size, qint64 alignment)
+{
+    alignment = qMax<qint64>(alignment, sizeof(void*));
+#ifdef _WIN32
+    return _aligned_malloc(static_cast<size_t>(size), static_cast<size_t>(alignment));
+#else
+    void *memory = nullptr;
+    return posix_memalign(&memory, static_cast<size_t>(alignment), static_cast<size_t>(size)) == 0 ? memory : nullptr;
+#endif
+}
+
+void alignedFree(void *memory)
+{
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+bool ensureDirectory(const QString &filePath, QString &strError)
+{
+    QDir dir = QFileInfo(filePath).absoluteDir();
+    if (!dir.exists() && !dir.mkpath(".")) {
+        strError = QString("File system error: Failed to create directory - %1").arg(dir.path());
+        return false;
+    }
+    return true;
+}
+
+NativeFileHandle openFile(const QString &filePath, bool keepContent)
+{
+#ifdef _WIN32
+    return CreateFileW(filePath.toStdWString().c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                       nullptr, keepContent ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+#else
+    return ::open(filePath.toUtf8().constData(), O_RDWR | O_CREAT | (keepContent ? 0 : O_TRUNC), 0666);
+#endif
+}
+
+void closeFile(NativeFileHandle &handle)
+{
+    if (handle == InvalidFileHandle) {
+        return;
+    }
+#ifdef _WIN32
+    CloseHandle(handle);
+#else
+    ::close(handle);
+#endif
+    handle = InvalidFileHandle;
+}
+
+qint64 fileSize(NativeFileHandle handle)
+{
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    return GetFileSizeEx(handle, &size) ? static_cast<qint64>(size.QuadPart) : -1;
+#else
+    struct stat st;
+    return fstat(handle, &st) == 0 ? static_cast<qint64>(st.st_size) : -1;
+#endif
+}
+
+// Logical block size of the device holding the file, 0 if unknown. POSIX reports the preferred I/O size of the
+// file system, a multiple of it
+qint64 logicalBlockSize(const QString &filePath, NativeFileHandle handle)
+{
+#ifdef _WIN32
+    Q_UNUSED(handle);
+    wchar_t volume[MAX_PATH + 1];
+    DWORD sectorsPerCluster, bytesPerSector, freeClusters, totalClusters;
+    if (!GetVolumePathNameW(QDir::toNativeSeparators(filePath).toStdWString().c_str(), volume, MAX_PATH + 1)
+        || !GetDiskFreeSpaceW(volume, &sectorsPerCluster, &bytesPerSector, &freeClusters, &totalClusters)) {
+        return 0;
+    }
+    return bytesPerSector;
+#else
+    Q_UNUSED(filePath);
+    struct stat st;
+    return fstat(handle, &st) == 0 ? static_cast<qint64>(st.st_blksize) : 0;
+#endif
+}
+
+bool truncateFile(NativeFileHandle handle, qint64 size)
+{
+#ifdef _WIN32
+    LARGE_INTEGER li;
+    li.QuadPart = size;
+    return SetFilePointerEx(handle, li, nullptr, FILE_BEGIN) && SetEndOfFile(handle);
+#else
+    return ftruncate(handle, size) == 0;
+#endif
+}
+
+// Write all of data at offset, the file position is not used
+bool positionalWrite(NativeFileHandle handle, qint64 offset, const char *data, qint64 size)
+{
+    while (size > 0) {
+#ifdef _WIN32
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+        overlapped.OffsetHigh = static_cast<DWORD>((offset >> 32) & 0xFFFFFFFF);
+        DWORD written = 0;
+        if (!WriteFile(handle, data, static_cast<DWORD>(qMin<qint64>(size, 0x40000000)), &written, &overlapped) || written == 0) {
+            return false;
+        }
+#else
+        const ssize_t written = ::pwrite(handle, data, static_cast<size_t>(size), offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+#endif
+        offset += written;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Start the write-back of a range (wait = false), or wait until the file data is on disk
+bool syncFile(NativeFileHandle handle, qint64 offset, qint64 size, bool wait)
+{
+#ifdef _WIN32
+    Q_UNUSED(offset);
+    Q_UNUSED(size);
+    return !wait || FlushFileBuffers(handle) != FALSE;
+#elif defined(__linux__)
+    if (!wait) {
+        return sync_file_range(handle, offset, size, SYNC_FILE_RANGE_WRITE) == 0;
+    }
+    return fdatasync(handle) == 0;
+#else
+    Q_UNUSED(offset);
+    Q_UNUSED(size);
+    // No range write-back outside Linux, the kernel writes the data back on its own
+    return !wait || fsync(handle) == 0;
+#endif
+}
+
+/**
+ * @brief The whole file mapped into memory (MemoryMappedFile)
+ */
+class MemoryMappedStorage : public DownloadStorage
+{
+public:
+    StorageBackend backend() const override { return StorageBackend::MemoryMapped; }
+
+    bool open(const QString &filePath, qint64 size, bool keepContent) override
+    {
+        return m_file.open(filePath, size, keepContent);
+    }
+    void close() override { m_file.close(); }
+    qint64 write(qint64 offset, const char *data, qint64 size) override { return m_file.write(offset, data, size); }
+    char *beginWrite(qint64 offset, qint64 maxSize, qint64 &size) override
+    {
+        size = 0;
+        if (!m_file.isOpen() || offset < 0 || offset >= m_file.size() || maxSize <= 0) {
+            return nullptr;
+        }
+        size = qMin(maxSize, m_file.size() - offset);
+        return static_cast<char*>(m_file.getMappedData()) + offset;
+    }
+    bool commitWrite(qint64 offset, qint64 size) override
+    {
+        m_file.markWritten(offset, size);
+        return true;
+    }
+    bool flushRange(qint64 offset, qint64 size, bool wait) override { return m_file.flushRange(offset, size, wait); }
+    bool flushDirty(bool wait) override { return m_file.flushDirty(wait); }
+    bool flush() override { return m_file.flush(); }
+    bool resize(qint64 size) override
+    {
+        Q_UNUSED(size);
+        return false;
+    }
+    void startBackgroundFlush(int intervalMs) override { m_file.startBackgroundFlush(intervalMs); }
+    bool isOpen() const override { return m_file.isOpen(); }
+    qint64 size() const override { return m_file.size(); }
+    QString lastError() const override { return m_file.lastError(); }
+
+private:
+    MemoryMappedFile m_file;
+};
+
+/**
+ * @brief MAPPING_WINDOW_SIZE windows of the file mapped on demand.
+ *        At most MAX_MAPPED_WINDOWS stay mapped while unused, the least recently used one is unmapped first
+ *        (its dirty pages stay in the page cache and are written back by the kernel or the next flush)
+ */
+class WindowedMappedStorage : public DownloadStorage
+{
+public:
+    WindowedMappedStorage()
+        : m_handle(InvalidFileHandle)
+#ifdef _WIN32
+        , m_mappingHandle(nullptr)
+#endif
+        , m_nSize(0)
+        , m_nUseCounter(0)
+    {
+    }
+    ~WindowedMappedStorage() { close(); }
+
+    StorageBackend backend() const override { return StorageBackend::WindowedMemoryMapped; }
+
+    bool open(const QString &filePath, qint64 size, bool keepContent) override
+    {
+        close();
+        QString strError;
+        if (size <= 0) {
+            setLastError(QString("Parameter error: Invalid file size specified - %1 bytes").arg(size));
+            return false;
+        }
+        if (!ensureDirectory(filePath, strError)) {
+            setLastError(strError);
+            return false;
+        }
+        m_handle = openFile(filePath, keepContent);
+        if (m_handle == InvalidFileHandle) {
+            setLastError(systemErrorString());
+            return false;
+        }
+        if (!allocateFileSpace(m_handle, size, strError)) {
+            setLastError(strError);
+            closeFile(m_handle);
+            return false;
+        }
+#ifdef _WIN32
+        // The mapping object of the whole file only reserves, the views map the windows
+        m_mappingHandle = CreateFileMappingW(m_handle, nullptr, PAGE_READWRITE,
+                                             static_cast<DWORD>((size >> 32) & 0xFFFFFFFF), static_cast<DWORD>(size & 0xFFFFFFFF), nullptr);
+        if (m_mappingHandle == nullptr) {
+            setLastError(systemErrorString());
+            closeFile(m_handle);
+            return false;
+        }
+#endif
+        m_nSize = size;
+        return true;
+    }
+
+    void close() override
+    {
+        std::lock_guard<std::mutex> lock(m_windowMutex);
+        for (std::pair<const qint64, Window> &window : m_windows) {
+            unmapWindow(window.second);
+        }
+        m_windows.clear();
+#ifdef _WIN32
+        if (m_mappingHandle != nullptr) {
+            CloseHandle(m_mappingHandle);
+            m_mappingHandle = nullptr;
+        }
+#endif
+        closeFile(m_handle);
+        m_nSize = 0;
+    }
+
+    qint64 write(qint64 offset, const char *data, qint64 size) override
+    {
+        if (!isOpen()) {
+            setLastError(QString("File operation error: File is not open or has been closed"));
+            return -1;
+        }
+        if (offset < 0 || offset >= m_nSize) {
+            setLastError(QString("Parameter error: Invalid file offset specified - %1").arg(offset));
+            return -1;
+        }
+        size = qMin(size, m_nSize - offset);
+
+        qint64 written = 0;
+        while (written < size) {
+            const qint64 position = offset + written;
+            const qint64 index = position / MAPPING_WINDOW_SIZE;
+            quint8 *window = acquireWindow(index);
+            if (window == nullptr) {
+                return -1;
+            }
+            const qint64 windowOffset = position - index * MAPPING_WINDOW_SIZE;
+            const qint64 count = qMin(size - written, MAPPING_WINDOW_SIZE - windowOffset);
+            // Outside the lock, writers of other ranges (and windows) are not serialized
+            memcpy(window + windowOffset, data + written, static_cast<size_t>(count));
+            releaseWindow(index);
+            written += count;
+        }
+        return written;
+    }
+
+    char *beginWrite(qint64 offset, qint64 maxSize, qint64 &size) override
+    {
+        size = 0;
+        if (!isOpen() || offset < 0 || offset >= m_nSize || maxSize <= 0) {
+            return nullptr;
+        }
+        // The window stays mapped until commitWrite()
+        const qint64 index = offset / MAPPING_WINDOW_SIZE;
+        quint8 *window = acquireWindow(index);
+        if (window == nullptr) {
+            return nullptr;
+        }
+        const qint64 windowOffset = offset - index * MAPPING_WINDOW_SIZE;
+        size = qMin(qMin(maxSize, m_nSize - offset), MAPPING_WINDOW_SIZE - windowOffset);
+        return reinterpret_cast<char*>(window + windowOffset);
+    }
+
+    bool commitWrite(qint64 offset, qint64 size) override
+    {
+        Q_UNUSED(size);
+        releaseWindow(offset / MAPPING_WINDOW_SIZE);
+        return true;
+    }
+
+    bool flushRange(qint64 offset, qint64 size, bool wait) override
+    {
+        if (!isOpen()) {
+            return false;
+        }
+        if (offset < 0 || size <= 0 || offset >= m_nSize) {
+            return true;
+        }
+        size = qMin(size, m_nSize - offset);
+        bool bRet = true;
+#ifndef __linux__
+        // Hand the dirty pages of the mapped windows to the file first, sync_file_range does without on Linux
+        std::lock_guard<std::mutex> lock(m_windowMutex);
+        for (std::pair<const qint64, Window> &window : m_windows) {
+            const qint64 windowStart = window.first * MAPPING_WINDOW_SIZE;
+            const qint64 first = qMax(offset, windowStart);
+            const qint64 last = qMin(offset + size, windowStart + window.second.size);
+            if (first >= last) {
+                continue;
+            }
+            const qint64 alignedFirst = first - first % MemoryMappedFile::pageSize();
+#ifdef _WIN32
+            bRet = FlushViewOfFile(window.second.data + (alignedFirst - windowStart), static_cast<SIZE_T>(last - alignedFirst)) && bRet;
+#else
+            bRet = msync(window.second.data + (alignedFirst - windowStart), static_cast<size_t>(last - alignedFirst), wait ? MS_SYNC : MS_ASYNC) == 0 && bRet;
+#endif
+        }
+#endif
+        return syncFile(m_handle, offset, size, wait) && bRet;
+    }
+
+    bool flushDirty(bool wait) override { return flushRange(0, m_nSize, wait); }
+
+    bool resize(qint64 size) override
+    {
+        Q_UNUSED(size);
+        return false;
+    }
+
+    bool isOpen() const override { return m_handle != InvalidFileHandle; }
+    qint64 size() const override { return m_nSize; }
+    QString lastError() const override
+    {
+        std::lock_guard<std::mutex> lock(m_errorMutex);
+        return m_lastError;
+    }
+
+private:
+    struct Window
+    {
+        quint8 *data;
+        qint64 size;
+        int refs;
+        quint64 lastUse;
+    };
+
+    quint8 *acquireWindow(qint64 index)
+    {
+        std::lock_guard<std::mutex> lock(m_windowMutex);
+        std::map<qint64, Window>::iterator iter = m_windows.find(index);
+        if (iter == m_windows.end()) {
+            evictWindows();
+            Window window = { nullptr, qMin<qint64>(MAPPING_WINDOW_SIZE, m_nSize - index * MAPPING_WINDOW_SIZE), 0, 0 };
+            const qint64 offset = index * MAPPING_WINDOW_SIZE;
+#ifdef _WIN32
+            window.data = static_cast<quint8*>(MapViewOfFile(m_mappingHandle, FILE_MAP_ALL_ACCESS,
+                                                             static_cast<DWORD>((offset >> 32) & 0xFFFFFFFF), static_cast<DWORD>(offset & 0xFFFFFFFF),
+                                                             static_cast<SIZE_T>(window.size)));
+#else
+            void *data = mmap(nullptr, static_cast<size_t>(window.size), PROT_READ | PROT_WRITE, MAP_SHARED, m_handle, offset);
+            window.data = data == MAP_FAILED ? nullptr : static_cast<quint8*>(data);
+#endif
+            if (window.data == nullptr) {
+                setLastError(systemErrorString());
+                return nullptr;
+            }
+            iter = m_windows.insert(std::make_pair(index, window)).first;
+        }
+        ++iter->second.refs;
+        iter->second.lastUse = ++m_nUseCounter;
+        return iter->second.data;
+    }
+
+    void releaseWindow(qint64 index)
+    {
+        std::lock_guard<std::mutex> lock(m_windowMutex);
+        std::map<qint64, Window>::iterator iter = m_windows.find(index);
+        if (iter != m_windows.end()) {
+            --iter->second.refs;
+        }
+    }
+
+    // Make room for one more window (m_windowMutex held). Windows in use are never unmapped, so there may be more of them
+    void evictWindows()
+    {
+        while (static_cast<int>(m_windows.size()) >= MAX_MAPPED_WINDOWS) {
+            std::map<qint64, Window>::iterator victim = m_windows.end();
+            for (std::map<qint64, Window>::iterator iter = m_windows.begin(); iter != m_windows.end(); ++iter) {
+                if (iter->second.refs == 0 && (victim == m_windows.end() || iter->second.lastUse < victim->second.lastUse)) {
+                    victim = iter;
+                }
+            }
+            if (victim == m_windows.end()) {
+                return;
+            }
+            unmapWindow(victim->second);
+            m_windows.erase(victim);
+        }
+    }
+
+    void unmapWindow(Window &window)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(window.data);
+#else
+        munmap(window.data, static_cast<size_t>(window.size));
+#endif
+        window.data = nullptr;
+    }
+
+    void setLastError(const QString &error) const
+    {
+        std::lock_guard<std::mutex> lock(m_errorMutex);
+        m_lastError = error;
+        qWarning() << "[DownloadStorage] Error:" << error;
+    }
+
+    NativeFileHandle m_handle;
+#ifdef _WIN32
+    HANDLE m_mappingHandle;
+#endif
+    qint64 m_nSize;
+
+    std::mutex m_windowMutex;
+    std::map<qint64, Window> m_windows;
+    quint64 m_nUseCounter;
+
+    mutable std::mutex m_errorMutex;
+    mutable QString m_lastError;
+};
+
+/**
+ * @brief Positional writes (pwrite / WriteFile at an offset) through write-combining buffers
+ *
+ * Every write stream (a run of writes each starting where the previous one ended) fills its own buffer,
+ * the file sees WRITE_COMBINE_SIZE writes instead of one per network read. Base of the direct I/O and io_uring backends.
+ */
+class PositionalWriteStorage : public DownloadStorage
+{
+public:
+    PositionalWriteStorage()
+        : m_handle(InvalidFileHandle)
+        , m_nSize(0)
+        , m_bFixedSize(false)
+    {
+    }
+    ~PositionalWriteStorage() { closeStorage(); }
+
+    StorageBackend backend() const override { return StorageBackend::PositionalWrite; }
+
+    bool open(const QString &filePath, qint64 size, bool keepContent) override
+    {
+        close();
+        QString strError;
+        if (!ensureDirectory(filePath, strError)) {
+            setLastError(strError);
+            return false;
+        }
+        if (!openHandles(filePath, keepContent)) {
+            closeHandles();
+            return false;
+        }
+        if (size > 0 && !allocateFileSpace(m_handle, size, strError)) {
+            setLastError(strError);
+            closeHandles();
+            return false;
+        }
+        m_bFixedSize = size > 0;
+        m_nSize = size > 0 ? size : qMax<qint64>(0, fileSize(m_handle));
+        return true;
+    }
+
+    void close() override { closeStorage(); }
+
+    qint64 write(qint64 offset, const char *data, qint64 size) override
+    {
+        if (!isOpen()) {
+            setLastError(QString("File operation error: File is not open or has been closed"));
+            return -1;
+        }
+        if (offset < 0 || (m_bFixedSize && offset >= m_nSize)) {
+            setLastError(QString("Parameter error: Invalid file offset specified - %1").arg(offset));
+            return -1;
+        }
+        if (size <= 0) {
+            return 0;
+        }
+        if (m_bFixedSize) {
+            size = qMin(size, m_nSize - offset);
+        }
+
+        std::unique_ptr<Buffer> buffer = takeBuffer(offset);
+        if (!buffer) {
+            return -1;
+        }
+
+        qint64 written = 0;
+        while (written < size) {
+            const qint64 count = qMin(size - written, WRITE_COMBINE_SIZE - buffer->lead - buffer->length);
+            memcpy(buffer->data() + buffer->length, data + written, static_cast<size_t>(count));
+            buffer->length += count;
+            written += count;
+            if (buffer->lead + buffer->length < WRITE_COMBINE_SIZE) {
+                continue;
+            }
+            const qint64 next = buffer->offset + buffer->length;
+            if (!storeBuffer(std::move(buffer))) {
+                return -1;
+            }
+            buffer = takeBuffer(next);
+            if (!buffer) {
+                return -1;
+            }
+        }
+        growSize(offset + size);
+        return storeBuffer(std::move(buffer)) ? size : -1;
+    }
+
+    char *beginWrite(qint64 offset, qint64 maxSize, qint64 &size) override
+    {
+        size = 0;
+        if (!isOpen() || offset < 0 || maxSize <= 0 || (m_bFixedSize && offset >= m_nSize)) {
+            return nullptr;
+        }
+        if (m_bFixedSize) {
+            maxSize = qMin(maxSize, m_nSize - offset);
+        }
+        // The region is the free tail of the stream's buffer, parked until commitWrite()
+        std::unique_ptr<Buffer> buffer = takeBuffer(offset);
+        if (!buffer) {
+            return nullptr;
+        }
+        size = qMin(maxSize, WRITE_COMBINE_SIZE - buffer->lead - buffer->length);
+        char *region = buffer->data() + buffer->length;
+        std::lock_guard<std::mutex> lock(m_bufferMutex);
+        m_reserved[offset] = std::move(buffer);
+        return region;
+    }
+
+    bool commitWrite(qint64 offset, qint64 size) override
+    {
+        std::unique_ptr<Buffer> buffer;
+        {
+            std::lock_guard<std::mutex> lock(m_bufferMutex);
+            std::map<qint64, std::unique_ptr<Buffer>>::iterator iter = m_reserved.find(offset);
+            if (iter == m_reserved.end()) {
+                return false;
+            }
+            buffer = std::move(iter->second);
+            m_reserved.erase(iter);
+        }
+        buffer->length += qMax<qint64>(0, size);
+        growSize(offset + size);
+        return storeBuffer(std::move(buffer));
+    }
+
+    bool flushRange(qint64 offset, qint64 size, bool wait) override
+    {
+        if (!isOpen()) {
+            return false;
+        }
+        if (offset < 0 || size <= 0) {
+            return true;
+        }
+        bool bRet = writeBuffers(offset, size);
+        bRet = waitForWrites() && bRet;
+        return syncFile(m_handle, offset, size, wait) && bRet;
+    }
+
+    bool flushDirty(bool wait) override
+    {
+        if (!isOpen()) {
+            return false;
+        }
+        bool bRet = writeBuffers(0, std::numeric_limits<qint64>::max());
+        bRet = waitForWrites() && bRet;
+        return syncFile(m_handle, 0, 0, wait) && bRet;
+    }
+
+    bool resize(qint64 size) override
+    {
+        if (!isOpen() || size < 0) {
+            return false;
+        }
+        bool bRet = writeBuffers(0, std::numeric_limits<qint64>::max());
+        bRet = waitForWrites() && bRet;
+        if (!bRet) {
+            return false;
+        }
+        QString strError;
+        if (size > fileSize(m_handle)) {
+            if (!allocateFileSpace(m_handle, size, strError)) {
+                setLastError(strError);
+                return false;
+            }
+        } else if (!truncateFile(m_handle, size)) {
+            setLastError(systemErrorString());
+            return false;
+        }
+        m_nSize = size;
+        return true;
+    }
+
+    bool isOpen() const override { return m_handle != InvalidFileHandle; }
+    qint64 size() const override { return m_nSize; }
+    QString lastError() const override
+    {
+        std::lock_guard<std::mutex> lock(m_errorMutex);
+        return m_lastError;
+    }
+
+protected:
+    struct Buffer
+    {
+        Buffer(qint64 alignment)
+            : memory(static_cast<char*>(alignedAlloc(WRITE_COMBINE_SIZE, alignment))), lead(0), offset(0), length(0)
+        {
+        }
+        ~Buffer() { alignedFree(memory); }
+        char *data() { return memory + lead; }
+
+        char *memory;   // WRITE_COMBINE_SIZE bytes aligned to the storage alignment
+        qint64 lead;    // Unused bytes in front of the data, file offsets and memory addresses share their alignment
+        qint64 offset;  // File offset of data()
+        qint64 length;
+    };
+
+    // Open / close the file handles, a backend may need more than m_handle
+    virtual bool openHandles(const QString &filePath, bool keepContent)
+    {
+        m_handle = openFile(filePath, keepContent);
+        if (m_handle == InvalidFileHandle) {
+            setLastError(systemErrorString());
+            return false;
+        }
+        return true;
+    }
+    virtual void closeHandles() { closeFile(m_handle); }
+
+    // File offset alignment of the buffers (a full buffer ends at an aligned offset)
+    virtual qint64 alignment() const { return 1; }
+
+    // Write a full or flushed buffer. An asynchronous backend takes it over (resets the pointer)
+    virtual bool writeBuffer(std::unique_ptr<Buffer> &buffer)
+    {
+        if (!positionalWrite(m_handle, buffer->offset, buffer->data(), buffer->length)) {
+            setLastError(systemErrorString());
+            return false;
+        }
+        return true;
+    }
+
+    // Wait for the writes taken over by writeBuffer()
+    virtual bool waitForWrites() { return true; }
+
+    // Write out the buffers, wait for them and close the handles. Called by the most derived destructor,
+    // the virtual functions of a destroyed subclass are gone in ~PositionalWriteStorage()
+    void closeStorage()
+    {
+        if (isOpen()) {
+            writeBuffers(0, std::numeric_limits<qint64>::max());
+            waitForWrites();
+            closeHandles();
+        }
+        std::lock_guard<std::mutex> lock(m_bufferMutex);
+        m_buffers.clear();
+        m_reserved.clear();
+        m_freeBuffers.clear();
+        m_nSize = 0;
+        m_bFixedSize = false;
+    }
+
+    // The buffer of the stream writing at offset: the one ending there (this stream's,
+    // or a finished neighbour's whose data is contiguous with ours), or a new one
+    std::unique_ptr<Buffer> takeBuffer(qint64 offset)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_bufferMutex);
+            std::map<qint64, std::unique_ptr<Buffer>>::iterator iter = m_buffers.find(offset);
+            if (iter != m_buffers.end()) {
+                std::unique_ptr<Buffer> buffer = std::move(iter->second);
+                m_buffers.erase(iter);
+                return buffer;
+            }
+        }
+        std::unique_ptr<Buffer> buffer = acquireBuffer(offset);
+        if (!buffer) {
+            setLastError(QString("Memory error: Failed to allocate a write buffer"));
+        }
+        return buffer;
+    }
+
+    // Give a buffer back after writing to it: written out if full (ending at an aligned offset), pending otherwise
+    bool storeBuffer(std::unique_ptr<Buffer> buffer)
+    {
+        if (buffer->lead + buffer->length >= WRITE_COMBINE_SIZE) {
+            const bool bRet = writeBuffer(buffer);
+            if (buffer) {
+                releaseBuffer(std::move(buffer));
+            }
+            return bRet;
+        }
+        if (buffer->length == 0) {
+            releaseBuffer(std::move(buffer));
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(m_bufferMutex);
+        const qint64 end = buffer->offset + buffer->length;
+        m_buffers[end] = std::move(buffer);
+        return true;
+    }
+
+    // A growing file: size() is the end of the data written so far
+    void growSize(qint64 end)
+    {
+        if (m_bFixedSize) {
+            return;
+        }
+        qint64 size = m_nSize.load();
+        while (size < end && !m_nSize.compare_exchange_weak(size, end)) {
+        }
+    }
+
+    std::unique_ptr<Buffer> acquireBuffer(qint64 offset)
+    {
+        std::unique_ptr<Buffer> buffer;
+        {
+            std::lock_guard<std::mutex> lock(m_bufferMutex);
+            if (!m_freeBuffers.empty()) {
+                buffer = std::move(m_freeBuffers.back());
+                m_freeBuffers.pop_back();
+            }
+        }
+        if (!buffer) {
+            buffer.reset(new Buffer(alignment()));
+            if (buffer->memory == nullptr) {
+                return std::unique_ptr<Buffer>();
+            }
+        }
+        buffer->lead = offset % alignment();
+        buffer->offset = offset;
+        buffer->length = 0;
+        return buffer;
+    }
+
+    void releaseBuffer(std::unique_ptr<Buffer> buffer)
+    {
+        std::lock_guard<std::mutex> lock(m_bufferMutex);
+        if (buffer && m_freeBuffers.size() < MAX_FREE_BUFFERS) {
+            m_freeBuffers.push_back(std::move(buffer));
+        }
+    }
+
+    void setLastError(const QString &error) const
+    {
+        std::lock_guard<std::mutex> lock(m_errorMutex);
+        m_lastError = error;
+        qWarning() << "[DownloadStorage] Error:" << error;
+    }
+
+    NativeFileHandle m_handle;
+
+private:
+    // Write out the buffers holding data of [offset, offset + size)
+    bool writeBuffers(qint64 offset, qint64 size)
+    {
+        std::vector<std::unique_ptr<Buffer>> buffers;
+        {
+            std::lock_guard<std::mutex> lock(m_bufferMutex);
+            std::map<qint64, std::unique_ptr<Buffer>>::iterator iter = m_buffers.upper_bound(offset);
+            while (iter != m_buffers.end()) {
+                if (iter->second->offset - offset >= size) {
+                    ++iter;
+                    continue;
+                }
+                buffers.push_back(std::move(iter->second));
+                iter = m_buffers.erase(iter);
+            }
+        }
+        bool bRet = true;
+        for (std::unique_ptr<Buffer> &buffer : buffers) {
+            bRet = writeBuffer(buffer) && bRet;
+            if (buffer) {
+                releaseBuffer(std::move(buffer));
+            }
+        }
+        return bRet;
+    }
+
+    std::atomic<qint64> m_nSize;
+    bool m_bFixedSize;
+
+    // Pending buffers keyed by the file offset following their data (where the next write of their stream lands)
+    std::mutex m_bufferMutex;
+    std::map<qint64, std::unique_ptr<Buffer>> m_buffers;
+    // Buffers handed out by beginWrite(), keyed by the region offset
+    std::map<qint64, std::unique_ptr<Buffer>> m_reserved;
+    std::vector<std::unique_ptr<Buffer>> m_freeBuffers;
+
+    mutable std::mutex m_errorMutex;
+    mutable QString m_lastError;
+};
+
+/**
+ * @brief Positional writes bypassing the page cache, a download does not evict the cache of everything else.
+ *        The aligned middle of every buffer goes through the direct handle, the unaligned head and tail of a stream
+ *        (range boundaries, early flushes) through the buffered one. They never share a page
+ */
+class DirectIOStorage : public PositionalWriteStorage
+{
+public:
+    DirectIOStorage() : m_directHandle(InvalidFileHandle), m_nAlignment(MemoryMappedFile::pageSize()) {}
+    ~DirectIOStorage() { closeStorage(); }
+
+    StorageBackend backend() const override { return StorageBackend::DirectIO; }
+
+protected:
+    bool openHandles(const QString &filePath, bool keepContent) override
+    {
+        if (!PositionalWriteStorage::openHandles(filePath, keepContent)) {
+            return false;
+        }
+#ifdef _WIN32
+        m_directHandle = CreateFileW(filePath.toStdWString().c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                     nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, nullptr);
+#elif defined(O_DIRECT)
+        m_directHandle = ::open(filePath.toUtf8().constData(), O_WRONLY | O_DIRECT);
+#else
+        m_directHandle = ::open(filePath.toUtf8().constData(), O_WRONLY);
+#if defined(F_NOCACHE)
+        if (m_directHandle != InvalidFileHandle) {
+            fcntl(m_directHandle, F_NOCACHE, 1);
+        }
+#endif
+#endif
+        if (m_directHandle == InvalidFileHandle) {
+            // e.g. tmpfs has no O_DIRECT
+            qWarning() << "[DownloadStorage] Direct I/O not available, using buffered writes:" << systemErrorString();
+        }
+        // Offsets, sizes and memory of direct I/O are aligned to the block size (a power of 2), whole buffers still
+        // have to end at aligned offsets
+        const qint64 blockSize = logicalBlockSize(filePath, m_handle);
+        m_nAlignment = MemoryMappedFile::pageSize();
+        if (blockSize > 0 && (blockSize & (blockSize - 1)) == 0 && blockSize <= WRITE_COMBINE_SIZE) {
+            m_nAlignment = qMax(m_nAlignment, blockSize);
+        }
+        return true;
+    }
+
+    void closeHandles() override
+    {
+        closeFile(m_directHandle);
+        PositionalWriteStorage::closeHandles();
+    }
+
+    qint64 alignment() const override { return m_nAlignment; }
+
+    bool writeBuffer(std::unique_ptr<Buffer> &buffer) override
+    {
+        const qint64 begin = buffer->offset;
+        const qint64 end = buffer->offset + buffer->length;
+        const qint64 first = (begin + m_nAlignment - 1) / m_nAlignment * m_nAlignment;
+        const qint64 last = end / m_nAlignment * m_nAlignment;
+        if (m_directHandle == InvalidFileHandle || last <= first) {
+            return PositionalWriteStorage::writeBuffer(buffer);
+        }
+
+        const char *data = buffer->data();
+        if ((first > begin && !positionalWrite(m_handle, begin, data, first - begin))
+            || !positionalWrite(m_directHandle, first, data + (first - begin), last - first)
+            || (end > last && !positionalWrite(m_handle, last, data + (last - begin), end - last))) {
+            setLastError(systemErrorString());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    NativeFileHandle m_directHandle;
+    qint64 m_nAlignment;    // Page size or logical block size of the device, the larger
+};
+
+#ifdef QT_MTNETWORK_IO_URING
+/**
+ * @brief Buffers are submitted to an io_uring and written asynchronously, the writer goes on filling the next one.
+ *        Errors of the asynchronous writes are reported by the next flush
+ */
+class IoUringStorage : public PositionalWriteStorage
+{
+public:
+    IoUringStorage() : m_bRingReady(false), m_nInflight(0), m_bWriteFailed(false) {}
+    ~IoUringStorage() { closeStorage(); }
+
+    StorageBackend backend() const override { return StorageBackend::IoUring; }
+
+protected:
+    bool openHandles(const QString &filePath, bool keepContent) override
+    {
+        if (!PositionalWriteStorage::openHandles(filePath, keepContent)) {
+            return false;
+        }
+        const int ret = io_uring_queue_init(IO_URING_QUEUE_DEPTH, &m_ring, 0);
+        m_bRingReady = ret == 0;
+        if (!m_bRingReady) {
+            qWarning() << "[DownloadStorage] io_uring not available, using synchronous writes:" << strerror(-ret);
+        }
+        return true;
+    }
+
+    void closeHandles() override
+    {
+        if (m_bRingReady) {
+            waitForWrites();
+            io_uring_queue_exit(&m_ring);
+            m_bRingReady = false;
+        }
+        PositionalWriteStorage::closeHandles();
+    }
+
+    bool writeBuffer(std::unique_ptr<Buffer> &buffer) override
+    {
+        if (!m_bRingReady) {
+            return PositionalWriteStorage::writeBuffer(buffer);
+        }
+        std::lock_guard<std::mutex> lock(m_ringMutex);
+        while (m_nInflight >= IO_URING_QUEUE_DEPTH) {
+            if (!reap(true)) {
+                return false;
+            }
+        }
+        if (!submit(buffer.get())) {
+            return false;
+        }
+        buffer.release();
+        reap(false);
+        return true;
+    }
+
+    bool waitForWrites() override
+    {
+        if (!m_bRingReady) {
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(m_ringMutex);
+        while (m_nInflight > 0) {
+            if (!reap(true)) {
+                break;
+            }
+        }
+        const bool bRet = !m_bWriteFailed && m_nInflight == 0;
+        m_bWriteFailed = false;
+        return bRet;
+    }
+
+private:
+    // m_ringMutex held
+    bool submit(Buffer *buffer)
+    {
+        io_uring_sqe *sqe = io_uring_get_sqe(&m_ring);
+        if (sqe == nullptr) {
+            setLastError(QString("File operation error: io_uring submission queue is full"));
+            return false;
+        }
+        io_uring_prep_write(sqe, m_handle, buffer->data(), static_cast<unsigned>(buffer->length), static_cast<__u64>(buffer->offset));
+        io_uring_sqe_set_data(sqe, buffer);
+        const int ret = io_uring_submit(&m_ring);
+        if (ret < 0) {
+            setLastError(QString::fromLocal8Bit(strerror(-ret)));
+            return false;
+        }
+        ++m_nInflight;
+        return true;
+    }
+
+    // Handle the completions, waiting for at least one if wait is set (m_ringMutex held)
+    bool reap(bool wait)
+    {
+        io_uring_cqe *cqe = nullptr;
+        int ret = wait ? io_uring_wait_cqe(&m_ring, &cqe) : io_uring_peek_cqe(&m_ring, &cqe);
+        while (ret == 0 && cqe != nullptr) {
+            std::unique_ptr<Buffer> buffer(static_cast<Buffer*>(io_uring_cqe_get_data(cqe)));
+            const int result = cqe->res;
+            io_uring_cqe_seen(&m_ring, cqe);
+            --m_nInflight;
+
+            if (result < 0 || (result == 0 && buffer->length > 0)) {
+                setLastError(QString::fromLocal8Bit(strerror(result < 0 ? -result : EIO)));
+                m_bWriteFailed = true;
+            } else if (result < buffer->length) {
+                // Short write, submit the rest
+                buffer->lead += result;
+                buffer->offset += result;
+                buffer->length -= result;
+                if (submit(buffer.get())) {
+                    buffer.release();
+                } else {
+                    m_bWriteFailed = true;
+                }
+            }
+            if (buffer) {
+                releaseBuffer(std::move(buffer));
+            }
+            ret = io_uring_peek_cqe(&m_ring, &cqe);
+        }
+        if (wait && ret < 0 && ret != -EAGAIN) {
+            setLastError(QString::fromLocal8Bit(strerror(-ret)));
+            m_bWriteFailed = true;
+            return false;
+        }
+        return true;
+    }
+
+    io_uring m_ring;
+    bool m_bRingReady;
+    std::mutex m_ringMutex;
+    int m_nInflight;
+    bool m_bWriteFailed;
+};
+#endif // QT_MTNETWORK_IO_URING
+
+} // namespace
+
+bool allocateFileSpace(NativeFileHandle handle, qint64 size, QString &strError)
+{
+#ifdef _WIN32
+    // Reserve the clusters, then set the end of file
+    FILE_ALLOCATION_INFO allocation;
+    allocation.AllocationSize.QuadPart = size;
+    if (!SetFileInformationByHandle(handle, FileAllocationInfo, &allocation, sizeof(allocation))) {
+        qDebug() << "[DownloadStorage] Failed to reserve disk space:" << systemErrorString();
+    }
+    if (!truncateFile(handle, size)) {
+        strError = systemErrorString();
+        return false;
+    }
+    LARGE_INTEGER li;
+    li.QuadPart = 0;
+    SetFilePointerEx(handle, li, nullptr, FILE_BEGIN);
+    return true;
+#else
+#if defined(__linux__)
+    // Unlike posix_fallocate, fails on file systems without support instead of writing zeros over the whole file
+    if (fallocate(handle, 0, 0, size) == -1 && errno != EOPNOTSUPP && errno != ENOSYS) {
+        strError = systemErrorString();
+        return false;
+    }
+#elif defined(__APPLE__)
+    const qint64 current = fileSize(handle);
+    if (current >= 0 && current < size) {
+        fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, size - current, 0 };
+        if (fcntl(handle, F_PREALLOCATE, &store) == -1) {
+            store.fst_flags = F_ALLOCATEALL;
+            if (fcntl(handle, F_PREALLOCATE, &store) == -1 && errno == ENOSPC) {
+                strError = systemErrorString();
+                return false;
+            }
+        }
+    }
+#endif
+    // Sets the size where fallocate had no effect on it: shrinking, or no allocation support
+    if (fileSize(handle) != size && ftruncate(handle, size) == -1) {
+        strError = systemErrorString();
+        return false;
+    }
+    return true;
+#endif
+}
+
+qint64 DownloadStorage::writeFrom(QIODevice *device, qint64 offset, qint64 maxSize)
+{
+    qint64 total = 0;
+    while (total < maxSize) {
+        qint64 nRead = 0;
+        qint64 nRegion = 0;
+        char *region = beginWrite(offset + total, maxSize - total, nRegion);
+        if (region != nullptr) {
+            nRead = device->read(region, nRegion);
+            if (!commitWrite(offset + total, qMax<qint64>(0, nRead))) {
+                return -1;
+            }
+        } else {
+            char buffer[READ_CHUNK_SIZE];
+            nRead = device->read(buffer, qMin<qint64>(READ_CHUNK_SIZE, maxSize - total));
+            if (nRead > 0 && write(offset + total, buffer, nRead) != nRead) {
+                return -1;
+            }
+        }
+        if (nRead <= 0) {
+            break;
+        }
+        total += nRead;
+    }
+    return total;
+}
+
+std::unique_ptr<DownloadStorage> DownloadStorage::create(StorageBackend backend, bool multiSegment)
+{
+    if (backend == StorageBackend::Auto) {
+        backend = multiSegment ? StorageBackend::MemoryMapped : StorageBackend::PositionalWrite;
+    }
+    if (!multiSegment && (backend == StorageBackend::MemoryMapped || backend == StorageBackend::WindowedMemoryMapped)) {
+        // A mapping needs the final size up front
+        backend = StorageBackend::PositionalWrite;
+    }
+
+    switch (backend) {
+    case StorageBackend::MemoryMapped:
+        return std::unique_ptr<DownloadStorage>(new MemoryMappedStorage);
+    case StorageBackend::WindowedMemoryMapped:
+        return std::unique_ptr<DownloadStorage>(new WindowedMappedStorage);
+    case StorageBackend::DirectIO:
+        return std::unique_ptr<DownloadStorage>(new DirectIOStorage);
+    case StorageBackend::IoUring:
+#ifdef QT_MTNETWORK_IO_URING
+        return std::unique_ptr<DownloadStorage>(new IoUringStorage);
+#else
+        qDebug() << "[DownloadStorage] Built without io_uring support, using positional writes";
+        return std::unique_ptr<DownloadStorage>(new PositionalWriteStorage);
+#endif
+    case StorageBackend::PositionalWrite:
+    default:
+        return std::unique_ptr<DownloadStorage>(new PositionalWriteStorage);
+    }
+}
+
+const char *DownloadStorage::backendName(StorageBackend backend)
+{
+    switch (backend) {
+    case StorageBackend::Auto: return "auto";
+    case StorageBackend::MemoryMapped: return "mmap";
+    case StorageBackend::WindowedMemoryMapped: return "windowed-mmap";
+    case StorageBackend::PositionalWrite: return "pwrite";
+    case StorageBackend::DirectIO: return "direct-io";
+    case StorageBackend::IoUring: return "io_uring";
+    }
+    return "unknown";
+}
+
+} // namespace QtNetworkRequest
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <QString>
+#include <memory>
+
+#include "networkrequestdefs.h"
+
+class QIODevice;
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace QtNetworkRequest
+{
+#ifdef _WIN32
+    typedef HANDLE NativeFileHandle;
+#else
+    typedef int NativeFileHandle;
+#endif
+
+    /**
+     * @brief Reserve the disk blocks of [0, size) and set the file size to size
+     *        (fallocate / F_PREALLOCATE / FileAllocationInfo, a sparse resize where the file system has no support),
+     *        so a full disk fails the download up front instead of a write (or a page fault) in the middle of it
+     * @return Success status, strError is set on failure
+     */
+    bool allocateFileSpace(NativeFileHandle handle, qint64 size, QString &strError);
+
+    /**
+     * @brief Destination file of a download (DownloadConfig::storageBackend)
+     *
+     * Shared by the single stream and the multi-threaded download paths.
+     * write() may be called concurrently as long as the writers write disjoint ranges,
+     * a flush covers the writes that returned before it.
+     */
+    class DownloadStorage
+    {
+    public:
+        virtual ~DownloadStorage() {}
+
+        /**
+         * @brief Create a storage of the given backend
+         * @param backend Requested backend. Auto and backends not available in this build fall back to a supported one
+         * @param multiSegment Multi-threaded download (final size known up front, random access).
+         *        A single stream download does not know its size when opening the file, the mapped backends are not used for it
+         */
+        static std::unique_ptr<DownloadStorage> create(StorageBackend backend, bool multiSegment);
+        static const char *backendName(StorageBackend backend);
+
+        virtual StorageBackend backend() const = 0;
+
+        /**
+         * @brief Open or create the file
+         * @param filePath File path
+         * @param size Final file size, allocated up front. 0 = unknown, the file grows with the writes
+         * @param keepContent Keep the existing content of the file (resume a download) instead of truncating it
+         * @return Success status
+         */
+        virtual bool open(const QString &filePath, qint64 size, bool keepContent = false) = 0;
+
+        /**
+         * @brief Write out buffered data and close the file
+         */
+        virtual void close() = 0;
+
+        /**
+         * @brief Write data to specified position (possibly buffered until the next flush)
+         * @return Bytes accepted, -1 indicates failure
+         */
+        virtual qint64 write(qint64 offset, const char *data, qint64 size) = 0;
+
+        /**
+         * @brief Writable memory of the file at offset, filled in place (e.g. by QIODevice::read()) and completed by commitWrite().
+         *        One region per write stream at a time, regions of different streams must not overlap
+         * @param offset File offset
+         * @param maxSize Wanted bytes
+         * @param size Bytes available at the returned address (up to maxSize, less at the end of a mapping window or a buffer)
+         * @return nullptr if the backend has no such memory or on failure, write() is the way then
+         */
+        virtual char *beginWrite(qint64 offset, qint64 maxSize, qint64 &size)
+        {
+            Q_UNUSED(offset);
+            Q_UNUSED(maxSize);
+            size = 0;
+            return nullptr;
+        }
+
+        /**
+         * @brief Complete a beginWrite(), size bytes (up to the region size, 0 to cancel) of the region were filled
+         * @return Success status
+         */
+        virtual bool commitWrite(qint64 offset, qint64 size)
+        {
+            Q_UNUSED(offset);
+            Q_UNUSED(size);
+            return false;
+        }
+
+        /**
+         * @brief Read up to maxSize bytes of device into the file at offset, straight into the file memory where the backend has it
+         *        (no intermediate buffer, no allocation)
+         * @return Bytes read and written, -1 indicates a write failure
+         */
+        qint64 writeFrom(QIODevice *device, qint64 offset, qint64 maxSize);
+
+        /**
+         * @brief Write out and flush a range
+         * @param wait Wait until the data is on disk, otherwise only start the write-back
+         */
+        virtual bool flushRange(qint64 offset, qint64 size, bool wait = false) = 0;
+
+        /**
+         * @brief Write out and flush everything written since the last flush
+         * @param wait Wait until the data is on disk, otherwise only start the write-back
+         */
+        virtual bool flushDirty(bool wait = false) = 0;
+
+        /**
+         * @brief Flush the whole file to disk and wait for it
+         */
+        virtual bool flush() { return flushDirty(true); }
+
+        /**
+         * @brief Truncate or extend (allocating the blocks) the file. Not supported by the mapped backends
+         */
+        virtual bool resize(qint64 size) = 0;
+
+        /**
+         * @brief Keep the write-back going from a background thread (only the mapped backends need it)
+         */
+        virtual void startBackgroundFlush(int intervalMs = 500) { Q_UNUSED(intervalMs); }
+
+        virtual bool isOpen() const = 0;
+        virtual qint64 size() const = 0;
+        virtual QString lastError() const = 0;
+    };
+}
@@ -0,0 +1,176 @@
+#include "networkeventlooppool.h"
+#include <QDebug>
+#include <QThread>
+#include <QCoreApplication>
+#include "networkrequestrunnable.h"
+#include "networkrequestevent.h"
+
+using namespace QtNetworkRequest;
+
+NetworkEventLoopWorker::NetworkEventLoopWorker(QObject *parent)
+    : QObject(parent), m_nLoad(0)
+{
+}
+
+NetworkEventLoopWorker::~NetworkEventLoopWorker()
+{
+    shutdown();
+}
+
+void NetworkEventLoopWorker::post(std::shared_ptr<NetworkRequestRunnable> r)
+{
+    if (!r)
+        return;
+
+    m_nLoad.fetch_add(1, std::memory_order_relaxed);
+    ExecuteRequestEvent *event = new ExecuteRequestEvent;
+    event->runnable = std::move(r);
+    QCoreApplication::postEvent(this, event);
+}
+
+int NetworkEventLoopWorker::load() const
+{
+    return m_nLoad.load(std::memory_order_relaxed);
+}
+
+bool NetworkEventLoopWorker::event(QEvent *pEvent)
+{
+    if (pEvent->type() == NetworkEvent::ExecuteRequest)
+    {
+        ExecuteRequestEvent *e = static_cast<ExecuteRequestEvent *>(pEvent);
+        if (nullptr != e && e->runnable)
+        {
+            execute(std::move(e->runnable));
+        }
+        return true;
+    }
+
+    return QObject::event(pEvent);
+}
+
+void NetworkEventLoopWorker::execute(std::shared_ptr<NetworkRequestRunnable> r)
+{
+    const quint64 uiRequestId = r->requestId();
+
+    // NetworkRequestRunnable::quit() (called by the manager once the response is handled or the request is stopped)
+    // releases the request in this thread
+    connect(r.get(), &NetworkRequestRunnable::exitLoop, this, [this, uiRequestId]() { release(uiRequestId); }, Qt::QueuedConnection);
+    m_mapRunning.insert(uiRequestId, r);
+
+    if (!r->execute())
+    {
+        release(uiRequestId);
+    }
+}
+
+void NetworkEventLoopWorker::release(quint64 uiRequestId)
+{
+    std::shared_ptr<NetworkRequestRunnable> r = m_mapRunning.take(uiRequestId);
+    if (r)
+    {
+        r->disconnect(this);
+        r->finish();
+        m_nLoad.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void NetworkEventLoopWorker::shutdown()
+{
+    for (auto iter = m_mapRunning.begin(); iter != m_mapRunning.end(); ++iter)
+    {
+        std::shared_ptr<NetworkRequestRunnable> r = iter.value();
+        if (r)
+        {
+            r->disconnect(this);
+            r->finish();
+        }
+    }
+    m_mapRunning.clear();
+    m_nLoad.store(0, std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////////
+NetworkEventLoopPool::NetworkEventLoopPool(int nThreadCount)
+{
+    if (nThreadCount <= 0)
+    {
+        nThreadCount = QThread::idealThreadCount();
+        if (nThreadCount <= 0)
+        {
+            nThreadCount = 1;
+        }
+    }
+
+    for (int i = 0; i < nThreadCount; ++i)
+    {
+        QThread *pThread = new QThread;
+        pThread->setObjectName(QString("NetworkEventLoop-%1").arg(i));
+
+        NetworkEventLoopWorker *pWorker = new NetworkEventLoopWorker;
+        pWorker->moveToThread(pThread);
+        // Release the requests inside the worker thread, before the thread's network manager is destroyed
+        QObject::connect(pThread, &QThread::finished, pWorker, &NetworkEventLoopWorker::shutdown, Qt::DirectConnection);
+        QObject::connect(pThread, &QThread::finished, pWorker, &QObject::deleteLater);
+        pThread->start();
+
+        m_threads.push_back(pThread);
+        m_workers.push_back(pWorker);
+    }
+    qDebug() << "[QMultiThreadNetwork] Event loop threads:" << nThreadCount;
+}
+
+NetworkEventLoopPool::~NetworkEventLoopPool()
+{
+    for (QThread *pThread : m_threads)
+    {
+        pThread->quit();
+    }
+    for (QThread *pThread : m_threads)
+    {
+        if (!pThread->wait(3000))
+        {
+            qDebug() << "[QMultiThreadNetwork] Event loop thread wait failed:" << pThread->objectName();
+        }
+        delete pThread;
+    }
+    m_threads.clear();
+    // Workers are deleted in their own thread when it finishes
+    m_workers.clear();
+}
+
+void NetworkEventLoopPool::start(std::shared_ptr<NetworkRequestRunnable> r, const QString &strAffinity)
+{
+    if (m_workers.empty() || !r)
+        return;
+
+    if (!strAffinity.isEmpty())
+    {
+        m_workers[qHash(strAffinity) % m_workers.size()]->post(std::move(r));
+        return;
+    }
+
+    NetworkEventLoopWorker *pIdlest = m_workers.front();
+    for (NetworkEventLoopWorker *pWorker : m_workers)
+    {
+        if (pWorker->load() < pIdlest->load())
+        {
+            pIdlest = pWorker;
+        }
+    }
+    pIdlest->post(std::move(r));
+}
+
+int NetworkEventLoopPool::threadCount() const
+{
+    return static_cast<int>(m_workers.size());
+}
+
+int NetworkEventLoopPool::activeRequestCount() const
+{
+    int nCount = 0;
+    for (NetworkEventLoopWorker *pWorker : m_workers)
+    {
+        nCount += pWorker->load();
+    }
+    return nCount;
+}
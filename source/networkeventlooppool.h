@@ -0,0 +1,73 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class QThread;
+
+namespace QtNetworkRequest
+{
+    class NetworkRequestRunnable;
+
+    // Network thread of ExecutionMode::EventLoop.
+    // Lives in its own QThread, whose single event loop drives every request dispatched to it.
+    class NetworkEventLoopWorker : public QObject
+    {
+        Q_OBJECT
+
+    public:
+        explicit NetworkEventLoopWorker(QObject *parent = 0);
+        ~NetworkEventLoopWorker();
+
+        // Thread-safe. Queue the runnable to be executed in the worker thread
+        void post(std::shared_ptr<NetworkRequestRunnable> r);
+
+        // Requests dispatched to this worker and not released yet
+        int load() const;
+
+        bool event(QEvent *pEvent) Q_DECL_OVERRIDE;
+
+    public Q_SLOTS:
+        // Abort all requests of this worker. Called in the worker thread right before it exits
+        void shutdown();
+
+    private:
+        void execute(std::shared_ptr<NetworkRequestRunnable> r);
+        void release(quint64 uiRequestId);
+
+    private:
+        Q_DISABLE_COPY(NetworkEventLoopWorker);
+        std::atomic<int> m_nLoad;
+        // Only accessed in the worker thread
+        QHash<quint64, std::shared_ptr<NetworkRequestRunnable>> m_mapRunning;
+    };
+
+    // Fixed set of network threads (ExecutionMode::EventLoop).
+    // Requests are dispatched to the least loaded thread, so a handful of threads can
+    // serve thousands of concurrent requests without blocking one thread per request.
+    // Requests with an affinity key always go to the thread the key hashes to, they share its network manager
+    // and with it the connections it keeps (HTTP/2 streams of one origin).
+    class NetworkEventLoopPool
+    {
+    public:
+        // nThreadCount: 0 = system CPU core count
+        explicit NetworkEventLoopPool(int nThreadCount = 0);
+        ~NetworkEventLoopPool();
+
+        // strAffinity: empty = least loaded thread
+        void start(std::shared_ptr<NetworkRequestRunnable> r, const QString &strAffinity = QString());
+
+        int threadCount() const;
+        int activeRequestCount() const;
+
+    private:
+        NetworkEventLoopPool(const NetworkEventLoopPool &) = delete;
+        NetworkEventLoopPool &operator=(const NetworkEventLoopPool &) = delete;
+
+        std::vector<QThread *> m_threads;
+        std::vector<NetworkEventLoopWorker *> m_workers;
+    };
+}
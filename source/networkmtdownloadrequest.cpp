@@ -15,15 +15,25 @@
 #include <QNetworkAccessManager>
 #include <QCoreApplication>
 #include <QUuid>
+#include <limits>
 #include "networkrequestmanager.h"
 #include "networkrequestutility.h"
-#include "networkrequestevent.h"
+#include "networkaccessmanagerpool.h"
+#include "networkprogresstracker.h"
+#include "networkprobecache.h"
+#include "networkredirectcache.h"
 
 using namespace QtNetworkRequest;
 
+// HTTP/1.1 connections a QNetworkAccessManager opens to one host, further requests wait for one of them
+#define CONNECTIONS_PER_MANAGER 6
+
 NetworkMTDownloadRequest::NetworkMTDownloadRequest(QObject *parent /* = nullptr */)
-    : NetworkRequest(parent), m_nThreadCount(0), m_nSuccess(0), m_nFailed(0), m_bytesTotal(0), m_nFileSize(-1)
+    : NetworkRequest(parent), m_nFileSize(-1), m_nSegmentManagers(1), m_nThreadCount(0), m_nMinSegmentSize(1), m_nSegmentAlignment(1), m_nSuccess(0), m_nFailed(0),
+      m_nResumedBytes(0), m_bDiscardPartial(false), m_pProbeReply(nullptr), m_bProbeCached(false), m_bSingleStreamForced(false)
 {
+    m_journalTimer.setInterval(JOURNAL_FLUSH_INTERVAL_MS);
+    connect(&m_journalTimer, &QTimer::timeout, this, &NetworkMTDownloadRequest::flushJournal);
 }
 
 NetworkMTDownloadRequest::~NetworkMTDownloadRequest()
@@ -34,27 +44,42 @@ NetworkMTDownloadRequest::~NetworkMTDownloadRequest()
 void NetworkMTDownloadRequest::abort()
 {
     __super::abort();
+    m_journalTimer.stop();
+    discardProbe();
+
+    // A resumable download keeps its partial file and journal for a later request, unless the file changed on the server
+    const bool bKeepPartial = m_journal && !m_bDiscardPartial;
+    if (bKeepPartial)
+    {
+        flushJournal();
+    }
     clearDownloaders();
 
-    // Close memory mapped file
-    if (m_mappedFile)
+    // Close the destination file
+    if (m_storage)
     {
-        m_mappedFile->close();
-        m_mappedFile.reset();
+        m_storage->close();
+        m_storage.reset();
     }
 
     // Clean up temporary file if it exists
     if (!m_strTempFilePath.isEmpty())
     {
-        QFile tempFile(m_strTempFilePath);
-        if (tempFile.exists())
+        if (!bKeepPartial)
         {
-            tempFile.remove();
+            QFile tempFile(m_strTempFilePath);
+            if (tempFile.exists())
+            {
+                tempFile.remove();
+            }
+            if (m_journal)
+            {
+                m_journal->remove();
+            }
         }
         m_strTempFilePath.clear();
     }
-
-    clearProgress();
+    m_journal.reset();
 }
 
 bool NetworkMTDownloadRequest::requestFileSize()
@@ -66,12 +91,27 @@ bool NetworkMTDownloadRequest::requestFileSize()
     const QUrl& url = m_url;
     m_nFileSize = -1;
 
-    if (nullptr == m_pNetworkManager)
+    m_bProbeCached = false;
+
+    // Reuse the worker thread's network manager, the first Downloaders share it as well
+    m_pNetworkManager = NetworkAccessManagerPool::threadLocalManager();
+    QNetworkRequest request(url);
+    // HTTP: probe with an open-ended range instead of HEAD. A 206 tells range support and the size (Content-Range), a 200
+    // a server that ignores ranges. Either way the body that follows is not wasted: the first part adopts the reply and
+    // stops at its segment boundary, or it carries on as the single stream (onProbeHeaders()).
+    // Other schemes ask for the size with HEAD
+    const bool bHttp = isHttpProxy(url.scheme()) || isHttpsProxy(url.scheme());
+    if (bHttp)
     {
-        m_pNetworkManager = new QNetworkAccessManager(this);
+        request.setRawHeader("Range", "bytes=0-");
+        // Content-Range offsets must be those of the file itself
+        request.setRawHeader("Accept-Encoding", "identity");
     }
-    QNetworkRequest request(url);
-    request.setRawHeader("Accept-Encoding", "gzip,deflate");
+    else
+    {
+        request.setRawHeader("Accept-Encoding", "gzip,deflate");
+    }
+    NetworkRequestUtility::applyHttp2(request, m_upContext->behavior.http2);
 
 #ifndef QT_NO_SSL
     if (url.scheme().toLower() == "https")
@@ -88,9 +128,14 @@ bool NetworkMTDownloadRequest::requestFileSize()
     }
 #endif
 
-    m_pNetworkReply = m_pNetworkManager->head(request);
+    m_pNetworkReply = bHttp ? m_pNetworkManager->get(request) : m_pNetworkManager->head(request);
     if (m_pNetworkReply)
     {
+        watchReply(m_pNetworkReply);
+        if (bHttp)
+        {
+            connect(m_pNetworkReply, &QNetworkReply::metaDataChanged, this, &NetworkMTDownloadRequest::onProbeHeaders);
+        }
         connect(m_pNetworkReply, SIGNAL(finished()), this, SLOT(onFinished()));
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
         connect(m_pNetworkReply, SIGNAL(errorOccurred(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
@@ -107,8 +152,28 @@ void NetworkMTDownloadRequest::start()
 
     m_nSuccess = 0;
     m_nFailed = 0;
+    m_mapPartRetries.clear();
     m_nThreadCount = 1;
+    m_bSingleStreamForced = false;
 
+    // A recent probe of the url: the range requests go out at once.
+    // Without range support the probe is sent anyway, a server ignoring it answers with the whole file to download
+    ResourceProbe probe;
+    if (NetworkProbeCache::globalInstance()->lookup(QUrl(m_upContext->url), probe) && probe.acceptRanges)
+    {
+        qDebug() << "[QMultiThreadNetwork] Cached probe, file size:" << probe.size;
+        m_pNetworkManager = NetworkAccessManagerPool::threadLocalManager();
+        m_probe = probe;
+        m_nFileSize = probe.size;
+        m_bProbeCached = true;
+        if (probe.location.isValid())
+        {
+            // No redirect chain to walk for each segment
+            m_url = probe.location;
+        }
+        startMTDownload();
+        return;
+    }
     if (!requestFileSize())
     {
         m_strError = "Network error: Invalid URL format";
@@ -125,7 +190,7 @@ void NetworkMTDownloadRequest::startMTDownload()
 
     // Start timing
     m_downloadTimer.start();
-    if (m_nFileSize <= 0)
+    if (m_nFileSize <= 0 && !m_pProbeReply)
     {
         m_strError = "Server error: Content-Length header not provided";
         qDebug() << "[QMultiThreadNetwork]" << m_strError;
@@ -139,9 +204,16 @@ void NetworkMTDownloadRequest::startMTDownload()
         emit response(ToFailedResult());
         return;
     }
+    if (m_nFileSize <= 0)
+    {
+        // A chunked answer without Content-Length, typically from a server that ignores ranges
+        streamProbe();
+        return;
+    }
 
-    // Generate temporary file path
-    m_strTempFilePath = generateTempFilePath(m_strDstFilePath);
+    // Generate temporary file path. A resumable download uses a fixed one, so a later request finds it
+    const bool bResumable = m_upContext->downloadConfig && m_upContext->downloadConfig->resumable;
+    m_strTempFilePath = bResumable ? NetworkDownloadJournal::tempFilePath(m_strDstFilePath) : generateTempFilePath(m_strDstFilePath);
     if (m_strTempFilePath.isEmpty())
     {
         m_strError = "Failed to generate temporary file path";
@@ -154,17 +226,44 @@ void NetworkMTDownloadRequest::startMTDownload()
         return;
     }
 
-    // Create and open memory mapped file with temporary name
-    m_mappedFile = std::make_unique<MemoryMappedFile>();
-    if (!m_mappedFile->open(m_strTempFilePath, m_nFileSize))
+    // Resume from the journal if it describes this very version of the file
+    bool bResume = false;
+    m_nResumedBytes = 0;
+    m_bDiscardPartial = false;
+    if (bResumable)
     {
-        m_strError = QString("Memory mapping error: Failed to create memory mapped file - %1").arg(m_mappedFile->lastError());
+        m_journal = std::make_unique<NetworkDownloadJournal>(m_strDstFilePath);
+        // Resuming needs ranges
+        bResume = m_probe.acceptRanges
+            && m_journal->load()
+            && QFileInfo(m_strTempFilePath).size() == m_nFileSize
+            && m_journal->matches(m_upContext->url, m_nFileSize, m_probe.etag, m_probe.lastModified);
+        if (bResume)
+        {
+            m_nResumedBytes = m_journal->completedBytes();
+            qDebug() << "[QMultiThreadNetwork] Resume download:" << m_nResumedBytes << "/" << m_nFileSize << "bytes on disk";
+        }
+        else
+        {
+            m_journal->reset(m_upContext->url, m_nFileSize, m_probe.etag, m_probe.lastModified);
+        }
+    }
+
+    // Create and open the destination file with temporary name, its blocks are allocated up front
+    Q_ASSERT(nullptr != m_upContext->downloadConfig);
+    m_storage = DownloadStorage::create(m_upContext->downloadConfig->storageBackend, true);
+    if (!m_storage->open(m_strTempFilePath, m_nFileSize, bResume))
+    {
+        m_strError = QString("File storage error: Failed to create file - %1").arg(m_storage->lastError());
         qDebug() << "[QMultiThreadNetwork]" << m_strError;
+        m_storage.reset();
         emit response(ToFailedResult());
         return;
     }
+    qDebug() << "[QMultiThreadNetwork] Storage backend:" << DownloadStorage::backendName(m_storage->backend());
+    // Keep the write-back going while downloading instead of syncing everything at the end
+    m_storage->startBackgroundFlush();
     clearDownloaders();
-    Q_ASSERT(nullptr != m_upContext->downloadConfig);
     m_nThreadCount = m_upContext->downloadConfig->threadCount;
     // If threadCount is 0, auto detect CPU cores
     if (m_nThreadCount == 0) {
@@ -172,40 +271,115 @@ void NetworkMTDownloadRequest::startMTDownload()
         qDebug() << "[QMultiThreadNetwork]" << "Auto-detected thread count:" << m_nThreadCount;
     }
     m_nThreadCount = qMax(m_nThreadCount, 2);
-    m_bytesTotal = m_nFileSize;
+    if (m_spProgress)
+    {
+        // The downloaders add what they write on top of the bytes already on disk
+        m_spProgress->set(m_nResumedBytes, m_nFileSize);
+    }
+
+    m_nMinSegmentSize = qMax<qint64>(1, m_upContext->downloadConfig->minSegmentSize);
+    m_nSegmentAlignment = m_upContext->downloadConfig->segmentAlignment;
+    if (m_nSegmentAlignment <= 0)
+    {
+        m_nSegmentAlignment = MemoryMappedFile::pageSize();
+    }
+    // Only the bytes not on disk yet are downloaded
+    QList<NetworkDownloadJournal::Range> missingRanges;
+    if (m_journal)
+    {
+        missingRanges = m_journal->missingRanges();
+    }
+    else
+    {
+        missingRanges.append(NetworkDownloadJournal::Range(0, m_nFileSize - 1));
+    }
+    qint64 nMissing = 0;
+    for (const NetworkDownloadJournal::Range &range : missingRanges)
+    {
+        nMissing += range.second - range.first + 1;
+    }
+    if (nMissing == 0)
+    {
+        // Everything was downloaded before, only the rename is left
+        finishDownload();
+        return;
+    }
 
-    // Divide file into n segments and download asynchronously
-    for (int i = 0; i < m_nThreadCount; i++)
+    // No more segments than minimum-sized ones, a small file is not worth many connections
+    m_nThreadCount = static_cast<int>(qMin<qint64>(m_nThreadCount, qMax<qint64>(1, nMissing / m_nMinSegmentSize)));
+    // A single stream if the server does not serve ranges, or the file is below minMultiThreadSize
+    if (!m_probe.acceptRanges || m_nFileSize < m_upContext->downloadConfig->minMultiThreadSize)
+    {
+        m_nThreadCount = 1;
+    }
+    m_spResult->downloadStrategy = (m_nThreadCount > 1) ? DownloadStrategy::MultiThread : DownloadStrategy::SingleStream;
+    qDebug() << "[QMultiThreadNetwork] Download strategy:" << (m_nThreadCount > 1 ? "multi-thread" : "single stream") << m_nThreadCount;
+    createSegmentManagers();
+
+    // Divide the missing bytes into about n segments, each missing range getting its share.
+    // These are only the initial ranges, parts that finish early take over the tail of the slowest part (stealWork())
+    QList<NetworkDownloadJournal::Range> segments;
+    for (const NetworkDownloadJournal::Range &range : missingRanges)
     {
-        qint64 start = 0;
-        qint64 end = -1;
-        if (m_nThreadCount > 1)
+        const qint64 nLength = range.second - range.first + 1;
+        const qint64 nSegments = qBound<qint64>(1, qRound64(static_cast<double>(m_nThreadCount) * nLength / nMissing), qMax<qint64>(1, nLength / m_nMinSegmentSize));
+        for (qint64 i = 0; i < nSegments; i++)
         {
             // First calculate the start and end of each segment (information required by HTTP protocol)
-            start = m_nFileSize * i / m_nThreadCount;
-            end = m_nFileSize * (i + 1) / m_nThreadCount;
+            qint64 start = (i == 0) ? range.first : qMax(range.first, alignDown(range.first + nLength * i / nSegments));
+            qint64 end = (nSegments == i + 1) ? range.second : qMin(range.second, alignDown(range.first + nLength * (i + 1) / nSegments) - 1);
+            if (end < start)
+            {
+                // Swallowed by the alignment of its neighbours
+                continue;
+            }
+            segments.append(NetworkDownloadJournal::Range(start, end));
         }
-        if (m_nThreadCount == i + 1)
+    }
+
+    // Every range must come from the version that was probed
+    const QByteArray ifRange = m_journal ? m_journal->ifRange() : m_probe.ifRange();
+    m_pendingRanges.clear();
+    for (int i = 0; i < segments.size(); i++)
+    {
+        const qint64 start = segments.at(i).first;
+        const qint64 end = segments.at(i).second;
+        if (i >= m_nThreadCount)
         {
-            end = m_nFileSize - 1;
+            m_pendingRanges.append(segments.at(i));
+            continue;
         }
         // Download the file in segments
         std::unique_ptr<Downloader> downloader = 
             std::make_unique<Downloader>(i, 
-                m_mappedFile.get(), 
-                m_pNetworkManager, 
-                m_upContext->behavior.showProgress, 
+                m_storage.get(), 
+                segmentManager(i), 
+                m_spProgress.get(), 
                 m_upContext->behavior.maxRedirectionCount, 
                 this);
 
         connect(downloader.get(), SIGNAL(downloadFinished(int, bool, const QString &)),
                 this, SLOT(onSubPartFinished(int, bool, const QString &)));
-        connect(downloader.get(), SIGNAL(downloadProgress(int, qint64, qint64)),
-                this, SLOT(onSubPartDownloadProgress(int, qint64, qint64)));
-        if (downloader->start(m_upContext->url, start, end))
+        downloader->setIfRange(ifRange);
+        downloader->setBandwidthPath(BandwidthPath::of(*m_upContext));
+        downloader->setHttp2(m_upContext->behavior.http2);
+        bool bStarted = false;
+        if (m_pProbeReply && start == 0)
+        {
+            // Carry on with the data of the probe instead of requesting the first range again
+            bStarted = downloader->adopt(m_pProbeReply, m_url, start, end);
+            if (bStarted)
+            {
+                m_pProbeReply = nullptr;
+            }
+        }
+        else
+        {
+            bStarted = downloader->start(m_url, start, end);
+        }
+        if (bStarted)
         {
             m_mapDownloader[i] = std::move(downloader);
-            m_mapBytesReceived.insert(i, 0);
         }
         else
         {
@@ -215,6 +389,70 @@ void NetworkMTDownloadRequest::startMTDownload()
             return;
         }
     }
+
+    if (m_journal)
+    {
+        // Batched: data and journal reach the disk once per interval, not per write
+        m_journal->save();
+        m_journalTimer.start();
+    }
+}
+
+void NetworkMTDownloadRequest::streamProbe()
+{
+    // Nothing to split, preallocate or resume without a size: the probe is the single stream, the file grows up to its end
+    m_nFileSize = -1;
+    m_nResumedBytes = 0;
+    m_bDiscardPartial = false;
+    m_journal.reset();
+    m_strTempFilePath = generateTempFilePath(m_strDstFilePath);
+    if (m_strTempFilePath.isEmpty())
+    {
+        m_strError = "Failed to generate temporary file path";
+        emit response(ToFailedResult());
+        return;
+    }
+
+    Q_ASSERT(nullptr != m_upContext->downloadConfig);
+    m_storage = DownloadStorage::create(m_upContext->downloadConfig->storageBackend, false);
+    if (!m_storage->open(m_strTempFilePath, 0))
+    {
+        m_strError = QString("File storage error: Failed to create file - %1").arg(m_storage->lastError());
+        qDebug() << "[QMultiThreadNetwork]" << m_strError;
+        m_storage.reset();
+        emit response(ToFailedResult());
+        return;
+    }
+    clearDownloaders();
+    m_pendingRanges.clear();
+    m_nThreadCount = 1;
+    m_spResult->downloadStrategy = DownloadStrategy::SingleStream;
+    qDebug() << "[QMultiThreadNetwork] Download strategy: single stream of unknown size";
+    createSegmentManagers();
+    if (m_spProgress)
+    {
+        m_spProgress->set(0, 0);
+    }
+
+    std::unique_ptr<Downloader> downloader =
+        std::make_unique<Downloader>(0,
+            m_storage.get(),
+            segmentManager(0),
+            m_spProgress.get(),
+            m_upContext->behavior.maxRedirectionCount,
+            this);
+    connect(downloader.get(), SIGNAL(downloadFinished(int, bool, const QString &)),
+            this, SLOT(onSubPartFinished(int, bool, const QString &)));
+    downloader->setBandwidthPath(BandwidthPath::of(*m_upContext));
+    if (!downloader->adopt(m_pProbeReply, m_url, 0, -1))
+    {
+        m_strError = QString("Download error: Part 0 failed - %1").arg(downloader->errorString());
+        abort();
+        emit response(ToFailedResult());
+        return;
+    }
+    m_pProbeReply = nullptr;
+    m_mapDownloader[0] = std::move(downloader);
 }
 
 void NetworkMTDownloadRequest::onSubPartFinished(int index, bool bSuccess, const QString &strErr)
@@ -228,16 +466,50 @@ void NetworkMTDownloadRequest::onSubPartFinished(int index, bool bSuccess, const
         qDebug() << "[QMultiThreadNetwork] Download repeated part finished.";
         return;
     }
-    m_setFinishedIds.insert(index);
 
     if (bSuccess)
     {
+        auto iter = m_mapDownloader.find(index);
+        if (iter != m_mapDownloader.end())
+        {
+            recordCompleted(iter->second.get());
+        }
+        // Keep the connection busy with the tail of the slowest part rather than leaving it idle
+        if (stealWork(index))
+        {
+            return;
+        }
+        m_setFinishedIds.insert(index);
         m_nSuccess++;
     }
+    else if (retrySubPart(index, strErr))
+    {
+        return;
+    }
+    else if (m_bProbeCached && isProbeOutdated(index))
+    {
+        reprobe();
+        return;
+    }
+    else if (!m_bSingleStreamForced && m_mapDownloader.count(index) > 0 && m_mapDownloader[index]->isRangeIgnored())
+    {
+        // The whole file came instead of the range after a fresh probe: the server does not honour ranges after all,
+        // the download goes on as a single stream
+        m_bSingleStreamForced = true;
+        reprobe();
+        return;
+    }
     else
     {
+        m_setFinishedIds.insert(index);
+        auto iter = m_mapDownloader.find(index);
+        if (iter != m_mapDownloader.end() && iter->second && iter->second->isResourceChanged())
+        {
+            m_bDiscardPartial = true;
+        }
         if (++m_nFailed == 1)
         {
+            NetworkProbeCache::globalInstance()->remove(QUrl(m_upContext->url));
             abort();
         }
         if (m_strError.isEmpty())
@@ -246,45 +518,12 @@ void NetworkMTDownloadRequest::onSubPartFinished(int index, bool bSuccess, const
         }
     }
 
-    // If completion count equals file segment count, file download is successful; if failure count > 0, download failed
-    if (m_nSuccess == m_nThreadCount || m_nFailed > 0)
+    // If every part is finished with nothing left to take over, file download is successful; if failure count > 0, download failed
+    if (m_nSuccess == static_cast<int>(m_mapDownloader.size()) || m_nFailed > 0)
     {
         if (m_nFailed == 0)
         {
-            // Record download end time and elapsed time
-            qint64 elapsedMs = m_downloadTimer.elapsed();
-            double elapsedSeconds = elapsedMs / 1000.0;
-
-            // Get response header information (headers from HEAD request)
-            QMap<QByteArray, QByteArray> responseHeaders;
-            if (m_pNetworkReply)
-            {
-                foreach(const QByteArray & header, m_pNetworkReply->rawHeaderList())
-                {
-                    responseHeaders[header] = m_pNetworkReply->rawHeader(header);
-                }
-            }
-            // Close memory mapped file before rename operation
-            if (m_mappedFile)
-            {
-                m_mappedFile->close();
-                m_mappedFile.reset();
-            }
-
-            // Rename temporary file to final name
-            if (!renameTempFileToFinal())
-            {
-                m_strError = QString("Failed to rename temporary file to final destination: %1").arg(m_strError);
-                emit response(ToFailedResult());
-                return;
-            }
-
-            double speed = (m_nFileSize / 1024.0 / 1024.0) / elapsedSeconds;
-            QString msg = QString("The download took %1 seconds in total, with an average speed of %2 MB/s.").arg(elapsedSeconds).arg(speed);
-            emit response(ToSuccessResult(msg.toUtf8(), responseHeaders));
-
-            qDebug() << "[QMultiThreadNetwork] Download took " << elapsedSeconds << "seconds (" << elapsedMs << "ms)";
-            qDebug() << "[QMultiThreadNetwork] Average speed:" << QString::number(speed, 'f', 2) << "MB/s";
+            finishDownload();
         }
         else
         {
@@ -296,37 +535,133 @@ void NetworkMTDownloadRequest::onSubPartFinished(int index, bool bSuccess, const
     }
 }
 
-void NetworkMTDownloadRequest::onSubPartDownloadProgress(int index, qint64 bytesReceived, qint64 bytesTotal)
+bool NetworkMTDownloadRequest::retrySubPart(int index, const QString &strErr)
+{
+    // A stream of unknown size cannot go on with a range request
+    if (!m_upContext->behavior.retryOnFailed || m_nFailed > 0 || m_nFileSize < 0)
+    {
+        return false;
+    }
+    auto iter = m_mapDownloader.find(index);
+    if (iter == m_mapDownloader.end() || !iter->second)
+    {
+        return false;
+    }
+    Downloader *pDownloader = iter->second.get();
+
+    // A part that keeps making progress keeps its retries
+    quint16 &nRetries = m_mapPartRetries[index];
+    if (pDownloader->rangeBytesWritten() > 0)
+    {
+        nRetries = 0;
+    }
+    const qint64 nDelayMs = pDownloader->retryDelay(m_upContext->behavior.retry, nRetries);
+    if (nDelayMs < 0)
+    {
+        return false;
+    }
+    ++nRetries;
+
+    // The bytes already written stay, only the rest of the range is requested again
+    recordCompleted(pDownloader);
+    qDebug() << "[QMultiThreadNetwork] Part" << index << "failed:" << strErr << "- retry" << nRetries
+             << "from" << pDownloader->writePosition() << "in" << nDelayMs << "ms";
+    QTimer::singleShot(static_cast<int>(nDelayMs), this, [this, index]() {
+        if (m_bAbortManual)
+        {
+            return;
+        }
+        auto iter = m_mapDownloader.find(index);
+        if (iter == m_mapDownloader.end() || !iter->second)
+        {
+            return;
+        }
+        if (!iter->second->resume())
+        {
+            // No more retries for it, fails the download
+            m_mapPartRetries[index] = m_upContext->behavior.retry.maxAttempts;
+            onSubPartFinished(index, false, iter->second->errorString());
+        }
+    });
+    return true;
+}
+
+void NetworkMTDownloadRequest::finishDownload()
 {
-    if (m_bAbortManual || bytesReceived <= 0 || bytesTotal <= 0)
+    qint64 nWritten = m_nResumedBytes;
+    for (const std::pair<const int, std::unique_ptr<Downloader>> &pair : m_mapDownloader)
+    {
+        nWritten += pair.second ? pair.second->totalBytesWritten() : 0;
+    }
+    if (m_nFileSize < 0)
+    {
+        // Streamed without a size, the file is what arrived until the end of the stream
+        m_nFileSize = nWritten;
+    }
+    if (nWritten != m_nFileSize)
+    {
+        m_strError = QString("Download error: Received %1 of %2 bytes").arg(nWritten).arg(m_nFileSize);
+        qDebug() << "[QMultiThreadNetwork]" << m_strError;
+        emit response(ToFailedResult());
         return;
+    }
 
-    if (!m_mapBytesReceived.contains(index))
+    // Record download end time and elapsed time
+    qint64 elapsedMs = m_downloadTimer.elapsed();
+    double elapsedSeconds = elapsedMs / 1000.0;
+
+    // Get response header information (headers from HEAD request)
+    QMap<QByteArray, QByteArray> responseHeaders;
+    if (m_pNetworkReply)
     {
+        foreach(const QByteArray & header, m_pNetworkReply->rawHeaderList())
+        {
+            responseHeaders[header] = m_pNetworkReply->rawHeader(header);
+        }
+    }
+    m_journalTimer.stop();
+    // Close the destination file before rename operation
+    if (m_storage)
+    {
+        m_storage->flush();
+        m_storage->close();
+        m_storage.reset();
+    }
+
+    // Rename temporary file to final name
+    if (!renameTempFileToFinal())
+    {
+        m_strError = QString("Failed to rename temporary file to final destination: %1").arg(m_strError);
+        emit response(ToFailedResult());
         return;
     }
-	// qDebug() << "Part:" << index << " progress:" << bytesReceived << "/" << bytesTotal;
-    m_mapBytesReceived[index] = bytesReceived;
-
-	if (m_bytesTotal > 0)
-	{
-        qint64 totalReceived = 0;
-		for (auto iter = m_mapBytesReceived.begin(); iter != m_mapBytesReceived.end(); ++iter)
-		{
-            totalReceived += iter.value();
-        }
-		int progress = totalReceived * 100 / m_bytesTotal;
-		if (m_nProgress < progress)
-		{
-			m_nProgress = progress;
-			NetworkProgressEvent* event = new NetworkProgressEvent;
-			event->uiId = m_upContext->task.id;
-			event->uiBatchId = m_upContext->task.batchId;
-			event->iBtyes = totalReceived;
-			event->iTotalBtyes = m_bytesTotal;
-			QCoreApplication::postEvent(NetworkRequestManager::globalInstance(), event);
-		}
-	}
+    if (m_journal)
+    {
+        m_journal->remove();
+        m_journal.reset();
+    }
+
+    double speed = (m_nFileSize / 1024.0 / 1024.0) / elapsedSeconds;
+    QString msg = QString("The download took %1 seconds in total, with an average speed of %2 MB/s.").arg(elapsedSeconds).arg(speed);
+    QSharedPointer<ResponseResult> spResult = ToSuccessResult(msg.toUtf8(), responseHeaders);
+    // The phases above are those of the HEAD request, the transfer is that of all parts
+    spResult->performance.transferMs = elapsedMs;
+    spResult->performance.payloadBytesReceived += nWritten - m_nResumedBytes;
+    for (const std::pair<const int, std::unique_ptr<Downloader>> &pair : m_mapDownloader)
+    {
+        if (!pair.second)
+            continue;
+        SegmentPerformance segment;
+        segment.index = pair.first;
+        segment.bytes = pair.second->totalBytesWritten();
+        segment.durationMs = pair.second->activeMs();
+        segment.bytesPerSecond = segment.durationMs > 0 ? segment.bytes * 1000.0 / segment.durationMs : 0;
+        spResult->performance.segments.append(segment);
+    }
+    emit response(spResult);
+
+    qDebug() << "[QMultiThreadNetwork] Download took " << elapsedSeconds << "seconds (" << elapsedMs << "ms)";
+    qDebug() << "[QMultiThreadNetwork] Average speed:" << QString::number(speed, 'f', 2) << "MB/s";
 }
 
 void NetworkMTDownloadRequest::onFinished()
@@ -351,7 +686,7 @@ void NetworkMTDownloadRequest::onFinished()
     if (!bSuccess)
     {
         // Handle redirection
-        if (statusCode == 301 || statusCode == 302)
+        if (statusCode == 301 || statusCode == 302 || statusCode == 307 || statusCode == 308)
         {
             const QVariant &redirectionTarget = m_pNetworkReply->attribute(QNetworkRequest::RedirectionTargetAttribute);
             const QUrl &redirectUrl = m_url.resolved(redirectionTarget.toUrl());
@@ -359,6 +694,8 @@ void NetworkMTDownloadRequest::onFinished()
                 ++m_nRedirectionCount <= m_upContext->behavior.maxRedirectionCount)
             {
                 qDebug() << "[QMultiThreadNetwork] url:" << m_url.toString() << "redirectUrl:" << redirectUrl.toString();
+                NetworkRedirectCache::globalInstance()->store(m_url, redirectUrl, statusCode);
+                // The segments go straight to the resolved url
                 m_url = redirectUrl;
 
                 m_pNetworkReply->deleteLater();
@@ -379,7 +716,6 @@ void NetworkMTDownloadRequest::onFinished()
         emit response(ToFailedResult());
         return;
     }
-    clearProgress();
 
     for (auto& headerpair : m_pNetworkReply->rawHeaderPairs())
     {
@@ -387,9 +723,8 @@ void NetworkMTDownloadRequest::onFinished()
         qDebug() << headerLine;
     }
 
-    const QVariant &var = m_pNetworkReply->header(QNetworkRequest::ContentLengthHeader);
-    m_nFileSize = var.toLongLong();
-    m_bytesTotal = m_nFileSize;
+    m_probe = ResourceProbe::of(m_pNetworkReply);
+    m_nFileSize = m_probe.size;
     qDebug() << "[QMultiThreadNetwork] File size:" << m_nFileSize;
 
     m_pNetworkReply->deleteLater();
@@ -398,6 +733,222 @@ void NetworkMTDownloadRequest::onFinished()
     startMTDownload();
 }
 
+void NetworkMTDownloadRequest::onProbeHeaders()
+{
+    QNetworkReply *pReply = m_pNetworkReply;
+    if (!pReply || m_bAbortManual)
+    {
+        return;
+    }
+    const int nStatusCode = pReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (nStatusCode < 200 || nStatusCode >= 300)
+    {
+        // Redirects and errors are handled once the reply finished
+        return;
+    }
+
+    m_probe = ResourceProbe::of(pReply);
+    if (nStatusCode != 206 || m_bSingleStreamForced)
+    {
+        // The range was ignored, whatever Accept-Ranges says. Or it was served, but the ranges of an earlier attempt came back whole
+        m_probe.acceptRanges = false;
+    }
+    m_nFileSize = m_probe.size;
+    qDebug() << "[QMultiThreadNetwork] Probe status:" << nStatusCode << "file size:" << m_nFileSize << "ranges:" << m_probe.acceptRanges;
+    NetworkProbeCache::globalInstance()->store(QUrl(m_upContext->url), m_probe);
+
+    // The reply is no longer the request's own: it becomes the first part or is dropped
+    pReply->disconnect(this);
+    m_pNetworkReply = nullptr;
+    m_pProbeReply = pReply;
+    qint64 nFirst = -1;
+    qint64 nTotal = -1;
+    if (nStatusCode == 206 && (!ResourceProbe::parseContentRange(pReply->rawHeader("Content-Range"), nFirst, nTotal) || nFirst != 0))
+    {
+        // Not the range that was asked for, the parts request their ranges themselves
+        discardProbe();
+    }
+    // A 200 is the whole file (Range ignored): it is downloaded as a single stream carrying on with this reply
+    startMTDownload();
+    // Not taken over (resumed download, or the download did not start)
+    discardProbe();
+}
+
+void NetworkMTDownloadRequest::discardProbe()
+{
+    if (m_pProbeReply)
+    {
+        m_pProbeReply->disconnect(this);
+        m_pProbeReply->abort();
+        m_pProbeReply->deleteLater();
+        m_pProbeReply = nullptr;
+    }
+}
+
+bool NetworkMTDownloadRequest::isProbeOutdated(int index) const
+{
+    auto iter = m_mapDownloader.find(index);
+    if (iter == m_mapDownloader.end() || !iter->second)
+    {
+        return false;
+    }
+    // The file changed since the probe, or the url it resolved to (a signed one) expired
+    const Downloader *pPart = iter->second.get();
+    const int nStatusCode = pPart->lastStatusCode();
+    return pPart->isResourceChanged() || pPart->isRangeIgnored() || (nStatusCode >= 400 && nStatusCode < 500);
+}
+
+void NetworkMTDownloadRequest::reprobe()
+{
+    qDebug() << "[QMultiThreadNetwork] Probe is outdated, probing" << m_upContext->url << "again";
+    NetworkProbeCache::globalInstance()->remove(QUrl(m_upContext->url));
+    m_journalTimer.stop();
+    clearDownloaders();
+    m_pendingRanges.clear();
+    m_mapPartRetries.clear();
+    m_nSuccess = 0;
+    m_nFailed = 0;
+    if (m_storage)
+    {
+        m_storage->close();
+        m_storage.reset();
+    }
+    // Nothing written for the old version is worth keeping
+    if (!m_strTempFilePath.isEmpty())
+    {
+        QFile::remove(m_strTempFilePath);
+        m_strTempFilePath.clear();
+    }
+    if (m_journal)
+    {
+        m_journal->remove();
+        m_journal.reset();
+    }
+    // The redirects are followed again as well
+    m_url = NetworkRedirectCache::globalInstance()->resolve(QUrl(m_upContext->url), m_upContext->behavior.maxRedirectionCount);
+    m_nRedirectionCount = 0;
+    if (!requestFileSize())
+    {
+        m_strError = "Network error: Invalid URL format";
+        emit response(ToFailedResult());
+    }
+}
+
+bool NetworkMTDownloadRequest::stealWork(int index)
+{
+    auto iterThief = m_mapDownloader.find(index);
+    if (iterThief == m_mapDownloader.end() || !iterThief->second)
+    {
+        return false;
+    }
+    Downloader *pThief = iterThief->second.get();
+
+    // Ranges nobody has started yet go first
+    if (!m_pendingRanges.isEmpty())
+    {
+        const NetworkDownloadJournal::Range range = m_pendingRanges.takeFirst();
+        if (pThief->start(m_url, range.first, range.second))
+        {
+            return true;
+        }
+        qDebug() << "[QMultiThreadNetwork] Part" << index << "failed to start pending range:" << pThief->errorString();
+        m_pendingRanges.prepend(range);
+        return false;
+    }
+
+    // Take from the part expected to finish last at its current speed
+    Downloader *pVictim = nullptr;
+    int nVictimIndex = -1;
+    double dMaxRemainingMs = -1.0;
+    for (const std::pair<const int, std::unique_ptr<Downloader>> &pair : m_mapDownloader)
+    {
+        Downloader *pDownloader = pair.second.get();
+        if (pair.first == index || !pDownloader || !pDownloader->isRunning())
+        {
+            continue;
+        }
+        const qint64 nRemaining = pDownloader->remainingBytes();
+        if (nRemaining < 2 * m_nMinSegmentSize)
+        {
+            continue;
+        }
+        const double dSpeed = pDownloader->throughput();
+        const double dRemainingMs = dSpeed > 0 ? nRemaining / dSpeed : std::numeric_limits<double>::max();
+        if (dRemainingMs > dMaxRemainingMs)
+        {
+            dMaxRemainingMs = dRemainingMs;
+            pVictim = pDownloader;
+            nVictimIndex = pair.first;
+        }
+    }
+    if (!pVictim)
+    {
+        return false;
+    }
+
+    const qint64 nFrom = pVictim->writePosition();
+    const qint64 nTo = pVictim->endPoint();
+    // Split so both parts finish at the same time at their current speeds, the faster one takes the bigger share
+    double dThiefShare = 0.5;
+    const double dThiefSpeed = pThief->throughput();
+    const double dVictimSpeed = pVictim->throughput();
+    if (dThiefSpeed > 0 && dVictimSpeed > 0)
+    {
+        dThiefShare = dThiefSpeed / (dThiefSpeed + dVictimSpeed);
+    }
+    const qint64 nLow = alignUp(nFrom + m_nMinSegmentSize);
+    const qint64 nHigh = alignDown(nTo + 1 - m_nMinSegmentSize);
+    if (nLow > nHigh)
+    {
+        return false;
+    }
+    const qint64 nSplit = qBound(nLow, alignUp(nFrom + static_cast<qint64>((nTo - nFrom + 1) * (1.0 - dThiefShare))), nHigh);
+
+    if (!pThief->start(m_url, nSplit, nTo))
+    {
+        qDebug() << "[QMultiThreadNetwork] Part" << index << "failed to take over range:" << pThief->errorString();
+        return false;
+    }
+    pVictim->shrinkRange(nSplit - 1);
+
+    qDebug() << "[QMultiThreadNetwork] Part" << index << "takes over" << nSplit << "-" << nTo << "from part" << nVictimIndex;
+    return true;
+}
+
+qint64 NetworkMTDownloadRequest::alignDown(qint64 nPos) const
+{
+    return nPos - nPos % m_nSegmentAlignment;
+}
+
+qint64 NetworkMTDownloadRequest::alignUp(qint64 nPos) const
+{
+    return alignDown(nPos + m_nSegmentAlignment - 1);
+}
+
+void NetworkMTDownloadRequest::createSegmentManagers()
+{
+    m_nSegmentManagers = 1;
+    // HTTP/2: every segment is a stream of the one connection of the worker thread's manager
+    if (m_upContext->behavior.http2)
+    {
+        return;
+    }
+    // Enough managers that no segment waits for a connection, and up to one per core so that the socket and TLS work
+    // of the connections is spread over the managers' HTTP threads
+    const int nRequired = (m_nThreadCount + CONNECTIONS_PER_MANAGER - 1) / CONNECTIONS_PER_MANAGER;
+    const int nManagers = qMin(m_nThreadCount, qMax(nRequired, QThread::idealThreadCount()));
+    // Created by the first download of the thread that needs them, the next downloads reuse them and their connections
+    m_nSegmentManagers = qMax(1, nManagers);
+    qDebug() << "[QMultiThreadNetwork] Segments:" << m_nThreadCount << "network managers:" << nManagers;
+}
+
+QNetworkAccessManager *NetworkMTDownloadRequest::segmentManager(int index) const
+{
+    // Round robin, the worker thread's shared manager takes the first segment
+    const int nSlot = index % m_nSegmentManagers;
+    return nSlot == 0 ? m_pNetworkManager : NetworkAccessManagerPool::threadLocalManager(nSlot);
+}
+
 void NetworkMTDownloadRequest::clearDownloaders()
 {
     for (std::pair<const int, std::unique_ptr<Downloader>> &pair : m_mapDownloader)
@@ -414,10 +965,31 @@ void NetworkMTDownloadRequest::clearDownloaders()
     m_setFinishedIds.clear();
 }
 
-void NetworkMTDownloadRequest::clearProgress()
+void NetworkMTDownloadRequest::recordCompleted(const Downloader *pDownloader)
 {
-    m_mapBytesReceived.clear();
-    m_bytesTotal = 0;
+    if (m_journal && pDownloader && pDownloader->writePosition() > pDownloader->rangeStart())
+    {
+        m_journal->addCompleted(pDownloader->rangeStart(), pDownloader->writePosition() - 1);
+    }
+}
+
+void NetworkMTDownloadRequest::flushJournal()
+{
+    if (!m_journal || !m_storage || !m_storage->isOpen())
+    {
+        return;
+    }
+    for (const std::pair<const int, std::unique_ptr<Downloader>> &pair : m_mapDownloader)
+    {
+        recordCompleted(pair.second.get());
+    }
+    // Data first: the journal must never claim bytes that are not on disk yet (only the chunks written since the last flush)
+    if (!m_storage->flushDirty(true))
+    {
+        qDebug() << "[QMultiThreadNetwork] Journal not saved, flushing the data failed:" << m_storage->lastError();
+        return;
+    }
+    m_journal->save();
 }
 
 QString NetworkMTDownloadRequest::generateTempFilePath(const QString& originalPath)
@@ -483,25 +1055,32 @@ bool NetworkMTDownloadRequest::renameTempFileToFinal()
 }
 
 //////////////////////////////////////////////////////////////////////////
-Downloader::Downloader(int index, MemoryMappedFile *mappedFile, QNetworkAccessManager *pNetworkManager, bool bShowProgress, quint16 nMaxRedirectionCount, QObject *parent)
+Downloader::Downloader(int index, DownloadStorage *storage, QNetworkAccessManager *pNetworkManager, TransferProgress *pProgress, quint16 nMaxRedirectionCount, QObject *parent)
     : QObject(parent),
-      m_nIndex(index),
+      m_pNetworkManager(QPointer<QNetworkAccessManager>(pNetworkManager)),
       m_pNetworkReply(nullptr),
       m_bAbortManual(false),
+      m_nIndex(index),
       m_nStartPoint(0),
       m_nEndPoint(0),
       m_nRedirectionCount(0),
-      m_pNetworkManager(QPointer<QNetworkAccessManager>(pNetworkManager)),
-      m_bShowProgress(bShowProgress),
       m_nMaxRedirectionCount(nMaxRedirectionCount),
-      m_mappedFile(QPointer<MemoryMappedFile>(mappedFile)),
-      m_bytesWritten(0)
+      m_storage(storage),
+      m_pProgress(pProgress),
+      m_bytesWritten(0),
+      m_nCompletedBytes(0),
+      m_bRangeShrunk(false),
+      m_nActiveMs(0),
+      m_bResourceChanged(false),
+      m_bRangeIgnored(false),
+      m_bStorageFailed(false),
+      m_bFullResponse(false),
+      m_bHttp2(false),
+      m_eLastError(QNetworkReply::NoError),
+      m_nLastStatusCode(0)
 {
-	m_timer.setInterval(m_mIntervalMs);
-	connect(&m_timer, &QTimer::timeout, this, [this]()
-		{
-			m_bTimeout = true;
-		});
+    m_throttleTimer.setSingleShot(true);
+    connect(&m_throttleTimer, &QTimer::timeout, this, &Downloader::onReadyRead);
 }
 
 Downloader::~Downloader()
@@ -512,7 +1091,7 @@ Downloader::~Downloader()
 void Downloader::abort()
 {
     m_bAbortManual = true;
-    m_timer.stop();
+    m_throttleTimer.stop();
     if (m_pNetworkReply)
     {
         if (m_pNetworkReply->isRunning())
@@ -523,26 +1102,47 @@ void Downloader::abort()
         m_pNetworkReply = nullptr;
     }
 
-    // Memory mapped file is managed externally, no need to close here
-    m_mappedFile = nullptr;
+    // The destination file is managed externally, no need to close here
+    m_storage = nullptr;
     m_pNetworkManager = nullptr;
 }
 
-bool Downloader::start(const QUrl &url, qint64 startPoint, qint64 endPoint)
+bool Downloader::beginRange(const QUrl &url, qint64 startPoint, qint64 endPoint)
 {
-    if (nullptr == m_pNetworkManager || nullptr == m_mappedFile || !url.isValid())
+    if (nullptr == m_pNetworkManager || nullptr == m_storage || !url.isValid())
     {
         m_strError = QString("Parameter error: Invalid parameters provided");
         return false;
     }
 
     m_bAbortManual = false;
+    m_nCompletedBytes += m_bytesWritten;
     m_bytesWritten = 0;
+    m_bRangeShrunk = false;
+    m_bResourceChanged = false;
+    m_bRangeIgnored = false;
+    m_bStorageFailed = false;
+    m_bFullResponse = false;
+    if (!m_speedTimer.isValid())
+    {
+        m_speedTimer.start();
+    }
+    if (!m_rangeTimer.isValid())
+    {
+        m_rangeTimer.start();
+    }
 
     m_url = url;
     m_nStartPoint = startPoint;
     m_nEndPoint = endPoint;
 
+    if (endPoint < 0 && m_storage->size() == 0)
+    {
+        // Size unknown, the file grows with the writes: the range runs to the end of the stream
+        m_nEndPoint = std::numeric_limits<qint64>::max() - 1;
+        return true;
+    }
+
     // Verify if download range is valid
     if (startPoint < 0 || endPoint < startPoint)
     {
@@ -551,7 +1151,7 @@ bool Downloader::start(const QUrl &url, qint64 startPoint, qint64 endPoint)
     }
 
     // Check if exceeding file size
-    qint64 fileSize = m_mappedFile->size();
+    qint64 fileSize = m_storage->size();
     if (startPoint >= fileSize)
     {
         m_strError = QString("Range error: Start point %1 exceeds file size %2").arg(startPoint).arg(fileSize);
@@ -560,8 +1160,16 @@ bool Downloader::start(const QUrl &url, qint64 startPoint, qint64 endPoint)
 
     if (endPoint >= fileSize)
     {
-        endPoint = fileSize - 1;
-        m_nEndPoint = endPoint;
+        m_nEndPoint = fileSize - 1;
+    }
+    return true;
+}
+
+bool Downloader::start(const QUrl &url, qint64 startPoint, qint64 endPoint)
+{
+    if (!beginRange(url, startPoint, endPoint))
+    {
+        return false;
     }
     QString range = QString::asprintf("Bytes=%lld-%lld", m_nStartPoint, m_nEndPoint);
     if (range.isEmpty())
@@ -573,9 +1181,15 @@ bool Downloader::start(const QUrl &url, qint64 startPoint, qint64 endPoint)
     QNetworkRequest request;
     request.setUrl(url);
     request.setRawHeader("Range", range.toLocal8Bit());
+    if (!m_ifRange.isEmpty())
+    {
+        request.setRawHeader("If-Range", m_ifRange);
+    }
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/octet-stream");
-    request.setRawHeader("Accept-Encoding", "gzip,deflate");
+    // Byte ranges of the file itself, not of a compressed representation
+    request.setRawHeader("Accept-Encoding", "identity");
     request.setRawHeader("Connection", "keep-alive");
+    NetworkRequestUtility::applyHttp2(request, m_bHttp2);
 
 #ifndef QT_NO_SSL
     if (url.scheme().toLower() == "https")
@@ -597,66 +1211,177 @@ bool Downloader::start(const QUrl &url, qint64 startPoint, qint64 endPoint)
     m_pNetworkReply = m_pNetworkManager->get(request);
     if (m_pNetworkReply)
     {
-        connect(m_pNetworkReply, SIGNAL(finished()), this, SLOT(onFinished()));
-        connect(m_pNetworkReply, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+        connectReply();
+    }
+    return true;
+}
+
+bool Downloader::adopt(QNetworkReply *pReply, const QUrl &url, qint64 startPoint, qint64 endPoint)
+{
+    if (!pReply || !beginRange(url, startPoint, endPoint))
+    {
+        return false;
+    }
+    qDebug() << "[QMultiThreadNetwork] Part" << m_nIndex << "continues the probe up to" << m_nEndPoint;
+    m_pNetworkReply = pReply;
+    connectReply();
+    // The reply runs to the end of the file, what follows the range belongs to the other parts
+    m_bRangeShrunk = m_nEndPoint < m_storage->size() - 1;
+    // The probe came back whole (no range support): no Content-Range to check
+    m_bFullResponse = pReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 200;
+    return true;
+}
+
+void Downloader::connectReply()
+{
+    // A throttled reply stops reading the socket once its buffer is full
+    const qint64 nReadBufferSize = NetworkBandwidthLimiter::globalInstance()->readBufferSize(m_bandwidth);
+    if (nReadBufferSize > 0)
+    {
+        m_pNetworkReply->setReadBufferSize(nReadBufferSize);
+    }
+    connect(m_pNetworkReply, SIGNAL(finished()), this, SLOT(onFinished()));
+    connect(m_pNetworkReply, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
-        connect(m_pNetworkReply, SIGNAL(errorOccurred(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
+    connect(m_pNetworkReply, SIGNAL(errorOccurred(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
 #else
-        connect(m_pNetworkReply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
+    connect(m_pNetworkReply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
 #endif
-        
-        connect(m_pNetworkReply, &QNetworkReply::downloadProgress, this, [=](qint64 bytesReceived, qint64 bytesTotal)
-            {
-                if (!m_bAbortManual && m_bTimeout && bytesReceived > 0 && bytesTotal > 0)
-                    m_bTimeout = false;
-                    emit downloadProgress(m_nIndex, bytesReceived, bytesTotal); 
-            });
+}
+
+bool Downloader::resume()
+{
+    if (isRunning())
+    {
+        return false;
     }
-    m_timer.start();
-    return true;
+    return start(m_url, writePosition(), m_nEndPoint);
+}
+
+qint64 Downloader::retryDelay(const RetryPolicy &policy, quint16 nRetry) const
+{
+    if (m_bResourceChanged || m_bRangeIgnored || m_bStorageFailed || m_bAbortManual)
+    {
+        return -1;
+    }
+    return NetworkRequestUtility::retryDelay(policy, nRetry, m_eLastError, m_nLastStatusCode, m_lastRetryAfter);
 }
 
 void Downloader::onReadyRead()
+{
+    readReply(true);
+}
+
+void Downloader::readReply(bool bThrottled)
 {
     if (m_pNetworkReply && m_pNetworkReply->error() == QNetworkReply::NoError && m_pNetworkReply->isOpen())
     {
-        const QByteArray &bytesRev = m_pNetworkReply->readAll();
-        if (bytesRev.isEmpty())
+        const int statusCode = m_pNetworkReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (statusCode >= 300)
+        {
+            // Body of a redirection or an error page (the error is only set when the reply finishes), not part of the file
+            m_pNetworkReply->readAll();
+            return;
+        }
+        if (m_bytesWritten == 0 && !m_bFullResponse && !checkContentRange(statusCode))
+        {
+            qDebug() << "[QMultiThreadNetwork] Part" << m_nIndex << m_strError;
+            endRange(false);
             return;
+        }
 
-        if (m_mappedFile && m_mappedFile->isOpen())
+        if (!m_storage || !m_storage->isOpen())
         {
-            // Calculate write position: start position + bytes already written
-            qint64 writePosition = m_nStartPoint + m_bytesWritten;
+            qCritical() << "[QMultiThreadNetwork] Part" << m_nIndex << "Destination file is not open";
+            m_strError = QString("File storage error: File is not open for writing");
+            m_bStorageFailed = true;
+            endRange(false);
+            return;
+        }
 
-            // Check if it will exceed download range
-            qint64 remainingBytes = m_nEndPoint - m_nStartPoint + 1;
-            qint64 bytesToWrite = qMin(static_cast<qint64>(bytesRev.size()), remainingBytes - m_bytesWritten);
+        const qint64 nAvailable = m_pNetworkReply->bytesAvailable();
+        if (nAvailable <= 0)
+            return;
 
-            if (bytesToWrite > 0)
+        // Check if it will exceed download range
+        qint64 nToWrite = qMin(nAvailable, remainingBytes());
+        if (nToWrite <= 0)
+        {
+            qWarning() << "[QMultiThreadNetwork] Part" << m_nIndex << "Attempted to write beyond download range";
+            return;
+        }
+        NetworkBandwidthLimiter *pLimiter = NetworkBandwidthLimiter::globalInstance();
+        if (bThrottled)
+        {
+            // The rest waits in the reply, the parts of a request share its limits
+            nToWrite = pLimiter->acquire(m_bandwidth, NetworkBandwidthLimiter::Download, nToWrite, m_throttleTimer);
+            if (nToWrite <= 0)
             {
-                qint64 bytesWritten = m_mappedFile->write(writePosition, bytesRev.constData(), bytesToWrite);
-                if (bytesWritten > 0)
-                {
-                    m_bytesWritten += bytesWritten;
-                }
-                else
-                {
-                    qCritical() << "[QMultiThreadNetwork] Part" << m_nIndex << "MemoryMappedFile write error:" << m_mappedFile->lastError();
-                    m_strError = m_mappedFile->lastError();
-                }
+                return;
             }
-            else
+        }
+        else
+        {
+            pLimiter->consume(m_bandwidth, NetworkBandwidthLimiter::Download, nToWrite);
+        }
+
+        // Read straight into the file at the write position (start position + bytes already written), no intermediate buffer
+        const qint64 bytesWritten = m_storage->writeFrom(m_pNetworkReply, writePosition(), nToWrite);
+        if (bytesWritten > 0)
+        {
+            m_bytesWritten += bytesWritten;
+            if (m_pProgress)
             {
-                qWarning() << "[QMultiThreadNetwork] Part" << m_nIndex << "Attempted to write beyond download range";
+                m_pProgress->add(bytesWritten);
+            }
+            if (m_bRangeShrunk && remainingBytes() <= 0)
+            {
+                // The rest of this response was handed to another part
+                endRange(true);
+                return;
             }
         }
-        else
+        else if (bytesWritten < 0)
+        {
+            qCritical() << "[QMultiThreadNetwork] Part" << m_nIndex << "Storage write error:" << m_storage->lastError();
+            // Reading on would skip the bytes that were not written, the range fails right away
+            m_strError = m_storage->lastError();
+            m_bStorageFailed = true;
+            endRange(false);
+            return;
+        }
+    }
+}
+
+bool Downloader::checkContentRange(int nStatusCode)
+{
+    if (nStatusCode == 200)
+    {
+        // The whole file instead of our range: If-Range did not match (the file changed), or the server ignores Range
+        m_bRangeIgnored = true;
+        m_bResourceChanged = !m_ifRange.isEmpty();
+        m_strError = m_bResourceChanged ? QString("Download error: The file changed on the server")
+                                        : QString("Download error: The server ignored the range request");
+        return false;
+    }
+    if (nStatusCode == 206)
+    {
+        const QByteArray contentRange = m_pNetworkReply->rawHeader("Content-Range");
+        qint64 nFirst = -1;
+        qint64 nTotal = -1;
+        const bool bValid = ResourceProbe::parseContentRange(contentRange, nFirst, nTotal);
+        // The total may be unknown ("*")
+        const bool bSizeChanged = bValid && nTotal >= 0 && m_storage && nTotal != m_storage->size();
+        if (!bValid || nFirst != m_nStartPoint || bSizeChanged)
         {
-            qCritical() << "[QMultiThreadNetwork] Part" << m_nIndex << "Memory mapped file is not open";
-            m_strError = QString("Memory mapping error: File is not open for memory mapping");
+            // Other bytes than those asked for, or those of a file of another size
+            m_bResourceChanged = bSizeChanged;
+            m_strError = QString("Download error: Unexpected Content-Range \"%1\" for the range from %2")
+                .arg(QString::fromLatin1(contentRange)).arg(m_nStartPoint);
+            return false;
         }
     }
+    return true;
 }
 
 void Downloader::onFinished()
@@ -670,8 +1395,20 @@ void Downloader::onFinished()
             return;
         }
 
+        // The tail held back by the bandwidth limits
+        m_throttleTimer.stop();
+        readReply(false);
+        if (!m_pNetworkReply)
+        {
+            // The range ended while the tail was written
+            return;
+        }
+
         bool bSuccess = (m_pNetworkReply->error() == QNetworkReply::NoError);
         int statusCode = m_pNetworkReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        m_eLastError = m_pNetworkReply->error();
+        m_nLastStatusCode = statusCode;
+        m_lastRetryAfter = m_pNetworkReply->rawHeader("Retry-After");
         bool bHttpProxy = isHttpProxy(m_url.scheme()) || isHttpsProxy(m_url.scheme());
         if (bHttpProxy)
         {
@@ -680,7 +1417,7 @@ void Downloader::onFinished()
         if (!bSuccess)
         {
             // Handle redirection
-            if (statusCode == 301 || statusCode == 302)
+            if (statusCode == 301 || statusCode == 302 || statusCode == 307 || statusCode == 308)
             {
                 const QVariant &redirectionTarget = m_pNetworkReply->attribute(QNetworkRequest::RedirectionTargetAttribute);
                 const QUrl &redirectUrl = m_url.resolved(redirectionTarget.toUrl());
@@ -688,11 +1425,14 @@ void Downloader::onFinished()
                 {
                     qDebug() << "[QMultiThreadNetwork] Redirecting from:" << m_url.toString()
                              << "to:" << redirectUrl.toString();
+                    NetworkRedirectCache::globalInstance()->store(m_url, redirectUrl, statusCode);
 
                     // Clean up current resources
                     m_pNetworkReply->deleteLater();
                     m_pNetworkReply = nullptr;
 
+                    // Whatever was written came from the redirect response
+                    m_bytesWritten = 0;
                     start(redirectUrl, m_nStartPoint, m_nEndPoint);
                     return;
                 }
@@ -705,10 +1445,10 @@ void Downloader::onFinished()
         }
         else
         {
-            // Memory mapped file syncs automatically, no need to manually flush
-            if (m_mappedFile && m_mappedFile->isOpen())
+            // Start the write-back of this range only, the whole file is synced once when the download completes
+            if (m_storage && m_storage->isOpen())
             {
-                m_mappedFile->flush();
+                m_storage->flushRange(m_nStartPoint, m_bytesWritten);
             }
         }
 
@@ -716,6 +1456,7 @@ void Downloader::onFinished()
         m_pNetworkReply->deleteLater();
         m_pNetworkReply = nullptr;
 
+        stopRangeTimer();
         emit downloadFinished(m_nIndex, bSuccess, m_strError);
     }
     catch (const std::exception &e)
@@ -751,4 +1492,53 @@ void Downloader::onError(QNetworkReply::NetworkError code)
 
     m_strError = m_pNetworkReply->errorString();
     qDebug() << "[QMultiThreadNetwork] Part" << m_nIndex << "Downloader::onError" << m_strError;
-}
\ No newline at end of file
+}
+
+double Downloader::throughput() const
+{
+    const qint64 nElapsedMs = m_speedTimer.isValid() ? m_speedTimer.elapsed() : 0;
+    if (nElapsedMs <= 0)
+    {
+        return 0;
+    }
+    return static_cast<double>(totalBytesWritten()) / nElapsedMs;
+}
+
+bool Downloader::shrinkRange(qint64 nEndPoint)
+{
+    if (!isRunning() || nEndPoint >= m_nEndPoint || nEndPoint < writePosition())
+    {
+        return false;
+    }
+    m_nEndPoint = nEndPoint;
+    m_bRangeShrunk = true;
+    return true;
+}
+
+void Downloader::endRange(bool bSuccess)
+{
+    m_throttleTimer.stop();
+    if (m_pNetworkReply)
+    {
+        m_pNetworkReply->disconnect(this);
+        m_pNetworkReply->abort();
+        m_pNetworkReply->deleteLater();
+        m_pNetworkReply = nullptr;
+    }
+    if (bSuccess && m_storage && m_storage->isOpen())
+    {
+        m_storage->flushRange(m_nStartPoint, m_bytesWritten);
+    }
+
+    stopRangeTimer();
+    emit downloadFinished(m_nIndex, bSuccess, bSuccess ? QString() : m_strError);
+}
+
+void Downloader::stopRangeTimer()
+{
+    if (m_rangeTimer.isValid())
+    {
+        m_nActiveMs += m_rangeTimer.elapsed();
+        m_rangeTimer.invalidate();
+    }
+}
@@ -9,7 +9,10 @@
 #include <QTimer>
 
 #include "networkrequest.h"
-#include "memorymappedfile.h"
+#include "networkdownloadstorage.h"
+#include "networkdownloadjournal.h"
+#include "networkbandwidthlimiter.h"
+#include "networkprobecache.h"
 
 class QFile;
 
@@ -31,13 +34,35 @@ namespace QtNetworkRequest
 		void abort() Q_DECL_OVERRIDE;
 		void onFinished() Q_DECL_OVERRIDE;
 		void onSubPartFinished(int index, bool bSuccess, const QString &strErr);
-		void onSubPartDownloadProgress(int index, qint64 bytesReceived, qint64 bytesTotal);
 
 	private:
+		// Retry a failed part from its write position after the backoff delay (behavior.retryOnFailed).
+		// Returns false if the failure is final
+		bool retrySubPart(int index, const QString &strErr);
+		// Probe the size with a GET of the first range (HEAD for other schemes than HTTP)
 		bool requestFileSize();
+		// Headers of the probe: size and validators are known, the download starts and the first part carries on with the probe
+		void onProbeHeaders();
+		void discardProbe();
+		// Whether the failure of the part means the cached probe no longer holds
+		bool isProbeOutdated(int index) const;
+		// The probe no longer holds: start over with a new probe, redirects followed again
+		void reprobe();
 		void startMTDownload();
+		// No size known (no Content-Length): the probe reply carries on as the single stream up to its end
+		void streamProbe();
+		void finishDownload();
+		// Hand the unfinished tail of the slowest part to the idle downloader. Returns false if nothing is worth splitting
+		bool stealWork(int index);
+		qint64 alignUp(qint64 nPos) const;
+		qint64 alignDown(qint64 nPos) const;
+		// How many of the worker thread's network managers the downloaders are spread over
+		void createSegmentManagers();
+		QNetworkAccessManager *segmentManager(int index) const;
 		void clearDownloaders();
-		void clearProgress();
+		// Resumable download: record the data written by a downloader, then flush data and journal to disk
+		void recordCompleted(const Downloader *pDownloader);
+		void flushJournal();
 		QString generateTempFilePath(const QString& originalPath);
 		bool renameTempFileToFinal();
 
@@ -46,17 +71,32 @@ namespace QtNetworkRequest
 		QString m_strTempFilePath;
 		qint64 m_nFileSize;
 
+		// Managers of the worker thread the downloaders use (NetworkAccessManagerPool), each with its own connections and HTTP thread
+		int m_nSegmentManagers;
 		std::map<int, std::unique_ptr<Downloader>> m_mapDownloader;
 		int m_nThreadCount; // How many segments to divide into for download
+		qint64 m_nMinSegmentSize;
+		qint64 m_nSegmentAlignment;
 		int m_nSuccess;
 		int m_nFailed;
 		QSet<int> m_setFinishedIds;
-
-		std::unique_ptr<MemoryMappedFile> m_mappedFile; // Memory mapped file
+		// Ranges waiting for a free downloader
+		QList<NetworkDownloadJournal::Range> m_pendingRanges;
+		// Retries in a row without progress of each part
+		QHash<int, quint16> m_mapPartRetries;
+
+		// Resumable download (DownloadConfig::resumable)
+		std::unique_ptr<NetworkDownloadJournal> m_journal;
+		QTimer m_journalTimer;
+		ResourceProbe m_probe;
+		qint64 m_nResumedBytes;		// Bytes already on disk when the download started
+		bool m_bDiscardPartial;		// The file changed on the server, the partial data is useless
+		QNetworkReply *m_pProbeReply;	// Probe waiting to be taken over by the first part
+		bool m_bProbeCached;			// The download started from NetworkProbeCache, without probing
+		bool m_bSingleStreamForced;		// The server answered range requests with the whole file, no more splitting
+
+		std::unique_ptr<DownloadStorage> m_storage;		// Destination file (DownloadConfig::storageBackend)
 		QElapsedTimer m_downloadTimer;					// Download timer
-
-		QMap<int, qint64> m_mapBytesReceived;
-		qint64 m_bytesTotal;
 	};
 
 	// Used for downloading files (or part of a file)
@@ -66,29 +106,76 @@ namespace QtNetworkRequest
 
 	public:
 		explicit Downloader(int index,
-							MemoryMappedFile *mappedFile,
+							DownloadStorage *storage,
 							QNetworkAccessManager *pNetworkManager,
-							bool bShowProgress = false,
+							TransferProgress *pProgress = nullptr,
 							quint16 nMaxRedirectionCount = 5,
 							QObject *parent = 0);
 
 		virtual ~Downloader();
 
 		bool start(const QUrl &url, qint64 startPoint = 0, qint64 endPoint = -1);
+		// Take over a running reply that delivers the file from startPoint to its end (the probe), for the range up to endPoint.
+		// endPoint -1 with a storage of unknown size (still empty): the whole stream. Call it before the reply announced any data
+		bool adopt(QNetworkReply *pReply, const QUrl &url, qint64 startPoint, qint64 endPoint);
+		// Request the rest of the current range again after a failure, the bytes already written are kept
+		bool resume();
 
 		void abort();
 
 		QString errorString() const { return m_strError; }
 
+		bool isRunning() const { return nullptr != m_pNetworkReply; }
+		// Next file offset to be written and last offset of the current range
+		qint64 rangeStart() const { return m_nStartPoint; }
+		qint64 writePosition() const { return m_nStartPoint + m_bytesWritten; }
+		qint64 endPoint() const { return m_nEndPoint; }
+		qint64 remainingBytes() const { return m_nEndPoint - writePosition() + 1; }
+		// Bytes written since the range was (re)started
+		qint64 rangeBytesWritten() const { return m_bytesWritten; }
+		// Bytes written by this downloader over all of its ranges
+		qint64 totalBytesWritten() const { return m_nCompletedBytes + m_bytesWritten; }
+		// Average write speed in bytes per millisecond, 0 if not measured yet
+		double throughput() const;
+		// Time spent transferring ranges (idle time between ranges excluded)
+		qint64 activeMs() const { return m_nActiveMs + (m_rangeTimer.isValid() ? m_rangeTimer.elapsed() : 0); }
+		// Give up the tail of the current range after nEndPoint (work stealing). The range finishes as soon as nEndPoint is written
+		bool shrinkRange(qint64 nEndPoint);
+
+		// Validator sent as If-Range with every range request. The part fails if the server answers with the whole (changed) file
+		void setIfRange(const QByteArray &ifRange) { m_ifRange = ifRange; }
+		// Bandwidth limits the reads are held to (those of the request)
+		void setBandwidthPath(const BandwidthPath &path) { m_bandwidth = path; }
+		// Ranges go as HTTP/2 streams over the connection the downloaders share (behavior.http2)
+		void setHttp2(bool bHttp2) { m_bHttp2 = bHttp2; }
+		bool isResourceChanged() const { return m_bResourceChanged; }
+		// The server answered the range request with the whole file
+		bool isRangeIgnored() const { return m_bRangeIgnored; }
+		// HTTP status of the last reply
+		int lastStatusCode() const { return m_nLastStatusCode; }
+		// Delay before retry nRetry + 1 of the failed range, -1 = not worth retrying
+		qint64 retryDelay(const RetryPolicy &policy, quint16 nRetry) const;
+
 	Q_SIGNALS:
 		void downloadFinished(int index, bool bSuccess, const QString &strErr);
-		void downloadProgress(int index, qint64 bytesReceived, qint64 bytesTotal);
 
 	public Q_SLOTS:
 		void onFinished();
 		void onReadyRead();
 		void onError(QNetworkReply::NetworkError code);
 
+	private:
+		// Check the range and reset the state of the previous one
+		bool beginRange(const QUrl &url, qint64 startPoint, qint64 endPoint);
+		void connectReply();
+		// Write what the reply holds, within the bandwidth quota unless the reply finished
+		void readReply(bool bThrottled);
+		// End the current range before the reply ends (range was shrunk, or the response is unusable)
+		void endRange(bool bSuccess);
+		// Whether the response carries the range that was asked for (checked before its first byte is written)
+		bool checkContentRange(int nStatusCode);
+		void stopRangeTimer();
+
 	private:
 		QPointer<QNetworkAccessManager> m_pNetworkManager;
 		QNetworkReply *m_pNetworkReply;
@@ -100,16 +187,29 @@ namespace QtNetworkRequest
 		qint64 m_nStartPoint;
 		qint64 m_nEndPoint;
 
-		bool m_bShowProgress;
 		quint16 m_nRedirectionCount;
 		quint16 m_nMaxRedirectionCount;
 
-		QPointer<MemoryMappedFile> m_mappedFile; // Memory mapped file pointer
+		DownloadStorage *m_storage;				 // Owned by the request, which clears its downloaders before closing it
+		TransferProgress *m_pProgress;			 // Progress of the whole request, shared by its downloaders (nullptr = not wanted)
 		qint64 m_bytesWritten;					 // Bytes written
-
-		QTimer m_timer;
-		int m_mIntervalMs{ 250 };
-		bool m_bTimeout = false;
+		qint64 m_nCompletedBytes;				 // Bytes written by the previous ranges
+		bool m_bRangeShrunk;					 // Part of the current range was taken over by another downloader
+		QElapsedTimer m_speedTimer;
+		QElapsedTimer m_rangeTimer;				 // Running while a range is transferred
+		qint64 m_nActiveMs;
+		QByteArray m_ifRange;
+		bool m_bResourceChanged;
+		bool m_bRangeIgnored;
+		bool m_bStorageFailed;					 // Writing to the destination file failed, not worth retrying
+		bool m_bFullResponse;					 // Adopted 200 probe: the whole file is the range
+		BandwidthPath m_bandwidth;
+		bool m_bHttp2;
+		QTimer m_throttleTimer;					 // Reads again once the bandwidth quota allows it
+		// Outcome of the last reply, for retryDelay()
+		QNetworkReply::NetworkError m_eLastError;
+		int m_nLastStatusCode;
+		QByteArray m_lastRetryAfter;
 	};
 }
 
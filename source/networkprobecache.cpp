@@ -0,0 +1,135 @@
+#include "networkprobecache.h"
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QUrl>
+#include "networkresponsecache.h"
+
+using namespace QtNetworkRequest;
+
+// How long a probe is trusted before the resource is probed again
+#define PROBE_CACHE_TTL_MS (10 * 60 * 1000)
+#define PROBE_CACHE_MAX_ENTRIES 256
+
+QByteArray ResourceProbe::ifRange() const
+{
+    // If-Range only accepts a strong ETag or a date
+    if (!etag.isEmpty() && !etag.startsWith("W/"))
+    {
+        return etag;
+    }
+    return lastModified;
+}
+
+ResourceProbe ResourceProbe::of(const QNetworkReply *pReply)
+{
+    ResourceProbe probe;
+    if (!pReply)
+    {
+        return probe;
+    }
+    const int nStatusCode = pReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (nStatusCode == 206)
+    {
+        qint64 nFirst = -1;
+        probe.acceptRanges = parseContentRange(pReply->rawHeader("Content-Range"), nFirst, probe.size);
+    }
+    else
+    {
+        const QVariant length = pReply->header(QNetworkRequest::ContentLengthHeader);
+        probe.size = length.isValid() ? length.toLongLong() : -1;
+        probe.acceptRanges = pReply->rawHeader("Accept-Ranges").toLower().contains("bytes");
+    }
+    probe.etag = pReply->rawHeader("ETag");
+    probe.lastModified = pReply->rawHeader("Last-Modified");
+    // Redirects are followed request by request, the reply is the one of the last hop
+    probe.location = pReply->url();
+    return probe;
+}
+
+bool ResourceProbe::parseContentRange(const QByteArray &value, qint64 &nFirst, qint64 &nTotal)
+{
+    nFirst = -1;
+    nTotal = -1;
+    const QByteArray range = value.trimmed();
+    const int nDash = range.indexOf('-');
+    const int nSlash = range.lastIndexOf('/');
+    if (!range.toLower().startsWith("bytes ") || nDash < 0 || nSlash < nDash)
+    {
+        return false;
+    }
+    bool bOk = false;
+    nFirst = range.mid(6, nDash - 6).trimmed().toLongLong(&bOk);
+    if (!bOk)
+    {
+        nFirst = -1;
+        return false;
+    }
+    const QByteArray total = range.mid(nSlash + 1).trimmed();
+    if (total != "*")
+    {
+        nTotal = total.toLongLong(&bOk);
+        if (!bOk)
+        {
+            nTotal = -1;
+            return false;
+        }
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+NetworkProbeCache *NetworkProbeCache::globalInstance()
+{
+    static NetworkProbeCache s_instance;
+    return &s_instance;
+}
+
+NetworkProbeCache::NetworkProbeCache()
+    : m_entries(PROBE_CACHE_MAX_ENTRIES)
+{
+}
+
+bool NetworkProbeCache::lookup(const QUrl &url, ResourceProbe &probe)
+{
+    const QString strKey = NetworkResponseCache::cacheKey(url);
+    QMutexLocker locker(&m_mutex);
+    Entry *pEntry = m_entries.object(strKey);
+    if (!pEntry)
+    {
+        return false;
+    }
+    if (QDateTime::currentMSecsSinceEpoch() - pEntry->nStoredMs > PROBE_CACHE_TTL_MS)
+    {
+        m_entries.remove(strKey);
+        return false;
+    }
+    probe = pEntry->probe;
+    return true;
+}
+
+void NetworkProbeCache::store(const QUrl &url, const ResourceProbe &probe)
+{
+    if (probe.size <= 0 || probe.ifRange().isEmpty())
+    {
+        return;
+    }
+    Entry *pEntry = new Entry;
+    pEntry->probe = probe;
+    pEntry->nStoredMs = QDateTime::currentMSecsSinceEpoch();
+    QMutexLocker locker(&m_mutex);
+    m_entries.insert(NetworkResponseCache::cacheKey(url), pEntry);
+}
+
+void NetworkProbeCache::remove(const QUrl &url)
+{
+    QMutexLocker locker(&m_mutex);
+    m_entries.remove(NetworkResponseCache::cacheKey(url));
+}
+
+void NetworkProbeCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_entries.clear();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <QByteArray>
+#include <QCache>
+#include <QMutex>
+#include <QString>
+#include <QUrl>
+
+class QNetworkReply;
+
+namespace QtNetworkRequest
+{
+    /**
+     * @brief What the probe of a multi-threaded download learnt about the resource
+     */
+    struct ResourceProbe
+    {
+        qint64 size{ -1 };
+        // The server answered a range request with 206 or announced Accept-Ranges: bytes
+        bool acceptRanges{ false };
+        QByteArray etag;
+        QByteArray lastModified;
+        // Url the probe ended up at after redirects, where the ranges are requested
+        QUrl location;
+
+        // Value of the If-Range header: a strong ETag or the date, empty if there is neither
+        QByteArray ifRange() const;
+
+        // Size, range support and validators of a response to a range GET (206) or of a full response (200/HEAD)
+        static ResourceProbe of(const QNetworkReply *pReply);
+        // First byte and total length of a Content-Range value ("bytes 0-99/1234"), nTotal = -1 if unknown ("*").
+        // false if it is missing or malformed
+        static bool parseContentRange(const QByteArray &value, qint64 &nFirst, qint64 &nTotal);
+    };
+
+    /**
+     * @brief Process wide cache of resource probes by url, so that a repeated download of the same file starts its
+     * range requests at once instead of probing first.
+     *
+     * Only probes with a validator are kept: the range requests send it as If-Range, so a resource that changed since
+     * is noticed (the server answers 200) and the download probes again. Entries expire after PROBE_CACHE_TTL_MS.
+     */
+    class NetworkProbeCache
+    {
+    public:
+        static NetworkProbeCache *globalInstance();
+
+        // The fresh probe of a url, false if there is none
+        bool lookup(const QUrl &url, ResourceProbe &probe);
+        // Keep a probe (ignored without a validator or size)
+        void store(const QUrl &url, const ResourceProbe &probe);
+        void remove(const QUrl &url);
+        void clear();
+
+    private:
+        NetworkProbeCache();
+        NetworkProbeCache(const NetworkProbeCache &) = delete;
+        NetworkProbeCache &operator=(const NetworkProbeCache &) = delete;
+
+        struct Entry
+        {
+            ResourceProbe probe;
+            qint64 nStoredMs{ 0 };
+        };
+
+    private:
+        QMutex m_mutex;
+        // Least recently used entries are evicted, one unit of cost each
+        QCache<QString, Entry> m_entries;
+    };
+}
@@ -0,0 +1,252 @@
+#include "networkprogresstracker.h"
+#include <QMutexLocker>
+#include "networkreply.h"
+
+using namespace QtNetworkRequest;
+
+#define DEFAULT_PROGRESS_INTERVAL_MS 100
+
+NetworkProgressTracker::NetworkProgressTracker(QObject *parent)
+    : QObject(parent), m_bNotifying(false), m_bTimerRequested(false), m_nMinBytes(0), m_nIntervalMs(DEFAULT_PROGRESS_INTERVAL_MS)
+{
+    m_timer.setInterval(DEFAULT_PROGRESS_INTERVAL_MS);
+    connect(&m_timer, &QTimer::timeout, this, &NetworkProgressTracker::onTick);
+}
+
+NetworkProgressTracker::~NetworkProgressTracker()
+{
+    clear();
+}
+
+std::shared_ptr<TransferProgress> NetworkProgressTracker::track(quint64 uiRequestId, bool bDownload,
+                                                                const std::shared_ptr<NetworkReply> &reply,
+                                                                quint64 uiBatchId, const std::shared_ptr<NetworkReply> &batchReply)
+{
+    std::shared_ptr<TransferProgress> progress = std::make_shared<TransferProgress>();
+    bool bStartTimer = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        Entry &entry = m_entries[uiRequestId];
+        entry.progress = progress;
+        entry.reply = reply;
+        entry.bDownload = bDownload;
+        if (uiBatchId > 0)
+        {
+            std::shared_ptr<BatchEntry> &batch = m_batches[uiBatchId];
+            if (!batch)
+            {
+                batch = std::make_shared<BatchEntry>();
+                batch->uiBatchId = uiBatchId;
+                batch->reply = batchReply;
+            }
+            entry.batch = batch;
+        }
+        if (!m_bTimerRequested)
+        {
+            m_bTimerRequested = true;
+            bStartTimer = true;
+        }
+    }
+    if (bStartTimer)
+    {
+        // The timer belongs to the tracker's thread
+        QMetaObject::invokeMethod(this, "onTracked", Qt::QueuedConnection);
+    }
+    return progress;
+}
+
+void NetworkProgressTracker::finish(quint64 uiRequestId)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        auto iter = m_entries.find(uiRequestId);
+        if (iter == m_entries.end())
+        {
+            return;
+        }
+        sample(iter.value(), true);
+        if (iter.value().batch)
+        {
+            sampleBatch(*iter.value().batch);
+        }
+        m_entries.erase(iter);
+    }
+    notify();
+}
+
+void NetworkProgressTracker::untrack(quint64 uiRequestId)
+{
+    QMutexLocker locker(&m_mutex);
+    auto iter = m_entries.find(uiRequestId);
+    if (iter != m_entries.end())
+    {
+        m_entries.erase(iter);
+    }
+}
+
+void NetworkProgressTracker::untrackBatch(quint64 uiBatchId)
+{
+    QMutexLocker locker(&m_mutex);
+    m_batches.remove(uiBatchId);
+}
+
+void NetworkProgressTracker::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_entries.clear();
+    m_batches.clear();
+    m_notifications.clear();
+}
+
+void NetworkProgressTracker::setInterval(int nIntervalMs, qint64 nMinBytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_nIntervalMs = qMax(1, nIntervalMs);
+    m_nMinBytes = qMax<qint64>(0, nMinBytes);
+}
+
+void NetworkProgressTracker::onTracked()
+{
+    QMutexLocker locker(&m_mutex);
+    m_timer.setInterval(m_nIntervalMs);
+    if (!m_timer.isActive())
+    {
+        m_timer.start();
+    }
+}
+
+void NetworkProgressTracker::onTick()
+{
+    if (m_bNotifying)
+    {
+        // A progress slot is running a nested event loop
+        return;
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_entries.isEmpty())
+        {
+            // Idle, the next track() starts the timer again
+            m_timer.stop();
+            m_bTimerRequested = false;
+            return;
+        }
+        if (m_timer.interval() != m_nIntervalMs)
+        {
+            m_timer.setInterval(m_nIntervalMs);
+        }
+
+        for (auto iter = m_entries.begin(); iter != m_entries.end(); ++iter)
+        {
+            sample(iter.value(), false);
+        }
+        for (auto iter = m_batches.begin(); iter != m_batches.end(); ++iter)
+        {
+            sampleBatch(*iter.value());
+        }
+    }
+    notify();
+}
+
+void NetworkProgressTracker::sample(Entry &entry, bool bFinal)
+{
+    const qint64 nBytes = entry.progress->bytes.load(std::memory_order_relaxed);
+    const qint64 nTotal = entry.progress->total.load(std::memory_order_relaxed);
+
+    // Batch totals move by the delta since the previous sample, no per-request maps to sum up
+    if (entry.batch && nBytes != entry.nSampled)
+    {
+        if (entry.bDownload)
+        {
+            entry.batch->nDownloaded += nBytes - entry.nSampled;
+            entry.batch->bDownloadChanged = true;
+        }
+        else
+        {
+            entry.batch->nUploaded += nBytes - entry.nSampled;
+            entry.batch->bUploadChanged = true;
+        }
+        entry.nSampled = nBytes;
+    }
+
+    if (nBytes == entry.nReported)
+    {
+        return;
+    }
+    const bool bComplete = (nTotal > 0 && nBytes >= nTotal);
+    if (!bFinal && !bComplete && qAbs(nBytes - entry.nReported) < m_nMinBytes)
+    {
+        return;
+    }
+    entry.nReported = nBytes;
+
+    std::shared_ptr<NetworkReply> reply = entry.reply.lock();
+    if (reply)
+    {
+        m_notifications.push_back({ std::move(reply), nBytes, nTotal, entry.bDownload, false });
+    }
+}
+
+void NetworkProgressTracker::sampleBatch(BatchEntry &batch)
+{
+    if (!batch.bDownloadChanged && !batch.bUploadChanged)
+    {
+        return;
+    }
+    std::shared_ptr<NetworkReply> reply = batch.reply.lock();
+    if (reply)
+    {
+        if (batch.bDownloadChanged)
+        {
+            m_notifications.push_back({ reply, batch.nDownloaded, 0, true, true });
+        }
+        if (batch.bUploadChanged)
+        {
+            m_notifications.push_back({ reply, batch.nUploaded, 0, false, true });
+        }
+    }
+    batch.bDownloadChanged = false;
+    batch.bUploadChanged = false;
+}
+
+void NetworkProgressTracker::notify()
+{
+    if (m_bNotifying)
+    {
+        // Emitted by the outer call
+        return;
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_notifications.empty())
+        {
+            return;
+        }
+        m_emitting.swap(m_notifications);
+    }
+
+    m_bNotifying = true;
+    for (const Notification &notification : m_emitting)
+    {
+        NetworkReply *pReply = notification.reply.get();
+        if (notification.bBatch)
+        {
+            if (notification.bDownload)
+                emit pReply->batchDownloadProgress(notification.nBytes);
+            else
+                emit pReply->batchUploadProgress(notification.nBytes);
+        }
+        else
+        {
+            if (notification.bDownload)
+                emit pReply->downloadProgress(notification.nBytes, notification.nTotal);
+            else
+                emit pReply->uploadProgress(notification.nBytes, notification.nTotal);
+        }
+    }
+    // Keeps the capacity for the next tick
+    m_emitting.clear();
+    m_bNotifying = false;
+}
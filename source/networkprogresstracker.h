@@ -0,0 +1,128 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+#include <QTimer>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace QtNetworkRequest
+{
+    class NetworkReply;
+
+    /**
+     * @brief Transfer progress of one request (behavior.showProgress).
+     *        Written by the request on its worker thread, sampled by NetworkProgressTracker on the main thread
+     */
+    struct TransferProgress
+    {
+        std::atomic<qint64> bytes{ 0 };
+        std::atomic<qint64> total{ 0 };
+
+        void set(qint64 nBytes, qint64 nTotal)
+        {
+            total.store(nTotal, std::memory_order_relaxed);
+            bytes.store(nBytes, std::memory_order_relaxed);
+        }
+        // Concurrent writers (the parts of a multi-threaded download)
+        void add(qint64 nBytes) { bytes.fetch_add(nBytes, std::memory_order_relaxed); }
+    };
+
+    /**
+     * @brief Reports the progress of the tracked requests to their NetworkReply.
+     *
+     * A single timer samples the counters of all requests at a fixed rate, so the main thread handles
+     * one tick per interval no matter how many transfers are running or how often they receive data.
+     * Batch totals are kept incrementally from the per-request deltas.
+     */
+    class NetworkProgressTracker : public QObject
+    {
+        Q_OBJECT
+
+    public:
+        explicit NetworkProgressTracker(QObject *parent = nullptr);
+        ~NetworkProgressTracker();
+
+        /**
+         * @brief Start sampling a request (any thread)
+         * @param batchReply Reply of the batch, nullptr for a single request. The batch total is kept until untrackBatch()
+         * @return Counters the request writes its progress into
+         */
+        std::shared_ptr<TransferProgress> track(quint64 uiRequestId, bool bDownload,
+                                                const std::shared_ptr<NetworkReply> &reply,
+                                                quint64 uiBatchId, const std::shared_ptr<NetworkReply> &batchReply);
+
+        /**
+         * @brief Report the last progress of a finished request and stop sampling it (main thread)
+         */
+        void finish(quint64 uiRequestId);
+
+        // Stop sampling without a report (any thread)
+        void untrack(quint64 uiRequestId);
+        // Drop the total of a batch that finished or was stopped (any thread). Its members are fed a few at a time,
+        // the total outlives the members being sampled
+        void untrackBatch(quint64 uiBatchId);
+        void clear();
+
+        /**
+         * @brief Sampling interval, and the change a request needs before it is reported again
+         *        (a request that reached its total is always reported)
+         */
+        void setInterval(int nIntervalMs, qint64 nMinBytes);
+
+    private Q_SLOTS:
+        void onTracked();
+        void onTick();
+
+    private:
+        struct BatchEntry
+        {
+            quint64 uiBatchId{ 0 };
+            std::weak_ptr<NetworkReply> reply;
+            qint64 nDownloaded{ 0 };
+            qint64 nUploaded{ 0 };
+            bool bDownloadChanged{ false };
+            bool bUploadChanged{ false };
+        };
+
+        struct Entry
+        {
+            std::shared_ptr<TransferProgress> progress;
+            std::weak_ptr<NetworkReply> reply;
+            std::shared_ptr<BatchEntry> batch;
+            bool bDownload{ true };
+            qint64 nSampled{ 0 };  // Bytes already added to the batch total
+            qint64 nReported{ 0 }; // Bytes of the last report
+        };
+
+        struct Notification
+        {
+            std::shared_ptr<NetworkReply> reply;
+            qint64 nBytes;
+            qint64 nTotal;
+            bool bDownload;
+            bool bBatch;
+        };
+
+        // m_mutex must be held
+        void sample(Entry &entry, bool bFinal);
+        void sampleBatch(BatchEntry &batch);
+        // Emit the collected notifications, without m_mutex (slots may post new requests)
+        void notify();
+
+    private:
+        QMutex m_mutex;
+        QHash<quint64, Entry> m_entries;
+        QHash<quint64, std::shared_ptr<BatchEntry>> m_batches;
+        // Reused between ticks, no allocation per report once warmed up
+        std::vector<Notification> m_notifications;
+        std::vector<Notification> m_emitting;
+        bool m_bNotifying;
+        bool m_bTimerRequested;
+        qint64 m_nMinBytes;
+        int m_nIntervalMs;
+        QTimer m_timer;
+    };
+}
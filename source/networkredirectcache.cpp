@@ -0,0 +1,71 @@
+#include "networkredirectcache.h"
+#include <QDebug>
+#include <QMutexLocker>
+#include "networkresponsecache.h"
+
+using namespace QtNetworkRequest;
+
+#define REDIRECT_CACHE_MAX_ENTRIES 512
+
+NetworkRedirectCache *NetworkRedirectCache::globalInstance()
+{
+    static NetworkRedirectCache s_instance;
+    return &s_instance;
+}
+
+NetworkRedirectCache::NetworkRedirectCache()
+    : m_targets(REDIRECT_CACHE_MAX_ENTRIES)
+{
+}
+
+bool NetworkRedirectCache::isPermanent(int nStatusCode)
+{
+    return nStatusCode == 301 || nStatusCode == 308;
+}
+
+QUrl NetworkRedirectCache::resolve(const QUrl &url, int nMaxHops)
+{
+    QUrl target = url;
+    QMutexLocker locker(&m_mutex);
+    if (m_targets.isEmpty())
+    {
+        return target;
+    }
+    for (int nHop = 0; nHop < nMaxHops; ++nHop)
+    {
+        const QUrl *pNext = m_targets.object(NetworkResponseCache::cacheKey(target));
+        // A loop ends where it started over
+        if (!pNext || *pNext == url)
+        {
+            break;
+        }
+        target = *pNext;
+    }
+    if (target != url)
+    {
+        qDebug() << "[QMultiThreadNetwork] Permanent redirect from:" << url.toString() << "to:" << target.toString();
+    }
+    return target;
+}
+
+void NetworkRedirectCache::store(const QUrl &from, const QUrl &to, int nStatusCode)
+{
+    if (!isPermanent(nStatusCode) || !to.isValid() || from == to)
+    {
+        return;
+    }
+    QMutexLocker locker(&m_mutex);
+    m_targets.insert(NetworkResponseCache::cacheKey(from), new QUrl(to));
+}
+
+void NetworkRedirectCache::remove(const QUrl &from)
+{
+    QMutexLocker locker(&m_mutex);
+    m_targets.remove(NetworkResponseCache::cacheKey(from));
+}
+
+void NetworkRedirectCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_targets.clear();
+}
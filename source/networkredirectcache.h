@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QCache>
+#include <QMutex>
+#include <QString>
+#include <QUrl>
+
+namespace QtNetworkRequest
+{
+    /**
+     * @brief Process wide cache of permanent redirects (301/308) by source url, shared by all request types.
+     *
+     * A request for a url that was permanently moved goes to the final location at once instead of taking the hop
+     * again. Temporary redirects (302/307) are not kept, their targets (signed urls, load balancers) may change with
+     * every request. The least recently used entries are evicted beyond REDIRECT_CACHE_MAX_ENTRIES.
+     */
+    class NetworkRedirectCache
+    {
+    public:
+        static NetworkRedirectCache *globalInstance();
+
+        // 301 and 308
+        static bool isPermanent(int nStatusCode);
+
+        // Target after at most nMaxHops cached redirects, url itself if it was not redirected
+        QUrl resolve(const QUrl &url, int nMaxHops);
+        // Keep the redirect from -> to if nStatusCode is a permanent one
+        void store(const QUrl &from, const QUrl &to, int nStatusCode);
+        void remove(const QUrl &from);
+        void clear();
+
+    private:
+        NetworkRedirectCache();
+        NetworkRedirectCache(const NetworkRedirectCache &) = delete;
+        NetworkRedirectCache &operator=(const NetworkRedirectCache &) = delete;
+
+    private:
+        QMutex m_mutex;
+        QCache<QString, QUrl> m_targets;
+    };
+}
@@ -5,11 +5,16 @@
 #include "networkcommonrequest.h"
 #include "networkmtdownloadrequest.h"
 #include "networkrequestutility.h"
+#include "networkbandwidthlimiter.h"
+#include "networkredirectcache.h"
 
 using namespace QtNetworkRequest;
 
 NetworkRequest::NetworkRequest(QObject *parent)
-    : QObject(parent), m_bAbortManual(false), m_pNetworkManager(nullptr), m_pNetworkReply(nullptr), m_nProgress(0), m_nRedirectionCount(0)
+    : QObject(parent), m_bAbortManual(false), m_pNetworkManager(nullptr), m_pNetworkReply(nullptr), m_nRedirectionCount(0),
+      m_nConnectedMs(-1), m_nHeadersMs(-1), m_bHandshake(false), m_bEncrypted(false), m_bHttp2(false),
+      m_nReplyBytesReceived(0), m_nReplyBytesSent(0), m_nBytesReceived(0), m_nBytesSent(0),
+      m_eReplyError(QNetworkReply::NoError), m_nReplyStatusCode(0)
 {
 }
 
@@ -24,16 +29,14 @@ NetworkRequest::~NetworkRequest()
         m_pNetworkReply->deleteLater();
         m_pNetworkReply = nullptr;
     }
-    if (m_pNetworkManager)
-    {
-        m_pNetworkManager->deleteLater();
-        m_pNetworkManager = nullptr;
-    }
+    // The network manager is owned by the worker thread (NetworkAccessManagerPool), do not destroy it here
+    m_pNetworkManager = nullptr;
 }
 
 void NetworkRequest::abort()
 {
     m_bAbortManual = true;
+    disconnectAuthentication();
     if (m_pNetworkReply)
     {
         if (m_pNetworkReply->isRunning())
@@ -48,7 +51,6 @@ void NetworkRequest::abort()
 void NetworkRequest::start()
 {
     m_bAbortManual = false;
-    m_nProgress = 0;
     m_spResult = QSharedPointer<ResponseResult>::create();
 }
 
@@ -63,15 +65,38 @@ void NetworkRequest::onError(QNetworkReply::NetworkError code)
 void NetworkRequest::onAuthenticationRequired(QNetworkReply *r, QAuthenticator *a)
 {
     Q_UNUSED(a);
+    // The network manager is shared by all requests of the thread, only handle our own reply
+    if (r != m_pNetworkReply)
+        return;
     qDebug() << "[QMultiThreadNetwork] Authentication Required." << r->readAll();
 }
 
+void NetworkRequest::connectAuthentication()
+{
+    if (m_pNetworkManager)
+    {
+        // Restarts after a redirect must not add a connection each
+        connect(m_pNetworkManager, SIGNAL(authenticationRequired(QNetworkReply *, QAuthenticator *)),
+                this, SLOT(onAuthenticationRequired(QNetworkReply *, QAuthenticator *)), Qt::UniqueConnection);
+    }
+}
+
+void NetworkRequest::disconnectAuthentication()
+{
+    if (m_pNetworkManager)
+    {
+        disconnect(m_pNetworkManager, SIGNAL(authenticationRequired(QNetworkReply *, QAuthenticator *)),
+                   this, SLOT(onAuthenticationRequired(QNetworkReply *, QAuthenticator *)));
+    }
+}
+
 void NetworkRequest::setRequestContext(std::unique_ptr<RequestContext> context)
 {
     if (context)
     {
         m_upContext = std::move(context);
-        m_url = QUrl(m_upContext->url);
+        // A url that was moved permanently is requested at its new location right away
+        m_url = NetworkRedirectCache::globalInstance()->resolve(QUrl(m_upContext->url), m_upContext->behavior.maxRedirectionCount);
     }
 }
 
@@ -87,6 +112,7 @@ QSharedPointer<QtNetworkRequest::ResponseResult> NetworkRequest::ToFailedResult(
     m_spResult->headers = headers;
     m_spResult->task = m_upContext->task;
     m_spResult->userContext = m_upContext->userContext;
+    fillPerformance(m_spResult->performance);
     return m_spResult;
 }
 
@@ -102,9 +128,104 @@ QSharedPointer<QtNetworkRequest::ResponseResult> NetworkRequest::ToSuccessResult
     m_spResult->headers = headers;
     m_spResult->task = m_upContext->task;
     m_spResult->userContext = m_upContext->userContext;
+    fillPerformance(m_spResult->performance);
     return m_spResult;
 }
 
+void NetworkRequest::watchReply(QNetworkReply *pReply)
+{
+    if (!pReply)
+        return;
+
+    m_replyTimer.start();
+    m_nConnectedMs = -1;
+    m_nHeadersMs = -1;
+    m_bHandshake = false;
+    m_bEncrypted = false;
+    m_bHttp2 = false;
+    m_nReplyBytesReceived = 0;
+    m_nReplyBytesSent = 0;
+    m_eReplyError = QNetworkReply::NoError;
+    m_nReplyStatusCode = 0;
+    m_replyRetryAfter.clear();
+
+#ifndef QT_NO_SSL
+    connect(pReply, &QNetworkReply::encrypted, this, [this]() {
+        m_nConnectedMs = m_replyTimer.elapsed();
+        m_bHandshake = true;
+    });
+#endif
+    connect(pReply, &QNetworkReply::metaDataChanged, this, [this, pReply]() {
+        if (m_nHeadersMs >= 0)
+            return;
+        m_nHeadersMs = m_replyTimer.elapsed();
+        m_bEncrypted = pReply->attribute(QNetworkRequest::ConnectionEncryptedAttribute).toBool();
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
+        m_bHttp2 = pReply->attribute(QNetworkRequest::Http2WasUsedAttribute).toBool();
+#else
+        m_bHttp2 = pReply->attribute(QNetworkRequest::HTTP2WasUsedAttribute).toBool();
+#endif
+    });
+    // Foreground traffic holds the background transfers back, whether or not it is throttled itself
+    const bool bForeground = !m_upContext || m_upContext->behavior.priority != Priority::Background;
+    connect(pReply, &QNetworkReply::downloadProgress, this, [this, bForeground](qint64 nReceived, qint64) {
+        if (nReceived > m_nReplyBytesReceived)
+        {
+            if (bForeground)
+                NetworkBandwidthLimiter::globalInstance()->noteForeground(NetworkBandwidthLimiter::Download);
+            m_nBytesReceived += nReceived - m_nReplyBytesReceived;
+            m_nReplyBytesReceived = nReceived;
+        }
+    });
+    connect(pReply, &QNetworkReply::uploadProgress, this, [this, bForeground](qint64 nSent, qint64) {
+        if (nSent > m_nReplyBytesSent)
+        {
+            if (bForeground)
+                NetworkBandwidthLimiter::globalInstance()->noteForeground(NetworkBandwidthLimiter::Upload);
+            m_nBytesSent += nSent - m_nReplyBytesSent;
+            m_nReplyBytesSent = nSent;
+        }
+    });
+    // Connected ahead of the request's own finished slot, which may delete the reply
+    connect(pReply, &QNetworkReply::finished, this, [this, pReply]() {
+        m_eReplyError = pReply->error();
+        m_nReplyStatusCode = pReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        m_replyRetryAfter = pReply->rawHeader("Retry-After");
+    });
+}
+
+void NetworkRequest::fillPerformance(ResponseResult::Performance &performance) const
+{
+    performance.redirectCount = m_nRedirectionCount;
+    performance.payloadBytesReceived = m_nBytesReceived;
+    performance.payloadBytesSent = m_nBytesSent;
+    if (!m_replyTimer.isValid())
+        return;
+
+    performance.connectMs = m_nConnectedMs;
+    performance.timeToFirstByteMs = m_nHeadersMs;
+    // The result is made when the reply finished
+    performance.transferMs = (m_nHeadersMs >= 0) ? m_replyTimer.elapsed() - m_nHeadersMs : -1;
+    // Only a TLS handshake tells a new connection apart, Qt 5 has no such event for plain HTTP
+    if (m_bHandshake)
+        performance.connectionReused = 0;
+    else if (m_bEncrypted)
+        performance.connectionReused = 1;
+    else
+        performance.connectionReused = -1;
+    performance.http2 = m_bHttp2;
+}
+
+qint64 NetworkRequest::retryDelay() const
+{
+    if (!m_upContext || !m_upContext->behavior.retryOnFailed || !canRetry())
+    {
+        return -1;
+    }
+    return NetworkRequestUtility::retryDelay(m_upContext->behavior.retry, m_upContext->task.retryCount,
+                                             m_eReplyError, m_nReplyStatusCode, m_replyRetryAfter);
+}
+
 std::unique_ptr<NetworkRequest> NetworkRequestFactory::create(std::unique_ptr<RequestContext> context)
 {
     std::unique_ptr<NetworkRequest> pRequest;
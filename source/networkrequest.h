@@ -4,6 +4,7 @@
 
 #include <QObject>
 #include <memory>
+#include <QElapsedTimer>
 #include <QNetworkReply>
 #include "networkrequestdefs.h"
 #include <QSharedPointer>
@@ -11,6 +12,8 @@
 class QNetworkAccessManager;
 namespace QtNetworkRequest
 {
+	struct TransferProgress;
+
 	class NetworkRequest : public QObject
 	{
 		Q_OBJECT
@@ -22,11 +25,27 @@ namespace QtNetworkRequest
 		const QString errorString() const { return m_strError; }
 
 		void setRequestContext(std::unique_ptr<RequestContext> context);
+		// Transfer progress counters sampled by the manager (nullptr = progress not wanted)
+		void setProgress(std::shared_ptr<TransferProgress> progress) { m_spProgress = std::move(progress); }
+		// Milliseconds to wait before trying the failed request again, -1 = no retry (behavior.retryOnFailed, RetryPolicy).
+		// Decided on the last watched reply
+		qint64 retryDelay() const;
 
 	protected:
+		// The request can be made again from scratch (nothing was handed out that cannot be taken back)
+		virtual bool canRetry() const { return !m_bAbortManual; }
+
 		QSharedPointer<ResponseResult> ToFailedResult(const QByteArray& body = QByteArray(), const QMap<QByteArray, QByteArray>& headers = {});
 		QSharedPointer<ResponseResult> ToSuccessResult(const QByteArray& body, const QMap<QByteArray, QByteArray>& headers);
 
+		// Measure the phases and the bytes of a reply for ResponseResult::Performance, call it right after creating the reply.
+		// Bytes add up over all watched replies, the phases are those of the last one
+		void watchReply(QNetworkReply *pReply);
+		void fillPerformance(ResponseResult::Performance &performance) const;
+		// authenticationRequired of the thread's shared network manager, connected only while a reply of this request runs
+		void connectAuthentication();
+		void disconnectAuthentication();
+
 	public Q_SLOTS:
 		virtual void start();
 		virtual void abort();
@@ -43,11 +62,28 @@ namespace QtNetworkRequest
 		QSharedPointer<ResponseResult> m_spResult;
 		bool m_bAbortManual;
 		QString m_strError;
-		int m_nProgress;
+		std::shared_ptr<TransferProgress> m_spProgress;
 		quint16 m_nRedirectionCount;
-		QNetworkAccessManager *m_pNetworkManager;
+		QNetworkAccessManager *m_pNetworkManager; // Shared by the worker thread, not owned
 		QNetworkReply *m_pNetworkReply;
         QUrl m_url;
+
+	private:
+		// Phases of the last watched reply, milliseconds since it was issued (-1 = not reached)
+		QElapsedTimer m_replyTimer;
+		qint64 m_nConnectedMs;
+		qint64 m_nHeadersMs;
+		bool m_bHandshake;			// TLS handshake on a new connection
+		bool m_bEncrypted;
+		bool m_bHttp2;
+		qint64 m_nReplyBytesReceived;	// Body bytes of the last watched reply
+		qint64 m_nReplyBytesSent;
+		qint64 m_nBytesReceived;		// All replies, decoded body only
+		qint64 m_nBytesSent;
+		// Outcome of the last watched reply, for retryDelay()
+		QNetworkReply::NetworkError m_eReplyError;
+		int m_nReplyStatusCode;
+		QByteArray m_replyRetryAfter;
 	};
 
 	// Factory class
@@ -23,9 +23,12 @@ That must be called in the main thread.
 #include <QByteArray>
 #include <QVariant>
 #include <QSharedPointer>
+#include <memory>
 
 namespace QtNetworkRequest
 {
+    class NetworkRequestRunnable;
+
     ////////////////// Event ////////////////////////////////////////////////////
     namespace QEventRegister
     {
@@ -51,7 +54,7 @@ namespace QtNetworkRequest
     {
         const QEvent::Type WaitForIdleThread = (QEvent::Type)QEventRegister::regiester(QString("WaitForIdleThread"));
         const QEvent::Type ReplyResult = (QEvent::Type)QEventRegister::regiester(QString("ReplyResult"));
-        const QEvent::Type NetworkProgress = (QEvent::Type)QEventRegister::regiester(QString("NetworkProgress"));
+        const QEvent::Type ExecuteRequest = (QEvent::Type)QEventRegister::regiester(QString("ExecuteRequest"));
     }
 
     // Wait for idle thread event
@@ -71,19 +74,13 @@ namespace QtNetworkRequest
         bool bDestroyed;
     };
 
-    // Download/Upload progress event
-    class NetworkProgressEvent : public QEvent
+    // Execute request on a network thread event (ExecutionMode::EventLoop)
+    class ExecuteRequestEvent : public QEvent
     {
     public:
-        NetworkProgressEvent() : QEvent(QEvent::Type(NetworkEvent::NetworkProgress)), bDownload(true), uiId(0), uiBatchId(0), iBtyes(0), iTotalBtyes(0)
-        {
-        }
+        ExecuteRequestEvent() : QEvent(QEvent::Type(NetworkEvent::ExecuteRequest)) {}
 
-        bool bDownload;
-        quint64 uiId;
-        quint64 uiBatchId;
-        qint64 iBtyes;
-        qint64 iTotalBtyes;
+        std::shared_ptr<NetworkRequestRunnable> runnable;
     };
 }
 
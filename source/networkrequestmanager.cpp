@@ -3,22 +3,32 @@
 #include <memory>
 #include <QMutex>
 #include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QSet>
 #include <QUrl>
 #include <QQueue>
 #include <QThread>
 #include <QThreadPool>
-#include <QEvent>
+#include <QTimer>
 #include <QDebug>
 #include <QCoreApplication>
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
 #include <QRecursiveMutex>
 #endif
 #include "networkrequestrunnable.h"
+#include "networkeventlooppool.h"
+#include "networkrequestscheduler.h"
+#include "networkprogresstracker.h"
 #include "networkreply.h"
-#include "networkrequestevent.h"
+#include "networkresponsecache.h"
+#include "networkrequestregistry.h"
+#include "networkbandwidthlimiter.h"
+#include "networkredirectcache.h"
+#include "networkrequestutility.h"
 
 using namespace QtNetworkRequest;
 #define DEFAULT_MAX_THREAD_COUNT 8
+#define DEFAULT_EVENTLOOP_REQUESTS_PER_THREAD 256
 
 class NetworkRequestManagerPrivate
 {
@@ -33,17 +43,69 @@ private:
     std::shared_ptr<NetworkReply> postBatchRequest(BatchRequestPtrTasks &&tasks, quint64 &uiBatchId);
     bool sendRequest(std::unique_ptr<RequestContext> context, ResponseCallBack callback, bool bBlockUserInteraction);
 
+    // Runnable of a request, connected to the manager and registered for progress
+    std::shared_ptr<NetworkRequestRunnable> createRunnable(std::unique_ptr<RequestContext> context);
     bool startRunnable(std::shared_ptr<NetworkRequestRunnable> r, bool bAddToWaitQueueIfNotStart = true);
+    // Start queued runnables while execution slots are available
+    void scheduleNext();
+    // Queue the next members of the batches being fed, as many as there are free execution slots (m_mutex must be held)
+    void feedBatches();
+    bool dispatchRunnable(const std::shared_ptr<NetworkRequestRunnable> &r, bool bWaitForThread);
+    // Stop a runnable that was taken out of m_mapRunnable and give its execution slot back (m_mutex must be held)
+    void cancelRunnable(const std::shared_ptr<NetworkRequestRunnable> &r);
+    int executionSlots() const;
     void stopRequest(quint64 uiTaskId);
     void stopBatchRequests(quint64 uiBatchId);
     void stopSessionRequest(quint64 uiSessionId);
+    int stopRequests(const RequestFilter &filter);
     void stopAllRequest();
-
+    // Stop one member of a batch, the other members go on
+    void stopBatchMember(quint64 uiRequestId, quint64 uiBatchId);
+
+    // Secondary indices of the requests that were posted and did not finish or stop yet (m_indexMutex)
+    // Also registers the request's own bandwidth limits, dropped again by unindexRequest()
+    void indexRequest(const RequestContext &context);
+    void unindexRequest(quint64 uiRequestId);
+    static void limitRequest(const RequestContext &context);
+    // (requestId, batchId) of the indexed requests matching the filter, looked up through the narrowest index
+    QList<QPair<quint64, quint64>> matchRequests(const RequestFilter &filter) const;
+
+    struct BatchState;
+    // A result arrived (onResponse): take its runnable, count it in its batch and give its slot back, all under one lock.
+    // Returns false if it was stopped meanwhile and its cancelled result was delivered already
+    bool finishRunnable(const ResponseResult &rsp, bool &bBatchKnown, std::shared_ptr<BatchState> &finishedBatch);
     bool releaseRequestThread(quint64 uiId);
+    // Give the execution slot of a failed request back and queue its next attempt after nDelayMs
+    void scheduleRetry(quint64 uiRequestId, qint64 nDelayMs);
+    // Drop the retries waiting for their delay that match (m_mutex must be held)
+    void removeRetries(const std::function<bool(const NetworkRequestRunnable &)> &match);
+
+    // Single-flight (behavior.coalesce). Attach the request to an identical one in flight or make it the one
+    // later requests attach to. Returns true if it was attached and must not be started
+    bool joinFlight(const RequestContext &context);
+    // The result of a request reaches the requests attached to it, its key is free again
+    void finishFlight(const QSharedPointer<ResponseResult> &rsp);
+    // Detach a cancelled request from its flight (m_mutex must be held, m_flightMutex is taken after it).
+    // Returns true if its runnable must keep running because attached requests still wait for it
+    bool leaveFlight(quint64 uiRequestId);
+    // The request could not be started: free its key, the requests attached to it meanwhile are dropped with it
+    void abandonFlight(quint64 uiRequestId);
+    // Method, URL (user info included), headers as sent (cookies included) and cacheMode
+    static QString flightKey(const RequestContext &context);
+
+    // Counters of a batch in progress, batchId 0 if unknown
+    BatchSummary batchSummary(quint64 uiBatchId) const;
 
     bool setMaxThreadCount(int iMax);
     int maxThreadCount() const;
 
+    void setExecutionMode(ExecutionMode mode, int nThreadCount);
+    ExecutionMode executionMode() const;
+    bool setMaxConcurrentRequests(int nMax);
+    int maxConcurrentRequests() const;
+
+    void setSessionWeight(quint64 uiSessionId, quint32 uiWeight);
+
     bool isValid(const QUrl &url) const;
     bool isThreadAvailable() const;
 
@@ -52,9 +114,10 @@ private:
 
     std::shared_ptr<NetworkReply> getReply(quint64 uiId, bool bRemove = true);
     std::shared_ptr<NetworkReply> getBatchReply(quint64 uiBatchId, bool bRemove = true);
-    qint64 updateBatchProgress(quint64 uiId, quint64 uiBatchId, qint64 iBytes, qint64 iTotalBytes, bool bDownload);
 
     quint64 nextRequestId() const;
+    // First of uiCount consecutive request ids
+    quint64 nextRequestIds(quint64 uiCount) const;
     quint64 nextBatchId() const;
     quint64 nextSessionId() const;
 
@@ -64,7 +127,6 @@ private:
     void resetStopFlag();
     void markStopFlag();
     bool isStopped() const;
-    bool isSessionStopped(quint64 uiSessionId) const;
 
 private:
     Q_DISABLE_COPY(NetworkRequestManagerPrivate);
@@ -75,44 +137,144 @@ private:
     static std::atomic<quint64> ms_uiBatchId;
     static std::atomic<quint64> ms_uiSessionId;
     std::atomic<bool> m_bStopAllFlag;
+    // Incremented by stopAllRequest(), a synchronous request waiting for its retry delay gives up when it changed
+    std::atomic<quint64> m_uiStopGeneration;
 
+    // Scheduling state: runnables, retries, the scheduler and its slots, batches. Recursive, scheduleNext() and
+    // cancelRunnable() run from the stop paths with the lock held. The registries, the request indices and the
+    // single-flight maps have locks of their own, a result takes m_mutex once (finishRunnable())
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
     mutable QRecursiveMutex m_mutex;
 #else
     mutable QMutex m_mutex;
 #endif
     QThreadPool *m_pThreadPool;
+    // Network threads of ExecutionMode::EventLoop and of HTTP/2 requests (created on demand)
+    std::unique_ptr<NetworkEventLoopPool> m_pEventLoopPool;
+    std::atomic<ExecutionMode> m_eExecutionMode;
+    // Maximum executing requests in ExecutionMode::EventLoop (0 = DEFAULT_EVENTLOOP_REQUESTS_PER_THREAD per network thread)
+    int m_nMaxConcurrentRequests;
+
+    // Queued runnables waiting for an execution slot
+    NetworkRequestScheduler m_scheduler;
+    // Runnables holding an execution slot
+    int m_nRunning;
+    // scheduleNext() does nothing while a bulk stop is in progress, queued requests about to be stopped are not started
+    int m_nScheduleDeferred;
 
     QHash<quint64, std::shared_ptr<NetworkRequestRunnable>> m_mapRunnable;
+    // Next attempts of failed requests waiting for their retry delay, they hold no execution slot
+    QHash<quint64, std::shared_ptr<NetworkRequestRunnable>> m_mapRetryRunnable;
+    // Looked up on every submit, response and progress registration, they have locks of their own (not m_mutex)
     // One-to-one. requestId <---> NetworkReply *
-    QHash<quint64, std::shared_ptr<NetworkReply>> m_mapReply;
+    ShardedRegistry<std::shared_ptr<NetworkReply>> m_mapReply;
     // One-to-many. batchId <---> NetworkReply *
-    QHash<quint64, std::shared_ptr<NetworkReply>> m_mapBatchReply;
-
-    // session
-    QMultiMap<quint64, quint64> m_mapSessionIdToRequestId;
-    QSet<quint64> m_stoppedSessionIds;
-
-    // (batchId <---> Total task count)
-    QHash<quint64, size_t> m_mapBatchTotalSize;
-    // (batchId <----> Task completion count)
-    QHash<quint64, size_t> m_mapBatchFinishedSize;
-
-    // (<batchId, <requestId, downloaded bytes>>)
-    QHash<quint64, QHash<quint64, qint64>> m_mapBatchDCurrentBytes;
-    // (batchId <---> Total download bytes)
-    QHash<quint64, qint64> m_mapBatchDTotalBytes;
-    // (<batchId, <requestId, uploaded bytes>>)
-    QHash<quint64, QHash<quint64, qint64>> m_mapBatchUCurrentBytes;
-    // (batchId <---> Total upload bytes)
-    QHash<quint64, qint64> m_mapBatchUTotalBytes;
+    ShardedRegistry<std::shared_ptr<NetworkReply>> m_mapBatchReply;
+
+    // Secondary indices of the unfinished requests (single, batch members and coalesced followers)
+    struct IndexedRequest
+    {
+        quint64 uiSessionId{ 0 };
+        quint64 uiBatchId{ 0 };
+        QString strHost; // Lower-case
+        QString strUrl;
+        RequestType type{ RequestType::Unknown };
+        Priority priority{ Priority::Normal };
+    };
+    // Guards the indices, never held while taking m_mutex
+    mutable QMutex m_indexMutex;
+    // requestId <---> IndexedRequest
+    QHash<quint64, IndexedRequest> m_mapRequestIndex;
+    // sessionId <---> requestIds
+    QHash<quint64, QSet<quint64>> m_mapSessionRequests;
+    // host <---> requestIds
+    QHash<QString, QSet<quint64>> m_mapHostRequests;
+
+    // Bookkeeping of one batch, its members are found without looking at the other requests
+    struct BatchState
+    {
+        // Requests that did not finish yet
+        QSet<quint64> members;
+        BatchSummary summary;
+        QElapsedTimer clock;
+        // Members get a runnable only when the batch is fed, pending[nNextPending] is the next one
+        BatchRequestPtrTasks pending;
+        size_t nNextPending{ 0 };
+        // Members with a runnable (queued, running or waiting for a retry)
+        int nFed{ 0 };
+
+        bool hasPending() const { return nNextPending < pending.size(); }
+        void clearPending()
+        {
+            BatchRequestPtrTasks().swap(pending);
+            nNextPending = 0;
+        }
+
+        // A member finished, returns true if it was the last one
+        bool finish(const ResponseResult &rsp)
+        {
+            if (!members.remove(rsp.task.id))
+            {
+                return false;
+            }
+            if (rsp.success)
+                ++summary.succeeded;
+            else if (rsp.cancelled)
+                ++summary.cancelled;
+            else
+                ++summary.failed;
+            summary.payloadBytesReceived += rsp.performance.payloadBytesReceived;
+            summary.payloadBytesSent += rsp.performance.payloadBytesSent;
+            summary.wallTimeMs = clock.elapsed();
+            if (!members.isEmpty())
+            {
+                return false;
+            }
+            // Members stopped before they were fed may still be pending
+            clearPending();
+            return true;
+        }
+    };
+    // batchId <---> BatchState
+    QHash<quint64, std::shared_ptr<BatchState>> m_mapBatch;
+    // Batches with members not fed yet, in submission order
+    QList<std::shared_ptr<BatchState>> m_feedingBatches;
+
+    // Progress of the requests with behavior.showProgress, single and batch
+    NetworkProgressTracker m_progressTracker;
+
+    // Single-flight: requests waiting for the result of an identical request in flight
+    struct FlightFollower
+    {
+        TaskData task;
+        QVariant userContext;
+    };
+    struct Flight
+    {
+        QString key;
+        QList<FlightFollower> followers;
+        bool bLeaderCancelled{ false }; // Runs on for its followers only
+    };
+    // Guards the flights, never held while taking m_mutex
+    QMutex m_flightMutex;
+    // key <---> requestId of the request in flight
+    QHash<QString, quint64> m_mapFlightKey;
+    // requestId of the request in flight <---> Flight
+    QHash<quint64, Flight> m_mapFlight;
+    // requestId of a follower <---> requestId of the request in flight
+    QHash<quint64, quint64> m_mapFlightFollower;
 };
 std::atomic<quint64> NetworkRequestManagerPrivate::ms_uiRequestId = 0;
 std::atomic<quint64> NetworkRequestManagerPrivate::ms_uiBatchId = 0;
 std::atomic<quint64> NetworkRequestManagerPrivate::ms_uiSessionId = 0;
 
 NetworkRequestManagerPrivate::NetworkRequestManagerPrivate()
-    : m_bStopAllFlag(false), m_pThreadPool(new QThreadPool), q_ptr(nullptr)
+    : m_bStopAllFlag(false), m_uiStopGeneration(0),
+#if (QT_VERSION < QT_VERSION_CHECK(5, 14, 0))
+      m_mutex(QMutex::Recursive), // scheduleNext() re-enters with the lock held
+#endif
+      m_pThreadPool(new QThreadPool), m_eExecutionMode(ExecutionMode::ThreadPerRequest),
+      m_nMaxConcurrentRequests(0), m_nRunning(0), m_nScheduleDeferred(0), q_ptr(nullptr)
 {
 }
 
@@ -129,6 +291,7 @@ void NetworkRequestManagerPrivate::initialize()
     // Register meta types for signal/slot connections across threads
     qRegisterMetaType<QMap<QByteArray, QByteArray>>("QMap<QByteArray, QByteArray>");
     qRegisterMetaType<QSharedPointer<QtNetworkRequest::ResponseResult>>("QSharedPointer<QtNetworkRequest::ResponseResult>");
+    qRegisterMetaType<QtNetworkRequest::BatchSummary>("QtNetworkRequest::BatchSummary");
 
     int nIdeal = QThread::idealThreadCount();
     if (-1 != nIdeal)
@@ -139,6 +302,9 @@ void NetworkRequestManagerPrivate::initialize()
     {
         m_pThreadPool->setMaxThreadCount(DEFAULT_MAX_THREAD_COUNT);
     }
+    // Keep worker threads pinned (never expire), each of them owns a long-lived QNetworkAccessManager
+    // so that connections and TLS sessions can be reused by subsequent requests.
+    m_pThreadPool->setExpiryTimeout(-1);
 
     // To add something intialize...
 }
@@ -154,25 +320,43 @@ void NetworkRequestManagerPrivate::unInitialize()
     {
         qDebug() << "[QMultiThreadNetwork] ThreadPool waitForDone failed!";
     }
+
+    std::unique_ptr<NetworkEventLoopPool> pEventLoopPool;
+    {
+        QMutexLocker locker(&m_mutex);
+        pEventLoopPool = std::move(m_pEventLoopPool);
+    }
+    pEventLoopPool.reset();
 }
 
 void NetworkRequestManagerPrivate::reset()
 {
     QMutexLocker locker(&m_mutex);
 
-    m_mapBatchTotalSize.clear();
-    m_mapBatchFinishedSize.clear();
-    m_mapBatchDCurrentBytes.clear();
-    m_mapBatchDTotalBytes.clear();
-    m_mapBatchUCurrentBytes.clear();
-    m_mapBatchUTotalBytes.clear();
+    m_mapBatch.clear();
+    m_feedingBatches.clear();
+    m_progressTracker.clear();
 
     m_mapRunnable.clear();
+    m_mapRetryRunnable.clear();
     m_mapReply.clear();
     m_mapBatchReply.clear();
 
-    m_mapSessionIdToRequestId.clear();
-    m_stoppedSessionIds.clear();
+    {
+        QMutexLocker indexLocker(&m_indexMutex);
+        m_mapRequestIndex.clear();
+        m_mapSessionRequests.clear();
+        m_mapHostRequests.clear();
+    }
+    {
+        QMutexLocker flightLocker(&m_flightMutex);
+        m_mapFlightKey.clear();
+        m_mapFlight.clear();
+        m_mapFlightFollower.clear();
+    }
+
+    m_scheduler.clear();
+    m_nRunning = 0;
 }
 
 void NetworkRequestManagerPrivate::resetStopFlag()
@@ -196,15 +380,6 @@ bool NetworkRequestManagerPrivate::isStopped() const
     return m_bStopAllFlag.load(std::memory_order_acquire);
 }
 
-bool NetworkRequestManagerPrivate::isSessionStopped(quint64 uiSessionId) const
-{
-    if (m_stoppedSessionIds.end() != m_stoppedSessionIds.find(uiSessionId))
-    {
-        return true;
-    }
-    return false;
-}
-
 void NetworkRequestManagerPrivate::stopRequest(quint64 uiTaskId)
 {
     if (uiTaskId == 0)
@@ -213,33 +388,52 @@ void NetworkRequestManagerPrivate::stopRequest(quint64 uiTaskId)
     auto rsp = QSharedPointer<ResponseResult>::create();
     std::shared_ptr<NetworkReply> reply = nullptr;
 
+    quint64 uiBatchId = 0;
+    {
+        QMutexLocker locker(&m_indexMutex);
+        uiBatchId = m_mapRequestIndex.value(uiTaskId).uiBatchId;
+    }
+    if (uiBatchId > 0)
+    {
+        // The rest of its batch goes on
+        stopBatchMember(uiTaskId, uiBatchId);
+        return;
+    }
+
     {
         QMutexLocker locker(&m_mutex);
+        unindexRequest(uiTaskId);
         reply = m_mapReply.take(uiTaskId);
-
-        if (m_mapRunnable.contains(uiTaskId))
+        m_progressTracker.untrack(uiTaskId);
+        if (leaveFlight(uiTaskId))
+        {
+            // Requests attached to it still wait, it runs on without a reply of its own
+            std::shared_ptr<NetworkRequestRunnable> r = m_mapRunnable.value(uiTaskId, m_mapRetryRunnable.value(uiTaskId));
+            if (r.get())
+            {
+                rsp->task = r->task();
+            }
+        }
+        else if (std::shared_ptr<NetworkRequestRunnable> r = m_mapRetryRunnable.take(uiTaskId))
+        {
+            rsp->task = r->task();
+        }
+        else if (m_mapRunnable.contains(uiTaskId))
         {
             std::shared_ptr<NetworkRequestRunnable> r = m_mapRunnable.take(uiTaskId);
             if (r.get())
             {
                 rsp->task = r->task();
-
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 9, 0))
-                if (!m_pThreadPool->tryTake(r.get()))
-                {
-                    r->quit();
-                }
-#else
-                m_pThreadPool->cancel(r.get());
-                r->quit();
-#endif
+                cancelRunnable(r);
                 r.reset();
             }
+            scheduleNext();
         }
     }
 
     if (reply.get())
     {
+        rsp->task.id = uiTaskId;
         rsp->success = false;
         rsp->cancelled = true;
         rsp->body = QString("Operation canceled (id: %1)").arg(uiTaskId).toUtf8();
@@ -255,62 +449,43 @@ void NetworkRequestManagerPrivate::stopBatchRequests(quint64 uiBatchId)
         return;
 
     std::shared_ptr<NetworkReply> reply = nullptr;
+    std::shared_ptr<BatchState> batch;
 
     {
         QMutexLocker locker(&m_mutex);
         reply = m_mapBatchReply.take(uiBatchId);
-
-        // qDebug() << "Runnable[Before]: " << m_mapRunnable.size();
-        for (auto iter = m_mapRunnable.begin(); iter != m_mapRunnable.end();)
+        batch = m_mapBatch.take(uiBatchId);
+        if (batch)
         {
-            std::shared_ptr<NetworkRequestRunnable> r = iter.value();
-            if (r.get() && r->batchId() == uiBatchId)
+            // Only the unfinished members of the batch are visited
+            for (quint64 uiRequestId : qAsConst(batch->members))
             {
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 9, 0))
-                if (!m_pThreadPool->tryTake(r.get()))
+                unindexRequest(uiRequestId);
+                m_progressTracker.untrack(uiRequestId);
+                m_mapRetryRunnable.remove(uiRequestId);
+                if (std::shared_ptr<NetworkRequestRunnable> r = m_mapRunnable.take(uiRequestId))
                 {
-                    r->quit();
+                    cancelRunnable(r);
                 }
-#else
-                m_pThreadPool->cancel(r.get());
-                r->quit();
-#endif
-                iter = m_mapRunnable.erase(iter);
-                r.reset();
-            }
-            else
-            {
-                ++iter;
             }
-        }
-        // qDebug() << "Runnable[After]: " << m_mapRunnable.size();
+            batch->clearPending();
+            batch->nFed = 0;
+            scheduleNext();
 
-        if (m_mapBatchTotalSize.contains(uiBatchId))
-        {
-            m_mapBatchTotalSize.remove(uiBatchId);
-        }
-        if (m_mapBatchFinishedSize.contains(uiBatchId))
-        {
-            m_mapBatchFinishedSize.remove(uiBatchId);
-        }
-        if (m_mapBatchDCurrentBytes.contains(uiBatchId))
-        {
-            m_mapBatchDCurrentBytes.remove(uiBatchId);
-        }
-        if (m_mapBatchDTotalBytes.contains(uiBatchId))
-        {
-            m_mapBatchDTotalBytes.remove(uiBatchId);
-        }
-        if (m_mapBatchUCurrentBytes.contains(uiBatchId))
-        {
-            m_mapBatchUCurrentBytes.remove(uiBatchId);
-        }
-        if (m_mapBatchUTotalBytes.contains(uiBatchId))
-        {
-            m_mapBatchUTotalBytes.remove(uiBatchId);
+            batch->summary.cancelled += batch->members.size();
+            batch->summary.wallTimeMs = batch->clock.elapsed();
+            batch->members.clear();
         }
     }
 
+    if (batch)
+    {
+        m_progressTracker.untrackBatch(uiBatchId);
+        NetworkBandwidthLimiter::globalInstance()->remove(BandwidthScope::Batch, uiBatchId);
+        Q_Q(NetworkRequestManager);
+        emit q->batchRequestSummary(batch->summary);
+    }
+
     if (reply.get())
     {
         auto rsp = QSharedPointer<ResponseResult>::create();
@@ -329,39 +504,191 @@ void NetworkRequestManagerPrivate::stopSessionRequest(quint64 uiSessionId)
     if (uiSessionId == 0)
         return;
 
-    QMutexLocker locker(&m_mutex);
-    m_stoppedSessionIds.insert(uiSessionId);
-    for (auto iter = m_mapRunnable.begin(); iter != m_mapRunnable.end();)
+    RequestFilter filter;
+    filter.sessionId = uiSessionId;
+    stopRequests(filter);
+}
+
+int NetworkRequestManagerPrivate::stopRequests(const RequestFilter &filter)
+{
+    const QList<QPair<quint64, quint64>> requests = matchRequests(filter);
+    if (requests.isEmpty())
+        return 0;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        ++m_nScheduleDeferred;
+    }
+    for (const QPair<quint64, quint64> &request : requests)
+    {
+        if (request.second == 0)
+            stopRequest(request.first);
+        else
+            stopBatchMember(request.first, request.second);
+    }
     {
-        std::shared_ptr<NetworkRequestRunnable> r = iter.value();
-        if (r.get() && r->sessionId() == uiSessionId)
+        QMutexLocker locker(&m_mutex);
+        --m_nScheduleDeferred;
+        scheduleNext();
+    }
+    return requests.size();
+}
+
+void NetworkRequestManagerPrivate::stopBatchMember(quint64 uiRequestId, quint64 uiBatchId)
+{
+    auto rsp = QSharedPointer<ResponseResult>::create();
+    std::shared_ptr<NetworkReply> reply = nullptr;
+    std::shared_ptr<BatchState> finishedBatch;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        unindexRequest(uiRequestId);
+        auto iter = m_mapBatch.find(uiBatchId);
+        if (iter == m_mapBatch.end() || !iter.value()->members.contains(uiRequestId))
         {
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 9, 0))
-            if (!m_pThreadPool->tryTake(r.get()))
-            {
-                r->quit();
-            }
-#else
-            m_pThreadPool->cancel(r.get());
-            r->quit();
-#endif
-            iter = m_mapRunnable.erase(iter);
-            r.reset();
+            return;
         }
-        else
+
+        m_progressTracker.untrack(uiRequestId);
+        if (std::shared_ptr<NetworkRequestRunnable> r = m_mapRetryRunnable.take(uiRequestId))
         {
-            ++iter;
+            rsp->task = r->task();
+            --iter.value()->nFed;
+        }
+        else if (std::shared_ptr<NetworkRequestRunnable> r = m_mapRunnable.take(uiRequestId))
+        {
+            rsp->task = r->task();
+            --iter.value()->nFed;
+            cancelRunnable(r);
+        }
+        // Otherwise it was not fed yet, it is skipped when its turn comes
+        rsp->task.id = uiRequestId;
+        rsp->task.batchId = uiBatchId;
+        rsp->success = false;
+        rsp->cancelled = true;
+
+        if (iter.value()->finish(*rsp))
+        {
+            finishedBatch = iter.value();
+            m_mapBatch.erase(iter);
+        }
+        reply = getBatchReply(uiBatchId, finishedBatch != nullptr);
+        // Frees a slot of the batch
+        scheduleNext();
+    }
+
+    if (reply.get())
+    {
+        rsp->body = QString("Operation canceled (id: %1)").arg(uiRequestId).toUtf8();
+        rsp->task.endTime = QDateTime::currentDateTime();
+
+        reply->replyResult(rsp, finishedBatch != nullptr);
+    }
+    if (finishedBatch)
+    {
+        m_progressTracker.untrackBatch(uiBatchId);
+        NetworkBandwidthLimiter::globalInstance()->remove(BandwidthScope::Batch, uiBatchId);
+        Q_Q(NetworkRequestManager);
+        emit q->batchRequestFinished(uiBatchId, false);
+        emit q->batchRequestSummary(finishedBatch->summary);
+    }
+}
+
+void NetworkRequestManagerPrivate::limitRequest(const RequestContext &context)
+{
+    // Registered by the thread that posts the request, a request stopped before it reaches a worker thread leaves no bucket behind
+    const RequestContext::Behavior &behavior = context.behavior;
+    if (behavior.maxDownloadBytesPerSec > 0 || behavior.maxUploadBytesPerSec > 0)
+    {
+        NetworkBandwidthLimiter *pLimiter = NetworkBandwidthLimiter::globalInstance();
+        pLimiter->setLimit(BandwidthScope::Request, context.task.id, NetworkBandwidthLimiter::Download, behavior.maxDownloadBytesPerSec);
+        pLimiter->setLimit(BandwidthScope::Request, context.task.id, NetworkBandwidthLimiter::Upload, behavior.maxUploadBytesPerSec);
+    }
+}
+
+void NetworkRequestManagerPrivate::indexRequest(const RequestContext &context)
+{
+    IndexedRequest request;
+    request.uiSessionId = context.task.sessionId;
+    request.uiBatchId = context.task.batchId;
+    request.strHost = QUrl(context.url).host().toLower();
+    request.strUrl = context.url;
+    request.type = context.type;
+    request.priority = context.behavior.priority;
+
+    const quint64 uiRequestId = context.task.id;
+    limitRequest(context);
+
+    QMutexLocker locker(&m_indexMutex);
+    if (request.uiSessionId > 0)
+    {
+        m_mapSessionRequests[request.uiSessionId].insert(uiRequestId);
+    }
+    m_mapHostRequests[request.strHost].insert(uiRequestId);
+    m_mapRequestIndex.insert(uiRequestId, request);
+}
+
+void NetworkRequestManagerPrivate::unindexRequest(quint64 uiRequestId)
+{
+    NetworkBandwidthLimiter::globalInstance()->remove(BandwidthScope::Request, uiRequestId);
+
+    QMutexLocker locker(&m_indexMutex);
+    auto iter = m_mapRequestIndex.find(uiRequestId);
+    if (iter == m_mapRequestIndex.end())
+    {
+        return;
+    }
+
+    const IndexedRequest &request = iter.value();
+    if (request.uiSessionId > 0)
+    {
+        auto session = m_mapSessionRequests.find(request.uiSessionId);
+        if (session != m_mapSessionRequests.end() && session.value().remove(uiRequestId) && session.value().isEmpty())
+        {
+            m_mapSessionRequests.erase(session);
         }
     }
+    auto host = m_mapHostRequests.find(request.strHost);
+    if (host != m_mapHostRequests.end() && host.value().remove(uiRequestId) && host.value().isEmpty())
+    {
+        m_mapHostRequests.erase(host);
+    }
+    m_mapRequestIndex.erase(iter);
+}
 
-    QList<quint64> uiRequestIds = m_mapSessionIdToRequestId.values(uiSessionId);
-    for (quint64 &uiRequestId : uiRequestIds)
+QList<QPair<quint64, quint64>> NetworkRequestManagerPrivate::matchRequests(const RequestFilter &filter) const
+{
+    const QString strHost = filter.host.toLower();
+
+    QMutexLocker locker(&m_indexMutex);
+    QList<quint64> candidates;
+    if (filter.sessionId > 0)
+        candidates = m_mapSessionRequests.value(filter.sessionId).values();
+    else if (!strHost.isEmpty())
+        candidates = m_mapHostRequests.value(strHost).values();
+    else
+        candidates = m_mapRequestIndex.keys();
+
+    QList<QPair<quint64, quint64>> matches;
+    for (quint64 uiRequestId : qAsConst(candidates))
     {
-        if (m_mapReply.contains(uiRequestId))
+        auto iter = m_mapRequestIndex.constFind(uiRequestId);
+        if (iter == m_mapRequestIndex.constEnd())
+        {
+            continue;
+        }
+        const IndexedRequest &request = iter.value();
+        if ((filter.sessionId > 0 && request.uiSessionId != filter.sessionId)
+            || (!strHost.isEmpty() && request.strHost != strHost)
+            || (!filter.urlPrefix.isEmpty() && !request.strUrl.startsWith(filter.urlPrefix))
+            || (!filter.types.isEmpty() && !filter.types.contains(request.type))
+            || (!filter.priorities.isEmpty() && !filter.priorities.contains(request.priority)))
         {
-            m_mapReply.remove(uiRequestId);
+            continue;
         }
+        matches.append(qMakePair(uiRequestId, request.uiBatchId));
     }
+    return matches;
 }
 
 void NetworkRequestManagerPrivate::stopAllRequest()
@@ -370,6 +697,7 @@ void NetworkRequestManagerPrivate::stopAllRequest()
         return;
 
     markStopFlag();
+    m_uiStopGeneration.fetch_add(1, std::memory_order_acq_rel);
 
     {
         QMutexLocker locker(&m_mutex);
@@ -379,15 +707,7 @@ void NetworkRequestManagerPrivate::stopAllRequest()
             std::shared_ptr<NetworkRequestRunnable> r = iter.value();
             if (r.get())
             {
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 9, 0))
-                if (!m_pThreadPool->tryTake(r.get()))
-                {
-                    r->quit();
-                }
-#else
-                m_pThreadPool->cancel(r.get());
-                r->quit();
-#endif
+                cancelRunnable(r);
                 r.reset();
             }
         }
@@ -406,12 +726,6 @@ std::shared_ptr<NetworkReply> NetworkRequestManagerPrivate::postRequest(const QU
         task->sessionId = uiSessionId;
         std::shared_ptr<NetworkReply> pReply = std::make_shared<NetworkReply>(std::move(task));
         m_mapReply.insert(uiId, pReply);
-
-        if (uiSessionId > 0)
-        {
-            m_mapSessionIdToRequestId.insert(uiSessionId, uiId);
-        }
-
         return pReply;
     }
     return nullptr;
@@ -423,13 +737,20 @@ std::shared_ptr<NetworkReply> NetworkRequestManagerPrivate::postBatchRequest(Bat
         return nullptr;
 
     uiBatchId = nextBatchId();
-    m_mapBatchTotalSize[uiBatchId] = tasks.size();
+    std::shared_ptr<BatchState> batch = std::make_shared<BatchState>();
+    batch->summary.batchId = uiBatchId;
+    batch->clock.start();
 
     std::unique_ptr<TaskData> task = std::make_unique<TaskData>();
     task->batchId = uiBatchId;
     std::shared_ptr<NetworkReply> pReply = std::make_shared<NetworkReply>(std::move(task));
     m_mapBatchReply.insert(uiBatchId, pReply);
 
+    // Ids are consecutive, one clock read for the whole batch
+    const QDateTime createTime = QDateTime::currentDateTime();
+    const quint64 uiFirstId = nextRequestIds(static_cast<quint64>(tasks.size()));
+    quint64 uiCount = 0;
+    batch->members.reserve(static_cast<int>(tasks.size()));
     for (auto &context : tasks)
     {
         if (!context)
@@ -437,11 +758,32 @@ std::shared_ptr<NetworkReply> NetworkRequestManagerPrivate::postBatchRequest(Bat
             continue;
         }
         context->task.batchId = uiBatchId;
-        context->task.id = nextRequestId();
-        context->task.createTime = QDateTime::currentDateTime();
+        context->task.id = uiFirstId + uiCount++;
+        context->task.createTime = createTime;
+        batch->members.insert(context->task.id);
+    }
+    if (batch->members.isEmpty())
+    {
+        m_mapBatchReply.remove(uiBatchId);
+        uiBatchId = 0;
+        return nullptr;
+    }
+    batch->summary.total = batch->members.size();
+    // The tasks stay in the caller's vector, each one becomes a runnable when its batch is fed
+    batch->pending = std::move(tasks);
 
-        Q_Q(NetworkRequestManager);
-        q->startAsRunnable(std::move(context));
+    {
+        QMutexLocker locker(&m_mutex);
+        for (const auto &context : batch->pending)
+        {
+            if (context)
+            {
+                indexRequest(*context);
+            }
+        }
+        m_mapBatch.insert(uiBatchId, batch);
+        m_feedingBatches.append(batch);
+        scheduleNext();
     }
 
     return pReply;
@@ -456,17 +798,79 @@ bool NetworkRequestManagerPrivate::sendRequest(std::unique_ptr<RequestContext> c
     context->task.createTime = QDateTime::currentDateTime();
 
     QEventLoop eventloop;
-
-    std::shared_ptr<NetworkRequestRunnable> r = std::make_shared<NetworkRequestRunnable>(std::move(context));
-    QObject::connect(r.get(), &NetworkRequestRunnable::response, &eventloop, [&](QSharedPointer<QtNetworkRequest::ResponseResult> rsp)
-                     {
+    const quint64 uiStopGeneration = m_uiStopGeneration.load(std::memory_order_acquire);
+    // Attempt whose outcome is awaited, nullptr while a retry waits for its delay
+    std::shared_ptr<NetworkRequestRunnable> current;
+    bool bAnswered = false;
+
+    auto answer = [&](QSharedPointer<QtNetworkRequest::ResponseResult> rsp) {
+        bAnswered = true;
+        current.reset();
+        NetworkBandwidthLimiter::globalInstance()->remove(BandwidthScope::Request, rsp->task.id);
         if (callback)
             callback(rsp);
-        releaseRequestThread(rsp->task.id);
-        eventloop.quit(); });
+        eventloop.quit();
+    };
+    // The attempt was stopped (stopAllRequest, stopRequest), its own result never comes
+    auto answerCancelled = [&](const TaskData &task) {
+        auto rsp = QSharedPointer<ResponseResult>::create();
+        rsp->task = task;
+        rsp->success = false;
+        rsp->cancelled = true;
+        rsp->body = QString("Operation canceled (id: %1)").arg(task.id).toUtf8();
+        rsp->task.endTime = QDateTime::currentDateTime();
+        answer(rsp);
+    };
 
-    if (!startRunnable(r, false))
+    // Starts an attempt, a failed attempt worth retrying starts the next one after its delay
+    std::function<bool(const std::shared_ptr<NetworkRequestRunnable> &, bool)> launch;
+    launch = [&](const std::shared_ptr<NetworkRequestRunnable> &r, bool bQueue) -> bool
+    {
+        current = r;
+        QObject::connect(r.get(), &NetworkRequestRunnable::response, &eventloop, [&](QSharedPointer<QtNetworkRequest::ResponseResult> rsp)
+                         {
+            if (bAnswered)
+                return;
+            NetworkRequestRunnable::setDelivered(*rsp);
+            answer(rsp);
+            releaseRequestThread(rsp->task.id); });
+        std::weak_ptr<NetworkRequestRunnable> weak = r;
+        // Emitted by quit() when the attempt is cancelled, and when it is released after its result or retry (no longer current then).
+        // Queued: the cancel path holds m_mutex
+        QObject::connect(r.get(), &NetworkRequestRunnable::exitLoop, &eventloop, [&, weak]()
+                         {
+            std::shared_ptr<NetworkRequestRunnable> stopped = weak.lock();
+            if (!bAnswered && stopped && stopped == current)
+                answerCancelled(stopped->task()); }, Qt::QueuedConnection);
+        QObject::connect(r.get(), &NetworkRequestRunnable::retry, &eventloop, [&, weak](quint64 uiRequestId, qint64 nDelayMs)
+                         {
+            std::shared_ptr<NetworkRequestRunnable> previous = weak.lock();
+            std::unique_ptr<RequestContext> next = previous ? previous->takeRetryContext() : nullptr;
+            current.reset();
+            releaseRequestThread(uiRequestId);
+            if (!next)
+            {
+                eventloop.quit();
+                return;
+            }
+            std::shared_ptr<NetworkRequestRunnable> retry = std::make_shared<NetworkRequestRunnable>(std::move(next));
+            retry->setProgress(previous->progress());
+            QTimer::singleShot(static_cast<int>(nDelayMs), &eventloop, [&, retry]() {
+                // Not in m_mapRunnable while it waits, a stop of all requests meanwhile is noticed here
+                if (m_uiStopGeneration.load(std::memory_order_acquire) != uiStopGeneration)
+                    answerCancelled(retry->task());
+                else if (!launch(retry, true))
+                    eventloop.quit();
+            }); });
+        return startRunnable(r, bQueue);
+    };
+
+    limitRequest(*context);
+    const quint64 uiRequestId = context->task.id;
+    std::shared_ptr<NetworkRequestRunnable> r = std::make_shared<NetworkRequestRunnable>(std::move(context));
+    if (!launch(r, false))
     {
+        NetworkBandwidthLimiter::globalInstance()->remove(BandwidthScope::Request, uiRequestId);
         r.reset();
         return false;
     }
@@ -474,6 +878,8 @@ bool NetworkRequestManagerPrivate::sendRequest(std::unique_ptr<RequestContext> c
         eventloop.exec(QEventLoop::ExcludeUserInputEvents);
     else
         eventloop.exec();
+    // Also left without an answer when a retry could not be made
+    NetworkBandwidthLimiter::globalInstance()->remove(BandwidthScope::Request, uiRequestId);
     return true;
 }
 
@@ -482,6 +888,11 @@ quint64 NetworkRequestManagerPrivate::nextRequestId() const
     return ms_uiRequestId.fetch_add(1, std::memory_order_relaxed) + 1;
 }
 
+quint64 NetworkRequestManagerPrivate::nextRequestIds(quint64 uiCount) const
+{
+    return ms_uiRequestId.fetch_add(uiCount, std::memory_order_relaxed) + 1;
+}
+
 quint64 NetworkRequestManagerPrivate::nextBatchId() const
 {
     return ms_uiBatchId.fetch_add(1, std::memory_order_relaxed) + 1;
@@ -492,36 +903,229 @@ quint64 NetworkRequestManagerPrivate::nextSessionId() const
     return ms_uiSessionId.fetch_add(1, std::memory_order_relaxed) + 1;
 }
 
+std::shared_ptr<NetworkRequestRunnable> NetworkRequestManagerPrivate::createRunnable(std::unique_ptr<RequestContext> context)
+{
+    Q_Q(NetworkRequestManager);
+    const bool bShowProgress = context && context->behavior.showProgress;
+    const bool bDownload = context && context->type != RequestType::Upload;
+
+    std::shared_ptr<NetworkRequestRunnable> r = std::make_shared<NetworkRequestRunnable>(std::move(context));
+    QObject::connect(r.get(), &NetworkRequestRunnable::response, q, &NetworkRequestManager::onResponse);
+    QObject::connect(r.get(), &NetworkRequestRunnable::retry, q, &NetworkRequestManager::onRetry);
+
+    if (bShowProgress)
+    {
+        // The request writes its progress into the counters, the tracker samples them on the main thread
+        const quint64 uiId = r->requestId();
+        const quint64 uiBatchId = r->batchId();
+        r->setProgress(m_progressTracker.track(uiId, bDownload,
+                                               uiBatchId == 0 ? getReply(uiId, false) : nullptr,
+                                               uiBatchId, uiBatchId > 0 ? getBatchReply(uiBatchId, false) : nullptr));
+    }
+    return r;
+}
+
 bool NetworkRequestManagerPrivate::startRunnable(std::shared_ptr<NetworkRequestRunnable> r, bool bAddToWaitQueueIfNotStart)
 {
-    if (r.get())
+    if (!r.get())
+        return false;
+
+    QMutexLocker locker(&m_mutex);
+    if (bAddToWaitQueueIfNotStart)
+    {
+        // Queue it and let the scheduler decide when it gets an execution slot
+        m_mapRunnable.insert(r->requestId(), r);
+        r->setQueuePosition(m_scheduler.enqueue(r));
+        scheduleNext();
+        return true;
+    }
+
+    // Run immediately or fail, never queue
+    if (m_nRunning >= executionSlots() || !dispatchRunnable(r, false))
+        return false;
+
+    ++m_nRunning;
+    m_scheduler.acquire(r->sessionId());
+    m_mapRunnable.insert(r->requestId(), r);
+    return true;
+}
+
+void NetworkRequestManagerPrivate::scheduleNext()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_nScheduleDeferred > 0)
+        return;
+    feedBatches();
+
+    const int nSlots = executionSlots();
+    while (m_nRunning < nSlots)
+    {
+        std::shared_ptr<NetworkRequestRunnable> r = m_scheduler.dequeue();
+        if (!r.get())
+            break;
+
+        ++m_nRunning;
+        if (!dispatchRunnable(r, true))
+        {
+            qDebug() << "[QMultiThreadNetwork] dispatchRunnable() failed! Id:" << r->requestId();
+            m_mapRunnable.remove(r->requestId());
+            --m_nRunning;
+            m_scheduler.release(r->sessionId());
+        }
+    }
+}
+
+void NetworkRequestManagerPrivate::feedBatches()
+{
+    // Members wait in the queue only for the execution slots that are free, however many batches are being fed
+    int nBudget = qMax(1, executionSlots()) - m_nRunning - m_scheduler.batchMemberCount();
+    // One member per batch and round, so that the batches share the free slots
+    bool bFed = true;
+    while (nBudget > 0 && bFed)
     {
-        try
+        bFed = false;
+        for (auto iter = m_feedingBatches.begin(); iter != m_feedingBatches.end() && nBudget > 0;)
         {
-            if (bAddToWaitQueueIfNotStart)
-                m_pThreadPool->start(r.get());
+            BatchState &batch = *iter->get();
+            while (batch.hasPending())
+            {
+                std::unique_ptr<RequestContext> context = std::move(batch.pending[batch.nNextPending++]);
+                if (!context || !batch.members.contains(context->task.id))
+                {
+                    // Stopped before its turn
+                    continue;
+                }
+                std::shared_ptr<NetworkRequestRunnable> r = createRunnable(std::move(context));
+                ++batch.nFed;
+                m_mapRunnable.insert(r->requestId(), r);
+                r->setQueuePosition(m_scheduler.enqueue(r));
+                --nBudget;
+                bFed = true;
+                break;
+            }
+
+            if (batch.hasPending())
+            {
+                ++iter;
+            }
             else
             {
-                if (!m_pThreadPool->tryStart(r.get()))
-                    return false;
+                batch.clearPending();
+                iter = m_feedingBatches.erase(iter);
             }
+        }
+    }
+}
+
+bool NetworkRequestManagerPrivate::dispatchRunnable(const std::shared_ptr<NetworkRequestRunnable> &r, bool bWaitForThread)
+{
+    try
+    {
+        // HTTP/2 requests run on the network thread of their origin in either mode, so that they share one connection
+        if (executionMode() == ExecutionMode::EventLoop || !r->affinity().isEmpty())
+        {
+            // Network threads multiplex requests, never wait for an idle thread
+            if (!m_pEventLoopPool)
             {
-                QMutexLocker locker(&m_mutex);
-                m_mapRunnable.insert(r->requestId(), r);
+                m_pEventLoopPool = std::make_unique<NetworkEventLoopPool>();
             }
+            m_pEventLoopPool->start(r, r->affinity());
             return true;
         }
-        catch (std::exception *e)
+
+        if (bWaitForThread)
         {
-            qCritical() << "[QMultiThreadNetwork] startRunnable() exception:" << QString::fromUtf8(e->what());
+            m_pThreadPool->start(r.get());
+            return true;
         }
-        catch (...)
+        return m_pThreadPool->tryStart(r.get());
+    }
+    catch (std::exception *e)
+    {
+        qCritical() << "[QMultiThreadNetwork] dispatchRunnable() exception:" << QString::fromUtf8(e->what());
+    }
+    catch (...)
+    {
+        qCritical() << "[QMultiThreadNetwork] dispatchRunnable() unknown exception";
+    }
+    return false;
+}
+
+void NetworkRequestManagerPrivate::cancelRunnable(const std::shared_ptr<NetworkRequestRunnable> &r)
+{
+    // Still waiting in the scheduler, it never got an execution slot
+    if (m_scheduler.remove(r->requestId()))
+    {
+        // Nothing runs yet, only tells a waiting synchronous request (exitLoop)
+        r->quit();
+        return;
+    }
+
+    // Quit even if it was taken back before it ran, a waiting synchronous request learns from exitLoop that it was stopped
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 9, 0))
+    m_pThreadPool->tryTake(r.get());
+#else
+    m_pThreadPool->cancel(r.get());
+#endif
+    r->quit();
+
+    if (m_nRunning > 0)
+    {
+        --m_nRunning;
+    }
+    m_scheduler.release(r->sessionId());
+}
+
+int NetworkRequestManagerPrivate::executionSlots() const
+{
+    if (executionMode() == ExecutionMode::EventLoop)
+    {
+        if (m_nMaxConcurrentRequests > 0)
         {
-            qCritical() << "[QMultiThreadNetwork] startRunnable() unknown exception";
+            return m_nMaxConcurrentRequests;
         }
+        int nThreads = m_pEventLoopPool ? m_pEventLoopPool->threadCount() : QThread::idealThreadCount();
+        return qMax(1, nThreads) * DEFAULT_EVENTLOOP_REQUESTS_PER_THREAD;
     }
+    return m_pThreadPool->maxThreadCount();
+}
 
-    return false;
+bool NetworkRequestManagerPrivate::setMaxConcurrentRequests(int nMax)
+{
+    if (nMax < 0)
+        return false;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_nMaxConcurrentRequests = nMax;
+    }
+    scheduleNext();
+    return true;
+}
+
+int NetworkRequestManagerPrivate::maxConcurrentRequests() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_nMaxConcurrentRequests;
+}
+
+void NetworkRequestManagerPrivate::setSessionWeight(quint64 uiSessionId, quint32 uiWeight)
+{
+    QMutexLocker locker(&m_mutex);
+    m_scheduler.setSessionWeight(uiSessionId, uiWeight);
+}
+
+BatchSummary NetworkRequestManagerPrivate::batchSummary(quint64 uiBatchId) const
+{
+    QMutexLocker locker(&m_mutex);
+    std::shared_ptr<BatchState> batch = m_mapBatch.value(uiBatchId);
+    if (!batch)
+    {
+        return BatchSummary();
+    }
+    BatchSummary summary = batch->summary;
+    summary.wallTimeMs = batch->clock.elapsed();
+    return summary;
 }
 
 bool NetworkRequestManagerPrivate::setMaxThreadCount(int nMax)
@@ -533,6 +1137,10 @@ bool NetworkRequestManagerPrivate::setMaxThreadCount(int nMax)
         m_pThreadPool->setMaxThreadCount(nMax);
         bRet = true;
     }
+    if (bRet)
+    {
+        scheduleNext();
+    }
     return bRet;
 }
 
@@ -545,6 +1153,33 @@ int NetworkRequestManagerPrivate::maxThreadCount() const
     return -1;
 }
 
+void NetworkRequestManagerPrivate::setExecutionMode(ExecutionMode mode, int nThreadCount)
+{
+    QMutexLocker locker(&m_mutex);
+    if (mode == ExecutionMode::EventLoop)
+    {
+        if (!m_pEventLoopPool)
+        {
+            m_pEventLoopPool = std::make_unique<NetworkEventLoopPool>(nThreadCount);
+        }
+        else if (nThreadCount > 0 && nThreadCount != m_pEventLoopPool->threadCount())
+        {
+            qDebug() << "[QMultiThreadNetwork] Event loop threads already running:" << m_pEventLoopPool->threadCount();
+        }
+    }
+    // Requests already in flight keep running on the engine that started them
+    m_eExecutionMode.store(mode, std::memory_order_release);
+    qDebug() << "[QMultiThreadNetwork] Execution mode:" << (mode == ExecutionMode::EventLoop ? "EventLoop" : "ThreadPerRequest");
+
+    // The number of execution slots depends on the mode
+    scheduleNext();
+}
+
+ExecutionMode NetworkRequestManagerPrivate::executionMode() const
+{
+    return m_eExecutionMode.load(std::memory_order_acquire);
+}
+
 bool NetworkRequestManagerPrivate::isThreadAvailable() const
 {
     if (m_pThreadPool)
@@ -560,117 +1195,290 @@ bool NetworkRequestManagerPrivate::isValid(const QUrl &url) const
 }
 
 std::shared_ptr<NetworkReply> NetworkRequestManagerPrivate::getReply(quint64 uiRequestId, bool bRemove)
+{
+    std::shared_ptr<NetworkReply> reply = bRemove ? m_mapReply.take(uiRequestId) : m_mapReply.value(uiRequestId);
+    if (!reply)
+    {
+        qDebug() << QString("%1 failed! Id: ").arg(__FUNCTION__) << uiRequestId;
+    }
+    return reply;
+}
+
+std::shared_ptr<NetworkReply> NetworkRequestManagerPrivate::getBatchReply(quint64 uiBatchId, bool bRemove)
+{
+    return bRemove ? m_mapBatchReply.take(uiBatchId) : m_mapBatchReply.value(uiBatchId);
+}
+
+bool NetworkRequestManagerPrivate::finishRunnable(const ResponseResult &rsp, bool &bBatchKnown, std::shared_ptr<BatchState> &finishedBatch)
 {
     QMutexLocker locker(&m_mutex);
-    if (m_mapReply.contains(uiRequestId))
+    std::shared_ptr<NetworkRequestRunnable> r = m_mapRunnable.take(rsp.task.id);
+    if (!r.get())
+    {
+        return false;
+    }
+
+    bool bAbortBatch = false;
+    if (rsp.task.batchId > 0)
     {
-        if (bRemove)
+        auto iter = m_mapBatch.find(rsp.task.batchId);
+        if (iter != m_mapBatch.end())
         {
-            return m_mapReply.take(uiRequestId);
+            bBatchKnown = true;
+            // Its slot in the batch goes to the next member
+            --iter.value()->nFed;
+            if (iter.value()->finish(rsp))
+            {
+                finishedBatch = iter.value();
+                m_mapBatch.erase(iter);
+            }
+            else
+            {
+                bAbortBatch = !rsp.success && rsp.task.abortBatchOnFailed;
+            }
         }
-        else
+    }
+
+    cancelRunnable(r);
+    // A batch about to be stopped does not get its next member started, stopBatchRequests() schedules instead
+    if (!bAbortBatch)
+    {
+        scheduleNext();
+    }
+    return true;
+}
+
+bool NetworkRequestManagerPrivate::releaseRequestThread(quint64 uiRequestId)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_mapRunnable.contains(uiRequestId))
+    {
+        std::shared_ptr<NetworkRequestRunnable> r = m_mapRunnable.take(uiRequestId);
+        if (r.get())
         {
-            return m_mapReply.value(uiRequestId);
+            cancelRunnable(r);
         }
+        // The slot is free, start the next queued request
+        scheduleNext();
+        return true;
     }
-    qDebug() << QString("%1 failed! Id: ").arg(__FUNCTION__) << uiRequestId;
-    return nullptr;
+    return false;
 }
 
-std::shared_ptr<NetworkReply> NetworkRequestManagerPrivate::getBatchReply(quint64 uiBatchId, bool bRemove)
+void NetworkRequestManagerPrivate::scheduleRetry(quint64 uiRequestId, qint64 nDelayMs)
 {
-    QMutexLocker locker(&m_mutex);
-    if (m_mapBatchReply.contains(uiBatchId))
+    Q_Q(NetworkRequestManager);
+    std::shared_ptr<NetworkRequestRunnable> retry;
     {
-        if (bRemove)
+        QMutexLocker locker(&m_mutex);
+        std::shared_ptr<NetworkRequestRunnable> r = m_mapRunnable.take(uiRequestId);
+        if (!r.get())
         {
-            return m_mapBatchReply.take(uiBatchId);
+            // Stopped meanwhile
+            return;
         }
-        else
+        std::unique_ptr<RequestContext> context = r->takeRetryContext();
+        std::shared_ptr<TransferProgress> progress = r->progress();
+        // No slot is held while waiting
+        cancelRunnable(r);
+        scheduleNext();
+        if (!context)
+        {
+            return;
+        }
+
+        retry = std::make_shared<NetworkRequestRunnable>(std::move(context));
+        if (progress)
         {
-            return m_mapBatchReply.value(uiBatchId);
+            // The next attempt reports from its own start
+            progress->set(0, 0);
+            retry->setProgress(progress);
         }
+        m_mapRetryRunnable.insert(uiRequestId, retry);
     }
-    return nullptr;
+
+    QObject::connect(retry.get(), &NetworkRequestRunnable::response, q, &NetworkRequestManager::onResponse);
+    QObject::connect(retry.get(), &NetworkRequestRunnable::retry, q, &NetworkRequestManager::onRetry);
+    QTimer::singleShot(static_cast<int>(nDelayMs), q, [this, uiRequestId]() {
+        std::shared_ptr<NetworkRequestRunnable> r;
+        {
+            QMutexLocker locker(&m_mutex);
+            r = m_mapRetryRunnable.take(uiRequestId);
+        }
+        if (r.get() && !startRunnable(r))
+        {
+            qDebug() << "[QMultiThreadNetwork] startRunnable() failed! Id:" << uiRequestId;
+        }
+    });
 }
 
-qint64 NetworkRequestManagerPrivate::updateBatchProgress(quint64 uiRequestId, quint64 uiBatchId, qint64 iBytes, qint64 iTotalBytes, bool bDownload)
+void NetworkRequestManagerPrivate::removeRetries(const std::function<bool(const NetworkRequestRunnable &)> &match)
 {
-    Q_UNUSED(iTotalBytes);
-    // postEvent() calls are all in main thread, no need to lock
-
-    // Bytes increased for this request task compared to last time (download/upload)
-    quint64 uiIncreased = 0;
-    quint64 uiTotalBytes = 0;
-    if (iBytes == 0)
+    for (auto iter = m_mapRetryRunnable.begin(); iter != m_mapRetryRunnable.end();)
     {
-        if (bDownload)
+        if (iter.value() && match(*iter.value()))
         {
-            return m_mapBatchDTotalBytes[uiBatchId];
+            m_progressTracker.untrack(iter.key());
+            iter = m_mapRetryRunnable.erase(iter);
         }
         else
         {
-            return m_mapBatchUTotalBytes[uiBatchId];
+            ++iter;
         }
     }
+}
+
+bool NetworkRequestManagerPrivate::joinFlight(const RequestContext &context)
+{
+    if (!context.behavior.coalesce || context.streamConfig || context.task.batchId > 0
+        || (context.type != RequestType::Get && context.type != RequestType::Head))
+    {
+        return false;
+    }
+
+    const QString key = flightKey(context);
+    QMutexLocker locker(&m_flightMutex);
+    auto iter = m_mapFlightKey.constFind(key);
+    if (iter == m_mapFlightKey.constEnd())
+    {
+        m_mapFlightKey.insert(key, context.task.id);
+        m_mapFlight[context.task.id].key = key;
+        return false;
+    }
+
+    m_mapFlight[iter.value()].followers.append({ context.task, context.userContext });
+    m_mapFlightFollower.insert(context.task.id, iter.value());
+    return true;
+}
 
-    if (bDownload)
+void NetworkRequestManagerPrivate::finishFlight(const QSharedPointer<ResponseResult> &rsp)
+{
+    QList<FlightFollower> followers;
     {
-        const QHash<quint64, qint64> &mapReqId2Bytes = m_mapBatchDCurrentBytes.value(uiBatchId);
-        if (mapReqId2Bytes.contains(uiRequestId))
+        QMutexLocker locker(&m_flightMutex);
+        auto flight = m_mapFlight.find(rsp->task.id);
+        if (flight == m_mapFlight.end())
         {
-            qint64 curBytes = mapReqId2Bytes.value(uiRequestId);
-            if (iBytes > curBytes)
-            {
-                uiIncreased = iBytes - curBytes;
-            }
+            return;
         }
-        else
+        // Requests posted from now on go to the network again
+        m_mapFlightKey.remove(flight.value().key);
+        followers.swap(flight.value().followers);
+        m_mapFlight.erase(flight);
+        for (const FlightFollower &follower : followers)
         {
-            uiIncreased = iBytes;
+            m_mapFlightFollower.remove(follower.task.id);
+            unindexRequest(follower.task.id);
         }
-        m_mapBatchDCurrentBytes[uiBatchId][uiRequestId] = iBytes;
+    }
 
-        uiTotalBytes = m_mapBatchDTotalBytes.value(uiBatchId) + uiIncreased;
-        m_mapBatchDTotalBytes[uiBatchId] = uiTotalBytes;
+    for (const FlightFollower &follower : followers)
+    {
+        std::shared_ptr<NetworkReply> reply = getReply(follower.task.id);
+        if (!reply.get())
+        {
+            continue;
+        }
+        // Body and headers are implicitly shared with the result of the request in flight
+        QSharedPointer<ResponseResult> followerRsp = QSharedPointer<ResponseResult>::create(*rsp);
+        followerRsp->task.id = follower.task.id;
+        followerRsp->task.sessionId = follower.task.sessionId;
+        followerRsp->task.createTime = follower.task.createTime;
+        followerRsp->userContext = follower.userContext;
+        reply->replyResult(followerRsp, true);
     }
-    else
+}
+
+bool NetworkRequestManagerPrivate::leaveFlight(quint64 uiRequestId)
+{
+    // Leader that runs on for nobody any more
+    quint64 uiAbandonedId = 0;
     {
-        const QHash<quint64, qint64> &mapReqId2Bytes = m_mapBatchUCurrentBytes.value(uiBatchId);
-        if (mapReqId2Bytes.contains(uiRequestId))
+        QMutexLocker flightLocker(&m_flightMutex);
+        auto follower = m_mapFlightFollower.find(uiRequestId);
+        if (follower != m_mapFlightFollower.end())
         {
-            qint64 curBytes = mapReqId2Bytes.value(uiRequestId);
-            if (iBytes > curBytes)
+            const quint64 uiLeaderId = follower.value();
+            m_mapFlightFollower.erase(follower);
+
+            auto flight = m_mapFlight.find(uiLeaderId);
+            if (flight == m_mapFlight.end())
             {
-                uiIncreased = iBytes - curBytes;
+                return false;
             }
+            QList<FlightFollower> &followers = flight.value().followers;
+            for (int i = 0; i < followers.size(); ++i)
+            {
+                if (followers.at(i).task.id == uiRequestId)
+                {
+                    followers.removeAt(i);
+                    break;
+                }
+            }
+            if (!flight.value().bLeaderCancelled || !followers.isEmpty())
+            {
+                return false;
+            }
+            m_mapFlightKey.remove(flight.value().key);
+            m_mapFlight.erase(flight);
+            uiAbandonedId = uiLeaderId;
         }
         else
         {
-            uiIncreased = iBytes;
+            auto flight = m_mapFlight.find(uiRequestId);
+            if (flight == m_mapFlight.end())
+            {
+                return false;
+            }
+            if (!flight.value().followers.isEmpty())
+            {
+                flight.value().bLeaderCancelled = true;
+                return true;
+            }
+            m_mapFlightKey.remove(flight.value().key);
+            m_mapFlight.erase(flight);
+            return false;
         }
-        m_mapBatchUCurrentBytes[uiBatchId][uiRequestId] = iBytes;
+    }
 
-        uiTotalBytes = m_mapBatchUTotalBytes.value(uiBatchId) + uiIncreased;
-        m_mapBatchUTotalBytes[uiBatchId] = uiTotalBytes;
+    // Nobody waits for the request in flight any more
+    m_mapRetryRunnable.remove(uiAbandonedId);
+    if (std::shared_ptr<NetworkRequestRunnable> r = m_mapRunnable.take(uiAbandonedId))
+    {
+        cancelRunnable(r);
+        scheduleNext();
     }
+    return false;
+}
 
-    return uiTotalBytes;
+void NetworkRequestManagerPrivate::abandonFlight(quint64 uiRequestId)
+{
+    QMutexLocker locker(&m_flightMutex);
+    auto flight = m_mapFlight.find(uiRequestId);
+    if (flight == m_mapFlight.end())
+    {
+        return;
+    }
+    m_mapFlightKey.remove(flight.value().key);
+    for (const FlightFollower &follower : flight.value().followers)
+    {
+        m_mapFlightFollower.remove(follower.task.id);
+        unindexRequest(follower.task.id);
+    }
+    m_mapFlight.erase(flight);
 }
 
-bool NetworkRequestManagerPrivate::releaseRequestThread(quint64 uiRequestId)
+QString NetworkRequestManagerPrivate::flightKey(const RequestContext &context)
 {
-    QMutexLocker locker(&m_mutex);
-    if (m_mapRunnable.contains(uiRequestId))
+    QString key = QString("%1 %2 %3").arg(static_cast<int>(context.type)).arg(static_cast<int>(context.behavior.cacheMode))
+                      .arg(NetworkResponseCache::cacheKey(context.url));
+    // Requests of different users (Authorization, cookies) never share a response
+    const QMap<QByteArray, QByteArray> headers = NetworkRequestUtility::sentHeaders(context);
+    for (auto iter = headers.cbegin(); iter != headers.cend(); ++iter)
     {
-        std::shared_ptr<NetworkRequestRunnable> r = m_mapRunnable.take(uiRequestId);
-        if (r.get())
-        {
-            r->quit();
-        }
-        return true;
+        key += QString("\n%1: %2").arg(QString::fromLatin1(iter.key().toLower()), QString::fromLatin1(iter.value()));
     }
-    return false;
+    return key;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -752,7 +1560,14 @@ std::shared_ptr<NetworkReply> NetworkRequestManager::postRequest(std::unique_ptr
     if (pReply)
     {
         request->task.createTime = QDateTime::currentDateTime();
-        startAsRunnable(std::move(request));
+        d->indexRequest(*request);
+        // Attached to an identical request in flight, it is answered with that one's result
+        const quint64 uiId = request->task.id;
+        if (!d->joinFlight(*request) && !startAsRunnable(std::move(request)))
+        {
+            d->abandonFlight(uiId);
+            d->unindexRequest(uiId);
+        }
     }
     return pReply;
 }
@@ -806,6 +1621,12 @@ void NetworkRequestManager::stopSessionRequest(quint64 uiSessionId)
     d->stopSessionRequest(uiSessionId);
 }
 
+int NetworkRequestManager::stopRequests(const RequestFilter &filter)
+{
+    Q_D(NetworkRequestManager);
+    return d->stopRequests(filter);
+}
+
 void NetworkRequestManager::stopAllRequest()
 {
     Q_D(NetworkRequestManager);
@@ -818,15 +1639,20 @@ quint64 NetworkRequestManager::nextSessionId()
     return d->nextSessionId();
 }
 
-bool NetworkRequestManager::startAsRunnable(std::unique_ptr<RequestContext> context)
+BatchSummary NetworkRequestManager::batchSummary(quint64 uiBatchId)
 {
-    std::shared_ptr<NetworkRequestRunnable> r = std::make_shared<NetworkRequestRunnable>(std::move(context));
-    connect(r.get(), &NetworkRequestRunnable::response, this, &NetworkRequestManager::onResponse);
+    Q_D(NetworkRequestManager);
+    return d->batchSummary(uiBatchId);
+}
 
+bool NetworkRequestManager::startAsRunnable(std::unique_ptr<RequestContext> context)
+{
     Q_D(NetworkRequestManager);
+    std::shared_ptr<NetworkRequestRunnable> r = d->createRunnable(std::move(context));
     if (!d->startRunnable(r))
     {
         qDebug() << "[QMultiThreadNetwork] startRunnable() failed!";
+        d->m_progressTracker.untrack(r->requestId());
 
         r.reset();
         return false;
@@ -846,69 +1672,77 @@ int NetworkRequestManager::maxThreadCount()
     return d->maxThreadCount();
 }
 
-bool NetworkRequestManager::event(QEvent *event)
+void NetworkRequestManager::setExecutionMode(ExecutionMode mode, int nThreadCount)
 {
-    if (event->type() == NetworkEvent::NetworkProgress)
-    {
-        Q_D(NetworkRequestManager);
-        if (d->isStopped())
-        {
-            return true;
-        }
+    Q_D(NetworkRequestManager);
+    d->setExecutionMode(mode, nThreadCount);
+}
 
-        NetworkProgressEvent *evtProgress = static_cast<NetworkProgressEvent *>(event);
-        if (nullptr != evtProgress)
-        {
-            updateProgress(evtProgress->uiId,
-                           evtProgress->uiBatchId,
-                           evtProgress->iBtyes,
-                           evtProgress->iTotalBtyes,
-                           evtProgress->bDownload);
-        }
-        return true;
-    }
+ExecutionMode NetworkRequestManager::executionMode()
+{
+    Q_D(NetworkRequestManager);
+    return d->executionMode();
+}
 
-    return QObject::event(event);
+bool NetworkRequestManager::setMaxConcurrentRequests(int iMax)
+{
+    Q_D(NetworkRequestManager);
+    return d->setMaxConcurrentRequests(iMax);
 }
 
-void NetworkRequestManager::updateProgress(quint64 uiId, quint64 uiBatchId, qint64 iBytes, qint64 iTotalBytes, bool bDownload)
+int NetworkRequestManager::maxConcurrentRequests()
 {
     Q_D(NetworkRequestManager);
-    if (uiId == 0)
-        return;
+    return d->maxConcurrentRequests();
+}
 
-    // Find the reply for the single request
-    std::shared_ptr<NetworkReply> singleReply = d->getReply(uiId, false); // Do not remove from map
+void NetworkRequestManager::setSessionWeight(quint64 uiSessionId, quint32 uiWeight)
+{
+    Q_D(NetworkRequestManager);
+    d->setSessionWeight(uiSessionId, uiWeight);
+}
 
-    if (singleReply)
-    {
-        if (bDownload)
-        {
-            emit singleReply->downloadProgress(iBytes, iTotalBytes);
-        }
-        else
-        {
-            emit singleReply->uploadProgress(iBytes, iTotalBytes);
-        }
-    }
+void NetworkRequestManager::setProgressInterval(int nIntervalMs, qint64 nMinBytes)
+{
+    Q_D(NetworkRequestManager);
+    d->m_progressTracker.setInterval(nIntervalMs, nMinBytes);
+}
 
-    if (uiBatchId > 0) // Batch request
-    {
-        // Find the reply for the batch
-        std::shared_ptr<NetworkReply> batchReply = d->getBatchReply(uiBatchId, false); // Do not remove from map
-        if (batchReply)
-        {
-            quint64 totalBatchBytes = d->updateBatchProgress(uiId, uiBatchId, iBytes, iTotalBytes, bDownload);
-            if (bDownload)
-            {
-                emit batchReply->batchDownloadProgress(totalBatchBytes);
-            }
-            else
-            {
-                emit batchReply->batchUploadProgress(totalBatchBytes);
-            }
-        }
-    }
+void NetworkRequestManager::setCacheMemoryLimits(qint64 nMaxBytes, qint64 nMaxEntryBytes)
+{
+    NetworkResponseCache::globalInstance()->setMemoryLimits(nMaxBytes, nMaxEntryBytes);
+}
+
+bool NetworkRequestManager::setCacheDirectory(const QString &strDirectory, qint64 nMaxBytes)
+{
+    return NetworkResponseCache::globalInstance()->setDiskCache(strDirectory, nMaxBytes);
+}
+
+void NetworkRequestManager::clearCache()
+{
+    NetworkResponseCache::globalInstance()->clear();
+    NetworkRedirectCache::globalInstance()->clear();
+}
+
+void NetworkRequestManager::setBandwidthLimit(BandwidthScope scope, quint64 uiId, qint64 nDownloadBytesPerSec, qint64 nUploadBytesPerSec)
+{
+    NetworkBandwidthLimiter *pLimiter = NetworkBandwidthLimiter::globalInstance();
+    pLimiter->setLimit(scope, uiId, NetworkBandwidthLimiter::Download, nDownloadBytesPerSec);
+    pLimiter->setLimit(scope, uiId, NetworkBandwidthLimiter::Upload, nUploadBytesPerSec);
+}
+
+void NetworkRequestManager::setBackgroundBandwidth(qint64 nBytesPerSec)
+{
+    NetworkBandwidthLimiter::globalInstance()->setBackgroundRate(nBytesPerSec);
+}
+
+void NetworkRequestManager::onRetry(quint64 uiRequestId, qint64 nDelayMs)
+{
+    Q_ASSERT(QThread::currentThread() == NetworkRequestManager::globalInstance()->thread());
+    Q_D(NetworkRequestManager);
+    if (d->isStopped())
+        return;
+    d->scheduleRetry(uiRequestId, nDelayMs);
 }
 
 void NetworkRequestManager::onResponse(QSharedPointer<QtNetworkRequest::ResponseResult> rsp)
@@ -917,12 +1751,26 @@ void NetworkRequestManager::onResponse(QSharedPointer<QtNetworkRequest::Response
     Q_D(NetworkRequestManager);
     if (d->isStopped())
         return;
-    if (d->isSessionStopped(rsp->task.sessionId))
+    // Its slot is free before the result is delivered, the next queued request starts meanwhile
+    bool bBatchKnown = false;
+    std::shared_ptr<NetworkRequestManagerPrivate::BatchState> finishedBatch;
+    if (!d->finishRunnable(*rsp, bBatchKnown, finishedBatch))
+    {
+        // Stopped meanwhile, its cancelled result was delivered already
         return;
+    }
 
-    rsp->performance.durationMs = rsp->task.startTime.msecsTo(rsp->task.endTime);
+    NetworkRequestRunnable::setDelivered(*rsp);
     try
     {
+        // 1. Last progress report before the result, the batch total goes with its BatchState
+        d->m_progressTracker.finish(rsp->task.id);
+        if (finishedBatch)
+        {
+            d->m_progressTracker.untrackBatch(rsp->task.batchId);
+        }
+
+
         // 2. Notify user of results
         std::shared_ptr<NetworkReply> pReply;
         bool bDestroyed = true;
@@ -933,37 +1781,10 @@ void NetworkRequestManager::onResponse(QSharedPointer<QtNetworkRequest::Response
         }
         else if (batchId > 0) // Batch task
         {
-            size_t sizeFinished = 0;
-            size_t sizeTotal = 0;
+            // Still have requests not completed, unless a failure aborts the batch
+            if (bBatchKnown && !finishedBatch && (rsp->success || !rsp->task.abortBatchOnFailed))
             {
-                QMutexLocker locker(&d->m_mutex);
-                sizeTotal = d->m_mapBatchTotalSize.value(rsp->task.batchId);
-                if (sizeTotal > 0)
-                {
-                    sizeFinished = d->m_mapBatchFinishedSize.value(batchId);
-                    d->m_mapBatchFinishedSize[batchId] = ++sizeFinished;
-
-                    if (sizeFinished == sizeTotal)
-                    {
-                        d->m_mapBatchTotalSize.remove(batchId);
-                        d->m_mapBatchFinishedSize.remove(batchId);
-                    }
-                }
-            }
-
-            if (rsp->success)
-            {
-                if (sizeFinished < sizeTotal) // Still have requests not completed
-                {
-                    bDestroyed = false;
-                }
-            }
-            else // Batch task failed
-            {
-                if (!rsp->task.abortBatchOnFailed && (sizeFinished < sizeTotal))
-                {
-                    bDestroyed = false;
-                }
+                bDestroyed = false;
             }
             pReply = d->getBatchReply(batchId, bDestroyed);
         }
@@ -977,6 +1798,13 @@ void NetworkRequestManager::onResponse(QSharedPointer<QtNetworkRequest::Response
                 emit batchRequestFinished(batchId, rsp->success);
             }
         }
+        if (finishedBatch)
+        {
+            NetworkBandwidthLimiter::globalInstance()->remove(BandwidthScope::Batch, batchId);
+            emit batchRequestSummary(finishedBatch->summary);
+        }
+        // Identical requests attached to this one (behavior.coalesce)
+        d->finishFlight(rsp);
 
         // 3. If batch task failed and bAbortBatchWhileOneFailed is specified, stop tasks in this batch
         if (batchId > 0 && !rsp->success && rsp->task.abortBatchOnFailed)
@@ -984,8 +1812,8 @@ void NetworkRequestManager::onResponse(QSharedPointer<QtNetworkRequest::Response
             d->stopBatchRequests(batchId);
         }
 
-        // 4. Release task thread to make it idle
-        d->releaseRequestThread(rsp->task.id);
+        // 4. Its thread was released by finishRunnable()
+        d->unindexRequest(rsp->task.id);
     }
     catch (std::exception *e)
     {
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <utility>
+
+namespace QtNetworkRequest
+{
+    /**
+     * @brief Map of request (or batch) ids to values, split into independently locked shards.
+     *
+     * Ids are handed out sequentially, so requests that are submitted, looked up and completed at the same time
+     * on different threads land in different shards and rarely wait for each other. An operation holds the
+     * non-recursive lock of one shard for the hash lookup only, values are destroyed after it was released.
+     */
+    template <typename Value, int ShardCount = 16>
+    class ShardedRegistry
+    {
+        static_assert(ShardCount > 0 && (ShardCount & (ShardCount - 1)) == 0, "ShardCount must be a power of two");
+
+    public:
+        void insert(quint64 uiId, const Value &value)
+        {
+            Value previous;
+            Shard &shard = shardOf(uiId);
+            QMutexLocker locker(&shard.mutex);
+            Value &slot = shard.values[uiId];
+            std::swap(previous, slot);
+            slot = value;
+        }
+
+        // Default constructed value if there is none
+        Value value(quint64 uiId) const
+        {
+            const Shard &shard = shardOf(uiId);
+            QMutexLocker locker(&shard.mutex);
+            return shard.values.value(uiId);
+        }
+
+        Value take(quint64 uiId)
+        {
+            Shard &shard = shardOf(uiId);
+            QMutexLocker locker(&shard.mutex);
+            return shard.values.take(uiId);
+        }
+
+        bool contains(quint64 uiId) const
+        {
+            const Shard &shard = shardOf(uiId);
+            QMutexLocker locker(&shard.mutex);
+            return shard.values.contains(uiId);
+        }
+
+        bool remove(quint64 uiId)
+        {
+            Value removed;
+            Shard &shard = shardOf(uiId);
+            QMutexLocker locker(&shard.mutex);
+            auto iter = shard.values.find(uiId);
+            if (iter == shard.values.end())
+            {
+                return false;
+            }
+            std::swap(removed, iter.value());
+            shard.values.erase(iter);
+            return true;
+        }
+
+        void clear()
+        {
+            for (Shard &shard : m_shards)
+            {
+                QHash<quint64, Value> values;
+                {
+                    QMutexLocker locker(&shard.mutex);
+                    values.swap(shard.values);
+                }
+            }
+        }
+
+        int size() const
+        {
+            int nSize = 0;
+            for (const Shard &shard : m_shards)
+            {
+                QMutexLocker locker(&shard.mutex);
+                nSize += shard.values.size();
+            }
+            return nSize;
+        }
+
+    private:
+        // A cache line each, threads working on neighbouring shards do not invalidate each other's lock
+        struct alignas(64) Shard
+        {
+            mutable QMutex mutex;
+            QHash<quint64, Value> values;
+        };
+
+        Shard &shardOf(quint64 uiId) { return m_shards[uiId & (ShardCount - 1)]; }
+        const Shard &shardOf(quint64 uiId) const { return m_shards[uiId & (ShardCount - 1)]; }
+
+    private:
+        Shard m_shards[ShardCount];
+    };
+}
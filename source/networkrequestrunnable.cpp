@@ -1,20 +1,30 @@
 ﻿#include "networkrequestrunnable.h"
 #include <QDebug>
 #include <QEventLoop>
+#include <QUrl>
 #include <QCoreApplication>
 #include "networkrequest.h"
 #include "networkrequestmanager.h"
+#include "networkrequestutility.h"
 #include <QMutexLocker>
 
 using namespace QtNetworkRequest;
 
 NetworkRequestRunnable::NetworkRequestRunnable(std::unique_ptr<RequestContext> request, QObject* parent)
-    : QObject(parent), m_context(std::move(request)), m_bAbort(false)
+    : QObject(parent), m_context(std::move(request)), m_ePriority(Priority::Normal), m_uiQueuePosition(0), m_bAbort(false)
 {
     setAutoDelete(false);
+    m_queueTimer.start();
     if (m_context)
     {
         m_task = m_context->task;
+        m_ePriority = m_context->behavior.priority;
+        if (m_context->behavior.http2)
+        {
+            const QUrl url(m_context->url);
+            const int nDefaultPort = (url.scheme().toLower() == "https") ? 443 : 80;
+            m_strAffinity = QString("%1://%2:%3").arg(url.scheme().toLower(), url.host().toLower()).arg(url.port(nDefaultPort));
+        }
     }
 }
 
@@ -31,67 +41,126 @@ NetworkRequestRunnable::~NetworkRequestRunnable()
 
 void NetworkRequestRunnable::run()
 {
-    QDateTime startTime = QDateTime::currentDateTime();
-    RequestType type = RequestType::Unknown;
+    QEventLoop loop;
+
+    try
     {
-        QMutexLocker locker(&m_mutex);
-        if (m_context)
+        connect(this, &NetworkRequestRunnable::exitLoop, &loop, [&loop]() { loop.quit(); }, Qt::QueuedConnection);
+
+        if (execute())
         {
-            type = m_context->type;
+            loop.exec();
         }
     }
-    std::unique_ptr<NetworkRequest> pRequest = nullptr;
-    QEventLoop loop;
+    catch (std::exception* e)
+    {
+        qCritical() << "[QMultiThreadNetwork] NetworkRequestRunnable::run() exception:" << QString::fromUtf8(e->what());
+    }
+    catch (...)
+    {
+        qCritical() << "[QMultiThreadNetwork] NetworkRequestRunnable::run() unknown exception";
+    }
 
-    try
+    finish();
+}
+
+bool NetworkRequestRunnable::execute()
+{
+    QDateTime startTime = QDateTime::currentDateTime();
+    const qint64 nQueueWaitMs = m_queueTimer.elapsed();
+    QElapsedTimer execTimer;
+    execTimer.start();
+    if (m_bAbort)
     {
-        connect(this, &NetworkRequestRunnable::exitLoop, &loop, [&loop]() { loop.quit(); }, Qt::QueuedConnection);
+        // Stopped before it got a chance to run
+        return false;
+    }
 
+    RequestType type = RequestType::Unknown;
+    try
+    {
         {
             QMutexLocker locker(&m_mutex);
             if (m_context)
             {
-                pRequest = std::move(NetworkRequestFactory::create(std::move(m_context)));
+                type = m_context->type;
+                if (m_context->behavior.retryOnFailed)
+                {
+                    m_retryContext = NetworkRequestUtility::cloneContext(*m_context);
+                }
+                m_pRequest = NetworkRequestFactory::create(std::move(m_context));
             }
         }
-        if (pRequest.get())
+        if (m_pRequest.get())
         {
-            m_connect = connect(pRequest.get(), &NetworkRequest::response, this,
+            m_pRequest->setProgress(m_spProgress);
+            m_connect = connect(m_pRequest.get(), &NetworkRequest::response, this,
                                 [=](QSharedPointer<QtNetworkRequest::ResponseResult> rsp) {
+                if (!rsp->success && !m_bAbort && m_retryContext)
+                {
+                    const qint64 nDelayMs = m_pRequest->retryDelay();
+                    if (nDelayMs >= 0)
+                    {
+                        qDebug() << "[QMultiThreadNetwork] Request" << m_task.id << "failed:" << rsp->errorMessage
+                                 << "- retry" << (m_retryContext->task.retryCount + 1) << "in" << nDelayMs << "ms";
+                        {
+                            QMutexLocker locker(&m_mutex);
+                            ++m_retryContext->task.retryCount;
+                        }
+                        emit retry(m_task.id, nDelayMs);
+                        return;
+                    }
+                }
                 rsp->task.startTime = startTime;
                 rsp->task.endTime = QDateTime::currentDateTime();
                 rsp->cancelled = m_bAbort;
+                rsp->performance.durationMs = execTimer.elapsed();
+                rsp->performance.queuePosition = m_uiQueuePosition;
+                rsp->performance.queueWaitMs = nQueueWaitMs;
+                // Stamp only, see setDelivered()
+                rsp->performance.deliveryMs = QElapsedTimer::msecsSinceReference();
                 emit response(rsp);
             });
-            pRequest->start();
+            m_pRequest->start();
+            return true;
         }
         else
         {
             auto rsp = QSharedPointer<ResponseResult>::create();
+            rsp->task = m_task;
             rsp->task.startTime = startTime;
             rsp->task.endTime = QDateTime::currentDateTime();
             rsp->success = false;
             rsp->errorMessage = QString("[QMultiThreadNetwork] Configuration error: Unsupported request type (%1)").arg((qint32)type);
             emit response(rsp);
         }
-        loop.exec();
     }
     catch (std::exception* e)
     {
-        qCritical() << "[QMultiThreadNetwork] NetworkRequestRunnable::run() exception:" << QString::fromUtf8(e->what());
+        qCritical() << "[QMultiThreadNetwork] NetworkRequestRunnable::execute() exception:" << QString::fromUtf8(e->what());
     }
     catch (...)
     {
-        qCritical() << "[QMultiThreadNetwork] NetworkRequestRunnable::run() unknown exception";
+        qCritical() << "[QMultiThreadNetwork] NetworkRequestRunnable::execute() unknown exception";
     }
+    return false;
+}
 
-    if (pRequest.get())
+void NetworkRequestRunnable::finish()
+{
+    if (m_pRequest.get())
     {
-        pRequest->abort();
-        pRequest.reset();
+        m_pRequest->abort();
+        m_pRequest.reset();
     }
 }
 
+std::unique_ptr<RequestContext> NetworkRequestRunnable::takeRetryContext()
+{
+    QMutexLocker locker(&m_mutex);
+    return std::move(m_retryContext);
+}
+
 quint64 NetworkRequestRunnable::requestId() const
 {
     return m_task.id;
@@ -107,6 +176,14 @@ quint64 NetworkRequestRunnable::sessionId() const
     return m_task.sessionId;
 }
 
+void NetworkRequestRunnable::setDelivered(ResponseResult &rsp)
+{
+    if (rsp.performance.deliveryMs >= 0)
+    {
+        rsp.performance.deliveryMs = qMax<qint64>(0, QElapsedTimer::msecsSinceReference() - rsp.performance.deliveryMs);
+    }
+}
+
 void NetworkRequestRunnable::quit()
 {
     m_bAbort = true;
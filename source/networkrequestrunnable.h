@@ -3,12 +3,16 @@
 #include <QObject>
 #include <QRunnable>
 #include <QMutex>
+#include <QElapsedTimer>
 #include <atomic>
 #include "networkrequestdefs.h"
 #include <QSharedPointer>
 
 namespace QtNetworkRequest
 {
+	class NetworkRequest;
+	struct TransferProgress;
+
 	class NetworkRequestRunnable : public QObject, public QRunnable
 	{
 		Q_OBJECT
@@ -18,24 +22,56 @@ namespace QtNetworkRequest
 		~NetworkRequestRunnable();
 
 		// Automatically called after executing QThreadPool::start(QRunnable) or QThreadPool::tryStart(QRunnable)
+		// (ExecutionMode::ThreadPerRequest). Blocks the pool thread in an event loop until quit() is called.
 		virtual void run() Q_DECL_OVERRIDE;
 
+		// Create and start the request on the calling thread without blocking it (ExecutionMode::EventLoop).
+		// The request is driven by the thread's event loop until finish() is called. Returns false if nothing was started.
+		bool execute();
+		// Abort and destroy the request started by execute(), must be called on the same thread
+		void finish();
+
 		quint64 requestId() const;
 		quint64 batchId() const;
 		quint64 sessionId() const;
+		Priority priority() const { return m_ePriority; }
+		// Origin (scheme://host:port) of an HTTP/2 request, which runs on the network thread of its origin. Empty = any thread
+		const QString &affinity() const { return m_strAffinity; }
 		const TaskData task() const { return m_task; }
 
+		// Requests scheduled ahead of this one when it was queued (reported in ResponseResult::Performance)
+		void setQueuePosition(quint64 uiPosition) { m_uiQueuePosition = uiPosition; }
+		// Counters the request reports its transfer progress into (behavior.showProgress), set before it is started
+		void setProgress(std::shared_ptr<TransferProgress> progress) { m_spProgress = std::move(progress); }
+		const std::shared_ptr<TransferProgress> &progress() const { return m_spProgress; }
+
+		// The request to run after retry() was emitted (retry count incremented), nullptr otherwise
+		std::unique_ptr<RequestContext> takeRetryContext();
+
 		// End event loop to release task thread, make it idle, and automatically end executing request
 		void quit();
 
+		// Turn the emit time stamped into performance.deliveryMs on the worker thread into the delivery latency,
+		// called where the result is handled
+		static void setDelivered(ResponseResult &rsp);
+
 	Q_SIGNALS:
 		void response(QSharedPointer<QtNetworkRequest::ResponseResult> spResult);
+		// The request failed and is worth another attempt after nDelayMs (behavior.retryOnFailed), emitted instead of response()
+		void retry(quint64 uiRequestId, qint64 nDelayMs);
 		void exitLoop();
 
 	private:
 		Q_DISABLE_COPY(NetworkRequestRunnable);
 		std::unique_ptr<RequestContext> m_context;
+		std::unique_ptr<RequestContext> m_retryContext;	// Copy of the request for its next attempt
+		std::unique_ptr<NetworkRequest> m_pRequest;
+		std::shared_ptr<TransferProgress> m_spProgress;
 		TaskData m_task;
+		Priority m_ePriority;
+		QString m_strAffinity;
+		quint64 m_uiQueuePosition;
+		QElapsedTimer m_queueTimer;				// Created -> executed
 		QMetaObject::Connection m_connect;
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
         mutable QRecursiveMutex m_mutex;
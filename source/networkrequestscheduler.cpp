@@ -0,0 +1,221 @@
+#include "networkrequestscheduler.h"
+#include "networkrequestrunnable.h"
+
+using namespace QtNetworkRequest;
+
+NetworkRequestScheduler::NetworkRequestScheduler()
+    : m_nBatchMembers(0), m_uiServedSeq(0)
+{
+    for (int i = 0; i < PriorityCount; ++i)
+    {
+        m_nQueued[i] = 0;
+    }
+}
+
+int NetworkRequestScheduler::priorityIndex(Priority ePriority)
+{
+    int nIndex = static_cast<int>(ePriority);
+    if (nIndex < 0 || nIndex >= PriorityCount)
+    {
+        nIndex = static_cast<int>(Priority::Normal);
+    }
+    return nIndex;
+}
+
+quint64 NetworkRequestScheduler::enqueue(std::shared_ptr<NetworkRequestRunnable> r)
+{
+    if (!r)
+        return 0;
+
+    const int nPriority = priorityIndex(r->priority());
+    quint64 uiPosition = 0;
+    for (int i = 0; i <= nPriority; ++i)
+    {
+        uiPosition += m_nQueued[i];
+    }
+
+    const quint64 uiRequestId = r->requestId();
+    m_queues[nPriority][r->sessionId()].enqueue(uiRequestId);
+    ++m_nQueued[nPriority];
+
+    PendingEntry entry;
+    entry.batchMember = r->batchId() > 0;
+    entry.runnable = std::move(r);
+    entry.priority = nPriority;
+    m_mapPending.insert(uiRequestId, entry);
+    if (entry.batchMember)
+    {
+        ++m_nBatchMembers;
+    }
+
+    return uiPosition;
+}
+
+bool NetworkRequestScheduler::pickSession(int nPriority, quint64 &uiSessionId)
+{
+    QHash<quint64, QQueue<quint64>> &queues = m_queues[nPriority];
+
+    bool bFound = false;
+    quint64 uiBestRunning = 0;
+    quint64 uiBestWeight = 1;
+    quint64 uiBestServed = 0;
+    for (auto iter = queues.begin(); iter != queues.end();)
+    {
+        QQueue<quint64> &queue = iter.value();
+        // Drop requests removed while queued
+        while (!queue.isEmpty() && !m_mapPending.contains(queue.head()))
+        {
+            queue.dequeue();
+        }
+        if (queue.isEmpty())
+        {
+            iter = queues.erase(iter);
+            continue;
+        }
+
+        const SessionState state = m_mapSessions.value(iter.key());
+        const quint64 uiRunning = state.running;
+        const quint64 uiWeight = sessionWeight(iter.key());
+        // Compare running / weight without division: a/b < c/d <=> a*d < c*b
+        bool bBetter = !bFound;
+        if (bFound)
+        {
+            const quint64 lhs = uiRunning * uiBestWeight;
+            const quint64 rhs = uiBestRunning * uiWeight;
+            bBetter = (lhs < rhs) || (lhs == rhs && state.lastServed < uiBestServed);
+        }
+        if (bBetter)
+        {
+            bFound = true;
+            uiSessionId = iter.key();
+            uiBestRunning = uiRunning;
+            uiBestWeight = uiWeight;
+            uiBestServed = state.lastServed;
+        }
+        ++iter;
+    }
+    return bFound;
+}
+
+std::shared_ptr<NetworkRequestRunnable> NetworkRequestScheduler::dequeue()
+{
+    for (int nPriority = 0; nPriority < PriorityCount; ++nPriority)
+    {
+        if (m_nQueued[nPriority] <= 0)
+            continue;
+
+        quint64 uiSessionId = 0;
+        if (!pickSession(nPriority, uiSessionId))
+            continue;
+
+        QQueue<quint64> &queue = m_queues[nPriority][uiSessionId];
+        const quint64 uiRequestId = queue.dequeue();
+        if (queue.isEmpty())
+        {
+            m_queues[nPriority].remove(uiSessionId);
+        }
+
+        PendingEntry entry = m_mapPending.take(uiRequestId);
+        --m_nQueued[nPriority];
+        if (entry.batchMember)
+        {
+            --m_nBatchMembers;
+        }
+        std::shared_ptr<NetworkRequestRunnable> r = std::move(entry.runnable);
+
+        SessionState &state = m_mapSessions[uiSessionId];
+        ++state.running;
+        state.lastServed = ++m_uiServedSeq;
+        return r;
+    }
+    return nullptr;
+}
+
+bool NetworkRequestScheduler::remove(quint64 uiRequestId)
+{
+    auto iter = m_mapPending.find(uiRequestId);
+    if (iter == m_mapPending.end())
+        return false;
+
+    // The id stays in its session queue and is dropped lazily by pickSession()
+    --m_nQueued[iter.value().priority];
+    if (iter.value().batchMember)
+    {
+        --m_nBatchMembers;
+    }
+    m_mapPending.erase(iter);
+    return true;
+}
+
+void NetworkRequestScheduler::acquire(quint64 uiSessionId)
+{
+    SessionState &state = m_mapSessions[uiSessionId];
+    ++state.running;
+    state.lastServed = ++m_uiServedSeq;
+}
+
+void NetworkRequestScheduler::release(quint64 uiSessionId)
+{
+    auto iter = m_mapSessions.find(uiSessionId);
+    if (iter == m_mapSessions.end())
+        return;
+
+    if (iter.value().running > 0)
+    {
+        --iter.value().running;
+    }
+    releaseSessionIfIdle(uiSessionId);
+}
+
+void NetworkRequestScheduler::releaseSessionIfIdle(quint64 uiSessionId)
+{
+    auto iter = m_mapSessions.find(uiSessionId);
+    if (iter == m_mapSessions.end() || iter.value().running > 0)
+        return;
+
+    for (int i = 0; i < PriorityCount; ++i)
+    {
+        if (m_queues[i].contains(uiSessionId))
+            return;
+    }
+    m_mapSessions.erase(iter);
+}
+
+void NetworkRequestScheduler::setSessionWeight(quint64 uiSessionId, quint32 uiWeight)
+{
+    if (uiWeight == 0)
+    {
+        m_mapSessionWeights.remove(uiSessionId);
+    }
+    else
+    {
+        m_mapSessionWeights.insert(uiSessionId, uiWeight);
+    }
+}
+
+quint32 NetworkRequestScheduler::sessionWeight(quint64 uiSessionId) const
+{
+    return m_mapSessionWeights.value(uiSessionId, 1);
+}
+
+int NetworkRequestScheduler::size() const
+{
+    return m_mapPending.size();
+}
+
+bool NetworkRequestScheduler::isEmpty() const
+{
+    return m_mapPending.isEmpty();
+}
+
+void NetworkRequestScheduler::clear()
+{
+    m_mapPending.clear();
+    for (int i = 0; i < PriorityCount; ++i)
+    {
+        m_queues[i].clear();
+        m_nQueued[i] = 0;
+    }
+    m_nBatchMembers = 0;
+    m_mapSessions.clear();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <memory>
+#include <QHash>
+#include <QQueue>
+#include "networkrequestdefs.h"
+
+namespace QtNetworkRequest
+{
+    class NetworkRequestRunnable;
+
+    // Decides which queued request gets the next free execution slot.
+    // - Strict priority between classes (Interactive > Normal > Bulk > Background)
+    // - Weighted fair sharing between sessions inside a class: the session using the smallest
+    //   share of slots relative to its weight goes first, so one session posting a huge batch
+    //   cannot starve the others.
+    // Not thread-safe, the owner serializes access.
+    class NetworkRequestScheduler
+    {
+    public:
+        NetworkRequestScheduler();
+
+        // Queue a runnable. Returns its queue position (requests that will be scheduled before it)
+        quint64 enqueue(std::shared_ptr<NetworkRequestRunnable> r);
+        // Take the next runnable to execute and account its slot to its session. nullptr if nothing is queued
+        std::shared_ptr<NetworkRequestRunnable> dequeue();
+        // Remove a queued runnable. Returns false if it is not queued (already dispatched or unknown)
+        bool remove(quint64 uiRequestId);
+
+        // A runnable was dispatched without being queued (e.g. synchronous requests)
+        void acquire(quint64 uiSessionId);
+        // A dispatched runnable finished, give its slot back
+        void release(quint64 uiSessionId);
+
+        // Relative share of execution slots of a session (default 1). 0 restores the default
+        void setSessionWeight(quint64 uiSessionId, quint32 uiWeight);
+        quint32 sessionWeight(quint64 uiSessionId) const;
+
+        int size() const;
+        // Queued runnables that are members of a batch
+        int batchMemberCount() const { return m_nBatchMembers; }
+        bool isEmpty() const;
+        void clear();
+
+    private:
+        struct PendingEntry
+        {
+            std::shared_ptr<NetworkRequestRunnable> runnable;
+            int priority{ 0 };
+            bool batchMember{ false };
+        };
+
+        struct SessionState
+        {
+            quint32 running{ 0 };
+            // Sequence number of the last dispatch, breaks ties in round-robin order
+            quint64 lastServed{ 0 };
+        };
+
+        static const int PriorityCount = static_cast<int>(Priority::Background) + 1;
+        static int priorityIndex(Priority ePriority);
+
+        // Pick the session of a priority class that should be served next. Drops stale (removed) ids on the way
+        bool pickSession(int nPriority, quint64 &uiSessionId);
+        void releaseSessionIfIdle(quint64 uiSessionId);
+
+    private:
+        // requestId <---> queued runnable
+        QHash<quint64, PendingEntry> m_mapPending;
+        // Per priority class: sessionId <---> queued request ids (FIFO). May contain ids already removed
+        QHash<quint64, QQueue<quint64>> m_queues[PriorityCount];
+        // Live queued request count per priority class
+        int m_nQueued[PriorityCount];
+        int m_nBatchMembers;
+
+        QHash<quint64, SessionState> m_mapSessions;
+        QHash<quint64, quint32> m_mapSessionWeights;
+        quint64 m_uiServedSeq;
+    };
+}
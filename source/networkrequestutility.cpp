@@ -9,13 +9,15 @@
 #include <QDir>
 #include <QDebug>
 #include <QFile>
+#include <QNetworkRequest>
+#include <QLocale>
+#include <random>
 #include "networkrequestdefs.h"
 
 using namespace QtNetworkRequest;
 
-std::unique_ptr<QFile> NetworkRequestUtility::createAndOpenFile(const RequestContext *context, QString &strError)
+QString NetworkRequestUtility::getNewFilePath(const RequestContext *context, QString &strError)
 {
-    std::unique_ptr<QFile> pFile;
     strError.clear();
 
     Q_ASSERT(context && nullptr != context->downloadConfig);
@@ -23,7 +25,7 @@ std::unique_ptr<QFile> NetworkRequestUtility::createAndOpenFile(const RequestCon
     const QString &saveDir = getDownloadFileSaveDir(context, strError);
     if (saveDir.isEmpty())
     {
-        return pFile;
+        return QString();
     }
 
     // Get download save filename
@@ -32,7 +34,7 @@ std::unique_ptr<QFile> NetworkRequestUtility::createAndOpenFile(const RequestCon
     {
         strError = QString("Invalid request: File name cannot be empty");
         qWarning() << strError;
-        return pFile;
+        return QString();
     }
 
     // If file exists and bReplaceFileIfExist is set, close file and remove
@@ -46,27 +48,18 @@ std::unique_ptr<QFile> NetworkRequestUtility::createAndOpenFile(const RequestCon
             {
                 strError = QString("File operation failed: Unable to remove existing file '%1' - %2").arg(strFilePath).arg(strFileErr);
                 qWarning() << strError;
-                return pFile;
+                return QString();
             }
         }
         else
         {
             strError = QString("File conflict: Target file already exists at '%1'").arg(strFilePath);
             qWarning() << strError;
-            return pFile;
+            return QString();
         }
     }
 
-    // Create and open file
-    pFile = std::make_unique<QFile>(strFilePath);
-    if (!pFile->open(QIODevice::WriteOnly))
-    {
-        strError = QString("File operation failed: Unable to open file '%1' for writing - %2").arg(strFilePath).arg(pFile->errorString());
-        qWarning() << strError;
-        pFile.reset();
-        return pFile;
-    }
-    return pFile;
+    return strFilePath;
 }
 
 bool NetworkRequestUtility::readFileContent(const QString &strFilePath, QByteArray &bytes, QString &strError)
@@ -327,3 +320,154 @@ std::unique_ptr<QFile> NetworkRequestUtility::openFile(const QString& strFilePat
     qDebug() << "[QMultiThreadNetwork]" << errMessage;
     return nullptr;
 }
+
+void NetworkRequestUtility::applyCookies(QNetworkRequest &request, const QList<QNetworkCookie> &cookies)
+{
+    // The network manager (and its cookie jar) is shared by every request of the worker thread.
+    // Keep cookies scoped to this request: never load from or save to the shared jar.
+    request.setAttribute(QNetworkRequest::CookieLoadControlAttribute, QNetworkRequest::Manual);
+    request.setAttribute(QNetworkRequest::CookieSaveControlAttribute, QNetworkRequest::Manual);
+    if (!cookies.isEmpty())
+    {
+        request.setHeader(QNetworkRequest::CookieHeader, QVariant::fromValue(cookies));
+    }
+}
+
+QMap<QByteArray, QByteArray> NetworkRequestUtility::sentHeaders(const RequestContext &context)
+{
+    QMap<QByteArray, QByteArray> headers = context.headers;
+    if (context.cookies.isEmpty())
+    {
+        return headers;
+    }
+    for (auto iter = headers.cbegin(); iter != headers.cend(); ++iter)
+    {
+        if (iter.key().compare("cookie", Qt::CaseInsensitive) == 0)
+        {
+            // A raw Cookie header replaces the cookies
+            return headers;
+        }
+    }
+    QList<QByteArray> pairs;
+    for (const QNetworkCookie &cookie : context.cookies)
+    {
+        pairs << cookie.toRawForm(QNetworkCookie::NameAndValueOnly);
+    }
+    headers.insert("Cookie", pairs.join("; "));
+    return headers;
+}
+
+void NetworkRequestUtility::applyHttp2(QNetworkRequest &request, bool bHttp2)
+{
+    // Qt 6 allows HTTP/2 by default, Qt 5 does not: always say which one is meant
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
+    request.setAttribute(QNetworkRequest::Http2AllowedAttribute, bHttp2);
+#else
+    request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, bHttp2);
+#endif
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 11, 0))
+    // Cleartext: start with the HTTP/2 preface. The h2c upgrade would carry the first request over HTTP/1.1
+    // and open more HTTP/1.1 connections for the requests issued meanwhile
+    if (bHttp2 && request.url().scheme().toLower() == "http")
+    {
+        request.setAttribute(QNetworkRequest::Http2DirectAttribute, true);
+    }
+#endif
+}
+
+std::unique_ptr<RequestContext> NetworkRequestUtility::cloneContext(const RequestContext &context)
+{
+    std::unique_ptr<RequestContext> clone = std::make_unique<RequestContext>();
+    clone->type = context.type;
+    clone->url = context.url;
+    clone->headers = context.headers;
+    clone->body = context.body;
+    clone->cookies = context.cookies;
+    clone->task = context.task;
+    clone->behavior = context.behavior;
+    clone->userContext = context.userContext;
+    if (context.downloadConfig)
+    {
+        clone->downloadConfig = std::make_unique<DownloadConfig>(*context.downloadConfig);
+    }
+    if (context.uploadConfig)
+    {
+        clone->uploadConfig = std::make_unique<UploadConfig>(*context.uploadConfig);
+    }
+    if (context.streamConfig)
+    {
+        clone->streamConfig = std::make_unique<StreamConfig>(*context.streamConfig);
+    }
+    return clone;
+}
+
+qint64 NetworkRequestUtility::retryDelay(const RetryPolicy &policy, quint16 nRetry,
+                                         QNetworkReply::NetworkError eError, int nStatusCode, const QByteArray &retryAfter)
+{
+    if (nRetry + 1 >= policy.maxAttempts)
+    {
+        return -1;
+    }
+    const bool bRetryableStatus = nStatusCode > 0 && policy.retryStatusCodes.contains(nStatusCode);
+    const bool bRetryableError = eError != QNetworkReply::NoError && policy.retryNetworkErrors.contains(eError);
+    if (!bRetryableStatus && !bRetryableError)
+    {
+        return -1;
+    }
+
+    // Exponential backoff, the shift is bounded so it cannot overflow before the cap applies
+    const qint64 nMaxDelay = qMax(0, policy.maxDelayMs);
+    qint64 nDelay = qMin<qint64>(nMaxDelay, static_cast<qint64>(qMax(0, policy.baseDelayMs)) << qMin<int>(nRetry, 30));
+    const double dJitter = qBound(0.0, policy.jitter, 1.0);
+    if (dJitter > 0 && nDelay > 0)
+    {
+        // Spread the retries of many clients failing at the same moment
+        thread_local std::mt19937 generator(std::random_device{}());
+        std::uniform_real_distribution<double> distribution(0.0, dJitter);
+        nDelay -= static_cast<qint64>(nDelay * distribution(generator));
+    }
+
+    if (policy.honorRetryAfter && (nStatusCode == 429 || nStatusCode == 503))
+    {
+        const qint64 nRetryAfter = parseRetryAfter(retryAfter);
+        if (nRetryAfter > policy.maxRetryAfterMs)
+        {
+            return -1;
+        }
+        nDelay = qMax(nDelay, nRetryAfter);
+    }
+    return nDelay;
+}
+
+qint64 NetworkRequestUtility::parseRetryAfter(const QByteArray &value)
+{
+    const QByteArray trimmed = value.trimmed();
+    if (trimmed.isEmpty())
+    {
+        return -1;
+    }
+
+    bool bOk = false;
+    const qint64 nSeconds = trimmed.toLongLong(&bOk);
+    if (bOk)
+    {
+        return nSeconds >= 0 ? nSeconds * 1000 : -1;
+    }
+
+    const QDateTime date = parseHttpDate(trimmed);
+    if (!date.isValid())
+    {
+        return -1;
+    }
+    return qMax<qint64>(0, QDateTime::currentDateTimeUtc().msecsTo(date));
+}
+
+QDateTime NetworkRequestUtility::parseHttpDate(const QByteArray &value)
+{
+    QDateTime date = QLocale::c().toDateTime(QString::fromLatin1(value.trimmed()), QStringLiteral("ddd, dd MMM yyyy HH:mm:ss 'GMT'"));
+    if (date.isValid())
+    {
+        date.setTimeSpec(Qt::UTC);
+    }
+    return date;
+}
@@ -6,14 +6,15 @@
 
 class QFile;
 class QUrl;
+class QNetworkRequest;
 
 namespace QtNetworkRequest
 {
     class NetworkRequestUtility
     {
     public:
-        // Create and open file
-        static std::unique_ptr<QFile> createAndOpenFile(const RequestContext* context, QString &errMessage);
+        // Path of a new download file. An existing file is removed if overwriteFile is set, otherwise it is an error
+        static QString getNewFilePath(const RequestContext* context, QString &errMessage);
 
         // Create shared read/write file
         static QString getFilePath(const RequestContext* context, QString &errMessage);
@@ -35,6 +36,23 @@ namespace QtNetworkRequest
 
         static const QString getRequestTypeString(const RequestType eType);
 
+        // Attach request cookies to the request itself instead of the (shared) cookie jar
+        static void applyCookies(QNetworkRequest &request, const QList<QNetworkCookie> &cookies);
+        // Raw headers the request is sent with: RequestContext::headers and the Cookie header of RequestContext::cookies
+        static QMap<QByteArray, QByteArray> sentHeaders(const RequestContext &context);
+        // Allow or forbid HTTP/2 (behavior.http2), call it after the URL is set
+        static void applyHttp2(QNetworkRequest &request, bool bHttp2);
+
+        // Copy of a request, configs included (the retry of a failed request)
+        static std::unique_ptr<RequestContext> cloneContext(const RequestContext &context);
+        // Milliseconds to wait before retry nRetry + 1 of a failed reply, -1 = not worth retrying (see RetryPolicy)
+        static qint64 retryDelay(const RetryPolicy &policy, quint16 nRetry,
+                                 QNetworkReply::NetworkError eError, int nStatusCode, const QByteArray &retryAfter);
+        // Retry-After header value (delay-seconds or HTTP-date) in milliseconds, -1 if missing or invalid
+        static qint64 parseRetryAfter(const QByteArray &value);
+        // HTTP-date (IMF-fixdate, e.g. "Wed, 21 Oct 2015 07:28:00 GMT") in UTC, invalid if it is none
+        static QDateTime parseHttpDate(const QByteArray &value);
+
     private:
         NetworkRequestUtility() {}
         virtual ~NetworkRequestUtility() {}
@@ -0,0 +1,639 @@
+#include "networkresponsecache.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <climits>
+#include "networkrequestutility.h"
+
+using namespace QtNetworkRequest;
+
+#define DEFAULT_CACHE_MEMORY_BYTES (8 * 1024 * 1024)
+#define DEFAULT_CACHE_MEMORY_ENTRY_BYTES (64 * 1024)
+#define CACHE_FILE_MAGIC 0x514E4332 // "QNC2", files of "QNC1" did not vary on the cookie
+#define CACHE_FILE_SUFFIX ".qnc"
+// Variants of one url (other cookies, other values of its Vary headers) kept side by side
+#define CACHE_MAX_VARIANTS 8
+// Heuristic freshness of a response with Last-Modified only: 10% of its age, at most a day (RFC 9111 4.2.2)
+#define CACHE_HEURISTIC_MAX_MS (24 * 3600 * 1000LL)
+
+bool CachedResponse::isFresh() const
+{
+    if (nFreshnessMs <= 0)
+    {
+        return false;
+    }
+    const qint64 nAgeMs = nInitialAgeMs + qMax<qint64>(0, QDateTime::currentMSecsSinceEpoch() - nResponseTimeMs);
+    return nAgeMs < nFreshnessMs;
+}
+
+NetworkResponseCache *NetworkResponseCache::globalInstance()
+{
+    static NetworkResponseCache s_instance;
+    return &s_instance;
+}
+
+NetworkResponseCache::NetworkResponseCache()
+    : m_nMaxMemoryEntryBytes(DEFAULT_CACHE_MEMORY_ENTRY_BYTES), m_nDiskBytes(0), m_nMaxDiskBytes(0), m_uiUseCounter(0)
+{
+    m_memory.setMaxCost(DEFAULT_CACHE_MEMORY_BYTES);
+}
+
+void NetworkResponseCache::setMemoryLimits(qint64 nMaxBytes, qint64 nMaxEntryBytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_memory.setMaxCost(static_cast<int>(qBound<qint64>(0, nMaxBytes, INT_MAX)));
+    m_nMaxMemoryEntryBytes = qMax<qint64>(0, nMaxEntryBytes);
+}
+
+bool NetworkResponseCache::setDiskCache(const QString &strDirectory, qint64 nMaxBytes)
+{
+    QStringList obsoleteFiles;
+    bool bRet = true;
+    {
+        QMutexLocker locker(&m_mutex);
+        m_strDirectory.clear();
+        m_disk.clear();
+        m_nDiskBytes = 0;
+        m_nMaxDiskBytes = qMax<qint64>(0, nMaxBytes);
+        if (!strDirectory.isEmpty() && m_nMaxDiskBytes > 0)
+        {
+            QDir dir(strDirectory);
+            if (!dir.mkpath("."))
+            {
+                qDebug() << "[QMultiThreadNetwork] Cache directory not writable:" << strDirectory;
+                bRet = false;
+            }
+            else
+            {
+                m_strDirectory = dir.absolutePath();
+                // Oldest first, they are the first to go when the budget is exceeded
+                const QFileInfoList files = dir.entryInfoList(QStringList() << QString("*%1").arg(CACHE_FILE_SUFFIX),
+                                                              QDir::Files, QDir::Time | QDir::Reversed);
+                for (const QFileInfo &fileInfo : files)
+                {
+                    std::shared_ptr<CachedResponse> meta = std::make_shared<CachedResponse>();
+                    DiskEntry entry;
+                    if (!readMeta(fileInfo.absoluteFilePath(), *meta, entry.nBodyOffset))
+                    {
+                        obsoleteFiles << fileInfo.absoluteFilePath();
+                        continue;
+                    }
+                    entry.meta = meta;
+                    entry.filePath = fileInfo.absoluteFilePath();
+                    insertDisk(meta->key, entry, obsoleteFiles);
+                }
+            }
+        }
+    }
+    for (const QString &strFile : obsoleteFiles)
+    {
+        QFile::remove(strFile);
+    }
+    return bRet;
+}
+
+std::shared_ptr<const CachedResponse> NetworkResponseCache::lookup(const QUrl &url, const QMap<QByteArray, QByteArray> &requestHeaders)
+{
+    QString key;
+    std::shared_ptr<const CachedResponse> response;
+    DiskEntry diskEntry;
+    {
+        QMutexLocker locker(&m_mutex);
+        key = findVariantLocked(cacheKey(url), requestHeaders);
+        if (key.isEmpty())
+        {
+            return nullptr;
+        }
+        if (std::shared_ptr<const CachedResponse> *pResponse = m_memory.object(key))
+        {
+            response = *pResponse;
+        }
+        else
+        {
+            auto iter = m_disk.find(key);
+            iter.value().uiLastUse = ++m_uiUseCounter;
+            diskEntry = iter.value();
+        }
+    }
+
+    if (!response)
+    {
+        // Body read without the lock, the file is replaced atomically (QSaveFile)
+        QFile file(diskEntry.filePath);
+        std::shared_ptr<CachedResponse> loaded = std::make_shared<CachedResponse>(*diskEntry.meta);
+        if (file.open(QIODevice::ReadOnly) && file.seek(diskEntry.nBodyOffset))
+        {
+            loaded->body = file.read(loaded->nBodySize);
+        }
+        if (loaded->body.size() != loaded->nBodySize)
+        {
+            qDebug() << "[QMultiThreadNetwork] Cache file unreadable:" << diskEntry.filePath;
+            QStringList obsoleteFiles;
+            {
+                QMutexLocker locker(&m_mutex);
+                auto iter = m_disk.find(key);
+                if (iter != m_disk.end() && iter.value().meta == diskEntry.meta)
+                {
+                    removeLocked(key, obsoleteFiles);
+                }
+            }
+            for (const QString &strFile : obsoleteFiles)
+            {
+                QFile::remove(strFile);
+            }
+            return nullptr;
+        }
+        response = loaded;
+    }
+    return response;
+}
+
+bool NetworkResponseCache::store(const QUrl &url, const QMap<QByteArray, QByteArray> &requestHeaders,
+                                 const QMap<QByteArray, QByteArray> &responseHeaders, const QByteArray &body)
+{
+    std::shared_ptr<CachedResponse> response = std::make_shared<CachedResponse>();
+    response->headers = responseHeaders;
+    response->body = body;
+    response->nBodySize = body.size();
+    response->nResponseTimeMs = QDateTime::currentMSecsSinceEpoch();
+    if (!describe(*response, requestHeaders, hasCredentials(url, requestHeaders)))
+    {
+        // The variant this request would get must not be served any more, the other ones stay
+        QStringList obsoleteFiles;
+        {
+            QMutexLocker locker(&m_mutex);
+            const QString key = findVariantLocked(cacheKey(url), requestHeaders);
+            if (!key.isEmpty())
+            {
+                removeLocked(key, obsoleteFiles);
+            }
+        }
+        for (const QString &strFile : obsoleteFiles)
+        {
+            QFile::remove(strFile);
+        }
+        return false;
+    }
+    response->key = variantKey(cacheKey(url), response->vary);
+    return put(response);
+}
+
+std::shared_ptr<const CachedResponse> NetworkResponseCache::refresh(const std::shared_ptr<const CachedResponse> &cached,
+                                                                    const QMap<QByteArray, QByteArray> &requestHeaders,
+                                                                    const QMap<QByteArray, QByteArray> &notModifiedHeaders)
+{
+    std::shared_ptr<CachedResponse> response = std::make_shared<CachedResponse>(*cached);
+    for (auto iter = notModifiedHeaders.cbegin(); iter != notModifiedHeaders.cend(); ++iter)
+    {
+        const QByteArray name = iter.key().toLower();
+        // The 304 describes the stored body, it does not carry one
+        if (name == "content-length" || name == "content-encoding" || name == "transfer-encoding")
+        {
+            continue;
+        }
+        for (auto it = response->headers.begin(); it != response->headers.end();)
+        {
+            it = (it.key().toLower() == name) ? response->headers.erase(it) : std::next(it);
+        }
+        response->headers.insert(iter.key(), iter.value());
+    }
+    response->nResponseTimeMs = QDateTime::currentMSecsSinceEpoch();
+
+    // The request matched the headers it varies on (lookup()), a new Vary may make it another variant
+    const bool bStorable = describe(*response, requestHeaders, hasCredentials(QUrl(urlKeyOf(cached->key)), requestHeaders));
+    response->key = variantKey(urlKeyOf(cached->key), response->vary);
+    if (!bStorable || response->key != cached->key)
+    {
+        QStringList obsoleteFiles;
+        {
+            QMutexLocker locker(&m_mutex);
+            removeLocked(cached->key, obsoleteFiles);
+        }
+        for (const QString &strFile : obsoleteFiles)
+        {
+            QFile::remove(strFile);
+        }
+    }
+    if (bStorable)
+    {
+        put(response);
+    }
+    return response;
+}
+
+void NetworkResponseCache::remove(const QUrl &url)
+{
+    QStringList obsoleteFiles;
+    {
+        QMutexLocker locker(&m_mutex);
+        const QStringList variants = m_variants.take(cacheKey(url));
+        for (const QString &key : variants)
+        {
+            dropLocked(key, obsoleteFiles);
+        }
+    }
+    for (const QString &strFile : obsoleteFiles)
+    {
+        QFile::remove(strFile);
+    }
+}
+
+void NetworkResponseCache::clear()
+{
+    QStringList obsoleteFiles;
+    {
+        QMutexLocker locker(&m_mutex);
+        m_memory.clear();
+        m_variants.clear();
+        for (const DiskEntry &entry : m_disk)
+        {
+            obsoleteFiles << entry.filePath;
+        }
+        m_disk.clear();
+        m_nDiskBytes = 0;
+    }
+    for (const QString &strFile : obsoleteFiles)
+    {
+        QFile::remove(strFile);
+    }
+}
+
+QString NetworkResponseCache::cacheKey(const QUrl &url)
+{
+    return QString::fromLatin1(url.adjusted(QUrl::RemoveFragment | QUrl::NormalizePathSegments).toEncoded());
+}
+
+bool NetworkResponseCache::put(const std::shared_ptr<CachedResponse> &response)
+{
+    qint64 nCost = response->nBodySize;
+    for (auto iter = response->headers.cbegin(); iter != response->headers.cend(); ++iter)
+    {
+        nCost += iter.key().size() + iter.value().size();
+    }
+
+    QStringList obsoleteFiles;
+    QString strFilePath;
+    bool bStored = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (nCost <= m_nMaxMemoryEntryBytes && nCost <= m_memory.maxCost())
+        {
+            removeLocked(response->key, obsoleteFiles);
+            bStored = m_memory.insert(response->key, new std::shared_ptr<const CachedResponse>(response), static_cast<int>(nCost));
+            if (bStored)
+            {
+                addVariantLocked(response->key, obsoleteFiles);
+            }
+        }
+        else if (!m_strDirectory.isEmpty() && nCost <= m_nMaxDiskBytes)
+        {
+            strFilePath = filePathOf(response->key);
+        }
+        else
+        {
+            // Too big for both tiers, an older version must not be served either
+            removeLocked(response->key, obsoleteFiles);
+        }
+    }
+
+    if (!strFilePath.isEmpty())
+    {
+        // Written without the lock, lookups keep reading the previous file until it is replaced
+        DiskEntry entry;
+        if (writeFile(*response, strFilePath, entry.nBodyOffset))
+        {
+            std::shared_ptr<CachedResponse> meta = std::make_shared<CachedResponse>(*response);
+            meta->body.clear();
+            entry.meta = meta;
+            entry.filePath = strFilePath;
+
+            QMutexLocker locker(&m_mutex);
+            insertDisk(response->key, entry, obsoleteFiles);
+            bStored = true;
+        }
+    }
+    for (const QString &strFile : obsoleteFiles)
+    {
+        QFile::remove(strFile);
+    }
+    return bStored;
+}
+
+bool NetworkResponseCache::describe(CachedResponse &response, const QMap<QByteArray, QByteArray> &requestHeaders, bool bCredentials)
+{
+    if (header(requestHeaders, "cache-control").toLower().contains("no-store"))
+    {
+        return false;
+    }
+
+    bool bNoCache = false;
+    bool bShareable = false;
+    qint64 nMaxAgeMs = -1;
+    for (const QByteArray &directive : header(response.headers, "cache-control").toLower().split(','))
+    {
+        const QByteArray trimmed = directive.trimmed();
+        // Meant for a single user, this cache serves every session
+        if (trimmed == "no-store" || trimmed.startsWith("private"))
+        {
+            return false;
+        }
+        if (trimmed == "public" || trimmed == "must-revalidate" || trimmed.startsWith("s-maxage"))
+        {
+            bShareable = true;
+        }
+        if (trimmed.startsWith("no-cache"))
+        {
+            bNoCache = true;
+        }
+        else if (trimmed.startsWith("max-age="))
+        {
+            bool bOk = false;
+            const qint64 nSeconds = trimmed.mid(8).replace('"', QByteArray()).toLongLong(&bOk);
+            nMaxAgeMs = bOk ? qMax<qint64>(0, nSeconds) * 1000 : 0;
+        }
+    }
+
+    // A response to a request with credentials is for that user unless it says otherwise (RFC 9111 3.5)
+    if (bCredentials && !bShareable)
+    {
+        return false;
+    }
+
+    response.vary.clear();
+    // Personalised by the session cookie even if the server does not say so
+    response.vary.insert("cookie", varyValue(requestHeaders, "cookie"));
+    for (const QByteArray &name : header(response.headers, "vary").split(','))
+    {
+        const QByteArray trimmed = name.trimmed().toLower();
+        if (trimmed.isEmpty())
+        {
+            continue;
+        }
+        if (trimmed == "*")
+        {
+            // Varies on things a request does not show
+            return false;
+        }
+        response.vary.insert(trimmed, varyValue(requestHeaders, trimmed));
+    }
+
+    response.etag = header(response.headers, "etag");
+    response.lastModified = header(response.headers, "last-modified");
+    response.nInitialAgeMs = qMax<qint64>(0, header(response.headers, "age").trimmed().toLongLong()) * 1000;
+
+    QDateTime date = NetworkRequestUtility::parseHttpDate(header(response.headers, "date"));
+    if (!date.isValid())
+    {
+        date = QDateTime::fromMSecsSinceEpoch(response.nResponseTimeMs, Qt::UTC);
+    }
+    const QByteArray expires = header(response.headers, "expires");
+    if (bNoCache)
+    {
+        response.nFreshnessMs = 0;
+    }
+    else if (nMaxAgeMs >= 0)
+    {
+        response.nFreshnessMs = nMaxAgeMs;
+    }
+    else if (!expires.isEmpty())
+    {
+        // An invalid date (e.g. "0") means already expired
+        const QDateTime expiresDate = NetworkRequestUtility::parseHttpDate(expires);
+        response.nFreshnessMs = expiresDate.isValid() ? qMax<qint64>(0, date.msecsTo(expiresDate)) : 0;
+    }
+    else
+    {
+        const QDateTime lastModified = NetworkRequestUtility::parseHttpDate(response.lastModified);
+        response.nFreshnessMs = lastModified.isValid() ? qBound<qint64>(0, lastModified.msecsTo(date) / 10, CACHE_HEURISTIC_MAX_MS) : 0;
+    }
+
+    // Neither fresh for a while nor revalidatable, storing it gains nothing
+    return response.nFreshnessMs > 0 || response.hasValidator();
+}
+
+bool NetworkResponseCache::hasCredentials(const QUrl &url, const QMap<QByteArray, QByteArray> &requestHeaders)
+{
+    return !url.userInfo().isEmpty() || !header(requestHeaders, "authorization").isEmpty();
+}
+
+QByteArray NetworkResponseCache::varyValue(const QMap<QByteArray, QByteArray> &requestHeaders, const QByteArray &name)
+{
+    const QByteArray value = header(requestHeaders, name);
+    if (name == "cookie" && !value.isEmpty())
+    {
+        return QCryptographicHash::hash(value, QCryptographicHash::Sha1).toHex();
+    }
+    return value;
+}
+
+bool NetworkResponseCache::matches(const CachedResponse &response, const QMap<QByteArray, QByteArray> &requestHeaders)
+{
+    for (auto iter = response.vary.cbegin(); iter != response.vary.cend(); ++iter)
+    {
+        if (varyValue(requestHeaders, iter.key()) != iter.value())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+QString NetworkResponseCache::variantKey(const QString &urlKey, const QMap<QByteArray, QByteArray> &vary)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    for (auto iter = vary.cbegin(); iter != vary.cend(); ++iter)
+    {
+        hash.addData(iter.key() + ':' + iter.value() + '\n');
+    }
+    // An encoded url has no spaces
+    return urlKey + QLatin1Char(' ') + QString::fromLatin1(hash.result().toHex());
+}
+
+QString NetworkResponseCache::urlKeyOf(const QString &key)
+{
+    return key.section(QLatin1Char(' '), 0, 0);
+}
+
+QByteArray NetworkResponseCache::header(const QMap<QByteArray, QByteArray> &headers, const QByteArray &name)
+{
+    for (auto iter = headers.cbegin(); iter != headers.cend(); ++iter)
+    {
+        if (iter.key().compare(name, Qt::CaseInsensitive) == 0)
+        {
+            return iter.value();
+        }
+    }
+    return QByteArray();
+}
+
+bool NetworkResponseCache::writeFile(const CachedResponse &response, const QString &filePath, qint64 &nBodyOffset) const
+{
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qDebug() << "[QMultiThreadNetwork] Cache file not writable:" << filePath << file.errorString();
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << quint32(CACHE_FILE_MAGIC) << response.key << response.headers << response.vary
+           << response.nResponseTimeMs << response.nInitialAgeMs << response.nFreshnessMs
+           << response.etag << response.lastModified << response.nBodySize;
+    nBodyOffset = file.pos();
+    if (stream.writeRawData(response.body.constData(), response.body.size()) != response.body.size() || !file.commit())
+    {
+        qDebug() << "[QMultiThreadNetwork] Cache file write failed:" << filePath << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool NetworkResponseCache::readMeta(const QString &filePath, CachedResponse &response, qint64 &nBodyOffset)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    quint32 uiMagic = 0;
+    stream >> uiMagic;
+    if (uiMagic != CACHE_FILE_MAGIC)
+    {
+        return false;
+    }
+    stream >> response.key >> response.headers >> response.vary
+           >> response.nResponseTimeMs >> response.nInitialAgeMs >> response.nFreshnessMs
+           >> response.etag >> response.lastModified >> response.nBodySize;
+    nBodyOffset = file.pos();
+    return stream.status() == QDataStream::Ok && file.size() == nBodyOffset + response.nBodySize;
+}
+
+QString NetworkResponseCache::filePathOf(const QString &key) const
+{
+    const QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return m_strDirectory + QLatin1Char('/') + QString::fromLatin1(hash) + QLatin1String(CACHE_FILE_SUFFIX);
+}
+
+void NetworkResponseCache::insertDisk(const QString &key, DiskEntry entry, QStringList &obsoleteFiles)
+{
+    m_memory.remove(key);
+    auto iter = m_disk.find(key);
+    if (iter != m_disk.end())
+    {
+        m_nDiskBytes -= iter.value().nBodyOffset + iter.value().meta->nBodySize;
+        if (iter.value().filePath != entry.filePath)
+        {
+            obsoleteFiles << iter.value().filePath;
+        }
+        m_disk.erase(iter);
+    }
+
+    entry.uiLastUse = ++m_uiUseCounter;
+    m_nDiskBytes += entry.nBodyOffset + entry.meta->nBodySize;
+    m_disk.insert(key, entry);
+    addVariantLocked(key, obsoleteFiles);
+
+    // Least recently used first
+    while (m_nDiskBytes > m_nMaxDiskBytes && !m_disk.isEmpty())
+    {
+        auto oldest = m_disk.begin();
+        for (auto it = m_disk.begin(); it != m_disk.end(); ++it)
+        {
+            if (it.value().uiLastUse < oldest.value().uiLastUse)
+            {
+                oldest = it;
+            }
+        }
+        const QString oldestKey = oldest.key();
+        removeLocked(oldestKey, obsoleteFiles);
+    }
+}
+
+void NetworkResponseCache::removeLocked(const QString &key, QStringList &obsoleteFiles)
+{
+    dropLocked(key, obsoleteFiles);
+    auto iter = m_variants.find(urlKeyOf(key));
+    if (iter != m_variants.end())
+    {
+        iter.value().removeAll(key);
+        if (iter.value().isEmpty())
+        {
+            m_variants.erase(iter);
+        }
+    }
+}
+
+void NetworkResponseCache::dropLocked(const QString &key, QStringList &obsoleteFiles)
+{
+    m_memory.remove(key);
+    auto iter = m_disk.find(key);
+    if (iter != m_disk.end())
+    {
+        m_nDiskBytes -= iter.value().nBodyOffset + iter.value().meta->nBodySize;
+        obsoleteFiles << iter.value().filePath;
+        m_disk.erase(iter);
+    }
+}
+
+void NetworkResponseCache::addVariantLocked(const QString &key, QStringList &obsoleteFiles)
+{
+    QStringList &variants = m_variants[urlKeyOf(key)];
+    variants.removeAll(key);
+    // Variants the memory tier evicted meanwhile do not count
+    for (auto iter = variants.begin(); iter != variants.end();)
+    {
+        iter = (m_memory.contains(*iter) || m_disk.contains(*iter)) ? std::next(iter) : variants.erase(iter);
+    }
+    variants.prepend(key);
+    while (variants.size() > CACHE_MAX_VARIANTS)
+    {
+        dropLocked(variants.takeLast(), obsoleteFiles);
+    }
+}
+
+QString NetworkResponseCache::findVariantLocked(const QString &urlKey, const QMap<QByteArray, QByteArray> &requestHeaders)
+{
+    auto iter = m_variants.find(urlKey);
+    if (iter == m_variants.end())
+    {
+        return QString();
+    }
+    QStringList &variants = iter.value();
+    QString found;
+    for (auto it = variants.begin(); it != variants.end() && found.isEmpty();)
+    {
+        std::shared_ptr<const CachedResponse> meta;
+        if (std::shared_ptr<const CachedResponse> *pResponse = m_memory.object(*it))
+        {
+            meta = *pResponse;
+        }
+        else
+        {
+            auto disk = m_disk.constFind(*it);
+            if (disk == m_disk.constEnd())
+            {
+                // Evicted from the memory tier
+                it = variants.erase(it);
+                continue;
+            }
+            meta = disk.value().meta;
+        }
+        if (matches(*meta, requestHeaders))
+        {
+            found = *it;
+        }
+        ++it;
+    }
+    if (variants.isEmpty())
+    {
+        m_variants.erase(iter);
+    }
+    return found;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <QByteArray>
+#include <QCache>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QUrl>
+#include <memory>
+
+namespace QtNetworkRequest
+{
+    /**
+     * @brief A stored GET response
+     */
+    struct CachedResponse
+    {
+        QString key;                            // Url key and fingerprint of vary (NetworkResponseCache::variantKey())
+        QMap<QByteArray, QByteArray> headers;
+        QByteArray body;                        // Empty in the index of the disk tier, loaded by lookup()
+        qint64 nBodySize{ 0 };
+        // Request header values the response varies on (Vary, and always Cookie), lower-case names.
+        // The cookie is kept as a hash, the disk tier gets no session secrets
+        QMap<QByteArray, QByteArray> vary;
+        qint64 nResponseTimeMs{ 0 };            // Milliseconds since epoch when the response was received
+        qint64 nInitialAgeMs{ 0 };              // Age header when it was received
+        qint64 nFreshnessMs{ 0 };               // Freshness lifetime, 0 = revalidate before every use
+        QByteArray etag;
+        QByteArray lastModified;
+
+        bool isFresh() const;
+        bool hasValidator() const { return !etag.isEmpty() || !lastModified.isEmpty(); }
+    };
+
+    /**
+     * @brief Process wide HTTP response cache shared by the worker threads (RequestContext::Behavior::cacheMode).
+     *
+     * Bodies up to a size limit are kept in a memory tier with least recently used eviction, larger ones in a
+     * disk tier (when a directory is set) evicted the same way. Freshness follows Cache-Control (no-store, no-cache,
+     * max-age) and Expires, with the usual heuristic on Last-Modified; stale entries are revalidated by the request
+     * with If-None-Match / If-Modified-Since.
+     *
+     * Every session and thread shares it, so it stores like a shared cache (RFC 9111 3.5): no private responses, no
+     * responses to requests with credentials unless they are marked public, s-maxage or must-revalidate. A response is
+     * only used for requests with the cookie it was received for; a url keeps a few such variants side by side.
+     */
+    class NetworkResponseCache
+    {
+    public:
+        static NetworkResponseCache *globalInstance();
+
+        /**
+         * @brief Memory tier budget
+         * @param nMaxBytes Total bytes of the memory tier, 0 disables it
+         * @param nMaxEntryBytes Larger bodies go to the disk tier
+         */
+        void setMemoryLimits(qint64 nMaxBytes, qint64 nMaxEntryBytes);
+
+        /**
+         * @brief Disk tier, the entries already in the directory are picked up
+         * @param strDirectory Cache directory, empty disables the disk tier
+         * @param nMaxBytes Total bytes of the files
+         * @return Success status
+         */
+        bool setDiskCache(const QString &strDirectory, qint64 nMaxBytes);
+
+        /**
+         * @brief Stored response for a GET (fresh or stale, see CachedResponse::isFresh()), body included
+         * @param requestHeaders Headers the request is sent with, Cookie included (NetworkRequestUtility::sentHeaders)
+         * @return nullptr if there is none matching the request headers
+         */
+        std::shared_ptr<const CachedResponse> lookup(const QUrl &url, const QMap<QByteArray, QByteArray> &requestHeaders);
+
+        /**
+         * @brief Store a 200 response to a GET if its headers allow it (replaces the variant for the same request headers)
+         * @return The response was stored
+         */
+        bool store(const QUrl &url, const QMap<QByteArray, QByteArray> &requestHeaders,
+                   const QMap<QByteArray, QByteArray> &responseHeaders, const QByteArray &body);
+
+        /**
+         * @brief A stale response was confirmed by a 304, take over its new headers and restart its freshness
+         * @param requestHeaders Headers of the revalidating request
+         * @return The refreshed response (the body of cached)
+         */
+        std::shared_ptr<const CachedResponse> refresh(const std::shared_ptr<const CachedResponse> &cached,
+                                                      const QMap<QByteArray, QByteArray> &requestHeaders,
+                                                      const QMap<QByteArray, QByteArray> &notModifiedHeaders);
+
+        // Drop every variant of a url (after a successful POST/PUT/DELETE to it)
+        void remove(const QUrl &url);
+        void clear();
+
+        static QString cacheKey(const QUrl &url);
+
+    private:
+        NetworkResponseCache();
+        NetworkResponseCache(const NetworkResponseCache &) = delete;
+        NetworkResponseCache &operator=(const NetworkResponseCache &) = delete;
+
+        struct DiskEntry
+        {
+            std::shared_ptr<const CachedResponse> meta; // Without body
+            QString filePath;
+            qint64 nBodyOffset{ 0 };
+            quint64 uiLastUse{ 0 };
+        };
+
+        // Store in the memory tier if it is small enough, otherwise in the disk tier
+        bool put(const std::shared_ptr<CachedResponse> &response);
+        // Fill freshness, validators and vary of a response, false if it must not be stored.
+        // bCredentials: the request carried Authorization or user info in its url
+        static bool describe(CachedResponse &response, const QMap<QByteArray, QByteArray> &requestHeaders, bool bCredentials);
+        static bool hasCredentials(const QUrl &url, const QMap<QByteArray, QByteArray> &requestHeaders);
+        static QByteArray header(const QMap<QByteArray, QByteArray> &headers, const QByteArray &name);
+        // Value of a request header as recorded in CachedResponse::vary
+        static QByteArray varyValue(const QMap<QByteArray, QByteArray> &requestHeaders, const QByteArray &name);
+        static bool matches(const CachedResponse &response, const QMap<QByteArray, QByteArray> &requestHeaders);
+        // Key of the variant of a url for the request header values it varies on, and the url key of a variant key
+        static QString variantKey(const QString &urlKey, const QMap<QByteArray, QByteArray> &vary);
+        static QString urlKeyOf(const QString &key);
+
+        bool writeFile(const CachedResponse &response, const QString &filePath, qint64 &nBodyOffset) const;
+        static bool readMeta(const QString &filePath, CachedResponse &response, qint64 &nBodyOffset);
+        QString filePathOf(const QString &key) const;
+        // m_mutex must be held. Returns the files to delete once it is released
+        void insertDisk(const QString &key, DiskEntry entry, QStringList &obsoleteFiles);
+        void removeLocked(const QString &key, QStringList &obsoleteFiles);
+        // Memory and disk entry of a variant, m_variants is left as it is
+        void dropLocked(const QString &key, QStringList &obsoleteFiles);
+        // Record key as the newest variant of its url, the oldest beyond CACHE_MAX_VARIANTS go
+        void addVariantLocked(const QString &key, QStringList &obsoleteFiles);
+        // Variant of the url matching the request headers, empty if there is none
+        QString findVariantLocked(const QString &urlKey, const QMap<QByteArray, QByteArray> &requestHeaders);
+
+    private:
+        QMutex m_mutex;
+        // Memory tier, the cost of an entry is its size in bytes
+        QCache<QString, std::shared_ptr<const CachedResponse>> m_memory;
+        qint64 m_nMaxMemoryEntryBytes;
+        // Disk tier
+        QString m_strDirectory;
+        QHash<QString, DiskEntry> m_disk;
+        qint64 m_nDiskBytes;
+        qint64 m_nMaxDiskBytes;
+        quint64 m_uiUseCounter;
+        // url key <---> keys of its variants, newest first. May hold variants the memory tier evicted
+        QHash<QString, QStringList> m_variants;
+    };
+}
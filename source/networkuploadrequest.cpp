@@ -6,26 +6,23 @@
 #include <QHttpPart>
 #include <QMimeDatabase>
 #include <QNetworkAccessManager>
-#include <QNetworkCookieJar>
 #include "networkrequestmanager.h"
 #include "networkrequestutility.h"
-#include "networkrequestevent.h"
+#include "networkaccessmanagerpool.h"
+#include "networkprogresstracker.h"
+#include "networkbandwidthlimiter.h"
+#include "networkredirectcache.h"
 
 using namespace QtNetworkRequest;
 
 NetworkUploadRequest::NetworkUploadRequest(QObject *parent /* = nullptr */)
 	: NetworkRequest(parent)
 {
-	m_timer.setInterval(m_mIntervalMs);
-	connect(&m_timer, &QTimer::timeout, this, [this]()
-		{
-			m_bTimeout = true;
-		});
 }
 
 NetworkUploadRequest::~NetworkUploadRequest()
 {
-	m_timer.stop();
+	m_pBody.reset();
 	// Improved destructor - ensure proper resource cleanup
 	if (m_pFile && m_pFile->isOpen())
 	{
@@ -46,25 +43,16 @@ void NetworkUploadRequest::start()
 		return;
 	}
 
-	if (nullptr == m_pNetworkManager)
-	{
-		m_pNetworkManager = new QNetworkAccessManager(this);
-		// Set timeout
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
-		m_pNetworkManager->setTransferTimeout(m_upContext->behavior.transferTimeout);
-#endif
-	}
-	m_pNetworkManager->connectToHost(url.host(), url.port());
-
-	for (QNetworkCookie& cookie : m_upContext->cookies)
-	{
-		if (m_pNetworkManager->cookieJar())
-		{
-			m_pNetworkManager->cookieJar()->insertCookie(cookie);
-		}
-	}
+	// Reuse the worker thread's network manager (keep-alive connections and TLS sessions)
+	m_pNetworkManager = NetworkAccessManagerPool::threadLocalManager();
 
 	QNetworkRequest request(url);
+	NetworkRequestUtility::applyCookies(request, m_upContext->cookies);
+	NetworkRequestUtility::applyHttp2(request, m_upContext->behavior.http2);
+	// Set timeout
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
+	request.setTransferTimeout(m_upContext->behavior.transferTimeout);
+#endif
 	request.setHeader(QNetworkRequest::ContentTypeHeader, "application/octet-stream");
 	// Let Qt automatically handle Content-Length, remove manual setting
 	// request.setHeader(QNetworkRequest::ContentLengthHeader, bytes.length());
@@ -80,12 +68,14 @@ void NetworkUploadRequest::start()
 	bool bFormData = m_upContext->uploadConfig && m_upContext->uploadConfig->useFormData && !m_upContext->uploadConfig->files.isEmpty();
 	if (!bFormData)
 	{
+		m_pBody.reset();
 		m_pFile = NetworkRequestUtility::openFile(m_upContext->uploadConfig->filePath, m_strError);
 		if (!m_pFile || !m_pFile->isOpen())
 		{
 			emit response(ToFailedResult());
 			return;
 		}
+		m_pBody = std::make_unique<NetworkThrottledDevice>(m_pFile.get(), BandwidthPath::of(*m_upContext));
 	}
 	else
 	{
@@ -158,7 +148,7 @@ void NetworkUploadRequest::start()
 			}
 			else
 			{
-				m_pNetworkReply = m_pNetworkManager->put(request, m_pFile.get());
+				m_pNetworkReply = m_pNetworkManager->put(request, m_pBody.get());
 			}
 		}
 		else
@@ -170,7 +160,7 @@ void NetworkUploadRequest::start()
 			}
 			else
 			{
-				m_pNetworkReply = m_pNetworkManager->post(request, m_pFile.get());
+				m_pNetworkReply = m_pNetworkManager->post(request, m_pBody.get());
 			}
 		}
 	}
@@ -183,27 +173,27 @@ void NetworkUploadRequest::start()
 		}
 		else
 		{
-			m_pNetworkReply = m_pNetworkManager->put(request, m_pFile.get());
+			m_pNetworkReply = m_pNetworkManager->put(request, m_pBody.get());
 		}
 	}
 
+	watchReply(m_pNetworkReply);
 	connect(m_pNetworkReply, SIGNAL(finished()), this, SLOT(onFinished()));
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
 	connect(m_pNetworkReply, SIGNAL(errorOccurred(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
 #else
 	connect(m_pNetworkReply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(onError(QNetworkReply::NetworkError)));
 #endif
-	connect(m_pNetworkManager, SIGNAL(authenticationRequired(QNetworkReply *, QAuthenticator *)),
-			SLOT(onAuthenticationRequired(QNetworkReply *, QAuthenticator *)));
-	if (m_upContext->behavior.showProgress)
+	connectAuthentication();
+	if (m_spProgress)
 	{
 		connect(m_pNetworkReply, SIGNAL(uploadProgress(qint64, qint64)), this, SLOT(onUploadProgress(qint64, qint64)));
 	}
-	m_timer.start();
 }
 
 void NetworkUploadRequest::onFinished()
 {
+	disconnectAuthentication();
 	if (!m_pNetworkReply)
 	{
 		m_strError = QString("Network error: Invalid reply");
@@ -226,7 +216,7 @@ void NetworkUploadRequest::onFinished()
 	if (!bSuccess)
 	{
 		// Handle redirection
-		if (statusCode == 301 || statusCode == 302)
+		if (statusCode == 301 || statusCode == 302 || statusCode == 307 || statusCode == 308)
 		{
 			const QVariant &redirectionTarget = m_pNetworkReply->attribute(QNetworkRequest::RedirectionTargetAttribute);
 			const QUrl &redirectUrl = url.resolved(redirectionTarget.toUrl());
@@ -234,6 +224,7 @@ void NetworkUploadRequest::onFinished()
 			{
 				qDebug() << "[NetworkUploadRequest] Redirecting from:" << url.toString()
 						 << "to:" << redirectUrl.toString();
+				NetworkRedirectCache::globalInstance()->store(url, redirectUrl, statusCode);
 				m_url = redirectUrl.toString();
 
 				// Clean up current resources
@@ -286,26 +277,16 @@ void NetworkUploadRequest::onFinished()
 
 void NetworkUploadRequest::onUploadProgress(qint64 iSent, qint64 iTotal)
 {
-	if (m_bAbortManual || !m_bTimeout || iSent <= 0 || iTotal <= 0)
+	if (m_bAbortManual || !m_spProgress || iSent <= 0)
 		return;
-	m_bTimeout = false;
 
-	int progress = iSent * 100 / iTotal;
-	if (m_nProgress < progress)
-	{
-		m_nProgress = progress;
-		NetworkProgressEvent *event = new NetworkProgressEvent;
-		event->bDownload = false;
-		event->uiId = m_upContext->task.id;
-		event->uiBatchId = m_upContext->task.batchId;
-		event->iBtyes = iSent;
-		event->iTotalBtyes = iTotal;
-		QCoreApplication::postEvent(NetworkRequestManager::globalInstance(), event);
-	}
+	// Sampled by the manager at its own rate
+	m_spProgress->set(iSent, qMax<qint64>(0, iTotal));
 }
 
 void NetworkUploadRequest::CloseFile()
 {
+	m_pBody.reset();
 	if (m_pFile)
 	{
 		if (m_pFile->isOpen())
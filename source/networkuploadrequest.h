@@ -1,7 +1,6 @@
 ﻿#pragma once
 
 #include <QObject>
-#include <QTimer>
 
 #include "networkrequest.h"
 
@@ -9,6 +8,8 @@ class QFile;
 
 namespace QtNetworkRequest
 {
+	class NetworkThrottledDevice;
+
 	// Upload request
 	class NetworkUploadRequest : public NetworkRequest
 	{
@@ -28,8 +29,7 @@ namespace QtNetworkRequest
 
 	private:
 		std::unique_ptr<QFile> m_pFile;
-		QTimer m_timer;
-		int m_mIntervalMs{ 250 };
-		bool m_bTimeout = false;
+		// m_pFile read within the upload bandwidth limits
+		std::unique_ptr<NetworkThrottledDevice> m_pBody;
 	};
 }
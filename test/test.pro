@@ -8,13 +8,15 @@ QT += core network testlib
 # Add test source files
 SOURCES += \
     main.cpp \
-    test_networkrequest.cpp
+    test_networkrequest.cpp \
+    ../benchmark/benchmarkhttpserver.cpp
 
 HEADERS += \
-    test_networkrequest.h
+    test_networkrequest.h \
+    ../benchmark/benchmarkhttpserver.h
 
-# Include network request library header file paths
-INCLUDEPATH += ../include ../source
+# Include network request library header file paths (the local HTTP server of the benchmark)
+INCLUDEPATH += ../include ../source ../benchmark
 
 CONFIG(debug, debug|release) {
         contains(TARGET_ARCH, x86_64) {
@@ -1,5 +1,6 @@
 #include "test_networkrequest.h"
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QSignalSpy>
 #include <QCoreApplication>
 #include <QThread>
@@ -17,6 +18,8 @@ void TestNetworkRequest::initTestCase()
     // Initialize network request manager
     NetworkRequestManager::initialize();
     QVERIFY(NetworkRequestManager::isInitialized());
+
+    QVERIFY(m_server.start());
 }
 
 void TestNetworkRequest::cleanupTestCase()
@@ -24,6 +27,8 @@ void TestNetworkRequest::cleanupTestCase()
     // Clean up network request manager
     NetworkRequestManager::unInitialize();
     QVERIFY(!NetworkRequestManager::isInitialized());
+
+    m_server.stop();
 }
 
 bool TestNetworkRequest::waitForFinished(std::shared_ptr<NetworkReply> reply, int timeoutMs)
@@ -42,6 +47,56 @@ bool TestNetworkRequest::waitForFinished(std::shared_ptr<NetworkReply> reply, in
     return !spy.isEmpty();
 }
 
+QSharedPointer<ResponseResult> TestNetworkRequest::takeResult(QSignalSpy &spy, int timeoutMs)
+{
+    if (spy.isEmpty() && !spy.wait(timeoutMs))
+    {
+        return nullptr;
+    }
+    return spy.takeFirst().first().value<QSharedPointer<ResponseResult>>();
+}
+
+QSharedPointer<ResponseResult> TestNetworkRequest::resumableDownload(RequestType type, const QUrl &url, const QString &strFilePath, bool bStop)
+{
+    NetworkRequestManager *pManager = NetworkRequestManager::globalInstance();
+    const quint64 uiSessionId = pManager->nextSessionId();
+    std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+    req->url = url.toString();
+    req->type = type;
+    req->task.sessionId = uiSessionId;
+    req->behavior.showProgress = true;
+    if (bStop)
+    {
+        req->behavior.maxDownloadBytesPerSec = 256 * 1024;
+    }
+    req->downloadConfig = std::make_unique<DownloadConfig>();
+    req->downloadConfig->saveDir = QFileInfo(strFilePath).absolutePath();
+    req->downloadConfig->saveFileName = QFileInfo(strFilePath).fileName();
+    req->downloadConfig->overwriteFile = true;
+    req->downloadConfig->resumable = true;
+    req->downloadConfig->threadCount = 4;
+    req->downloadConfig->minSegmentSize = 64 * 1024;
+    req->downloadConfig->minMultiThreadSize = 0;
+    std::shared_ptr<NetworkReply> reply = pManager->postRequest(std::move(req));
+    if (!reply)
+    {
+        return QSharedPointer<ResponseResult>();
+    }
+    QSignalSpy spy(reply.get(), &NetworkReply::requestFinished);
+    if (bStop)
+    {
+        std::shared_ptr<bool> spStopped = std::make_shared<bool>(false);
+        QObject::connect(reply.get(), &NetworkReply::downloadProgress, [pManager, uiSessionId, spStopped](qint64 nBytes, qint64 nTotal) {
+            if (!*spStopped && nTotal > 0 && nBytes >= nTotal / 4)
+            {
+                *spStopped = true;
+                pManager->stopSessionRequest(uiSessionId);
+            }
+        });
+    }
+    return takeResult(spy, 20000);
+}
+
 void TestNetworkRequest::testGetRequest()
 {
     // Test GET request
@@ -262,4 +317,665 @@ void TestNetworkRequest::testContentType()
 
     // Wait for request to complete
     QVERIFY(waitForFinished(reply, 10000));
-}
\ No newline at end of file
+}
+
+void TestNetworkRequest::testRetryAfter()
+{
+    // The first attempt gets a 503 asking to wait one second
+    const QUrl url = m_server.url("/bytes/64?fail=1&retryafter=1&tag=retry");
+    std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+    req->url = url.toString();
+    req->type = RequestType::Get;
+    req->behavior.retryOnFailed = true;
+    req->behavior.retry.baseDelayMs = 10;
+    req->behavior.retry.jitter = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+    std::shared_ptr<NetworkReply> reply = NetworkRequestManager::globalInstance()->postRequest(std::move(req));
+    QVERIFY(reply != nullptr);
+    QSignalSpy spy(reply.get(), &NetworkReply::requestFinished);
+
+    QSharedPointer<ResponseResult> rsp = takeResult(spy);
+    QVERIFY(rsp);
+    QVERIFY(rsp->success);
+    QCOMPARE(rsp->body.size(), 64);
+    QCOMPARE(rsp->task.retryCount, quint16(1));
+    // Retry-After outweighs the backoff delay
+    QVERIFY(timer.elapsed() >= 1000);
+    QCOMPARE(m_server.hitCount(url), 2);
+}
+
+void TestNetworkRequest::testSyncRetryStopped()
+{
+    // Every attempt fails, the stop comes while the retry waits for its delay
+    std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+    req->url = m_server.url("/bytes/64?fail=100&retryafter=1&tag=syncstop").toString();
+    req->type = RequestType::Get;
+    req->behavior.retryOnFailed = true;
+
+    QTimer::singleShot(300, []() { NetworkRequestManager::globalInstance()->stopAllRequest(); });
+    QSharedPointer<ResponseResult> rsp;
+    QVERIFY(NetworkRequestManager::globalInstance()->sendRequest(std::move(req),
+                                                                 [&rsp](QSharedPointer<ResponseResult> result) { rsp = result; }));
+    QVERIFY(rsp);
+    QVERIFY(!rsp->success);
+    QVERIFY(rsp->cancelled);
+}
+
+void TestNetworkRequest::testCacheRevalidation()
+{
+    // Stored with an ETag and no-cache: the second request is revalidated and answered with a 304
+    const QUrl url = m_server.url("/bytes/256?etag=v1&tag=revalidate");
+    QList<QSharedPointer<ResponseResult>> results;
+    for (int i = 0; i < 2; ++i)
+    {
+        std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+        req->url = url.toString();
+        req->type = RequestType::Get;
+        req->behavior.cacheMode = CacheMode::PreferCache;
+        std::shared_ptr<NetworkReply> reply = NetworkRequestManager::globalInstance()->postRequest(std::move(req));
+        QVERIFY(reply != nullptr);
+        QSignalSpy spy(reply.get(), &NetworkReply::requestFinished);
+        QSharedPointer<ResponseResult> rsp = takeResult(spy);
+        QVERIFY(rsp);
+        QVERIFY(rsp->success);
+        results << rsp;
+    }
+    QCOMPARE(results[0]->cacheStatus, CacheStatus::Miss);
+    QCOMPARE(results[1]->cacheStatus, CacheStatus::Revalidated);
+    QCOMPARE(results[1]->body.size(), 256);
+    QCOMPARE(results[1]->body, results[0]->body);
+    QCOMPARE(m_server.hitCount(url), 2);
+
+    // Not used for a request with other cookies
+    std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+    req->url = url.toString();
+    req->type = RequestType::Get;
+    req->behavior.cacheMode = CacheMode::CacheOnly;
+    req->cookies << QNetworkCookie("session", "other");
+    std::shared_ptr<NetworkReply> reply = NetworkRequestManager::globalInstance()->postRequest(std::move(req));
+    QVERIFY(reply != nullptr);
+    QSignalSpy spy(reply.get(), &NetworkReply::requestFinished);
+    QSharedPointer<ResponseResult> rsp = takeResult(spy);
+    QVERIFY(rsp);
+    QVERIFY(!rsp->success);
+    QCOMPARE(m_server.hitCount(url), 2);
+
+    // The response for the other cookie is stored next to the first one, neither evicts the other
+    auto get = [&](const QString &strCookie, CacheMode eMode) {
+        std::unique_ptr<RequestContext> request = std::make_unique<RequestContext>();
+        request->url = url.toString();
+        request->type = RequestType::Get;
+        request->behavior.cacheMode = eMode;
+        if (!strCookie.isEmpty())
+        {
+            request->cookies << QNetworkCookie("session", strCookie.toUtf8());
+        }
+        std::shared_ptr<NetworkReply> pReply = NetworkRequestManager::globalInstance()->postRequest(std::move(request));
+        if (!pReply)
+        {
+            return QSharedPointer<ResponseResult>();
+        }
+        QSignalSpy finished(pReply.get(), &NetworkReply::requestFinished);
+        return takeResult(finished);
+    };
+    rsp = get("other", CacheMode::PreferCache);
+    QVERIFY(rsp);
+    QVERIFY(rsp->success);
+    QCOMPARE(rsp->cacheStatus, CacheStatus::Miss);
+    QCOMPARE(m_server.hitCount(url), 3);
+    for (const QString &strCookie : { QString(), QString("other") })
+    {
+        rsp = get(strCookie, CacheMode::CacheOnly);
+        QVERIFY(rsp);
+        QVERIFY2(rsp->success, qPrintable(strCookie));
+        QCOMPARE(rsp->cacheStatus, CacheStatus::Hit);
+        QCOMPARE(rsp->body, results[0]->body);
+    }
+    QCOMPARE(m_server.hitCount(url), 3);
+}
+
+void TestNetworkRequest::testCoalesce()
+{
+    // The second request is posted while the first waits for its answer
+    const QUrl url = m_server.url("/bytes/128?delay=300&tag=coalesce");
+    QList<std::shared_ptr<NetworkReply>> replies;
+    for (quint64 uiUser = 0; uiUser < 2; ++uiUser)
+    {
+        std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+        req->url = url.toString();
+        req->type = RequestType::Get;
+        req->behavior.coalesce = true;
+        req->userContext = uiUser;
+        replies << NetworkRequestManager::globalInstance()->postRequest(std::move(req));
+        QVERIFY(replies.last() != nullptr);
+    }
+    QSignalSpy spy0(replies[0].get(), &NetworkReply::requestFinished);
+    QSignalSpy spy1(replies[1].get(), &NetworkReply::requestFinished);
+    QSharedPointer<ResponseResult> rsp0 = takeResult(spy0);
+    QSharedPointer<ResponseResult> rsp1 = takeResult(spy1);
+    QVERIFY(rsp0 && rsp1);
+    QVERIFY(rsp0->success && rsp1->success);
+    QCOMPARE(rsp1->body, rsp0->body);
+    QVERIFY(rsp1->task.id != rsp0->task.id);
+    QCOMPARE(rsp1->userContext.toULongLong(), 1ull);
+    QCOMPARE(m_server.hitCount(url), 1);
+}
+
+void TestNetworkRequest::testCoalesceCookies()
+{
+    // Same request for two users: each one goes to the server
+    const QUrl url = m_server.url("/bytes/128?delay=300&tag=coalescecookies");
+    QList<std::shared_ptr<NetworkReply>> replies;
+    for (const QByteArray &session : { QByteArray("alice"), QByteArray("bob") })
+    {
+        std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+        req->url = url.toString();
+        req->type = RequestType::Get;
+        req->behavior.coalesce = true;
+        req->cookies << QNetworkCookie("session", session);
+        replies << NetworkRequestManager::globalInstance()->postRequest(std::move(req));
+        QVERIFY(replies.last() != nullptr);
+    }
+    QSignalSpy spy0(replies[0].get(), &NetworkReply::requestFinished);
+    QSignalSpy spy1(replies[1].get(), &NetworkReply::requestFinished);
+    QSharedPointer<ResponseResult> rsp0 = takeResult(spy0);
+    QSharedPointer<ResponseResult> rsp1 = takeResult(spy1);
+    QVERIFY(rsp0 && rsp1);
+    QVERIFY(rsp0->success && rsp1->success);
+    QCOMPARE(m_server.hitCount(url), 2);
+}
+
+void TestNetworkRequest::testStopRequestsFilter()
+{
+    NetworkRequestManager *pManager = NetworkRequestManager::globalInstance();
+    const quint64 uiSessionId = pManager->nextSessionId();
+    // Answered after a second, still in flight when they are stopped
+    auto post = [&](const QString &strPath, quint64 uiSession) {
+        std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+        req->url = m_server.url(strPath).toString();
+        req->type = RequestType::Get;
+        req->task.sessionId = uiSession;
+        return pManager->postRequest(std::move(req));
+    };
+    QList<std::shared_ptr<NetworkReply>> session;
+    for (int i = 0; i < 3; ++i)
+    {
+        session << post(QString("/bytes/32?delay=1000&tag=stopsession%1").arg(i), uiSessionId);
+    }
+    std::shared_ptr<NetworkReply> prefixed = post("/bytes/48?delay=1000&tag=stopprefix", 0);
+    std::shared_ptr<NetworkReply> other = post("/bytes/64?delay=1000&tag=stopother", 0);
+
+    QList<std::shared_ptr<QSignalSpy>> sessionSpies;
+    for (const std::shared_ptr<NetworkReply> &reply : session)
+    {
+        QVERIFY(reply != nullptr);
+        sessionSpies << std::make_shared<QSignalSpy>(reply.get(), &NetworkReply::requestFinished);
+    }
+    QVERIFY(prefixed && other);
+    QSignalSpy prefixedSpy(prefixed.get(), &NetworkReply::requestFinished);
+    QSignalSpy otherSpy(other.get(), &NetworkReply::requestFinished);
+
+    RequestFilter bySession;
+    bySession.sessionId = uiSessionId;
+    QCOMPARE(pManager->stopRequests(bySession), 3);
+    RequestFilter byPrefix;
+    byPrefix.urlPrefix = m_server.url("/bytes/48").toString();
+    byPrefix.types << RequestType::Get;
+    QCOMPARE(pManager->stopRequests(byPrefix), 1);
+    // Nothing left to match
+    QCOMPARE(pManager->stopRequests(bySession), 0);
+
+    for (const std::shared_ptr<QSignalSpy> &spy : sessionSpies)
+    {
+        QSharedPointer<ResponseResult> rsp = takeResult(*spy, 0);
+        QVERIFY(rsp);
+        QVERIFY(rsp->cancelled);
+    }
+    QSharedPointer<ResponseResult> rsp = takeResult(prefixedSpy, 0);
+    QVERIFY(rsp);
+    QVERIFY(rsp->cancelled);
+
+    // Not matched, it goes on
+    rsp = takeResult(otherSpy);
+    QVERIFY(rsp);
+    QVERIFY(rsp->success);
+    QCOMPARE(rsp->body.size(), 64);
+}
+
+void TestNetworkRequest::testBatchLargerThanThreads()
+{
+    NetworkRequestManager *pManager = NetworkRequestManager::globalInstance();
+    const int nThreads = pManager->maxThreadCount();
+    // One member at a time, the batch is fed as its members finish
+    QVERIFY(pManager->setMaxThreadCount(1));
+
+    const int nMembers = 6;
+    const qint64 nSize = 4096;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    BatchRequestPtrTasks tasks;
+    for (int i = 0; i < nMembers; ++i)
+    {
+        std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+        req->url = m_server.url(QString("/bytes/%1?tag=batch%2").arg(nSize).arg(i)).toString();
+        req->type = RequestType::Download;
+        req->behavior.showProgress = true;
+        req->downloadConfig = std::make_unique<DownloadConfig>();
+        req->downloadConfig->saveDir = dir.path();
+        req->downloadConfig->saveFileName = QString("member%1.bin").arg(i);
+        req->downloadConfig->overwriteFile = true;
+        req->downloadConfig->threadCount = 1;
+        tasks.push_back(std::move(req));
+    }
+
+    QSignalSpy summarySpy(pManager, &NetworkRequestManager::batchRequestSummary);
+    quint64 uiBatchId = 0;
+    std::shared_ptr<NetworkReply> reply = pManager->postBatchRequest(std::move(tasks), uiBatchId);
+    QVERIFY(reply != nullptr);
+    QSignalSpy finishedSpy(reply.get(), &NetworkReply::requestFinished);
+    QList<qint64> progress;
+    QObject::connect(reply.get(), &NetworkReply::batchDownloadProgress, [&progress](qint64 nBytes) { progress << nBytes; });
+
+    const bool bFinished = summarySpy.wait(20000);
+    pManager->setMaxThreadCount(nThreads);
+    QVERIFY(bFinished);
+
+    QCOMPARE(finishedSpy.count(), nMembers);
+    for (const QList<QVariant> &arguments : finishedSpy)
+    {
+        QVERIFY(arguments.first().value<QSharedPointer<ResponseResult>>()->success);
+    }
+    const BatchSummary summary = summarySpy.takeFirst().first().value<BatchSummary>();
+    QCOMPARE(summary.batchId, uiBatchId);
+    QCOMPARE(summary.total, quint64(nMembers));
+    QCOMPARE(summary.succeeded, quint64(nMembers));
+    QCOMPARE(summary.failed, quint64(0));
+    QCOMPARE(summary.cancelled, quint64(0));
+    QCOMPARE(summary.payloadBytesReceived, nMembers * nSize);
+
+    // The batch total grows across members instead of starting over with each one
+    QVERIFY(!progress.isEmpty());
+    for (int i = 1; i < progress.size(); ++i)
+    {
+        QVERIFY(progress.at(i) >= progress.at(i - 1));
+    }
+    QCOMPARE(progress.last(), nMembers * nSize);
+}
+
+void TestNetworkRequest::testDownloadWithoutRanges()
+{
+    const qint64 nSize = 256 * 1024;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    // Four channels asked for, from a server with ranges and from one that ignores them (with and without a size)
+    auto download = [&](const QUrl &url, const QString &strFileName) {
+        std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+        req->url = url.toString();
+        req->type = RequestType::MTDownload;
+        req->downloadConfig = std::make_unique<DownloadConfig>();
+        req->downloadConfig->saveDir = dir.path();
+        req->downloadConfig->saveFileName = strFileName;
+        req->downloadConfig->overwriteFile = true;
+        req->downloadConfig->threadCount = 4;
+        req->downloadConfig->minSegmentSize = 16 * 1024;
+        req->downloadConfig->minMultiThreadSize = 0;
+        std::shared_ptr<NetworkReply> reply = NetworkRequestManager::globalInstance()->postRequest(std::move(req));
+        if (!reply)
+        {
+            return QSharedPointer<ResponseResult>();
+        }
+        QSignalSpy spy(reply.get(), &NetworkReply::requestFinished);
+        return takeResult(spy, 20000);
+    };
+
+    const QUrl rangesUrl = m_server.url(QString("/bytes/%1?tag=ranges").arg(nSize));
+    QSharedPointer<ResponseResult> rsp = download(rangesUrl, "ranges.bin");
+    QVERIFY(rsp);
+    QVERIFY2(rsp->success, qPrintable(rsp->errorMessage));
+    QCOMPARE(rsp->downloadStrategy, DownloadStrategy::MultiThread);
+
+    const QUrl noRangeUrl = m_server.url(QString("/bytes/%1?norange=1&tag=norange").arg(nSize));
+    rsp = download(noRangeUrl, "norange.bin");
+    QVERIFY(rsp);
+    QVERIFY2(rsp->success, qPrintable(rsp->errorMessage));
+    QCOMPARE(rsp->downloadStrategy, DownloadStrategy::SingleStream);
+    // The probe got the whole file and carried on as the single stream
+    QCOMPARE(m_server.hitCount(noRangeUrl), 1);
+
+    // Chunked without a Content-Length: the size is only known at the end of the stream
+    const QUrl chunkedUrl = m_server.url(QString("/bytes/%1?norange=1&chunked=1&tag=chunked").arg(nSize));
+    rsp = download(chunkedUrl, "chunked.bin");
+    QVERIFY(rsp);
+    QVERIFY2(rsp->success, qPrintable(rsp->errorMessage));
+    QCOMPARE(rsp->downloadStrategy, DownloadStrategy::SingleStream);
+    QCOMPARE(m_server.hitCount(chunkedUrl), 1);
+
+    QFile ranges(dir.filePath("ranges.bin"));
+    QFile noRange(dir.filePath("norange.bin"));
+    QFile chunked(dir.filePath("chunked.bin"));
+    QVERIFY(ranges.open(QIODevice::ReadOnly));
+    QVERIFY(noRange.open(QIODevice::ReadOnly));
+    QVERIFY(chunked.open(QIODevice::ReadOnly));
+    QCOMPARE(noRange.size(), nSize);
+    QCOMPARE(chunked.size(), nSize);
+    const QByteArray expected = ranges.readAll();
+    QCOMPARE(noRange.readAll(), expected);
+    QCOMPARE(chunked.readAll(), expected);
+}
+
+void TestNetworkRequest::testResumeDownload()
+{
+    const qint64 nSize = 2 * 1024 * 1024;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QByteArray expected = BenchmarkHttpServer::payload(nSize);
+    // Stopped midway, then requested again: only the missing bytes are downloaded
+    for (RequestType type : { RequestType::MTDownload, RequestType::Download })
+    {
+        const QString strName = (type == RequestType::MTDownload) ? "mt" : "single";
+        const QUrl url = m_server.url(QString("/bytes/%1?etag=v1&tag=resume%2").arg(nSize).arg(strName));
+        const QString strFilePath = dir.filePath(strName + ".bin");
+
+        QSharedPointer<ResponseResult> rsp = resumableDownload(type, url, strFilePath, true);
+        QVERIFY(rsp);
+        QVERIFY2(rsp->cancelled, qPrintable(strName));
+        QVERIFY(!QFile::exists(strFilePath));
+        QVERIFY(QFile::exists(strFilePath + ".download"));
+
+        rsp = resumableDownload(type, url, strFilePath, false);
+        QVERIFY(rsp);
+        QVERIFY2(rsp->success, qPrintable(rsp->errorMessage));
+        QVERIFY2(rsp->performance.payloadBytesReceived > 0 && rsp->performance.payloadBytesReceived < nSize, qPrintable(strName));
+        QVERIFY(!QFile::exists(strFilePath + ".download"));
+
+        QFile file(strFilePath);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QCOMPARE(file.size(), nSize);
+        QVERIFY2(file.readAll() == expected, qPrintable(strName));
+    }
+}
+
+void TestNetworkRequest::testResumeChangedFile()
+{
+    const qint64 nSize = 2 * 1024 * 1024;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    // The ETag changes after the first request: the If-Range of the resumed request does not match, the whole file comes with a 200
+    const QUrl url = m_server.url(QString("/bytes/%1?etag=v1&changeafter=1&tag=resumechanged").arg(nSize));
+    const QString strFilePath = dir.filePath("changed.bin");
+
+    QSharedPointer<ResponseResult> rsp = resumableDownload(RequestType::Download, url, strFilePath, true);
+    QVERIFY(rsp);
+    QVERIFY(rsp->cancelled);
+    QVERIFY(QFileInfo(strFilePath + ".download").size() > 0);
+
+    rsp = resumableDownload(RequestType::Download, url, strFilePath, false);
+    QVERIFY(rsp);
+    QVERIFY2(rsp->success, qPrintable(rsp->errorMessage));
+    // Started over from the first byte
+    QCOMPARE(rsp->performance.payloadBytesReceived, nSize);
+    QCOMPARE(m_server.hitCount(url), 2);
+
+    QFile file(strFilePath);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.size(), nSize);
+    QVERIFY(file.readAll() == BenchmarkHttpServer::payload(nSize));
+}
+
+void TestNetworkRequest::testWorkStealing()
+{
+    const qint64 nSize = 2 * 1024 * 1024;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    // Two parts of 1 MB, the second one is answered two seconds late: the first part takes over most of its range meanwhile
+    const QUrl url = m_server.url(QString("/bytes/%1?delay=2000&delayfrom=%2&tag=steal").arg(nSize).arg(nSize / 2));
+    std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+    req->url = url.toString();
+    req->type = RequestType::MTDownload;
+    req->downloadConfig = std::make_unique<DownloadConfig>();
+    req->downloadConfig->saveDir = dir.path();
+    req->downloadConfig->saveFileName = "steal.bin";
+    req->downloadConfig->overwriteFile = true;
+    req->downloadConfig->threadCount = 2;
+    req->downloadConfig->minSegmentSize = 64 * 1024;
+    req->downloadConfig->minMultiThreadSize = 0;
+    std::shared_ptr<NetworkReply> reply = NetworkRequestManager::globalInstance()->postRequest(std::move(req));
+    QVERIFY(reply != nullptr);
+    QSignalSpy spy(reply.get(), &NetworkReply::requestFinished);
+
+    QSharedPointer<ResponseResult> rsp = takeResult(spy, 20000);
+    QVERIFY(rsp);
+    QVERIFY2(rsp->success, qPrintable(rsp->errorMessage));
+    QCOMPARE(rsp->downloadStrategy, DownloadStrategy::MultiThread);
+    QCOMPARE(rsp->performance.segments.size(), 2);
+    const SegmentPerformance &first = rsp->performance.segments.at(0);
+    const SegmentPerformance &second = rsp->performance.segments.at(1);
+    QCOMPARE(first.bytes + second.bytes, nSize);
+    // The late part only wrote what was left of its shrunk range
+    QVERIFY(first.bytes > nSize / 2 + nSize / 4);
+    QVERIFY(second.bytes < nSize / 4);
+
+    QFile file(dir.filePath("steal.bin"));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.size(), nSize);
+    QVERIFY(file.readAll() == BenchmarkHttpServer::payload(nSize));
+}
+
+void TestNetworkRequest::testStorageBackends()
+{
+    // Not a multiple of the page or block size: unaligned heads and tails of the parts go through every backend
+    const qint64 nSize = 3 * 1024 * 1024 + 123;
+    const QByteArray expected = BenchmarkHttpServer::payload(nSize);
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QList<QPair<StorageBackend, QString>> backends = {
+        { StorageBackend::PositionalWrite, "positional" },
+        { StorageBackend::DirectIO, "directio" },
+        { StorageBackend::WindowedMemoryMapped, "windowed" },
+        { StorageBackend::MemoryMapped, "mapped" },
+    };
+    for (const QPair<StorageBackend, QString> &backend : backends)
+    {
+        for (RequestType type : { RequestType::MTDownload, RequestType::Download })
+        {
+            const QString strFileName = QString("%1-%2.bin").arg(backend.second).arg(type == RequestType::MTDownload ? "mt" : "single");
+            std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+            req->url = m_server.url(QString("/bytes/%1?tag=%2").arg(nSize).arg(strFileName)).toString();
+            req->type = type;
+            req->downloadConfig = std::make_unique<DownloadConfig>();
+            req->downloadConfig->saveDir = dir.path();
+            req->downloadConfig->saveFileName = strFileName;
+            req->downloadConfig->overwriteFile = true;
+            req->downloadConfig->threadCount = 4;
+            req->downloadConfig->minSegmentSize = 64 * 1024;
+            req->downloadConfig->minMultiThreadSize = 0;
+            req->downloadConfig->storageBackend = backend.first;
+            std::shared_ptr<NetworkReply> reply = NetworkRequestManager::globalInstance()->postRequest(std::move(req));
+            QVERIFY(reply != nullptr);
+            QSignalSpy spy(reply.get(), &NetworkReply::requestFinished);
+
+            QSharedPointer<ResponseResult> rsp = takeResult(spy, 20000);
+            QVERIFY2(rsp, qPrintable(strFileName));
+            QVERIFY2(rsp->success, qPrintable(strFileName + ": " + rsp->errorMessage));
+
+            QFile file(dir.filePath(strFileName));
+            QVERIFY2(file.open(QIODevice::ReadOnly), qPrintable(strFileName));
+            QCOMPARE(file.size(), nSize);
+            QVERIFY2(file.readAll() == expected, qPrintable(strFileName));
+        }
+    }
+}
+
+void TestNetworkRequest::testStreamSinks()
+{
+    const qint64 nSize = 1024 * 1024 + 17;
+    const QByteArray expected = BenchmarkHttpServer::payload(nSize);
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    auto get = [&](const QString &strTag, std::unique_ptr<StreamConfig> config) {
+        std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+        req->url = m_server.url(QString("/bytes/%1?chunked=1&tag=%2").arg(nSize).arg(strTag)).toString();
+        req->type = RequestType::Get;
+        req->streamConfig = std::move(config);
+        std::shared_ptr<NetworkReply> reply = NetworkRequestManager::globalInstance()->postRequest(std::move(req));
+        if (!reply)
+        {
+            return QSharedPointer<ResponseResult>();
+        }
+        QSignalSpy spy(reply.get(), &NetworkReply::requestFinished);
+        return takeResult(spy);
+    };
+
+    // Handed to the callback chunk by chunk (on the worker thread, the result is emitted after the last chunk)
+    std::shared_ptr<QByteArray> spReceived = std::make_shared<QByteArray>();
+    std::shared_ptr<int> spChunks = std::make_shared<int>(0);
+    std::unique_ptr<StreamConfig> config = std::make_unique<StreamConfig>();
+    config->readBufferSize = 64 * 1024;
+    config->onData = [spReceived, spChunks](const char *data, qint64 size) {
+        spReceived->append(data, static_cast<int>(size));
+        ++*spChunks;
+        return true;
+    };
+    QSharedPointer<ResponseResult> rsp = get("streamcallback", std::move(config));
+    QVERIFY(rsp);
+    QVERIFY2(rsp->success, qPrintable(rsp->errorMessage));
+    QVERIFY(rsp->body.isEmpty());
+    QVERIFY(*spChunks > 1);
+    QVERIFY(*spReceived == expected);
+
+    // Written to a device
+    QFile file(dir.filePath("stream.bin"));
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    config = std::make_unique<StreamConfig>();
+    config->device = &file;
+    rsp = get("streamdevice", std::move(config));
+    QVERIFY(rsp);
+    QVERIFY2(rsp->success, qPrintable(rsp->errorMessage));
+    QVERIFY(rsp->body.isEmpty());
+    file.close();
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.size(), nSize);
+    QVERIFY(file.readAll() == expected);
+
+    // The callback stops the request after the first chunk
+    std::shared_ptr<qint64> spBytes = std::make_shared<qint64>(0);
+    config = std::make_unique<StreamConfig>();
+    config->onData = [spBytes](const char *, qint64 size) {
+        *spBytes += size;
+        return false;
+    };
+    rsp = get("streamabort", std::move(config));
+    QVERIFY(rsp);
+    QVERIFY(!rsp->success);
+    QVERIFY(rsp->errorMessage.contains("Aborted by the data handler"));
+    QVERIFY(*spBytes > 0 && *spBytes < nSize);
+}
+
+void TestNetworkRequest::testBandwidthLimits()
+{
+    NetworkRequestManager *pManager = NetworkRequestManager::globalInstance();
+    const qint64 nSize = 512 * 1024;
+    const qint64 nRate = 256 * 1024;
+    const QByteArray expected = BenchmarkHttpServer::payload(nSize);
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    auto post = [&](RequestType type, const QString &strName, quint64 uiSessionId, qint64 nRequestRate) {
+        std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+        req->url = m_server.url(QString("/bytes/%1?tag=%2").arg(nSize).arg(strName)).toString();
+        req->type = type;
+        req->task.sessionId = uiSessionId;
+        req->behavior.maxDownloadBytesPerSec = nRequestRate;
+        req->downloadConfig = std::make_unique<DownloadConfig>();
+        req->downloadConfig->saveDir = dir.path();
+        req->downloadConfig->saveFileName = strName + ".bin";
+        req->downloadConfig->overwriteFile = true;
+        req->downloadConfig->threadCount = 4;
+        req->downloadConfig->minSegmentSize = 64 * 1024;
+        req->downloadConfig->minMultiThreadSize = 0;
+        return pManager->postRequest(std::move(req));
+    };
+    auto verifyFile = [&](const QString &strName) {
+        QFile file(dir.filePath(strName + ".bin"));
+        return file.open(QIODevice::ReadOnly) && file.readAll() == expected;
+    };
+
+    // Request limit: the parts of a multi-threaded download share it. Apart from the burst allowance (1/8 s of the
+    // rate) 512 KB at 256 KB/s take two seconds
+    QElapsedTimer timer;
+    timer.start();
+    std::shared_ptr<NetworkReply> reply = post(RequestType::MTDownload, "ratelimitrequest", 0, nRate);
+    QVERIFY(reply != nullptr);
+    QSignalSpy spy(reply.get(), &NetworkReply::requestFinished);
+    QSharedPointer<ResponseResult> rsp = takeResult(spy, 20000);
+    QVERIFY(rsp);
+    QVERIFY2(rsp->success, qPrintable(rsp->errorMessage));
+    QVERIFY2(timer.elapsed() >= 1500, qPrintable(QString::number(timer.elapsed())));
+    QVERIFY(verifyFile("ratelimitrequest"));
+
+    // Session limit: two downloads of the session share it, 1 MB in total
+    const quint64 uiSessionId = pManager->nextSessionId();
+    pManager->setBandwidthLimit(BandwidthScope::Session, uiSessionId, nRate, 0);
+    timer.restart();
+    std::shared_ptr<NetworkReply> first = post(RequestType::Download, "ratelimitsession1", uiSessionId, 0);
+    std::shared_ptr<NetworkReply> second = post(RequestType::Download, "ratelimitsession2", uiSessionId, 0);
+    QVERIFY(first && second);
+    QSignalSpy firstSpy(first.get(), &NetworkReply::requestFinished);
+    QSignalSpy secondSpy(second.get(), &NetworkReply::requestFinished);
+    QSharedPointer<ResponseResult> firstRsp = takeResult(firstSpy, 20000);
+    QSharedPointer<ResponseResult> secondRsp = takeResult(secondSpy, 20000);
+    const qint64 nElapsedMs = timer.elapsed();
+    pManager->setBandwidthLimit(BandwidthScope::Session, uiSessionId, 0, 0);
+    QVERIFY(firstRsp && secondRsp);
+    QVERIFY2(firstRsp->success, qPrintable(firstRsp->errorMessage));
+    QVERIFY2(secondRsp->success, qPrintable(secondRsp->errorMessage));
+    QVERIFY2(nElapsedMs >= 3500, qPrintable(QString::number(nElapsedMs)));
+    QVERIFY(verifyFile("ratelimitsession1"));
+    QVERIFY(verifyFile("ratelimitsession2"));
+
+    // Without limits the same download is not held back
+    timer.restart();
+    reply = post(RequestType::Download, "ratelimitnone", 0, 0);
+    QVERIFY(reply != nullptr);
+    QSignalSpy noneSpy(reply.get(), &NetworkReply::requestFinished);
+    rsp = takeResult(noneSpy);
+    QVERIFY(rsp);
+    QVERIFY2(rsp->success, qPrintable(rsp->errorMessage));
+    QVERIFY2(timer.elapsed() < 1500, qPrintable(QString::number(timer.elapsed())));
+    QVERIFY(verifyFile("ratelimitnone"));
+}
+
+void TestNetworkRequest::testRedirectCache()
+{
+    auto get = [&](const QUrl &url) {
+        std::unique_ptr<RequestContext> req = std::make_unique<RequestContext>();
+        req->url = url.toString();
+        req->type = RequestType::Get;
+        std::shared_ptr<NetworkReply> reply = NetworkRequestManager::globalInstance()->postRequest(std::move(req));
+        if (!reply)
+        {
+            return QSharedPointer<ResponseResult>();
+        }
+        QSignalSpy spy(reply.get(), &NetworkReply::requestFinished);
+        return takeResult(spy);
+    };
+
+    // A permanent redirect is followed once, the second request goes to the target at once. A temporary one every time
+    for (int nStatusCode : { 301, 308, 302, 307 })
+    {
+        const bool bPermanent = (nStatusCode == 301 || nStatusCode == 308);
+        const QString strTarget = QString("/bytes/64?tag=redirect%1").arg(nStatusCode);
+        const QUrl redirectUrl = m_server.url(QString("/redirect?code=%1&to=%2").arg(nStatusCode).arg(QString::fromLatin1(QUrl::toPercentEncoding(strTarget))));
+        for (int i = 0; i < 2; ++i)
+        {
+            QSharedPointer<ResponseResult> rsp = get(redirectUrl);
+            QVERIFY(rsp);
+            QVERIFY2(rsp->success, qPrintable(rsp->errorMessage));
+            QCOMPARE(rsp->body, BenchmarkHttpServer::payload(64));
+            QCOMPARE(rsp->performance.redirectCount, quint16((i > 0 && bPermanent) ? 0 : 1));
+        }
+        QCOMPARE(m_server.hitCount(redirectUrl), bPermanent ? 1 : 2);
+        QCOMPARE(m_server.hitCount(m_server.url(strTarget)), 2);
+    }
+}
@@ -10,6 +10,7 @@
 #include "networkrequestdefs.h"
 #include "networkrequestmanager.h"
 #include "networkreply.h"
+#include "benchmarkhttpserver.h"
 
 using namespace QtNetworkRequest;
 
@@ -29,8 +30,31 @@ private slots:
     void testRequestHeaders();
     void testContentType();
 
+    // Against the local server (benchmark/benchmarkhttpserver.h)
+    void testRetryAfter();
+    void testSyncRetryStopped();
+    void testCacheRevalidation();
+    void testCoalesce();
+    void testCoalesceCookies();
+    void testStopRequestsFilter();
+    void testBatchLargerThanThreads();
+    void testDownloadWithoutRanges();
+    void testResumeDownload();
+    void testResumeChangedFile();
+    void testWorkStealing();
+    void testStorageBackends();
+    void testStreamSinks();
+    void testBandwidthLimits();
+    void testRedirectCache();
+
 private:
     bool waitForFinished(std::shared_ptr<NetworkReply> reply, int timeoutMs = 10000);
+    // Result recorded by a spy on NetworkReply::requestFinished, nullptr if none arrived within timeoutMs
+    QSharedPointer<ResponseResult> takeResult(QSignalSpy &spy, int timeoutMs = 10000);
+    // Resumable download of url to strFilePath. bStop: held to a bandwidth limit and stopped once a quarter arrived
+    QSharedPointer<ResponseResult> resumableDownload(RequestType type, const QUrl &url, const QString &strFilePath, bool bStop);
+
+    BenchmarkHttpServer m_server;
 };
 
 #endif // TEST_NETWORKREQUEST_H
\ No newline at end of file